@@ -0,0 +1,150 @@
+#!/usr/bin/env python
+#
+# rpcbench.py:  Measure the throughput and latency of the RPC server.
+#
+# Copyright (c) 2015 The DynamicCoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#
+
+from __future__ import print_function, division
+import argparse
+import base64
+import json
+import sys
+import threading
+import time
+
+try:
+    import http.client as httplib
+except ImportError:
+    import httplib
+
+class Client(threading.Thread):
+    '''Sends requests over one keep-alive connection until the deadline.'''
+    def __init__(self, args, body, deadline):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.args = args
+        self.body = body
+        self.deadline = deadline
+        self.latencies = []
+        self.first_bytes = []
+        self.refused = 0
+        self.errors = 0
+
+    def run(self):
+        conn = connect(self.args)
+        while time.time() < self.deadline:
+            start = time.time()
+            try:
+                conn.request('POST', '/', self.body, headers(self.args))
+                response = conn.getresponse()
+                response.read(1)
+                first_byte = time.time() - start
+                response.read()
+            except Exception:
+                self.errors += 1
+                conn.close()
+                conn = connect(self.args)
+                continue
+            if response.status == 200:
+                self.latencies.append(time.time() - start)
+                self.first_bytes.append(first_byte)
+            elif response.status == 503:
+                self.refused += 1
+            else:
+                self.errors += 1
+        conn.close()
+
+def connect(args):
+    return httplib.HTTPConnection(args.host, args.port, timeout=args.timeout)
+
+def headers(args):
+    authpair = ('%s:%s' % (args.user, args.password)).encode('utf-8')
+    return {'Authorization': 'Basic ' + base64.b64encode(authpair).decode('ascii'),
+            'Content-Type': 'application/json',
+            'Connection': 'keep-alive'}
+
+def request_body(args):
+    call = {'method': args.method, 'params': json.loads(args.params), 'id': 0}
+    if args.batch > 1:
+        return json.dumps([dict(call, id=i) for i in range(args.batch)])
+    return json.dumps(call)
+
+def percentile(sorted_values, fraction):
+    if not sorted_values:
+        return 0.0
+    index = min(int(fraction * len(sorted_values)), len(sorted_values) - 1)
+    return sorted_values[index]
+
+def peak_memory(pid):
+    '''Peak resident memory of a local process in kB, as reported by Linux.'''
+    with open('/proc/%d/status' % pid) as status:
+        for line in status:
+            if line.startswith('VmHWM:'):
+                return int(line.split()[1])
+    return 0
+
+def print_percentiles(label, values):
+    print('%s mean %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f' % (label,
+          1000 * sum(values) / len(values),
+          1000 * percentile(values, 0.5), 1000 * percentile(values, 0.9),
+          1000 * percentile(values, 0.99), 1000 * values[-1]))
+
+def main():
+    parser = argparse.ArgumentParser(description='Load generator for the RPC server of dynamiccoind.')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=7332)
+    parser.add_argument('--user', default='')
+    parser.add_argument('--password', default='')
+    parser.add_argument('--clients', type=int, default=8, help='concurrent connections sending requests')
+    parser.add_argument('--idle', type=int, default=0, help='keep-alive connections to hold open without sending requests')
+    parser.add_argument('--duration', type=float, default=10, help='seconds to run')
+    parser.add_argument('--method', default='getblockcount')
+    parser.add_argument('--params', default='[]', help='parameters of the call, as a JSON array')
+    parser.add_argument('--batch', type=int, default=1, help='calls per request (as a JSON-RPC batch)')
+    parser.add_argument('--timeout', type=float, default=30, help='seconds to wait for a reply')
+    parser.add_argument('--pid', type=int, default=0, help='process id of a local dynamiccoind, to report its peak memory')
+    args = parser.parse_args()
+
+    body = request_body(args)
+
+    # Idle connections make one request, so that the server has served them, and then wait
+    idle = []
+    for i in range(args.idle):
+        conn = connect(args)
+        conn.request('POST', '/', request_body(args), headers(args))
+        conn.getresponse().read()
+        idle.append(conn)
+
+    deadline = time.time() + args.duration
+    start = time.time()
+    clients = [Client(args, body, deadline) for i in range(args.clients)]
+    for client in clients:
+        client.start()
+    for client in clients:
+        client.join()
+    elapsed = time.time() - start
+
+    for conn in idle:
+        conn.close()
+
+    latencies = sorted(l for client in clients for l in client.latencies)
+    first_bytes = sorted(f for client in clients for f in client.first_bytes)
+    refused = sum(client.refused for client in clients)
+    errors = sum(client.errors for client in clients)
+    print('clients:     %d (and %d idle connections)' % (args.clients, args.idle))
+    print('requests:    %d in %.1fs, %.1f/s (%d calls/s)' % (len(latencies), elapsed,
+          len(latencies) / elapsed, len(latencies) * args.batch / elapsed))
+    print('refused:     %d (503, work queue full)' % refused)
+    print('errors:      %d' % errors)
+    if latencies:
+        print_percentiles('latency ms: ', latencies)
+        print_percentiles('first byte ms:', first_bytes)
+    if args.pid:
+        print('peak memory: %.1f MiB (of the server, since it started)' % (peak_memory(args.pid) / 1024.0))
+    return 0 if latencies else 1
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,70 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Measure the coin database I/O of rebuilding the chain state.
+#
+# Builds a chain with many-output transactions, some of them partly spent,
+# then restarts with -reindex-chainstate and reports what the rebuild wrote
+# to the chainstate database. Run it against two builds to
+# compare them; the rebuilt set must match the one before the restart.
+#
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+import time
+
+class CoinDBIOTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--rounds", dest="rounds", default=20, type="int",
+                          help="Number of blocks of many-output transactions to build")
+
+    def setup_network(self):
+        self.nodes = []
+        self.is_network_split = False
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-debug=coindb"]))
+
+    def report(self, label):
+        stats = self.nodes[0].getdbstats()["chainstate"]
+        print("%s: byteswritten=%s approximatesize=%d" %
+              (label, stats.get("byteswritten", "n/a"), stats["approximatesize"]))
+
+    def run_test(self):
+        node = self.nodes[0]
+        addresses = [ node.getnewaddress() for i in range(50) ]
+
+        # Each round pays to many outputs, and spends a few of the outputs of
+        # the round before, so that transactions end up partly spent
+        for i in range(self.options.rounds):
+            for j in range(4):
+                node.sendmany("", dict((address, Decimal("0.01")) for address in addresses))
+            for j in range(10):
+                node.sendtoaddress(addresses[j], Decimal("0.015"))
+            node.generate(1)
+
+        tip = node.getbestblockhash()
+        height = node.getblockcount()
+        utxo = node.gettxoutsetinfo()
+        self.report("before restart")
+
+        stop_node(node, 0)
+        wait_bitcoinds()
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-debug=coindb", "-reindex-chainstate"])
+        node = self.nodes[0]
+        # The chain state is rebuilt in the background
+        for i in range(600):
+            if node.getbestblockhash() == tip:
+                break
+            time.sleep(0.1)
+        self.report("after -reindex-chainstate")
+
+        assert_equal(node.getbestblockhash(), tip)
+        assert_equal(node.getblockcount(), height)
+        assert_equal(node.gettxoutsetinfo(), utxo)
+        print "Success"
+
+if __name__ == '__main__':
+    CoinDBIOTest().main()
@@ -10,6 +10,9 @@
 from test_framework import BitcoinTestFramework
 from util import *
 import base64
+import json
+import socket
+import time
 
 try:
     import http.client as httplib
@@ -22,7 +25,7 @@ except ImportError:
 
 class HTTPBasicsTest (BitcoinTestFramework):        
     def setup_nodes(self):
-        return start_nodes(4, self.options.tmpdir, extra_args=[['-rpckeepalive=1'], ['-rpckeepalive=0'], [], []])
+        return start_nodes(4, self.options.tmpdir, extra_args=[['-rpckeepalive=1'], ['-rpckeepalive=0'], [], ['-rpcthreads=2']])
 
     def run_test(self):        
         
@@ -98,5 +101,86 @@ class HTTPBasicsTest (BitcoinTestFramework):
         assert_equal('"error":null' in out1, True)
         assert_equal(conn.sock!=None, True) #connection must be closed because bitcoind should use keep-alive by default
         
+        #node3 (4th node) has two RPC threads; idle keep-alive connections must not take them up
+        urlNode3 = urlparse.urlparse(self.nodes[3].url)
+        authpair = urlNode3.username + ':' + urlNode3.password
+        headers = {"Authorization": "Basic " + base64.b64encode(authpair)}
+        
+        idle = []
+        for i in range(10):
+            conn = httplib.HTTPConnection(urlNode3.hostname, urlNode3.port)
+            conn.connect()
+            conn.request('POST', '/', '{"method": "getbestblockhash"}', headers)
+            out1 = conn.getresponse().read();
+            assert_equal('"error":null' in out1, True)
+            idle.append(conn)
+        
+        conn = httplib.HTTPConnection(urlNode3.hostname, urlNode3.port, timeout=30)
+        conn.connect()
+        conn.request('POST', '/', '{"method": "getrpcinfo"}', headers)
+        out1 = conn.getresponse().read();
+        assert_equal('"error":null' in out1, True) #answered while all idle connections are still open
+        assert_equal(json.loads(out1)['result']['connections'] >= 11, True)
+        for c in idle:
+            c.close()
+        
+        #the replies to a batch are in request order, though its thread safe calls run in parallel
+        blockcount = self.nodes[3].getblockcount()
+        batch = [{"method": "getblockhash", "params": [i % (blockcount + 1)], "id": i} for i in range(50)]
+        batch.insert(20, {"method": "getblockcount", "params": [], "id": "count"})
+        batch.insert(30, {"method": "nosuchmethod", "params": [], "id": "bad"})
+        conn.request('POST', '/', json.dumps(batch), headers)
+        out1 = json.loads(conn.getresponse().read())
+        assert_equal([r['id'] for r in out1], [b['id'] for b in batch])
+        assert_equal(out1[0]['result'], self.nodes[3].getblockhash(0))
+        assert_equal(out1[20]['result'], blockcount)
+        assert_equal(out1[30]['error']['code'], -32601)
+        
+        rpcinfo = self.nodes[3].getrpcinfo()
+        assert_equal(rpcinfo['batches']['count'], 1)
+        assert_equal(rpcinfo['batches']['requests'], 52)
+        
+        #a large body is neither allocated nor waited for without the password
+        for auth in ["", "Authorization: Basic " + base64.b64encode("wrong:password") + "\r\n"]:
+            s = socket.create_connection((urlNode3.hostname, urlNode3.port))
+            s.settimeout(10)
+            s.sendall("POST / HTTP/1.1\r\n" + auth + "Content-Length: 30000000\r\n\r\n")
+            reply = ""
+            while True:
+                data = s.recv(4096)
+                if not data:
+                    break
+                reply += data
+            assert_equal(reply.split("\r\n")[0].split(" ")[1], "401") #refused, then closed
+            s.close()
+        
+        #node2 restarted with room for two connections, that must send a request within two seconds
+        stop_node(self.nodes[2], 2)
+        self.nodes[2] = start_node(2, self.options.tmpdir, ['-rpcmaxconnections=2', '-rpcservertimeout=2'])
+        headers = {"Authorization": "Basic " + base64.b64encode(urlNode2.username + ':' + urlNode2.password)}
+        
+        idle = [socket.create_connection((urlNode2.hostname, urlNode2.port)) for i in range(2)]
+        time.sleep(0.5)
+        conn = httplib.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.connect()
+        conn.request('POST', '/', '{"method": "getrpcinfo"}', headers)
+        resp = conn.getresponse()
+        assert_equal(resp.status, 503) #refused while the idle connections are open
+        resp.read()
+        conn.close()
+        
+        time.sleep(3)
+        for s in idle:
+            assert_equal(s.recv(1), '') #closed by the server
+            s.close()
+        conn = httplib.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.connect()
+        conn.request('POST', '/', '{"method": "getrpcinfo"}', headers)
+        rpcinfo = json.loads(conn.getresponse().read())['result']
+        assert_equal(rpcinfo['maxconnections'], 2)
+        assert_equal(rpcinfo['refused'], 1)
+        assert_equal(rpcinfo['timedout'] >= 2, True)
+        conn.close()
+        
 if __name__ == '__main__':
     HTTPBasicsTest ().main ()
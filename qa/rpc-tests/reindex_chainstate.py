@@ -0,0 +1,63 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The DynamicCoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test -reindex-chainstate with CheckBlockIndex
+#
+# Builds on the 200-block test chain with transactions that spend and
+# create outputs, restarts with -reindex-chainstate, and checks that the
+# rebuilt chain state ends at the same tip with the same UTXO set. The
+# chain is longer than MAX_BLOCKS_READ_AHEAD, so the blocks are read ahead.
+#
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+import time
+
+class ReindexChainstateTest(BitcoinTestFramework):
+
+    def setup_network(self):
+        self.nodes = []
+        self.is_network_split = False
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-checkblockindex=1"]))
+
+    def run_test(self):
+        node = self.nodes[0]
+        addresses = [ node.getnewaddress() for i in range(10) ]
+        for i in range(5):
+            node.sendmany("", dict((address, Decimal("0.1")) for address in addresses))
+            node.sendtoaddress(addresses[i], Decimal("0.15"))
+            node.generate(1)
+
+        tip = node.getbestblockhash()
+        height = node.getblockcount()
+        utxo = node.gettxoutsetinfo(True)
+        assert_equal(utxo["bestblock"], tip)
+
+        stop_node(node, 0)
+        wait_bitcoinds()
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-checkblockindex=1", "-reindex-chainstate"])
+        node = self.nodes[0]
+        # The chain state is rebuilt in the background
+        for i in range(600):
+            if node.getbestblockhash() == tip:
+                break
+            time.sleep(0.1)
+
+        assert_equal(node.getbestblockhash(), tip)
+        assert_equal(node.getblockcount(), height)
+        assert_equal(node.gettxoutsetinfo(True), utxo)
+
+        # The rebuilt chain state is kept across a normal restart
+        stop_node(node, 0)
+        wait_bitcoinds()
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-checkblockindex=1"])
+        node = self.nodes[0]
+        assert_equal(node.getbestblockhash(), tip)
+        assert_equal(node.gettxoutsetinfo(True), utxo)
+        print "Success"
+
+if __name__ == '__main__':
+    ReindexChainstateTest().main()
@@ -9,6 +9,9 @@
 
 from test_framework import BitcoinTestFramework
 from util import *
+from decimal import Decimal
+from struct import *
+import binascii
 import json
 
 try:
@@ -29,6 +32,15 @@ def http_get_call(host, port, path, response_object = 0):
         
     return conn.getresponse().read()
 
+def http_post_call(host, port, path, requestdata = '', response_object = 0):
+    conn = httplib.HTTPConnection(host, port)
+    conn.request('POST', path, requestdata)
+
+    if response_object:
+        return conn.getresponse()
+
+    return conn.getresponse().read()
+
 
 class RESTTest (BitcoinTestFramework):
     FORMAT_SEPARATOR = "."
@@ -82,6 +94,67 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
+
+        # check headers: the three from the one before the tip on are only two
+        tip_hash = self.nodes[0].getbestblockhash()
+        prev_hash = self.nodes[0].getblock(tip_hash)['previousblockhash']
+        json_string = http_get_call(url.hostname, url.port, '/rest/headers/3/'+prev_hash+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj), 2)
+        assert_equal(json_obj[0]['hash'], prev_hash)
+        assert_equal(json_obj[1]['hash'], tip_hash)
+        assert_equal(json_obj[0]['nextblockhash'], tip_hash)
+        assert_equal(json_obj[1]['confirmations'], 1)
+
+        response = http_get_call(url.hostname, url.port, '/rest/headers/3/'+prev_hash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_equal(int(response.getheader('content-length')), 2*80)
+
+        response = http_get_call(url.hostname, url.port, '/rest/headers/0/'+prev_hash+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
+
+        # check block hashes by height, one and a range
+        height = self.nodes[0].getblockcount()
+        json_string = http_get_call(url.hostname, url.port, '/rest/blockhashbyheight/'+str(height)+self.FORMAT_SEPARATOR+'json')
+        assert_equal(json.loads(json_string)['blockhash'], tip_hash)
+        json_string = http_get_call(url.hostname, url.port, '/rest/blockhashbyheight/5/'+str(height-1)+self.FORMAT_SEPARATOR+'json')
+        assert_equal(json.loads(json_string), [prev_hash, tip_hash])
+        response = http_get_call(url.hostname, url.port, '/rest/blockhashbyheight/'+str(height+1)+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+
+        # check getutxos: the outputs of the last sent tx (no other tx spends them), and one that does not exist
+        tx = self.nodes[0].getrawtransaction(txs[2], 1)
+        n = len(tx['vout'])
+        outpoints = '/'.join([txs[2]+'-'+str(i) for i in range(n+1)])
+        json_string = http_get_call(url.hostname, url.port, '/rest/getutxos/'+outpoints+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string, parse_float=Decimal)
+        assert_equal(json_obj['chaintipHash'], tip_hash)
+        assert_equal(json_obj['chainHeight'], height)
+        assert_equal(json_obj['bitmap'], '1'*n+'0')
+        assert_equal(len(json_obj['utxos']), n)
+        assert_equal(json_obj['utxos'][0]['height'], height)
+        assert_equal(json_obj['utxos'][0]['value'], tx['vout'][0]['value'])
+
+        # the same as a binary POST: checkmempool flag and a vector of outpoints
+        bin_request = b'\x01' + pack('B', n+1)
+        for i in range(n+1):
+            bin_request += binascii.unhexlify(txs[2])[::-1] + pack('<i', i)
+        bin_response = http_post_call(url.hostname, url.port, '/rest/getutxos'+self.FORMAT_SEPARATOR+'bin', bin_request)
+        assert_equal(unpack('<i', bin_response[0:4])[0], height)
+        assert_equal(binascii.hexlify(bin_response[4:36][::-1]).decode('ascii'), tip_hash)
+
+        # an output spent by a mempool tx is only unspent without checkmempool
+        spend = self.nodes[2].sendtoaddress(self.nodes[0].getnewaddress(), 30)
+        self.sync_all()
+        spent = self.nodes[0].getrawtransaction(spend, 1)['vin'][0]
+        outpoint = spent['txid']+'-'+str(spent['vout'])
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/getutxos/'+outpoint+self.FORMAT_SEPARATOR+'json'))
+        assert_equal(json_obj['bitmap'], '1')
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/getutxos/checkmempool/'+outpoint+self.FORMAT_SEPARATOR+'json'))
+        assert_equal(json_obj['bitmap'], '0')
+
+        response = http_get_call(url.hostname, url.port, '/rest/getutxos/'+txs[0]+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
                 
         
 
@@ -33,16 +33,9 @@ CAmount CGrsApi::GetPrice(unsigned int time)
 {
     LogPrintf("CGrsApi::GetPrice: time = %d\n", time);
 
-    // projected prices for before-the-trading era
-
-    if (time >= block_0_t && time < block_128002_t) {
-        // genesis reward zone
-        return 656 * USD1 + 35 * USCENT1;
-    } else if (time >= block_128002_t && time < block_193536_t) {
-        // decreasing reward zone
-        return 10 * USCENT1;
-    } else if (time >= block_193536_t && time < Params().LiveFeedSwitchTime()) {
-        return 10 * USCENT1;
+    CAmount price;
+    if (GetScheduledPrice(time, price)) {
+        return price;
     }
 
     // TODO(dmc): check cached price
@@ -70,6 +63,24 @@ CAmount CGrsApi::GetLatestPrice()
     return 10 * USCENT1;   // STUB: 0.1USD, TODO(dmc): get actual coin price
 }
 
+bool CGrsApi::GetScheduledPrice(unsigned int time, CAmount& price) const
+{
+    // projected prices for before-the-trading era
+
+    if (time >= block_0_t && time < block_128002_t) {
+        // genesis reward zone
+        price = 656 * USD1 + 35 * USCENT1;
+    } else if (time >= block_128002_t && time < block_193536_t) {
+        // decreasing reward zone
+        price = 10 * USCENT1;
+    } else if (time >= block_193536_t && time < Params().LiveFeedSwitchTime()) {
+        price = 10 * USCENT1;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 CAmount CGrsApi::GetGrsApiPrice(unsigned int timestamp)
 {
     LogPrintf("Getting GRS price for timestamp: time = %d\n", timestamp);
@@ -298,29 +309,50 @@ CAmount CDmcSystem::GetBlockRewardForNewTip(unsigned int time)
     return nSubsidy;
 }
 
+CRewardLedgerEntry CDmcSystem::GetRewardLedgerEntry(const CBlockIndex* pindex)
+{
+    CRewardLedgerEntry entry;
+    entry.nTime = pindex->nTime;
+    entry.nReward = pindex->nReward;
+    // validation never sees the feed price the miner stepped the reward
+    // against, so only the scheduled one is known
+    entry.fPriceKnown = grsApi.GetScheduledPrice(pindex->nTime, entry.nPrice);
+    if (!entry.fPriceKnown)
+        entry.nPrice = 0;
+
+    if (pindex->nTime > Params().LiveFeedSwitchTime()) {
+        CAmount prevReward = pindex->pprev ? pindex->pprev->nReward : genesisReward;
+        entry.nTargetPrice = GetTargetPrice(prevReward);
+        if (pindex->nReward > prevReward)
+            entry.nDecision = REWARD_RAISE;
+        else if (pindex->nReward < prevReward)
+            entry.nDecision = REWARD_LOWER;
+        else
+            entry.nDecision = REWARD_HOLD;
+    } else {
+        entry.nDecision = REWARD_SCHEDULE;
+    }
+    return entry;
+}
 
 CAmount CDmcSystem::GetBlockReward() const
 {
-    LOCK(cs_main);
-    return chainActive.Tip()->nReward;
+    return GetChainTipSummary()->nReward;
 }
 
 CAmount CDmcSystem::GetPrice()
 {
-    LOCK(cs_main);
-    return grsApi.GetPrice(chainActive.Tip()->nTime);
+    return grsApi.GetPrice(GetChainTipSummary()->nTime);
 }
 
 CAmount CDmcSystem::GetTargetPrice() const
 {
-    LOCK(cs_main);
-    return GetTargetPrice(chainActive.Tip()->nReward);
+    return GetTargetPrice(GetChainTipSummary()->nReward);
 }
 
 CAmount CDmcSystem::GetTotalCoins() const
 {
-    LOCK(cs_main);
-    return chainActive.Tip()->nChainReward;
+    return GetChainTipSummary()->nChainReward;
 }
 
 CAmount CDmcSystem::GetMarketCap()
@@ -328,21 +360,30 @@ CAmount CDmcSystem::GetMarketCap()
     return (GetTotalCoins() / COIN) * GetPrice();
 }
 
-
-CAmount CDmcSystem::GetPrice(unsigned int time)
+const CBlockIndex* CDmcSystem::GetBlockForTime(unsigned int time) const
 {
-    return grsApi.GetPrice(time);
+    // times at or after the tip resolve to it without waiting for cs_main
+    CChainTipSummaryRef tip = GetChainTipSummary();
+    if (tip->pindex && (int64_t)time >= tip->nTimeMax)
+        return tip->pindex;
+
+    // otherwise binary search over the median times past of the chain
+    LOCK(cs_main);
+    return chainActive.FindLatestAtMost(time);
 }
 
 CAmount CDmcSystem::GetTargetPrice(unsigned int time) const
 {
-    //TODO(dmc): temporary simplification
-//    const CBlockIndex* pindex;  // TODO(dmc): get block for time
-//    return GetTargetPrice(pindex->nReward);
-    return 10 * USCENT1;
+    const CBlockIndex* pindex = GetBlockForTime(time);
+    return GetTargetPrice(pindex ? pindex->nReward : genesisReward);
 }
 
 
+CAmount CDmcSystem::GetPrice(unsigned int time)
+{
+    return grsApi.GetPrice(time);
+}
+
 CAmount CDmcSystem::GetTargetPrice(CAmount reward) const
 {
     CAmount targetPrice = 1 * USD1 + (reward * USD1) / (100 * COIN);
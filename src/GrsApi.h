@@ -3,6 +3,7 @@
 
 #include "amount.h"
 #include "chain.h"
+#include "rewardledger.h"
 
 #include <ctime>
 #include <string>
@@ -21,6 +22,8 @@ public:
     CAmount GetPrice(unsigned int time);
     // Last known price broadcasted by GRS
     CAmount GetLatestPrice();
+    // Projected price at the specified time, if it is before the live feed
+    bool GetScheduledPrice(unsigned int time, CAmount& price) const;
 
 private:
 
@@ -48,6 +51,8 @@ public:
     bool CheckBlockReward(const CBlock& block, CAmount fees, CValidationState& state, CBlockIndex* pindex);
     CAmount GetBlockReward(const CBlockIndex* pindex);
     CAmount GetBlockRewardForNewTip(unsigned int time);
+    // Reward ledger record of a connected block (with nReward set)
+    CRewardLedgerEntry GetRewardLedgerEntry(const CBlockIndex* pindex);
 
     // Blockchain tip information
     CAmount GetBlockReward() const;
@@ -56,9 +61,14 @@ public:
     CAmount GetTotalCoins() const;
     CAmount GetMarketCap();
 
+    // Last block of the active chain whose median time past is at most time
+    // (NULL if there is none)
+    const CBlockIndex* GetBlockForTime(unsigned int time) const;
+    // Target price of the reward in force at the specified time
+    CAmount GetTargetPrice(unsigned int time) const;
+
 protected:
     CAmount GetPrice(unsigned int time);
-    CAmount GetTargetPrice(unsigned int time) const;
     
 protected:
     CAmount GetTargetPrice(CAmount reward) const;
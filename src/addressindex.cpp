@@ -0,0 +1,37 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "script/standard.h"
+
+bool GetAddressIndexKey(const CTxDestination& dest, unsigned char& nAddressType, uint160& hashAddress)
+{
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        nAddressType = ADDRESS_INDEX_PUBKEYHASH;
+        hashAddress = *keyID;
+        return true;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        nAddressType = ADDRESS_INDEX_SCRIPTHASH;
+        hashAddress = *scriptID;
+        return true;
+    }
+    return false;
+}
+
+bool GetAddressIndexKey(const CScript& scriptPubKey, unsigned char& nAddressType, uint160& hashAddress)
+{
+    CTxDestination dest;
+    return ExtractDestination(scriptPubKey, dest) && GetAddressIndexKey(dest, nAddressType, hashAddress);
+}
+
+CTxDestination GetAddressIndexDestination(unsigned char nAddressType, const uint160& hashAddress)
+{
+    if (nAddressType == ADDRESS_INDEX_PUBKEYHASH)
+        return CKeyID(hashAddress);
+    if (nAddressType == ADDRESS_INDEX_SCRIPTHASH)
+        return CScriptID(hashAddress);
+    return CNoDestination();
+}
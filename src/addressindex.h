@@ -0,0 +1,118 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "pubkey.h"
+#include "script/script.h"
+#include "script/standard.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+
+/** Kinds of address in the address index (-addressindex) */
+enum AddressIndexType
+{
+    ADDRESS_INDEX_NONE = 0,
+    ADDRESS_INDEX_PUBKEYHASH = 1,
+    ADDRESS_INDEX_SCRIPTHASH = 2,
+};
+
+/** The address an output pays to, if any. Pay to pubkey outputs count for the address of the key. */
+bool GetAddressIndexKey(const CScript& scriptPubKey, unsigned char& nAddressType, uint160& hashAddress);
+bool GetAddressIndexKey(const CTxDestination& dest, unsigned char& nAddressType, uint160& hashAddress);
+CTxDestination GetAddressIndexDestination(unsigned char nAddressType, const uint160& hashAddress);
+
+/**
+ * Key of an address index record ('a'): an output paid to an address, or an
+ * input spending one. The records of an address sort by height and position
+ * in the chain, so its history is read with one range scan. The value is the
+ * amount, negative for spends.
+ */
+struct CAddressIndexKey
+{
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    uint32_t nHeight;
+    //! Position of the transaction in its block
+    uint32_t nTxIndex;
+    uint256 txid;
+    //! The output, or for spends the input
+    uint32_t nIndex;
+    bool fSpending;
+
+    CAddressIndexKey() : nAddressType(ADDRESS_INDEX_NONE), hashAddress(0), nHeight(0), nTxIndex(0), txid(0), nIndex(0), fSpending(false) {}
+    CAddressIndexKey(unsigned char nAddressTypeIn, const uint160& hashAddressIn, uint32_t nHeightIn, uint32_t nTxIndexIn, const uint256& txidIn, uint32_t nIndexIn, bool fSpendingIn) :
+        nAddressType(nAddressTypeIn), hashAddress(hashAddressIn), nHeight(nHeightIn), nTxIndex(nTxIndexIn), txid(txidIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        char chType = 'a';
+        READWRITE(chType);
+        READWRITE(nAddressType);
+        READWRITE(hashAddress);
+        READWRITE(REF(CBigEndian32(nHeight)));
+        READWRITE(REF(CBigEndian32(nTxIndex)));
+        READWRITE(txid);
+        READWRITE(REF(CBigEndian32(nIndex)));
+        READWRITE(fSpending);
+    }
+};
+
+/** Key of an unspent output of an address ('u'), sorting by height */
+struct CAddressUnspentKey
+{
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    uint32_t nHeight;
+    uint256 txid;
+    uint32_t nIndex;
+
+    CAddressUnspentKey() : nAddressType(ADDRESS_INDEX_NONE), hashAddress(0), nHeight(0), txid(0), nIndex(0) {}
+    CAddressUnspentKey(unsigned char nAddressTypeIn, const uint160& hashAddressIn, uint32_t nHeightIn, const uint256& txidIn, uint32_t nIndexIn) :
+        nAddressType(nAddressTypeIn), hashAddress(hashAddressIn), nHeight(nHeightIn), txid(txidIn), nIndex(nIndexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        char chType = 'u';
+        READWRITE(chType);
+        READWRITE(nAddressType);
+        READWRITE(hashAddress);
+        READWRITE(REF(CBigEndian32(nHeight)));
+        READWRITE(txid);
+        READWRITE(REF(CBigEndian32(nIndex)));
+    }
+};
+
+/** Value of an unspent output record; a null value in an update erases the record */
+struct CAddressUnspentValue
+{
+    CAmount nValue;
+    CScript scriptPubKey;
+    bool fCoinBase;
+
+    CAddressUnspentValue() { SetNull(); }
+    CAddressUnspentValue(CAmount nValueIn, const CScript& scriptPubKeyIn, bool fCoinBaseIn) : nValue(nValueIn), scriptPubKey(scriptPubKeyIn), fCoinBase(fCoinBaseIn) {}
+
+    void SetNull() { nValue = -1; scriptPubKey.clear(); fCoinBase = false; }
+    bool IsNull() const { return nValue == -1; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nValue);
+        READWRITE(scriptPubKey);
+        READWRITE(fCoinBase);
+    }
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -0,0 +1,129 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockmap.h"
+
+#include "memusage.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <new>
+
+const unsigned int CBlockMap::CHUNK_SHIFT;
+const size_t CBlockMap::CHUNK_ENTRIES;
+const size_t CBlockMap::CACHE_LINE;
+const size_t CBlockMap::MIN_BUCKETS;
+const uint32_t CBlockMap::EMPTY;
+
+size_t CBlockMap::FindBucket(const uint256& hash) const
+{
+    uint64_t nHash = hash.GetLow64();
+    uint32_t nTag = nHash >> 32;
+    size_t nMask = vTable.size() - 1;
+    for (size_t nBucket = nHash & nMask; true; nBucket = (nBucket + 1) & nMask) {
+        const CBucket& bucket = vTable[nBucket];
+        if (bucket.nPos == EMPTY || (bucket.nTag == nTag && EntryAt(bucket.nPos)->value.first == hash))
+            return nBucket;
+    }
+}
+
+void CBlockMap::Rehash(size_t nBuckets)
+{
+    CBucket empty;
+    empty.nPos = EMPTY;
+    empty.nTag = 0;
+    vTable.assign(nBuckets, empty);
+    for (size_t nPos = 0; nPos < nSize; nPos++) {
+        const uint256& hash = EntryAt(nPos)->value.first;
+        CBucket& bucket = vTable[FindBucket(hash)];
+        bucket.nPos = nPos;
+        bucket.nTag = hash.GetLow64() >> 32;
+    }
+}
+
+void CBlockMap::AllocateChunk()
+{
+    char* pAlloc = new char[CHUNK_ENTRIES * sizeof(CEntry) + CACHE_LINE];
+    size_t nOffset = (CACHE_LINE - (size_t)pAlloc % CACHE_LINE) % CACHE_LINE;
+    vChunkAlloc.push_back(pAlloc);
+    vChunk.push_back(reinterpret_cast<CEntry*>(pAlloc + nOffset));
+}
+
+std::pair<CBlockMap::iterator, bool> CBlockMap::emplace(const uint256& hash, const CBlockIndex& index)
+{
+    if ((nSize + 1) * 4 > vTable.size() * 3)
+        Rehash(std::max(vTable.size() * 2, MIN_BUCKETS));
+    assert(nSize < EMPTY);
+
+    CBucket& bucket = vTable[FindBucket(hash)];
+    if (bucket.nPos != EMPTY)
+        return std::make_pair(iterator(this, bucket.nPos), false);
+
+    if (nSize == vChunk.size() * CHUNK_ENTRIES)
+        AllocateChunk();
+    new (EntryAt(nSize)) CEntry(hash, index);
+    bucket.nPos = nSize;
+    bucket.nTag = hash.GetLow64() >> 32;
+    return std::make_pair(iterator(this, nSize++), true);
+}
+
+void CBlockMap::clear()
+{
+    for (size_t nPos = 0; nPos < nSize; nPos++)
+        EntryAt(nPos)->~CEntry();
+    for (size_t i = 0; i < vChunkAlloc.size(); i++)
+        delete[] vChunkAlloc[i];
+    std::vector<char*>().swap(vChunkAlloc);
+    std::vector<CEntry*>().swap(vChunk);
+    nSize = 0;
+    std::vector<CBucket>().swap(vTable);
+}
+
+void CBlockMap::SortByHeight()
+{
+    // Counting sort of the positions by height
+    int nMaxHeight = 0;
+    for (size_t nPos = 0; nPos < nSize; nPos++)
+        nMaxHeight = std::max(nMaxHeight, EntryAt(nPos)->index.nHeight);
+    std::vector<uint32_t> vStart(nMaxHeight + 2, 0);
+    for (size_t nPos = 0; nPos < nSize; nPos++)
+        vStart[EntryAt(nPos)->index.nHeight + 1]++;
+    for (int nHeight = 0; nHeight <= nMaxHeight; nHeight++)
+        vStart[nHeight + 1] += vStart[nHeight];
+    std::vector<uint32_t> vOrder(nSize);
+    for (size_t nPos = 0; nPos < nSize; nPos++)
+        vOrder[vStart[EntryAt(nPos)->index.nHeight]++] = nPos;
+
+    // Copy the entries in that order. The value of an old entry is pointed to
+    // its copy, to find the new targets of pprev and pskip (which point to the
+    // index, the first member of an entry).
+    CBlockMap sorted;
+    sorted.Rehash(vTable.size());
+    for (size_t i = 0; i < vOrder.size(); i++) {
+        CEntry* pentry = EntryAt(vOrder[i]);
+        pentry->value.second = sorted.emplace(pentry->value.first, pentry->index).first->second;
+    }
+    for (size_t nPos = 0; nPos < sorted.nSize; nPos++) {
+        CBlockIndex& index = sorted.EntryAt(nPos)->index;
+        if (index.pprev)
+            index.pprev = reinterpret_cast<CEntry*>(index.pprev)->value.second;
+        if (index.pskip)
+            index.pskip = reinterpret_cast<CEntry*>(index.pskip)->value.second;
+    }
+    swap(sorted);
+}
+
+void CBlockMap::swap(CBlockMap& other)
+{
+    vChunkAlloc.swap(other.vChunkAlloc);
+    vChunk.swap(other.vChunk);
+    std::swap(nSize, other.nSize);
+    vTable.swap(other.vTable);
+}
+
+size_t CBlockMap::DynamicMemoryUsage() const
+{
+    return vChunkAlloc.size() * memusage::MallocUsage(CHUNK_ENTRIES * sizeof(CEntry) + CACHE_LINE) +
+           memusage::DynamicUsage(vTable) + memusage::DynamicUsage(vChunkAlloc) + memusage::DynamicUsage(vChunk);
+}
@@ -0,0 +1,176 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKMAP_H
+#define BITCOIN_BLOCKMAP_H
+
+#include "chain.h"
+#include "uint256.h"
+
+#include <iterator>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Storage of the block index, by block hash.
+ *
+ * The CBlockIndex entries live next to their hash in large cache line aligned
+ * chunks, rather than each in its own heap allocation, and are looked up through
+ * an open addressing (linear probing) table of 32 bit positions in those chunks,
+ * each with 32 more bits of the hash so that probing rarely touches an entry that
+ * does not match. On 64 bit systems an entry takes 192 bytes plus 11-21 bytes of
+ * table (at most 3/4 of the buckets are used), where a boost::unordered_map node,
+ * its bucket and a separately allocated entry with its shared proof of work hash
+ * took about 344 bytes: some 128MiB less per million headers.
+ *
+ * Entries are only moved by SortByHeight(), and only freed by clear(), so
+ * pointers to them and their phashBlock stay valid as entries are added.
+ * Iteration visits the entries in the order they were added, which is by height
+ * after SortByHeight(); neighbouring blocks of a chain share chunks, which keeps
+ * walks like GetAncestor() and LastCommonAncestor() local.
+ *
+ * The interface is the part of boost::unordered_map<uint256, CBlockIndex*> that
+ * is used on mapBlockIndex, except that entries are added with emplace(), and
+ * that operator[] returns NULL for an unknown hash rather than adding an entry.
+ */
+class CBlockMap
+{
+public:
+    typedef std::pair<const uint256, CBlockIndex*> value_type;
+
+private:
+    struct CEntry
+    {
+        //! First, so that its hot fields start a cache line
+        CBlockIndex index;
+        value_type value;
+
+        CEntry(const uint256& hash, const CBlockIndex& indexIn) : index(indexIn), value(hash, &index)
+        {
+            index.phashBlock = &value.first;
+        }
+    };
+
+    static const unsigned int CHUNK_SHIFT = 12;
+    static const size_t CHUNK_ENTRIES = (size_t)1 << CHUNK_SHIFT;
+    static const size_t CACHE_LINE = 64;
+    static const size_t MIN_BUCKETS = 1024;
+    static const uint32_t EMPTY = 0xffffffff;
+
+    //! Allocations of the chunks, and their first (aligned) entries
+    std::vector<char*> vChunkAlloc;
+    std::vector<CEntry*> vChunk;
+    size_t nSize;
+    struct CBucket
+    {
+        uint32_t nPos;
+        //! The bits of the hash above those that pick the first bucket to probe
+        uint32_t nTag;
+    };
+
+    //! The size is a power of two; nPos is EMPTY for empty buckets
+    std::vector<CBucket> vTable;
+
+    CEntry* EntryAt(size_t nPos) const { return vChunk[nPos >> CHUNK_SHIFT] + (nPos & (CHUNK_ENTRIES - 1)); }
+
+    //! The bucket holding hash, or the empty bucket where it would go
+    size_t FindBucket(const uint256& hash) const;
+    void Rehash(size_t nBuckets);
+    void AllocateChunk();
+
+    CBlockMap(const CBlockMap&);
+    CBlockMap& operator=(const CBlockMap&);
+
+public:
+    template <typename V>
+    class iterator_base
+    {
+    private:
+        template <typename W> friend class iterator_base;
+        friend class CBlockMap;
+
+        const CBlockMap* pmap;
+        size_t nPos;
+
+        iterator_base(const CBlockMap* pmapIn, size_t nPosIn) : pmap(pmapIn), nPos(nPosIn) {}
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef V value_type;
+        typedef ptrdiff_t difference_type;
+        typedef V* pointer;
+        typedef V& reference;
+
+        iterator_base() : pmap(NULL), nPos(0) {}
+        template <typename W>
+        iterator_base(const iterator_base<W>& it) : pmap(it.pmap), nPos(it.nPos) {}
+
+        V& operator*() const { return pmap->EntryAt(nPos)->value; }
+        V* operator->() const { return &pmap->EntryAt(nPos)->value; }
+        iterator_base& operator++() { nPos++; return *this; }
+        iterator_base operator++(int) { iterator_base it(*this); nPos++; return it; }
+        bool operator==(const iterator_base& it) const { return nPos == it.nPos && pmap == it.pmap; }
+        bool operator!=(const iterator_base& it) const { return !(*this == it); }
+    };
+
+    typedef iterator_base<value_type> iterator;
+    typedef iterator_base<const value_type> const_iterator;
+
+    CBlockMap() : nSize(0) {}
+    ~CBlockMap() { clear(); }
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, nSize); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, nSize); }
+
+    iterator find(const uint256& hash)
+    {
+        const_iterator it = static_cast<const CBlockMap*>(this)->find(hash);
+        return iterator(this, it.nPos);
+    }
+
+    const_iterator find(const uint256& hash) const
+    {
+        if (nSize == 0)
+            return end();
+        uint32_t nPos = vTable[FindBucket(hash)].nPos;
+        return const_iterator(this, nPos == EMPTY ? nSize : nPos);
+    }
+
+    size_t count(const uint256& hash) const { return find(hash) != end(); }
+
+    CBlockIndex* operator[](const uint256& hash) const
+    {
+        const_iterator it = find(hash);
+        return it == end() ? NULL : it->second;
+    }
+
+    /**
+     * Add an entry for hash, initialized as a copy of index (with phashBlock
+     * pointing to the stored hash), unless there is one already.
+     */
+    std::pair<iterator, bool> emplace(const uint256& hash, const CBlockIndex& index);
+
+    /** Free all entries. */
+    void clear();
+
+    /**
+     * Move the entries to fresh chunks in order of height, and fix up their
+     * pprev and pskip pointers. All other pointers to entries are invalidated,
+     * so this is only for right after loading the block index.
+     */
+    void SortByHeight();
+
+    void swap(CBlockMap& other);
+
+    size_t DynamicMemoryUsage() const;
+};
+
+#endif // BITCOIN_BLOCKMAP_H
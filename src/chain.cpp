@@ -13,13 +13,21 @@ using namespace std;
 void CChain::SetTip(CBlockIndex *pindex) {
     if (pindex == NULL) {
         vChain.clear();
+        vTimeMax.clear();
         return;
     }
     vChain.resize(pindex->nHeight + 1);
+    vTimeMax.resize(pindex->nHeight + 1);
+    int nChanged = pindex->nHeight + 1;
     while (pindex && vChain[pindex->nHeight] != pindex) {
         vChain[pindex->nHeight] = pindex;
+        nChanged = pindex->nHeight;
         pindex = pindex->pprev;
     }
+    for (int nHeight = nChanged; nHeight < (int)vChain.size(); nHeight++) {
+        int64_t nTime = vChain[nHeight]->GetMedianTimePast();
+        vTimeMax[nHeight] = nHeight > 0 ? std::max(vTimeMax[nHeight - 1], nTime) : nTime;
+    }
 }
 
 CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
@@ -51,9 +59,21 @@ CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
 }
 
 const CBlockIndex *CChain::FindFork(const CBlockIndex *pindex) const {
+    if (pindex == NULL)
+        return NULL;
     if (pindex->nHeight > Height())
         pindex = pindex->GetAncestor(Height());
     while (pindex && !Contains(pindex))
         pindex = pindex->pprev;
     return pindex;
 }
+
+CBlockIndex *CChain::FindEarliestAtLeast(int64_t nTime) const {
+    std::vector<int64_t>::const_iterator it = std::lower_bound(vTimeMax.begin(), vTimeMax.end(), nTime);
+    return it == vTimeMax.end() ? NULL : vChain[it - vTimeMax.begin()];
+}
+
+CBlockIndex *CChain::FindLatestAtMost(int64_t nTime) const {
+    std::vector<int64_t>::const_iterator it = std::upper_bound(vTimeMax.begin(), vTimeMax.end(), nTime);
+    return it == vTimeMax.begin() ? NULL : vChain[it - vTimeMax.begin() - 1];
+}
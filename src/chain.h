@@ -13,7 +13,6 @@
 
 #include <vector>
 
-#include <boost/shared_ptr.hpp>
 #include <boost/foreach.hpp>
 
 struct CDiskBlockPos
@@ -86,6 +85,9 @@ enum BlockStatus {
     BLOCK_FAILED_VALID       =   32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, //! descends from failed block
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    BLOCK_ASSUMED_VALID      =  128, //! below a loaded UTXO snapshot; not validated (or downloaded) yet, so nTx and
+                                     //! nReward are unknown (placeholders 1 and 0) and so are the chain totals below the snapshot block
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -96,11 +98,10 @@ enum BlockStatus {
 class CBlockIndex
 {
 public:
-    //! pointer to the hash of the block, if any. memory is owned by this CBlockIndex
+    // Fields used to walk and compare chains first, to fill one cache line
+
+    //! pointer to the hash of the block, if any. memory is owned by the entry in mapBlockIndex
     const uint256* phashBlock;
-    
-    //! pointer to the PoW of the block, if any. memory is owned by this CBlockIndex
-    boost::shared_ptr<uint256> pPowBlock;
 
     //! pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
@@ -111,6 +112,24 @@ public:
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
+    //! Verification status of this block. See enum BlockStatus
+    unsigned int nStatus;
+
+    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
+    uint256 nChainWork;
+
+    //! (memory only) Number of transactions in the chain up to and including this block.
+    //! This value will be non-zero only if and only if transactions for this block and all its parents are available.
+    //! Change to 64-bit type when necessary; won't happen before 2030
+    unsigned int nChainTx;
+
+    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
+    uint32_t nSequenceId;
+
+    //! Number of transactions in this block.
+    //! Note: in a potential headers-first mode, this number cannot be relied upon
+    unsigned int nTx;
+
     //! Which # file this block is stored in (blk?????.dat)
     int nFile;
 
@@ -120,41 +139,22 @@ public:
     //! Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos;
 
-    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    uint256 nChainWork;
-
-    //! Number of transactions in this block.
-    //! Note: in a potential headers-first mode, this number cannot be relied upon
-    unsigned int nTx;
-
     //! Block reward
     CAmount nReward;
 
-    //! (memory only) Number of transactions in the chain up to and including this block.
-    //! This value will be non-zero only if and only if transactions for this block and all its parents are available.
-    //! Change to 64-bit type when necessary; won't happen before 2030
-    unsigned int nChainTx;
-
     //! (memory only) Total block reward in the chain up to and including this block
     CAmount nChainReward;   // TODO: uint256?
 
-    //! Verification status of this block. See enum BlockStatus
-    unsigned int nStatus;
-
     //! block header
     int nVersion;
-    uint256 hashMerkleRoot;
     unsigned int nTime;
     unsigned int nBits;
     unsigned int nNonce;
-
-    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
-    uint32_t nSequenceId;
+    uint256 hashMerkleRoot;
 
     void SetNull()
     {
         phashBlock = NULL;
-        pPowBlock.reset();
         pprev = NULL;
         pskip = NULL;
         nHeight = 0;
@@ -252,9 +252,10 @@ public:
         return *phashBlock;
     }
     
+    //! Not kept in memory: it is only needed to check the header, and cheap to compute
     uint256 GetBlockPoW() const
     {
-        return *pPowBlock;
+        return GetBlockHeader().GetPoW();
     }
 
     int64_t GetBlockTime() const
@@ -405,6 +406,11 @@ public:
 class CChain {
 private:
     std::vector<CBlockIndex*> vChain;
+    /**
+     * The greatest median time past of the blocks up to each height. Unlike
+     * nTime it never decreases along the chain, so it can be binary searched.
+     */
+    std::vector<int64_t> vTimeMax;
 
 public:
     /** Returns the index entry for the genesis block of this chain, or NULL if none. */
@@ -456,6 +462,19 @@ public:
 
     /** Find the last common block between this chain and a block index entry. */
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
+
+    /** The greatest median time past up to a height of this chain, or -1 if no such height exists. */
+    int64_t GetTimeMax(int nHeight) const {
+        if (nHeight < 0 || nHeight >= (int)vTimeMax.size())
+            return -1;
+        return vTimeMax[nHeight];
+    }
+
+    /** Find the first block of this chain with a GetTimeMax of at least nTime, in O(log n). */
+    CBlockIndex *FindEarliestAtLeast(int64_t nTime) const;
+
+    /** Find the last block of this chain with a GetTimeMax of at most nTime, in O(log n). */
+    CBlockIndex *FindLatestAtMost(int64_t nTime) const;
 };
 
 #endif // BITCOIN_CHAIN_H
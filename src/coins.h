@@ -7,9 +7,10 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
 #include "serialize.h"
+#include "primitives/transaction.h"
 #include "uint256.h"
-#include "undo.h"
 
 #include <assert.h>
 #include <stdint.h>
@@ -17,9 +18,97 @@
 #include <boost/foreach.hpp>
 #include <boost/unordered_map.hpp>
 
+/**
+ * A UTXO entry: one unspent transaction output, with the metadata of the
+ * transaction it belongs to. Spent entries have a null output.
+ *
+ * Serialized format (that of the per-output records of the coin database):
+ * - VARINT(nHeight * 2 + fCoinBase)
+ * - VARINT(nVersion)
+ * - the CTxOut (via CTxOutCompressor)
+ */
+class Coin
+{
+public:
+    //! unspent transaction output
+    CTxOut out;
+
+    //! whether the containing transaction was a coinbase
+    bool fCoinBase;
+
+    //! at which height the containing transaction was included in the active block chain
+    int nHeight;
+
+    //! version of the containing transaction
+    int nVersion;
+
+    Coin() : fCoinBase(false), nHeight(0), nVersion(0) {}
+    Coin(const CTxOut &outIn, int nHeightIn, bool fCoinBaseIn, int nVersionIn) : out(outIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), nVersion(nVersionIn) {}
+
+    void Clear() {
+        out.SetNull();
+        fCoinBase = false;
+        nHeight = 0;
+        nVersion = 0;
+    }
+
+    bool IsCoinBase() const {
+        return fCoinBase;
+    }
+
+    bool IsSpent() const {
+        return out.IsNull();
+    }
+
+    void swap(Coin &to) {
+        std::swap(to.out.nValue, out.nValue);
+        to.out.scriptPubKey.swap(out.scriptPubKey);
+        std::swap(to.fCoinBase, fCoinBase);
+        std::swap(to.nHeight, nHeight);
+        std::swap(to.nVersion, nVersion);
+    }
+
+    friend bool operator==(const Coin &a, const Coin &b) {
+        // Spent coins are always equal.
+        if (a.IsSpent() && b.IsSpent())
+            return true;
+        return a.fCoinBase == b.fCoinBase &&
+               a.nHeight == b.nHeight &&
+               a.nVersion == b.nVersion &&
+               a.out == b.out;
+    }
+    friend bool operator!=(const Coin &a, const Coin &b) {
+        return !(a == b);
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        assert(ser_action.ForRead() || !IsSpent());
+        unsigned int nCode = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        READWRITE(VARINT(this->nVersion));
+        READWRITE(REF(CTxOutCompressor(out)));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 2;
+            fCoinBase = nCode & 1;
+        }
+    }
+
+    //! heap memory used by the script of the output
+    size_t DynamicMemoryUsage() const {
+        return memusage::DynamicUsage(static_cast<const std::vector<unsigned char>&>(out.scriptPubKey));
+    }
+};
+
 /** 
  * Pruned version of CTransaction: only retains metadata and unspent transaction outputs
  *
+ * This is the record format of coin databases written by older versions, and
+ * of the transactions in UTXO snapshot files; the coin views themselves work
+ * with single outputs (Coin).
+ *
  * Serialized format:
  * - VARINT(nVersion)
  * - VARINT(nCode)
@@ -237,9 +326,6 @@ public:
         Cleanup();
     }
 
-    //! mark an outpoint spent, and construct undo information
-    bool Spend(const COutPoint &out, CTxInUndo &undo);
-
     //! mark a vout spent
     bool Spend(int nPos);
 
@@ -256,6 +342,14 @@ public:
                 return false;
         return true;
     }
+
+    //! heap memory used by the outputs and their scripts
+    size_t DynamicMemoryUsage() const {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH(const CTxOut &out, vout)
+            ret += memusage::DynamicUsage(static_cast<const std::vector<unsigned char>&>(out.scriptPubKey));
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -271,25 +365,31 @@ public:
      * unordered_map will behave unpredictably if the custom hasher returns a
      * uint64_t, resulting in failures when syncing the chain (#4634).
      */
-    size_t operator()(const uint256& key) const {
-        return key.GetHash(salt);
+    size_t operator()(const COutPoint& key) const {
+        return key.hash.GetHash(salt) ^ key.n;
     }
 };
 
+/**
+ * Cache entry for one output. FRESH is only ever set on the outputs of a
+ * transaction that is added as a whole (AddCoins), so the parent view has no
+ * outputs of that transaction at all; CCoinsViewDB counts transactions on
+ * that basis.
+ */
 struct CCoinsCacheEntry
 {
-    CCoins coins; // The actual cached data.
+    Coin coin; // The actual cached data.
     unsigned char flags;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
-        FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        FRESH = (1 << 1), // The parent view does not have this entry (or it is spent).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coin(), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+typedef boost::unordered_map<COutPoint, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
 
 struct CCoinsStats
 {
@@ -298,10 +398,32 @@ struct CCoinsStats
     uint64_t nTransactions;
     uint64_t nTransactionOutputs;
     uint64_t nSerializedSize;
-    uint256 hashSerialized;
+    uint256 hashMuHash; //! order-independent hash of the set of unspent outputs
     CAmount nTotalAmount;
 
-    CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), nTotalAmount(0) {}
+    CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashMuHash(0), nTotalAmount(0) {}
+};
+
+/**
+ * Cursor for walking over all unspent outputs of a CCoinsView, one Coin at a
+ * time. The outputs of a transaction come out next to each other.
+ */
+class CCoinsViewCursor
+{
+public:
+    CCoinsViewCursor(const uint256 &hashBlockIn) : hashBlock(hashBlockIn) {}
+    virtual ~CCoinsViewCursor() {}
+
+    virtual bool GetKey(COutPoint &key) const = 0;
+    virtual bool GetValue(Coin &coin) const = 0;
+    virtual bool Valid() const = 0;
+    virtual void Next() = 0;
+
+    //! Get the best block at the time this cursor was created
+    const uint256 &GetBestBlock() const { return hashBlock; }
+
+private:
+    uint256 hashBlock;
 };
 
 
@@ -309,23 +431,31 @@ struct CCoinsStats
 class CCoinsView
 {
 public:
-    //! Retrieve the CCoins (unspent transaction outputs) for a given txid
-    virtual bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    //! Retrieve the Coin (unspent transaction output) for a given outpoint.
+    //! Returns true only when an unspent coin was found, which is returned in coin.
+    virtual bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
 
-    //! Just check whether we have data for a given txid.
-    //! This may (but cannot always) return true for fully spent transactions
-    virtual bool HaveCoins(const uint256 &txid) const;
+    //! Just check whether a given outpoint is unspent.
+    virtual bool HaveCoin(const COutPoint &outpoint) const;
+
+    //! Retrieve an unspent output of a transaction with an index of at least nStart (which
+    //! one is up to the view), and its outpoint. Returns false when none was found.
+    virtual bool GetCoinByTxid(const uint256 &txid, uint32_t nStart, COutPoint &outpoint, Coin &coin) const;
 
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
-    //! Do a bulk modification (multiple CCoins changes + BestBlock change).
+    //! Do a bulk modification (multiple Coin changes + BestBlock change).
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
 
+    //! Get a cursor over the whole dataset (NULL if unsupported); the caller owns it.
+    //! Changes that were not written to this view yet are not visible through it.
+    virtual CCoinsViewCursor *Cursor() const;
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -339,43 +469,25 @@ protected:
 
 public:
     CCoinsViewBacked(CCoinsView *viewIn);
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    bool GetCoinByTxid(const uint256 &txid, uint32_t nStart, COutPoint &outpoint, Coin &coin) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    CCoinsViewCursor *Cursor() const;
 };
 
 
-class CCoinsViewCache;
-
-/** 
- * A reference to a mutable cache entry. Encapsulating it allows us to run
- *  cleanup code after the modification is finished, and keeping track of
- *  concurrent modifications. 
+/**
+ * CCoinsView that adds a memory cache for unspent outputs to another
+ * CCoinsView. Entries are single outputs, so spending one output of a large
+ * transaction only brings that output into memory.
  */
-class CCoinsModifier
-{
-private:
-    CCoinsViewCache& cache;
-    CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
-
-public:
-    CCoins* operator->() { return &it->second.coins; }
-    CCoins& operator*() { return it->second.coins; }
-    ~CCoinsModifier();
-    friend class CCoinsViewCache;
-};
-
-/** CCoinsView that adds a memory cache for transactions to another CCoinsView */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
-    /* Whether this cache has an active modifier. */
-    bool hasModifier;
-
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
      * declared as "const".  
@@ -383,30 +495,45 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage of the Coin objects in cacheCoins. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
-    ~CCoinsViewCache();
 
     // Standard CCoinsView methods
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    bool GetCoinByTxid(const uint256 &txid, uint32_t nStart, COutPoint &outpoint, Coin &coin) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256 &hashBlock);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
     /**
-     * Return a pointer to CCoins in the cache, or NULL if not found. This is
-     * more efficient than GetCoins. Modifications to other cache entries are
-     * allowed while accessing the returned pointer.
+     * Check if we have the given unspent output already loaded in this cache.
+     * The semantics are the same as HaveCoin(), but no calls to the backing
+     * CCoinsView are made.
+     */
+    bool HaveCoinInCache(const COutPoint &outpoint) const;
+
+    /**
+     * Return a reference to the Coin in the cache, or a spent (empty) one if
+     * not found. This is more efficient than GetCoin. The reference stays
+     * valid until the entry is modified, or the cache flushed or uncached.
+     */
+    const Coin& AccessCoin(const COutPoint &outpoint) const;
+
+    /**
+     * Add a coin. Set fPossibleOverwrite to true if an unspent version may
+     * already exist in the cache or its parents.
      */
-    const CCoins* AccessCoins(const uint256 &txid) const;
+    void AddCoin(const COutPoint &outpoint, const Coin &coin, bool fPossibleOverwrite);
 
     /**
-     * Return a modifiable reference to a CCoins. If no entry with the given
-     * txid exists, a new one is created. Simultaneous modifications are not
-     * allowed.
+     * Spend a coin; if pcoinOut is given, the coin is swapped into it.
+     * Returns whether there was an unspent coin to spend.
      */
-    CCoinsModifier ModifyCoins(const uint256 &txid);
+    bool SpendCoin(const COutPoint &outpoint, Coin *pcoinOut = NULL);
 
     /**
      * Push the modifications applied to this cache to its base.
@@ -415,9 +542,19 @@ public:
      */
     bool Flush();
 
-    //! Calculate the size of the cache (in number of transactions)
+    //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the heap memory used by the cache, in bytes
+    size_t DynamicMemoryUsage() const;
+
+    /**
+     * Drop unmodified entries (which the base view has as well) until the
+     * memory usage is at most nTargetUsage, or none are left. Like Flush(),
+     * this invalidates references returned by AccessCoin.
+     */
+    void UncacheClean(size_t nTargetUsage);
+
     /** 
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -436,11 +573,28 @@ public:
 
     const CTxOut &GetOutputFor(const CTxIn& input) const;
 
-    friend class CCoinsModifier;
-
 private:
-    CCoinsMap::iterator FetchCoins(const uint256 &txid);
-    CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
+    CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
 };
 
+//! Add all of a transaction's spendable outputs to a cache; coinbases may overwrite an older, unspent duplicate (BIP30)
+void AddCoins(CCoinsViewCache &cache, const CTransaction &tx, int nHeight);
+
+/**
+ * CCoinsView::GetCoinByTxid for a view whose entries in mapCoins override those
+ * of base. The entries are looked at first, as that costs no reads: those before
+ * the output the base finds, or (when it finds none) the first
+ * MAX_CACHED_OUTPUT_PROBES, as outputs that only the map has come from the few
+ * transactions added since it was last written to the base.
+ */
+bool GetCoinByTxid(const CCoinsMap &mapCoins, const CCoinsView &base, const uint256 &txid, uint32_t nStart, COutPoint &outpoint, Coin &coin);
+
+/**
+ * Find any unspent output of a transaction, or return a spent Coin. This is
+ * only meant for the few places that work with transaction ids rather than
+ * outpoints; the coin database looks up all outputs of the transaction with
+ * one seek.
+ */
+const Coin& AccessByTxid(const CCoinsViewCache &cache, const uint256 &txid);
+
 #endif // BITCOIN_COINS_H
@@ -0,0 +1,117 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_HISTOGRAM_H
+#define BITCOIN_HISTOGRAM_H
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Log-linear histogram of latencies in microseconds, in the style of HdrHistogram.
+ *
+ * Values below 2^SUB_BUCKET_BITS are counted exactly; every power of two above
+ * that is split into 2^SUB_BUCKET_BITS equally wide buckets, so any value is
+ * reported with a relative error of at most 1/2^SUB_BUCKET_BITS (12.5%).
+ * Values of 2^MAX_MAGNITUDE microseconds (about 12 days) or more are clamped.
+ * The whole histogram takes a fixed ~2.4KB, regardless of the number of samples.
+ */
+class CLatencyHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int MAX_MAGNITUDE = 40;
+    static const int BUCKETS = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    CLatencyHistogram() : vCounts(BUCKETS, 0), nCount(0), nSum(0), nMax(0) {}
+
+    void Add(int64_t nValue)
+    {
+        if (nValue < 0)
+            nValue = 0;
+        vCounts[BucketFor(nValue)]++;
+        nCount++;
+        nSum += nValue;
+        if (nValue > nMax)
+            nMax = nValue;
+    }
+
+    void Merge(const CLatencyHistogram& other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+            vCounts[i] += other.vCounts[i];
+        nCount += other.nCount;
+        nSum += other.nSum;
+        if (other.nMax > nMax)
+            nMax = other.nMax;
+    }
+
+    void clear()
+    {
+        vCounts.assign(BUCKETS, 0);
+        nCount = 0;
+        nSum = 0;
+        nMax = 0;
+    }
+
+    uint64_t GetCount() const { return nCount; }
+    int64_t GetMax() const { return nMax; }
+    int64_t GetMean() const { return nCount ? nSum / (int64_t)nCount : 0; }
+
+    /** Smallest bucket upper bound below which at least dFraction (0..1] of the samples fall. */
+    int64_t GetPercentile(double dFraction) const
+    {
+        if (nCount == 0)
+            return 0;
+        uint64_t nTarget = (uint64_t)(dFraction * nCount + 0.5);
+        if (nTarget < 1)
+            nTarget = 1;
+        uint64_t nSeen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            nSeen += vCounts[i];
+            if (nSeen >= nTarget)
+                return std::min(UpperBound(i), nMax);
+        }
+        return nMax;
+    }
+
+    static int BucketFor(int64_t nValue)
+    {
+        if (nValue < SUB_BUCKETS)
+            return (int)nValue;
+        int nMagnitude = 63 - CountLeadingZeros((uint64_t)nValue);
+        if (nMagnitude >= MAX_MAGNITUDE)
+            return BUCKETS - 1;
+        int nShift = nMagnitude - SUB_BUCKET_BITS;
+        return nShift * SUB_BUCKETS + (int)(nValue >> nShift);
+    }
+
+    /** Largest value that is counted in bucket nBucket. */
+    static int64_t UpperBound(int nBucket)
+    {
+        if (nBucket < 2 * SUB_BUCKETS)
+            return nBucket;
+        int nShift = nBucket / SUB_BUCKETS - 1;
+        int64_t nSub = nBucket % SUB_BUCKETS + SUB_BUCKETS;
+        return ((nSub + 1) << nShift) - 1;
+    }
+
+private:
+    static int CountLeadingZeros(uint64_t n)
+    {
+        int nZeros = 0;
+        for (uint64_t nBit = (uint64_t)1 << 63; nBit && !(n & nBit); nBit >>= 1)
+            nZeros++;
+        return nZeros;
+    }
+
+    std::vector<uint64_t> vCounts;
+    uint64_t nCount;
+    int64_t nSum;
+    int64_t nMax;
+};
+
+#endif // BITCOIN_HISTOGRAM_H
@@ -18,6 +18,7 @@
 #include "main.h"
 #include "miner.h"
 #include "net.h"
+#include "rpccache.h"
 #include "rpcserver.h"
 #include "script/standard.h"
 #include "txdb.h"
@@ -118,9 +119,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -134,7 +135,7 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
+static CCoinsViewWriteBehind *pcoinswritebehind = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 
 void Shutdown()
@@ -180,6 +181,8 @@ void Shutdown()
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinswritebehind;
+        pcoinswritebehind = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
@@ -242,6 +245,7 @@ std::string HelpMessage(HelpMessageMode mode)
     // When adding new options to the categories, please keep and ensure alphabetical ordering.
     string strUsage = _("Options:") + "\n";
     strUsage += "  -?                     " + _("This help message") + "\n";
+    strUsage += "  -addressindex          " + strprintf(_("Maintain an index of the outputs and spends of every address, used by the getaddress* rpc calls (default: %u)"), 0) + "\n";
     strUsage += "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)") + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -checkblocks=<n>       " + strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288) + "\n";
@@ -255,13 +259,22 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -dbcache=<n>           " + strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache) + "\n";
+    strUsage += "  -dbprofile=<profile>   " + _("Tune the databases for initial block download (ibd), for a synced node (steady), or switch between those as needed (auto, default)") + "\n";
+    strUsage += "  -dbibdwritebuffer=<n>  " + strprintf(_("Percentage of each database cache used as write buffer during initial block download (1 to 44, default: %d)"), DEFAULT_DB_IBD_WRITE_BUFFER) + "\n";
+    strUsage += "  -dbwritebuffer=<n>     " + strprintf(_("Percentage of each database cache used as write buffer on a synced node (1 to 44, default: %d)"), DEFAULT_DB_WRITE_BUFFER) + "\n";
+    strUsage += "  -dbmaxopenfiles=<n>    " + strprintf(_("Number of table files the chain state database keeps open (default: %d)"), DEFAULT_DB_MAX_OPEN_FILES) + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
     strUsage += "  -maxorphantx=<n>       " + strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS) + "\n";
     strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
 #ifndef WIN32
     strUsage += "  -pid=<file>            " + strprintf(_("Specify pid file (default: %s)"), "dynamiccoind.pid") + "\n";
 #endif
+    strUsage += "  -prune=<n>             " + strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet rescans and is incompatible with -txindex and -addressindex. "
+            "Warning: Reverting this setting requires re-downloading the entire blockchain. "
+            "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024) + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + " " + _("on startup") + "\n";
+    strUsage += "  -reindex-chainstate    " + _("Rebuild chain state from the currently indexed blocks") + " " + _("on startup") + "\n";
+    strUsage += "  -spentindex            " + strprintf(_("Maintain an index of the input spending every output, used by the getspentinfo rpc call and /rest/spent (default: %u)"), 0) + "\n";
 #if !defined(WIN32)
     strUsage += "  -sysperms              " + _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)") + "\n";
 #endif
@@ -275,6 +288,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -connect=<ip>          " + _("Connect only to the specified node(s)") + "\n";
     strUsage += "  -discover              " + _("Discover own IP address (default: 1 when listening and no -externalip)") + "\n";
     strUsage += "  -dns                   " + _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)") + "\n";
+    strUsage += "  -dnscachettl=<n>       " + strprintf(_("Seconds to remember resolved host names (default: %u)"), DEFAULT_DNS_CACHE_TTL) + "\n";
     strUsage += "  -dnsseed               " + _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect)") + "\n";
     strUsage += "  -externalip=<ip>       " + _("Specify your own public address") + "\n";
     strUsage += "  -forcednsseed          " + strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), 0) + "\n";
@@ -383,7 +397,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -rpcport=<port>        " + strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 7332, 17332) + "\n";
     strUsage += "  -rpcallowip=<ip>       " + _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times") + "\n";
     strUsage += "  -rpcthreads=<n>        " + strprintf(_("Set the number of threads to service RPC calls (default: %d)"), 4) + "\n";
+    strUsage += "  -rpcworkqueue=<n>      " + strprintf(_("Set the number of RPC calls that may wait for a thread before further calls are refused (default: %d)"), 16) + "\n";
+    strUsage += "  -rpcbatchmax=<n>       " + strprintf(_("Refuse JSON-RPC batches of more than <n> calls, 0 = no limit (default: %d)"), DEFAULT_RPC_BATCH_MAX) + "\n";
+    strUsage += "  -rpcbatchtimeout=<n>   " + strprintf(_("Fail the calls of a JSON-RPC batch that did not start within <n> seconds, 0 = no limit (default: %d)"), DEFAULT_RPC_BATCH_TIMEOUT) + "\n";
+    strUsage += "  -rpcmaxconnections=<n> " + strprintf(_("Refuse JSON-RPC connections while <n> connections are open (default: %d)"), DEFAULT_RPC_MAX_CONNECTIONS) + "\n";
+    strUsage += "  -rpcservertimeout=<n>  " + strprintf(_("Close JSON-RPC connections that take more than <n> seconds to send a request or to read (part of) a reply, or are idle that long between requests, 0 = no limit (default: %d)"), DEFAULT_RPC_SERVER_TIMEOUT) + "\n";
     strUsage += "  -rpckeepalive          " + strprintf(_("RPC support for HTTP persistent connections (default: %d)"), 1) + "\n";
+    strUsage += "  -rpccachesize=<n>      " + strprintf(_("Cache up to <n> MiB of replies about blocks with at least -rpccachedepth confirmations, 0 = no cache (default: %u)"), DEFAULT_RPC_CACHE_SIZE) + "\n";
+    strUsage += "  -rpccachedepth=<n>     " + strprintf(_("Confirmations a block needs for replies about it to be cached (default: %d)"), DEFAULT_RPC_CACHE_DEPTH) + "\n";
 
     strUsage += "\n" + _("RPC SSL options: (see the DynamicCoin Wiki for SSL setup instructions)") + "\n";
     strUsage += "  -rpcssl                                  " + _("Use OpenSSL (https) for JSON-RPC connections") + "\n";
@@ -428,10 +449,55 @@ struct CImportingNow
     }
 };
 
+/**
+ * A reindex in prune mode can only use block files up to the first pruned one:
+ * delete all undo files, and the block files after the first gap.
+ */
+static void CleanupBlockRevFiles()
+{
+    using namespace boost::filesystem;
+    map<string, path> mapBlockFiles;
+
+    LogPrintf("Removing unusable blk?????.dat and rev?????.dat files for -reindex with -prune\n");
+    path blocksdir = GetDataDir() / "blocks";
+    for (directory_iterator it(blocksdir); it != directory_iterator(); it++) {
+        string strName = it->path().filename().string();
+        if (is_regular_file(*it) && strName.length() == 12 && strName.substr(8, 4) == ".dat") {
+            if (strName.substr(0, 3) == "blk")
+                mapBlockFiles[strName.substr(3, 5)] = it->path();
+            else if (strName.substr(0, 3) == "rev")
+                remove(it->path());
+        }
+    }
+
+    // The map is ordered by file number; keep the files numbered 0, 1, 2, ... up to the first gap.
+    int nContigCounter = 0;
+    BOOST_FOREACH(const PAIRTYPE(string, path)& item, mapBlockFiles) {
+        if (atoi(item.first) == nContigCounter) {
+            nContigCounter++;
+            continue;
+        }
+        remove(item.second);
+    }
+}
+
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
 {
     RenameThread("dynamiccoin-loadblk");
 
+    // -reindex-chainstate
+    if (fReindexChainState) {
+        CImportingNow imp;
+        LogPrintf("Reindexing chain state...\n");
+        int64_t nStart = GetTimeMillis();
+        CValidationState state;
+        if (!ActivateBestChain(state))
+            LogPrintf("Reindexing chain state failed: %s\n", state.GetRejectReason());
+        fReindexChainState = false;
+        LOCK(cs_main);
+        LogPrintf("Reindexing chain state finished at height %d in %ds\n", chainActive.Height(), (GetTimeMillis() - nStart) / 1000);
+    }
+
 #ifdef ENABLE_EXTERNAL_BLOCKFILE_LOADING
     // -reindex
     if (fReindex) {
@@ -453,6 +519,9 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Reindexing finished\n");
         // To avoid ending up in a situation without genesis block, re-try initializing (no-op if reindexing worked):
         InitBlockIndex();
+        // Pruning was held off while reindexing
+        if (fPruneMode)
+            PruneAndFlush();
     }
 
     // hardcoded $DATADIR/bootstrap.dat
@@ -636,11 +705,16 @@ bool AppInit2(boost::thread_group& threadGroup)
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", 125);
     nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
-    int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    // MIN_CORE_FILEDESCRIPTORS counts 64 open tables per database; 32 bit systems
+    // keep a file open for every table (64 bit ones map them into memory)
+    int nCoreFD = MIN_CORE_FILEDESCRIPTORS;
+    if (MIN_CORE_FILEDESCRIPTORS > 0 && sizeof(void*) <= 4)
+        nCoreFD += std::max(GetLevelDBProfile(false, true).nMaxOpenFiles + GetLevelDBProfile(false, false).nMaxOpenFiles - 2 * 64, 0);
+    int nFD = RaiseFileDescriptorLimit(nMaxConnections + nCoreFD);
+    if (nFD < nCoreFD)
         return InitError(_("Not enough file descriptors available."));
-    if (nFD - MIN_CORE_FILEDESCRIPTORS < nMaxConnections)
-        nMaxConnections = nFD - MIN_CORE_FILEDESCRIPTORS;
+    if (nFD - nCoreFD < nMaxConnections)
+        nMaxConnections = nFD - nCoreFD;
 
     // ********************************************************* Step 3: parameter-to-internal-flags
 
@@ -666,6 +740,26 @@ bool AppInit2(boost::thread_group& threadGroup)
     // Checkmempool and checkblockindex default to true in regtest mode
     mempool.setSanityCheck(GetBoolArg("-checkmempool", Params().DefaultConsistencyChecks()));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", Params().DefaultConsistencyChecks());
+
+    // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
+    int64_t nSignedPruneTarget = GetArg("-prune", 0) * 1024 * 1024;
+    if (nSignedPruneTarget < 0)
+        return InitError(_("Prune cannot be configured with a negative value."));
+    nPruneTarget = (uint64_t)nSignedPruneTarget;
+    if (nPruneTarget) {
+        if (nPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES)
+            return InitError(strprintf(_("Prune configured below the minimum of %d MiB.  Please use a higher number."), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+        if (GetBoolArg("-txindex", false))
+            return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-addressindex", false))
+            return InitError(_("Prune mode is incompatible with -addressindex."));
+#ifdef ENABLE_WALLET
+        if (GetBoolArg("-rescan", false))
+            return InitError(_("Rescans are not possible in pruned mode. You will need to use -reindex which will download the whole blockchain again."));
+#endif
+        LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
+        fPruneMode = true;
+    }
     Checkpoints::fEnabled = GetBoolArg("-checkpoints", true);
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
@@ -685,6 +779,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     nConnectTimeout = GetArg("-timeout", DEFAULT_CONNECT_TIMEOUT);
     if (nConnectTimeout <= 0)
         nConnectTimeout = DEFAULT_CONNECT_TIMEOUT;
+    nDNSCacheTTL = std::max(0, (int)GetArg("-dnscachettl", DEFAULT_DNS_CACHE_TTL));
 
     // Fee-per-kilobyte amount considered the same as "free"
     // If you are mining, be careful setting this:
@@ -858,6 +953,10 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     RegisterNodeSignals(GetNodeSignals());
 
+    // Pruned nodes cannot serve the full block chain
+    if (fPruneMode)
+        nLocalServices &= ~NODE_NETWORK;
+
     if (mapArgs.count("-onlynet")) {
         std::set<enum Network> nets;
         BOOST_FOREACH(std::string snet, mapMultiArgs["-onlynet"]) {
@@ -959,6 +1058,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     // ********************************************************* Step 7: load block chain
 
     fReindex = GetBoolArg("-reindex", false);
+    // A full reindex rebuilds the chain state too
+    fReindexChainState = !fReindex && GetBoolArg("-reindex-chainstate", false);
 
     // Upgrading to 0.8; hard-link the old blknnnn.dat files into /blocks/
     filesystem::path blocksDir = GetDataDir() / "blocks";
@@ -994,12 +1095,19 @@ bool AppInit2(boost::thread_group& threadGroup)
     else if (nTotalCache > (nMaxDbCache << 20))
         nTotalCache = (nMaxDbCache << 20); // total cache cannot be greater than nMaxDbCache
     size_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
+    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false) && !GetBoolArg("-addressindex", false) && !GetBoolArg("-spentindex", false))
         nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the rest is for the coins cache itself
+
+    std::string strDBProfile = GetArg("-dbprofile", "auto");
+    if (strDBProfile != "auto" && strDBProfile != "ibd" && strDBProfile != "steady")
+        return InitError(strprintf(_("Unknown -dbprofile '%s' (use auto, ibd or steady)"), strDBProfile));
+    fDBProfileAuto = (strDBProfile == "auto");
+    // Before the chain is loaded, only a reindex is known to be an initial block download
+    fDBProfileIBD = (strDBProfile == "ibd") || (fDBProfileAuto && (fReindex || fReindexChainState));
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1014,22 +1122,37 @@ bool AppInit2(boost::thread_group& threadGroup)
                 UnloadBlockIndex();
                 delete pcoinsTip;
                 delete pcoinsdbview;
+                delete pcoinswritebehind;
                 delete pcoinscatcher;
                 delete pblocktree;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, GetLevelDBProfile(fDBProfileIBD, false));
+                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState, "chainstate", GetLevelDBProfile(fDBProfileIBD, true));
+                pcoinswritebehind = new CCoinsViewWriteBehind(pcoinsdbview);
+                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinswritebehind);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
-                if (fReindex)
+                if (fReindex) {
                     pblocktree->WriteReindexing(true);
+                    // A reindex in prune mode cannot use the undo files, nor any block file after a pruned one
+                    if (fPruneMode)
+                        CleanupBlockRevFiles();
+                }
 
                 if (!LoadBlockIndex()) {
                     strLoadError = _("Error loading block database");
                     break;
                 }
 
+                // The chain state can only be rebuilt if all blocks are still there
+                if (fReindexChainState) {
+                    CUTXOSnapshotHeader header;
+                    if (fHavePruned)
+                        return InitError(_("-reindex-chainstate is not possible after blocks were pruned, use -reindex instead"));
+                    if (GetPendingUTXOSnapshot(header))
+                        return InitError(_("-reindex-chainstate is not possible before the blocks below the loaded UTXO snapshot are validated, use -reindex instead"));
+                }
+
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way around).
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(Params().HashGenesisBlock()) == 0)
@@ -1047,12 +1170,40 @@ bool AppInit2(boost::thread_group& threadGroup)
                     break;
                 }
 
+                // Check for changed -addressindex state
+                if (fAddressIndex != GetBoolArg("-addressindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -addressindex");
+                    break;
+                }
+
+                // Check for changed -spentindex state
+                if (fSpentIndex != GetBoolArg("-spentindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -spentindex");
+                    break;
+                }
+
+                // Check for changed -prune state: blocks that were pruned have to be downloaded again
+                if (fHavePruned && !fPruneMode) {
+                    strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
+                    break;
+                }
+
                 uiInterface.InitMessage(_("Verifying blocks..."));
                 if (!CVerifyDB().VerifyDB(pcoinsdbview, GetArg("-checklevel", 3),
                               GetArg("-checkblocks", 288))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
+
+                if (!RepairIndexes()) {
+                    strLoadError = _("Error repairing the address and spent indexes");
+                    break;
+                }
+
+                if (!UpdateRewardLedger()) {
+                    strLoadError = _("Error writing the reward ledger");
+                    break;
+                }
             } catch(std::exception &e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1200,6 +1351,17 @@ bool AppInit2(boost::thread_group& threadGroup)
         }
         if (chainActive.Tip() && chainActive.Tip() != pindexRescan)
         {
+            // A wallet that was not synced for a while may need blocks that were pruned since
+            if (fPruneMode)
+            {
+                CBlockIndex *block = chainActive.Tip();
+                while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA) && pindexRescan != block)
+                    block = block->pprev;
+
+                if (pindexRescan != block)
+                    return InitError(_("Prune: last wallet synchronisation goes beyond pruned data. You need to -reindex (download the whole blockchain again in case of pruned node)"));
+            }
+
             uiInterface.InitMessage(_("Rescanning..."));
             LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
             nStart = GetTimeMillis();
@@ -1237,12 +1399,19 @@ bool AppInit2(boost::thread_group& threadGroup)
 #endif // !ENABLE_WALLET
     // ********************************************************* Step 9: import blocks
 
+    // Get down to the prune target before syncing any further (a reindex prunes when done)
+    if (fPruneMode && !fReindex) {
+        uiInterface.InitMessage(_("Pruning blockstore..."));
+        PruneAndFlush();
+    }
+
     if (mapArgs.count("-blocknotify"))
         uiInterface.NotifyBlockTip.connect(BlockNotifyCallback);
 
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
+    // (with -reindex-chainstate that is the whole chain, which ThreadImport connects)
     CValidationState state;
-    if (!ActivateBestChain(state))
+    if (!fReindexChainState && !ActivateBestChain(state))
         strErrors << "Failed to connect best block";
 
     std::vector<boost::filesystem::path> vImportFiles;
@@ -1252,6 +1421,10 @@ bool AppInit2(boost::thread_group& threadGroup)
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (pcoinsdbview->HaveLegacyCoins() || !pcoinsdbview->HaveStats())
+        threadGroup.create_thread(boost::bind(&ThreadUpgradeCoinsDB, pcoinsdbview));
+    threadGroup.create_thread(&ThreadValidateUTXOSnapshot);
+    threadGroup.create_thread(boost::bind(&ThreadFlushState, pcoinswritebehind));
     if (chainActive.Tip() == NULL) {
         LogPrintf("Waiting for genesis block to be imported...\n");
         while (!fRequestShutdown && chainActive.Tip() == NULL)
@@ -1287,6 +1460,14 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     // ********************************************************* Step 11: finished
 
+    {
+        // Follow the tip from here on, to know which replies may be cached
+        LOCK(cs_main);
+        int64_t nCacheSize = std::max(GetArg("-rpccachesize", DEFAULT_RPC_CACHE_SIZE), (int64_t)0) << 20;
+        rpcResponseCache.SetLimits(nCacheSize, GetArg("-rpccachedepth", DEFAULT_RPC_CACHE_DEPTH), chainActive.Height());
+        RegisterValidationInterface(&rpcResponseCache);
+    }
+
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
 
@@ -5,6 +5,9 @@
 #include "leveldbwrapper.h"
 
 #include "util.h"
+#include "utilstrencodings.h"
+
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
 
@@ -27,14 +30,15 @@ void HandleError(const leveldb::Status& status) throw(leveldb_error)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, const CLevelDBProfile& profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    // up to two write buffers may be held in memory simultaneously; the block cache gets the rest, but at least an eighth
+    options.write_buffer_size = nCacheSize / 100 * std::max(std::min(profile.nWriteBufferPercent, 44), 1);
+    options.block_cache = leveldb::NewLRUCache(nCacheSize - 2 * options.write_buffer_size);
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.max_open_files = std::max(profile.nMaxOpenFiles, 20);
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,14 +47,15 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& pathIn, size_t nCacheSizeIn, bool fMemory, bool fWipe, const CLevelDBProfile& profileIn) :
+    path(pathIn), nCacheSize(nCacheSizeIn), profile(profileIn), pdb(NULL), nIterators(0), nBytesWritten(0)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -63,9 +68,16 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
         TryCreateDirectory(path);
         LogPrintf("Opening LevelDB in %s\n", path.string());
     }
+    Open();
+    LogPrintf("Opened LevelDB successfully\n");
+}
+
+void CLevelDBWrapper::Open()
+{
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    LogPrintf("LevelDB in %s uses the %s profile: %u byte write buffer, %u byte block cache, %d open files\n",
+        path.string(), profile.strName, options.write_buffer_size, nCacheSize - 2 * options.write_buffer_size, options.max_open_files);
 }
 
 CLevelDBWrapper::~CLevelDBWrapper()
@@ -82,7 +94,106 @@ CLevelDBWrapper::~CLevelDBWrapper()
 
 bool CLevelDBWrapper::WriteBatch(CLevelDBBatch& batch, bool fSync) throw(leveldb_error)
 {
-    leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    leveldb::Status status;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(csReopen);
+        status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    }
     HandleError(status);
+    {
+        boost::unique_lock<boost::mutex> lock(csCounters);
+        nBytesWritten += batch.nBytes;
+    }
+    return true;
+}
+
+void CLevelDBWrapper::ReleaseIterator(void* pwrapper, void* pUnused)
+{
+    CLevelDBWrapper* pthis = static_cast<CLevelDBWrapper*>(pwrapper);
+    boost::unique_lock<boost::mutex> lock(pthis->csIterators);
+    pthis->nIterators--;
+}
+
+leveldb::Iterator* CLevelDBWrapper::NewIterator()
+{
+    boost::shared_lock<boost::shared_mutex> lock(csReopen);
+    leveldb::Iterator* pcursor = pdb->NewIterator(iteroptions);
+    pcursor->RegisterCleanup(&CLevelDBWrapper::ReleaseIterator, this, NULL);
+    boost::unique_lock<boost::mutex> lockIterators(csIterators);
+    nIterators++;
+    return pcursor;
+}
+
+bool CLevelDBWrapper::SetProfile(const CLevelDBProfile& profileIn) throw(leveldb_error)
+{
+    {
+        boost::shared_lock<boost::shared_mutex> lock(csReopen);
+        if (profile == profileIn)
+            return true;
+    }
+    boost::unique_lock<boost::shared_mutex> lock(csReopen, boost::try_to_lock);
+    if (!lock.owns_lock())
+        return false;
+    {
+        boost::unique_lock<boost::mutex> lockIterators(csIterators);
+        if (nIterators > 0)
+            return false;
+    }
+
+    // The memory environment keeps the data of a closed database, so this works for it too
+    delete pdb;
+    pdb = NULL;
+    leveldb::Options optionsPrev = options;
+    CLevelDBProfile profilePrev = profile;
+    leveldb::Options optionsNew = GetOptions(nCacheSize, profileIn);
+    delete optionsNew.filter_policy;
+    optionsNew.filter_policy = options.filter_policy;
+    optionsNew.create_if_missing = true;
+    optionsNew.env = options.env;
+    options = optionsNew;
+    profile = profileIn;
+    try {
+        Open();
+    } catch (const leveldb_error&) {
+        // Never leave pdb NULL: go back to the options it was open with
+        delete options.block_cache;
+        options = optionsPrev;
+        profile = profilePrev;
+        Open();
+        throw;
+    }
+    delete optionsPrev.block_cache;
     return true;
 }
+
+void CLevelDBWrapper::Compact()
+{
+    boost::shared_lock<boost::shared_mutex> lock(csReopen);
+    pdb->CompactRange(NULL, NULL);
+}
+
+void CLevelDBWrapper::GetStats(CLevelDBStats& stats) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(csReopen);
+    stats.strProfile = profile.strName;
+    stats.nWriteBufferSize = options.write_buffer_size;
+    stats.nBlockCacheSize = nCacheSize - 2 * options.write_buffer_size;
+    stats.nMaxOpenFiles = options.max_open_files;
+
+    // All keys start with a type character below 0xff
+    leveldb::Range range("", "\xff");
+    pdb->GetApproximateSizes(&range, 1, &stats.nApproximateSize);
+
+    stats.vFilesAtLevel.clear();
+    for (int nLevel = 0; true; nLevel++) {
+        std::string strFiles;
+        if (!pdb->GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), &strFiles))
+            break;
+        stats.vFilesAtLevel.push_back(atoi(strFiles));
+    }
+    if (!pdb->GetProperty("leveldb.stats", &stats.strStats))
+        stats.strStats.clear();
+
+    boost::unique_lock<boost::mutex> lockCounters(csCounters);
+    stats.nBytesWritten = nBytesWritten;
+}
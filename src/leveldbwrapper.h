@@ -11,7 +11,11 @@
 #include "util.h"
 #include "version.h"
 
+#include <vector>
+
 #include <boost/filesystem/path.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
@@ -24,6 +28,45 @@ public:
 
 void HandleError(const leveldb::Status& status) throw(leveldb_error);
 
+/**
+ * Tuning of a database for a phase of operation. Write heavy initial block
+ * download wants a large write buffer, so that fewer level-0 tables pile up and
+ * writes do not stall on compactions; a synced node mostly reads, and wants a
+ * large block cache and its tables kept open.
+ */
+struct CLevelDBProfile
+{
+    std::string strName;
+    //! Share of the cache size for the write buffer, in percent; LevelDB may hold two of them
+    int nWriteBufferPercent;
+    int nMaxOpenFiles;
+
+    CLevelDBProfile() : strName("default"), nWriteBufferPercent(25), nMaxOpenFiles(64) {}
+    CLevelDBProfile(const std::string& strNameIn, int nWriteBufferPercentIn, int nMaxOpenFilesIn) :
+        strName(strNameIn), nWriteBufferPercent(nWriteBufferPercentIn), nMaxOpenFiles(nMaxOpenFilesIn) {}
+
+    bool operator==(const CLevelDBProfile& other) const
+    {
+        return strName == other.strName && nWriteBufferPercent == other.nWriteBufferPercent && nMaxOpenFiles == other.nMaxOpenFiles;
+    }
+};
+
+/** Statistics of a database, as reported by LevelDB */
+struct CLevelDBStats
+{
+    std::string strProfile;
+    size_t nWriteBufferSize;
+    size_t nBlockCacheSize;
+    int nMaxOpenFiles;
+    //! Approximate size of all tables on disk, in bytes
+    uint64_t nApproximateSize;
+    std::vector<int> vFilesAtLevel;
+    //! LevelDB's own compaction statistics ("leveldb.stats")
+    std::string strStats;
+    //! Size of the keys and values handed to LevelDB in batches since the database was opened
+    uint64_t nBytesWritten;
+};
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -31,8 +74,11 @@ class CLevelDBBatch
 
 private:
     leveldb::WriteBatch batch;
+    uint64_t nBytes;
 
 public:
+    CLevelDBBatch() : nBytes(0) {}
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
@@ -47,6 +93,7 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        nBytes += ssKey.size() + ssValue.size();
     }
 
     template <typename K>
@@ -58,6 +105,7 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        nBytes += ssKey.size();
     }
 };
 
@@ -70,6 +118,11 @@ private:
     //! database options used
     leveldb::Options options;
 
+    //! where the database is, the size of its caches and how they are split
+    boost::filesystem::path path;
+    size_t nCacheSize;
+    CLevelDBProfile profile;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -85,8 +138,26 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    /**
+     * Held shared by every access to pdb, and exclusively to reopen it. Only
+     * SetProfile takes it exclusively, and never waits for it, so holders may
+     * take it shared again.
+     */
+    mutable boost::shared_mutex csReopen;
+
+    //! Number of iterators alive; they keep pdb from being reopened
+    boost::mutex csIterators;
+    int nIterators;
+
+    //! Write counter reported by GetStats; reads are not counted, to keep lookups free of it
+    mutable boost::mutex csCounters;
+    uint64_t nBytesWritten;
+
+    static void ReleaseIterator(void* pwrapper, void* pUnused);
+    void Open();
+
 public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CLevelDBProfile& profile = CLevelDBProfile());
     ~CLevelDBWrapper();
 
     template <typename K, typename V>
@@ -98,7 +169,11 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(csReopen);
+            status = pdb->Get(readoptions, slKey, &strValue);
+        }
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -131,7 +206,11 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(csReopen);
+            status = pdb->Get(readoptions, slKey, &strValue);
+        }
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -164,10 +243,20 @@ public:
     }
 
     // not exactly clean encapsulation, but it's easiest for now
-    leveldb::Iterator* NewIterator()
-    {
-        return pdb->NewIterator(iteroptions);
-    }
+    leveldb::Iterator* NewIterator();
+
+    /**
+     * Reopen the database with the options of another profile. Returns false,
+     * to be retried later, while an iterator or compaction keeps it in use.
+     * If it cannot be opened with the new options, it is opened again with
+     * the previous ones before the error is thrown.
+     */
+    bool SetProfile(const CLevelDBProfile& profileIn) throw(leveldb_error);
+
+    //! Compact all tables; this can take minutes on a large database, while other access goes on
+    void Compact();
+
+    void GetStats(CLevelDBStats& stats) const;
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
@@ -6,6 +6,7 @@
 
 #include "main.h"
 
+#include "addressindex.h"
 #include "addrman.h"
 #include "alert.h"
 #include "chainparams.h"
@@ -29,7 +30,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/thread.hpp>
-#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
 
 using namespace boost;
 using namespace std;
@@ -53,10 +54,18 @@ CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
+bool fReindexChainState = false;
 bool fTxIndex = false;
+bool fAddressIndex = false;
+bool fSpentIndex = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+bool fPruneMode = false;
+bool fHavePruned = false;
+uint64_t nPruneTarget = 0;
+size_t nCoinCacheUsage = 5000 * 300;
+bool fDBProfileAuto = true;
+bool fDBProfileIBD = false;
 
 CDmcSystem *pDmcSystem = NULL;
 
@@ -156,6 +165,21 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Whether the next flush should look for block files to prune. */
+    bool fCheckForPruning = false;
+
+    /**
+     * Block of the loaded UTXO snapshot whose ancestors are not validated yet
+     * (NULL if none), the snapshot's header, and the lowest height below it
+     * that may still be missing block data. Protected by cs_main.
+     */
+    CBlockIndex *pindexSnapshotBase = NULL;
+    CUTXOSnapshotHeader snapshotHeader;
+    int nSnapshotMissingHeight = 0;
+
+    /** Whether a UTXO snapshot is being written to the coin database; no blocks are connected meanwhile. Protected by cs_main. */
+    bool fLoadingUTXOSnapshot = false;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -182,6 +206,8 @@ struct CMainSignals {
     boost::signals2::signal<void ()> Broadcast;
     /** Notifies listeners of a block validation result */
     boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
+    /** Notifies listeners of a new tip of the active chain, after connecting or disconnecting a block (cs_main is held). */
+    boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
 } g_signals;
 
 } // anon namespace
@@ -194,9 +220,11 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
     g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn));
     g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
+    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
+    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
     g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn));
     g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
@@ -207,6 +235,7 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
 }
 
 void UnregisterAllValidationInterfaces() {
+    g_signals.UpdatedBlockTip.disconnect_all_slots();
     g_signals.BlockChecked.disconnect_all_slots();
     g_signals.Broadcast.disconnect_all_slots();
     g_signals.Inventory.disconnect_all_slots();
@@ -266,6 +295,18 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Time (in microseconds) at which the last requested block arrived from this peer, or 0.
+    int64_t nLastBlockReceived;
+    //! Moving average of the time (in microseconds) this peer needs to deliver a block once it is first in its queue, or 0.
+    int64_t nAvgBlockServiceTime;
+    //! Moving average of the size of the blocks we downloaded from this peer.
+    int64_t nAvgBlockSize;
+    //! Number of blocks we allow to be in flight from this peer at once.
+    int nBlocksInFlightLimit;
+    //! The last header we sent to this peer (via headers announcement or getheaders response).
+    CBlockIndex *pindexBestHeaderSent;
+    //! Whether this peer wants block announcements via headers (sendheaders) instead of inv.
+    bool fPreferHeaders;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -278,6 +319,12 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        nLastBlockReceived = 0;
+        nAvgBlockServiceTime = 0;
+        nAvgBlockSize = 0;
+        nBlocksInFlightLimit = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        pindexBestHeaderSent = NULL;
+        fPreferHeaders = false;
     }
 };
 
@@ -334,11 +381,34 @@ void FinalizeNode(NodeId nodeid) {
     mapNodeState.erase(nodeid);
 }
 
+/** Fold a block delivered by the peer it was requested from into that peer's throughput estimate. */
+void UpdateBlockDownloadRate(CNodeState *state, const QueuedBlock& queued, unsigned int nBlockSize) {
+    int64_t nNow = GetTimeMicros();
+    // Blocks from one peer arrive in request order, so this block only started being served once
+    // the previous one had arrived.
+    int64_t nServiceTime = std::max<int64_t>(nNow - std::max(queued.nTime, state->nLastBlockReceived), 1);
+    if (state->nAvgBlockServiceTime == 0) {
+        state->nAvgBlockServiceTime = nServiceTime;
+        state->nAvgBlockSize = nBlockSize;
+    } else {
+        state->nAvgBlockServiceTime = (state->nAvgBlockServiceTime * 7 + nServiceTime) / 8;
+        state->nAvgBlockSize = (state->nAvgBlockSize * 7 + nBlockSize) / 8;
+    }
+    state->nLastBlockReceived = nNow;
+}
+
+/** Size a peer's download pipeline from the rate it has been delivering blocks at. */
+void UpdateBlocksInFlightLimit(CNodeState *state, int64_t nPingUsecTime) {
+    state->nBlocksInFlightLimit = GetBlocksInFlightLimit(state->nAvgBlockServiceTime, nPingUsecTime);
+}
+
 // Requires cs_main.
-void MarkBlockAsReceived(const uint256& hash) {
+void MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1, unsigned int nBlockSize = 0) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (nodeFrom == itInFlight->second.first)
+            UpdateBlockDownloadRate(state, *itInFlight->second.second, nBlockSize);
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
@@ -395,6 +465,27 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
     }
 }
 
+// Requires cs_main
+bool CanDirectFetch()
+{
+    return chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20;
+}
+
+// Requires cs_main
+bool PeerHasHeader(CNodeState *state, CBlockIndex *pindex)
+{
+    if (state->pindexBestKnownBlock && pindex == state->pindexBestKnownBlock->GetAncestor(pindex->nHeight))
+        return true;
+    if (state->pindexBestHeaderSent && pindex == state->pindexBestHeaderSent->GetAncestor(pindex->nHeight))
+        return true;
+    return false;
+}
+
+/** Whether a block in flight from another peer should be requested again from the peer described by state. */
+bool ShouldRerequestBlock(CNodeState *state, NodeId nodeInFlight, const QueuedBlock& queued, int64_t nNow) {
+    return ::ShouldRerequestBlock(state->nAvgBlockServiceTime, State(nodeInFlight)->nAvgBlockServiceTime, nNow - queued.nTime);
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
@@ -416,6 +507,35 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
  *  at most count entries. */
+/** Whether all blocks below the loaded UTXO snapshot have been downloaded. */
+bool HaveSnapshotHistory() {
+    AssertLockHeld(cs_main);
+    if (pindexSnapshotBase == NULL)
+        return true;
+    while (nSnapshotMissingHeight <= pindexSnapshotBase->nHeight &&
+           (pindexSnapshotBase->GetAncestor(nSnapshotMissingHeight)->nStatus & BLOCK_HAVE_DATA))
+        nSnapshotMissingHeight++;
+    return nSnapshotMissingHeight > pindexSnapshotBase->nHeight;
+}
+
+/** Find blocks below the loaded UTXO snapshot that the given peer can provide, lowest first. */
+void FindHistoricalBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks) {
+    if (count == 0 || HaveSnapshotHistory())
+        return;
+
+    CNodeState *state = State(nodeid);
+    assert(state != NULL);
+    if (state->pindexBestKnownBlock == NULL || state->pindexBestKnownBlock->GetAncestor(pindexSnapshotBase->nHeight) != pindexSnapshotBase)
+        return;
+
+    int nMaxHeight = std::min(nSnapshotMissingHeight + GetBlockDownloadWindow(state->nBlocksInFlightLimit), pindexSnapshotBase->nHeight);
+    for (int nHeight = nSnapshotMissingHeight; nHeight <= nMaxHeight && vBlocks.size() < count; nHeight++) {
+        CBlockIndex *pindex = pindexSnapshotBase->GetAncestor(nHeight);
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) && mapBlocksInFlight.count(pindex->GetBlockHash()) == 0)
+            vBlocks.push_back(pindex);
+    }
+}
+
 void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
     if (count == 0)
         return;
@@ -446,11 +566,14 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
     std::vector<CBlockIndex*> vToFetch;
     CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
-    // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
-    // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    // Never fetch further than the best block we know the peer has, or more than the peer's download window + 1 beyond
+    // the last linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be
+    // able to download that next block if the window were 1 larger.
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + GetBlockDownloadWindow(state->nBlocksInFlightLimit);
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
+    // Blocks holding back the start of the window may be taken over from slow peers.
+    int nRerequestEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_REREQUEST_WINDOW;
+    int64_t nNow = GetTimeMicros();
     NodeId waitingfor = -1;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
@@ -489,9 +612,22 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                 if (vBlocks.size() == count) {
                     return;
                 }
-            } else if (waitingfor == -1) {
-                // This is the first already-in-flight block.
-                waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+            } else {
+                map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(pindex->GetBlockHash());
+                NodeId nodeInFlight = itInFlight->second.first;
+                if (nodeInFlight != nodeid && pindex->nHeight <= nRerequestEnd &&
+                    ShouldRerequestBlock(state, nodeInFlight, *itInFlight->second.second, nNow)) {
+                    // A slow peer is holding back the window; fetch this block from the faster one instead.
+                    LogPrint("net", "Re-requesting overdue block %s (%d) from peer=%d, was peer=%d\n",
+                        pindex->GetBlockHash().ToString(), pindex->nHeight, nodeid, nodeInFlight);
+                    vBlocks.push_back(pindex);
+                    if (vBlocks.size() == count) {
+                        return;
+                    }
+                } else if (waitingfor == -1) {
+                    // This is the first already-in-flight block.
+                    waitingfor = nodeInFlight;
+                }
             }
         }
     }
@@ -499,6 +635,26 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
 } // anon namespace
 
+int GetBlocksInFlightLimit(int64_t nAvgBlockServiceTime, int64_t nPingUsecTime) {
+    if (nAvgBlockServiceTime == 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nDepth = (nPingUsecTime + 1000000 * BLOCK_DOWNLOAD_PIPELINE_TIME) / nAvgBlockServiceTime + 1;
+    return std::max<int64_t>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(MAX_BLOCKS_IN_TRANSIT_PER_PEER_MEASURED, nDepth));
+}
+
+int GetBlockDownloadWindow(int nBlocksInFlightLimit) {
+    return nBlocksInFlightLimit * BLOCK_DOWNLOAD_WINDOW_PER_BLOCK_IN_FLIGHT;
+}
+
+bool ShouldRerequestBlock(int64_t nAvgServiceTime, int64_t nAvgServiceTimeInFlight, int64_t nTimeInFlight) {
+    if (nAvgServiceTime == 0)
+        return false;
+    if (nAvgServiceTimeInFlight != 0 && nAvgServiceTimeInFlight < 2 * nAvgServiceTime)
+        return false;
+    // Don't bother unless the faster peer would already have delivered it several times over.
+    return nTimeInFlight > 4 * nAvgServiceTime + 1000000 * BLOCK_DOWNLOAD_PIPELINE_TIME;
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -511,6 +667,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlocksInFlightLimit = state->nBlocksInFlightLimit;
+    stats.nDownloadRate = state->nAvgBlockServiceTime ? state->nAvgBlockSize * 1000000 / state->nAvgBlockServiceTime : 0;
     return true;
 }
 
@@ -549,6 +707,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -984,26 +1143,22 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        if (view.HaveCoins(hash))
-            return false;
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // only helps filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx? Only
+                // the cache is checked for its outputs, as that is cheap.
+                for (unsigned int out = 0; out < tx.vout.size(); out++) {
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                        return false;
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false;
             }
         }
 
-        // are the actual inputs available?
-        if (!view.HaveInputs(tx))
-            return state.Invalid(error("AcceptToMemoryPool : inputs already spent"),
-                                 REJECT_DUPLICATE, "bad-txns-inputs-spent");
-
         // Bring the best block into scope
         view.GetBestBlock();
 
@@ -1099,6 +1254,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, bool fAllowSlow)
 {
     CBlockIndex *pindexSlow = NULL;
+    CDiskTxPos postx;
+    bool fFoundTxIndex = false;
     {
         LOCK(cs_main);
         {
@@ -1108,40 +1265,40 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
             }
         }
 
-        if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (std::exception &e) {
-                    return error("%s : Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut.GetHash() != hash)
-                    return error("%s : txid mismatch", __func__);
-                return true;
-            }
-        }
+        if (fTxIndex)
+            fFoundTxIndex = pblocktree->ReadTxIndex(hash, postx);
 
-        if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+        if (!fFoundTxIndex && fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
-                CCoinsViewCache &view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+                if (!coin.IsSpent())
+                    nHeight = coin.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
         }
     }
 
+    // Block files are only appended to, so they are read without holding cs_main
+    if (fFoundTxIndex) {
+        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: OpenBlockFile failed", __func__);
+        CBlockHeader header;
+        try {
+            file >> header;
+            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+            file >> txOut;
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        hashBlock = header.GetHash();
+        if (txOut.GetHash() != hash)
+            return error("%s : txid mismatch", __func__);
+        return true;
+    }
+
     if (pindexSlow) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow)) {
@@ -1158,6 +1315,23 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     return false;
 }
 
+bool GetSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value, bool fMempool)
+{
+    // The block tree database is safe to read without holding cs_main
+    if (fSpentIndex && pblocktree->ReadSpentIndex(key, value))
+        return true;
+
+    if (fMempool) {
+        LOCK(mempool.cs);
+        std::map<COutPoint, CInPoint>::const_iterator it = mempool.mapNextTx.find(COutPoint(key.txid, key.nIndex));
+        if (it != mempool.mapNextTx.end()) {
+            value = CSpentIndexValue(it->second.ptx->GetHash(), it->second.n, -1);
+            return true;
+        }
+    }
+    return false;
+}
+
 
 
 
@@ -1395,14 +1569,16 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            txundo.vprevout.push_back(CTxInUndo());
-            bool ret = inputs.ModifyCoins(txin.prevout.hash)->Spend(txin.prevout, txundo.vprevout.back());
-            assert(ret);
+            Coin coin;
+            bool fSpent = inputs.SpendCoin(txin.prevout, &coin);
+            assert(fSpent);
+            // The undo data always carries the metadata, so that every output can be restored on its own
+            txundo.vprevout.push_back(CTxInUndo(coin));
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 bool CScriptCheck::operator()() {
@@ -1434,20 +1610,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(
-                        error("CheckInputs() : tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight),
+                        error("CheckInputs() : tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs() : txin values out of range"),
                                  REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
@@ -1478,11 +1654,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1494,7 +1670,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
+                        CScriptCheck check(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1515,7 +1691,164 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
     return true;
 }
 
+namespace {
+    /**
+     * The block the optional indexes are at, and the number of the next entry of
+     * the index journal (see CIndexJournalEntry). Protected by cs_main.
+     */
+    uint256 hashIndexBest;
+    uint32_t nIndexJournalNext = 0;
+} // anon namespace
 
+/** Whether any of the indexes that RepairIndexes keeps in line with the chain state is enabled */
+static bool IsIndexJournalEnabled()
+{
+    return fAddressIndex || fSpentIndex;
+}
+
+/**
+ * Collect the address index records of connecting (or disconnecting) a block:
+ * the outputs paid to addresses and the spends from them, with the changes to
+ * the unspent outputs of addresses in the order they apply.
+ */
+static void GetAddressIndexRecords(const CBlock& block, const CBlockUndo& blockUndo, int nHeight, bool fConnect,
+                                   std::vector<std::pair<CAddressIndexKey, CAmount> >& vIndex,
+                                   std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent)
+{
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    for (unsigned int n = 0; n < block.vtx.size(); n++) {
+        // Disconnecting goes through the transactions in reverse order, so that
+        // outputs spent in the same block end up spent either way
+        unsigned int i = fConnect ? n : block.vtx.size() - 1 - n;
+        const CTransaction &tx = block.vtx[i];
+        const uint256 txid = tx.GetHash();
+        if (i > 0) {
+            const CTxUndo &txundo = blockUndo.vtxundo[i - 1];
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const COutPoint &prevout = tx.vin[j].prevout;
+                const CTxInUndo &undo = txundo.vprevout[j];
+                if (!GetAddressIndexKey(undo.txout.scriptPubKey, nAddressType, hashAddress))
+                    continue;
+                vIndex.push_back(make_pair(CAddressIndexKey(nAddressType, hashAddress, nHeight, i, txid, j, true), -undo.txout.nValue));
+                vUnspent.push_back(make_pair(CAddressUnspentKey(nAddressType, hashAddress, undo.nHeight, prevout.hash, prevout.n),
+                                             fConnect ? CAddressUnspentValue() : CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, undo.fCoinBase)));
+            }
+        }
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            const CTxOut &out = tx.vout[k];
+            if (!GetAddressIndexKey(out.scriptPubKey, nAddressType, hashAddress))
+                continue;
+            vIndex.push_back(make_pair(CAddressIndexKey(nAddressType, hashAddress, nHeight, i, txid, k, false), out.nValue));
+            vUnspent.push_back(make_pair(CAddressUnspentKey(nAddressType, hashAddress, nHeight, txid, k),
+                                         fConnect ? CAddressUnspentValue(out.nValue, out.scriptPubKey, tx.IsCoinBase()) : CAddressUnspentValue()));
+        }
+    }
+}
+
+/** Collect the spent index records of connecting a block, or their erasures for disconnecting it */
+static void GetSpentIndexRecords(const CBlock& block, int nHeight, bool fConnect, std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >& vSpent)
+{
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        const CTransaction &tx = block.vtx[i];
+        const uint256 txid = tx.GetHash();
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+            vSpent.push_back(make_pair(CSpentIndexKey(tx.vin[j].prevout.hash, tx.vin[j].prevout.n),
+                                       fConnect ? CSpentIndexValue(txid, j, nHeight) : CSpentIndexValue()));
+    }
+}
+
+/**
+ * Apply connecting (or disconnecting) a block to the optional indexes, after
+ * recording it in the index journal. Only a block that goes from the block the
+ * indexes are at changes them; the blocks VerifyDB connects again do not.
+ */
+static bool UpdateIndexes(const CBlock& block, const CBlockUndo& blockUndo, const CIndexJournalEntry& entry)
+{
+    AssertLockHeld(cs_main);
+    if (!IsIndexJournalEnabled() || hashIndexBest != (entry.fConnect ? entry.hashPrevBlock : entry.hashBlock))
+        return true;
+
+    if (!pblocktree->WriteIndexJournal(nIndexJournalNext, entry))
+        return error("%s : failed to write index journal", __func__);
+    nIndexJournalNext++;
+    if (fAddressIndex) {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspent;
+        GetAddressIndexRecords(block, blockUndo, entry.nHeight, entry.fConnect, vAddressIndex, vAddressUnspent);
+        if (entry.fConnect ? !pblocktree->WriteAddressIndex(vAddressIndex, vAddressUnspent) : !pblocktree->EraseAddressIndex(vAddressIndex, vAddressUnspent))
+            return error("%s : failed to write address index", __func__);
+    }
+    if (fSpentIndex) {
+        std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
+        GetSpentIndexRecords(block, entry.nHeight, entry.fConnect, vSpentIndex);
+        if (!pblocktree->UpdateSpentIndex(vSpentIndex))
+            return error("%s : failed to write spent index", __func__);
+    }
+    hashIndexBest = entry.GetIndexBest();
+    return true;
+}
+
+/** Read a block and its undo data back from disk, and apply it to the optional indexes as entry says */
+static bool ReplayIndexJournalEntry(const CIndexJournalEntry& entry)
+{
+    CBlock block;
+    CBlockUndo blockUndo;
+    if (!ReadBlockFromDisk(block, entry.posData) || block.GetHash() != entry.hashBlock)
+        return error("%s : failed to read block %s", __func__, entry.hashBlock.ToString());
+    if (entry.posUndo.IsNull() || !blockUndo.ReadFromDisk(entry.posUndo, entry.hashPrevBlock))
+        return error("%s : failed to read undo data of block %s", __func__, entry.hashBlock.ToString());
+    return UpdateIndexes(block, blockUndo, entry);
+}
+
+bool RepairIndexes()
+{
+    LOCK(cs_main);
+    if (!IsIndexJournalEnabled())
+        return true;
+
+    std::vector<std::pair<uint32_t, CIndexJournalEntry> > vJournal;
+    if (!pblocktree->ReadIndexJournal(vJournal))
+        return error("RepairIndexes() : failed to read index journal");
+    nIndexJournalNext = vJournal.empty() ? 0 : vJournal.back().first + 1;
+
+    int nUndone = 0, nConnected = 0;
+    if (fReindexChainState || chainActive.Tip() == NULL || !pblocktree->ReadIndexJournalBase(hashIndexBest)) {
+        // Indexes without a journal start out at the chain state; with
+        // -reindex-chainstate they are written again from the genesis block on
+        hashIndexBest = chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : Params().HashGenesisBlock();
+    } else {
+        if (!vJournal.empty())
+            hashIndexBest = vJournal.back().second.GetIndexBest();
+        // Undo the journaled blocks the chain state on disk does not include
+        while (true) {
+            BlockMap::iterator mi = mapBlockIndex.find(hashIndexBest);
+            if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+                break;
+            if (vJournal.empty())
+                return error("RepairIndexes() : indexes at unknown block %s", hashIndexBest.ToString());
+            CIndexJournalEntry entry = vJournal.back().second;
+            vJournal.pop_back();
+            entry.fConnect = !entry.fConnect;
+            if (!ReplayIndexJournalEntry(entry))
+                return false;
+            nUndone++;
+        }
+        // ... and connect the blocks of the active chain the indexes miss
+        for (CBlockIndex *pindex = chainActive.Next(mapBlockIndex[hashIndexBest]); pindex != NULL; pindex = chainActive.Next(pindex)) {
+            if (!ReplayIndexJournalEntry(CIndexJournalEntry(pindex, true)))
+                return false;
+            nConnected++;
+        }
+    }
+
+    if (!pblocktree->ResetIndexJournal(nIndexJournalNext, hashIndexBest))
+        return error("RepairIndexes() : failed to write index journal");
+    nIndexJournalNext = 0;
+    if (nUndone > 0 || nConnected > 0)
+        LogPrintf("RepairIndexes(): undid %d and connected %d blocks, indexes at %s\n", nUndone, nConnected, hashIndexBest.ToString());
+    return true;
+}
 
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
 {
@@ -1542,25 +1875,18 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         uint256 hash = tx.GetHash();
 
         // Check that all outputs are available and match the outputs in the block itself
-        // exactly. Note that transactions with only provably unspendable outputs won't
-        // have outputs available even in the block itself, so we handle that case
-        // specially with outsEmpty.
-        {
-        CCoins outsEmpty;
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        // exactly, and remove them. Provably unspendable outputs were never added.
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            if (tx.vout[k].scriptPubKey.IsUnspendable())
+                continue;
+            Coin coin;
+            bool fSpent = view.SpendCoin(COutPoint(hash, k), &coin);
+            // The Coin serialization does not serialize negative numbers.
+            // No network rules currently depend on the version here, so an inconsistency is harmless
+            // but it must be corrected before txout nversion ever influences a network rule.
+            if (!fSpent || coin.out != tx.vout[k] || coin.nHeight != pindex->nHeight || coin.fCoinBase != tx.IsCoinBase() ||
+                (tx.nVersion >= 0 && coin.nVersion != tx.nVersion))
+                fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
         }
 
         // restore inputs
@@ -1571,28 +1897,33 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
                 const CTxInUndo &undo = txundo.vprevout[j];
-                CCoinsModifier coins = view.ModifyCoins(out.hash);
-                if (undo.nHeight != 0) {
-                    // undo data contains height: this is the last output of the prevout tx being spent
-                    if (!coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
-                    coins->Clear();
-                    coins->fCoinBase = undo.fCoinBase;
-                    coins->nHeight = undo.nHeight;
-                    coins->nVersion = undo.nVersion;
-                } else {
-                    if (coins->IsPruned())
+                Coin coin(undo.txout, undo.nHeight, undo.fCoinBase, undo.nVersion);
+                if (undo.nHeight == 0) {
+                    // Undo data of older versions only has the metadata of the prevout
+                    // tx with its last spent output, so another output must be left.
+                    const Coin& alternate = AccessByTxid(view, out.hash);
+                    if (alternate.IsSpent()) {
                         fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
+                    } else {
+                        coin.fCoinBase = alternate.fCoinBase;
+                        coin.nHeight = alternate.nHeight;
+                        coin.nVersion = alternate.nVersion;
+                    }
                 }
-                if (coins->IsAvailable(out.n))
+                if (view.HaveCoin(out))
                     fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
-                if (coins->vout.size() < out.n+1)
-                    coins->vout.resize(out.n+1);
-                coins->vout[out.n] = undo.txout;
+                // Other outputs of the prevout tx may be in the parent view, so this one cannot be FRESH
+                view.AddCoin(out, coin, true);
             }
         }
     }
 
+    // Blocks that are only checked (with pfClean) leave the indexes and the reward ledger alone
+    if (pfClean == NULL && !UpdateIndexes(block, blockUndo, CIndexJournalEntry(pindex, false)))
+        return state.Abort("Failed to erase address or spent index");
+    if (pfClean == NULL && !pblocktree->EraseRewardLedger(pindex->nHeight))
+        return state.Abort("Failed to erase reward ledger");
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -1679,10 +2010,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                            (pindex->nHeight==91880 && pindex->GetBlockHash() == uint256("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            const uint256 hash = tx.GetHash();
+            for (unsigned int o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(hash, o)))
+                    return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
@@ -1780,6 +2113,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    if (!UpdateIndexes(block, blockundo, CIndexJournalEntry(pindex, true)))
+        return state.Abort("Failed to write address or spent index");
+
+    std::vector<std::pair<uint32_t, CRewardLedgerEntry> > vRewardLedger(1, std::make_pair((uint32_t)pindex->nHeight, pDmcSystem->GetRewardLedgerEntry(pindex)));
+    if (!pblocktree->WriteRewardLedger(vRewardLedger))
+        return state.Abort("Failed to write reward ledger");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -1798,54 +2138,262 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 }
 
 enum FlushStateMode {
+    FLUSH_STATE_NONE,
     FLUSH_STATE_IF_NEEDED,
     FLUSH_STATE_PERIODIC,
     FLUSH_STATE_ALWAYS
 };
 
+namespace {
+    /**
+     * Chain state flush handed over to ThreadFlushState: the block file info and
+     * block index entries to write before the coin database batch, which
+     * pcoinsFlushView keeps pending meanwhile, and the pruned block files to
+     * delete after it. Once the batch is committed, the index journal is
+     * reset up to nFlushIndexJournalEnd (if fFlushIndexJournal), which took
+     * the indexes to hashFlushIndexBest. pcoinsFlushView is only set while
+     * ThreadFlushState runs. Protected by cs_flush.
+     */
+    boost::mutex cs_flush;
+    boost::condition_variable condFlush;
+    CCoinsViewWriteBehind *pcoinsFlushView = NULL;
+    bool fFlushPending = false;
+    vector<pair<int, CBlockFileInfo> > vFlushFileInfo;
+    int nFlushLastBlockFile = -1;
+    vector<CDiskBlockIndex> vFlushBlockIndex;
+    set<int> setFlushFilesToPrune;
+    bool fFlushIndexJournal = false;
+    uint32_t nFlushIndexJournalEnd = 0;
+    uint256 hashFlushIndexBest;
+    CFlushStats flushStats;
+} // anon namespace
+
+/**
+ * Write block file info and block index entries (nLastFile < 0 leaves the last
+ * block file number alone), after the block and undo data they refer to.
+ */
+static bool WriteBlockIndexChanges(const vector<pair<int, CBlockFileInfo> > &vFileInfo, int nLastFile, const vector<CDiskBlockIndex> &vBlockIndex)
+{
+    // First make sure all block and undo data is flushed to disk.
+    FlushBlockFile();
+    // Then update all block file information (which may refer to block and undo files).
+    for (vector<pair<int, CBlockFileInfo> >::const_iterator it = vFileInfo.begin(); it != vFileInfo.end(); it++) {
+        if (!pblocktree->WriteBlockFileInfo(it->first, it->second))
+            return false;
+    }
+    if (nLastFile >= 0 && !pblocktree->WriteLastBlockFile(nLastFile))
+        return false;
+    for (vector<CDiskBlockIndex>::const_iterator it = vBlockIndex.begin(); it != vBlockIndex.end(); it++) {
+        if (!pblocktree->WriteBlockIndex(*it))
+            return false;
+    }
+    return pblocktree->Sync();
+}
+
+uint64_t CalculateCurrentUsage()
+{
+    LOCK(cs_LastBlockFile);
+
+    uint64_t nUsage = 0;
+    BOOST_FOREACH(const CBlockFileInfo &file, vinfoBlockFile) {
+        nUsage += file.nSize + file.nUndoSize;
+    }
+    return nUsage;
+}
+
+void PruneBlockIndexEntry(CBlockIndex *pindex)
+{
+    AssertLockHeld(cs_main);
+    pindex->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO);
+    pindex->nFile = 0;
+    pindex->nDataPos = 0;
+    pindex->nUndoPos = 0;
+    setDirtyBlockIndex.insert(pindex);
+
+    // The block has to be downloaded again before its descendants can be connected.
+    std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+    while (range.first != range.second) {
+        std::multimap<CBlockIndex*, CBlockIndex*>::iterator itUnlinked = range.first++;
+        if (itUnlinked->second == pindex)
+            mapBlocksUnlinked.erase(itUnlinked);
+    }
+}
+
+/** Mark the blocks stored in a block file as pruned; the file itself is deleted after the next flush. */
+void static PruneOneBlockFile(int nFile)
+{
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
+        CBlockIndex *pindex = it->second;
+        if ((pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)) && pindex->nFile == nFile)
+            PruneBlockIndexEntry(pindex);
+    }
+
+    vinfoBlockFile[nFile].SetNull();
+    setDirtyFileInfo.insert(nFile);
+}
+
+void SelectFilesToPrune(const std::vector<CBlockFileInfo> &vinfo, int nLastFile, uint64_t nCurrentUsage, uint64_t nTarget,
+                        unsigned int nMaxHeight, int nSnapshotHeight, std::set<int> &setFilesToPrune)
+{
+    // Leave room for the chunks the block and undo files being written may still allocate
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    for (int nFile = 0; nFile < nLastFile && nCurrentUsage + nBuffer >= nTarget; nFile++) {
+        const CBlockFileInfo &info = vinfo[nFile];
+        if (info.nSize == 0 || info.nHeightLast > nMaxHeight)
+            continue;
+        if (nSnapshotHeight >= 0 && info.nHeightFirst <= (unsigned int)nSnapshotHeight)
+            continue;
+        nCurrentUsage -= info.nSize + info.nUndoSize;
+        setFilesToPrune.insert(nFile);
+    }
+}
+
+/**
+ * Select the oldest block files to prune until the block and undo files fit in
+ * nPruneTarget again (see SelectFilesToPrune), and mark their blocks pruned.
+ */
+void static FindFilesToPrune(set<int> &setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || nPruneTarget == 0 || chainActive.Height() <= (int)MIN_BLOCKS_TO_KEEP)
+        return;
+
+    unsigned int nLastBlockWeCanPrune = chainActive.Height() - MIN_BLOCKS_TO_KEEP;
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    SelectFilesToPrune(vinfoBlockFile, nLastBlockFile, nCurrentUsage, nPruneTarget, nLastBlockWeCanPrune,
+                       pindexSnapshotBase != NULL ? pindexSnapshotBase->nHeight : -1, setFilesToPrune);
+    for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); it++) {
+        nCurrentUsage -= vinfoBlockFile[*it].nSize + vinfoBlockFile[*it].nUndoSize;
+        PruneOneBlockFile(*it);
+    }
+
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
+        nPruneTarget / 1024 / 1024, nCurrentUsage / 1024 / 1024, nLastBlockWeCanPrune, setFilesToPrune.size());
+}
+
+/** Delete pruned block and undo files, once the block index on disk no longer refers to them. */
+void static UnlinkPrunedFiles(const set<int> &setFilesToPrune)
+{
+    for (set<int>::const_iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); it++) {
+        CDiskBlockPos pos(*it, 0);
+        boost::system::error_code ec;
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"), ec);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"), ec);
+        LogPrintf("Prune: deleted blk/rev (%05u)\n", *it);
+    }
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed if either they're too large, forceWrite is set, or
- * fast is not set and it's been a while since the last write.
+ * fast is not set and it's been a while since the last write. In prune mode, block
+ * files to prune are picked here too; that forces a flush, after which they are deleted.
+ *
+ * While ThreadFlushState runs, this only takes a copy of the dirty block index
+ * entries and hands the coins cache over as a pending batch; the thread then
+ * writes both in the same order as below, so the chainstate never refers to
+ * index entries or block data that are not on disk yet. Only one flush can be
+ * in progress; FLUSH_STATE_ALWAYS waits for it to be committed.
  */
 bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
+    set<int> setFilesToPrune;
+    bool fFlushForPrune = false;
     try {
-    if ((mode == FLUSH_STATE_ALWAYS) ||
-        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+    if (fPruneMode && fCheckForPruning && !fReindex) {
+        FindFilesToPrune(setFilesToPrune);
+        fCheckForPruning = false;
+        if (!setFilesToPrune.empty()) {
+            fFlushForPrune = true;
+            if (!fHavePruned) {
+                pblocktree->WriteFlag("prunedblockfiles", true);
+                fHavePruned = true;
+            }
+        }
+    }
+    // The coins of a flush that is still being committed take memory as well,
+    // so they count against the budget; once the budget is used up, the next
+    // flush waits for the pending one.
+    size_t nPendingUsage;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_flush);
+        nPendingUsage = fFlushPending ? flushStats.nPendingUsage : 0;
+    }
+    size_t nCacheBudget = nCoinCacheUsage - std::min(nPendingUsage, nCoinCacheUsage);
+    size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    bool fCacheCritical = false;
+    if ((mode == FLUSH_STATE_IF_NEEDED || mode == FLUSH_STATE_PERIODIC) && cacheSize > nCacheBudget) {
+        // Unmodified entries can be dropped without writing anything. Only
+        // if that does not free a quarter of the budget, flush everything.
+        pcoinsTip->UncacheClean(nCacheBudget * 3 / 4);
+        size_t cacheSizeAfter = pcoinsTip->DynamicMemoryUsage();
+        LogPrint("coindb", "Dropped unmodified coins from the cache: %u -> %u bytes\n", cacheSize, cacheSizeAfter);
+        cacheSize = cacheSizeAfter;
+        fCacheCritical = cacheSize > nCacheBudget * 3 / 4;
+    }
+    if ((mode == FLUSH_STATE_ALWAYS) || fCacheCritical || fFlushForPrune ||
         (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
-        // Typical CCoins structures on disk are around 100 bytes in size.
+        // Typical Coin records on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(100 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
-        // First make sure all block and undo data is flushed to disk.
-        FlushBlockFile();
-        // Then update all block file information (which may refer to block and undo files).
-        bool fileschanged = false;
-        for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
-            if (!pblocktree->WriteBlockFileInfo(*it, vinfoBlockFile[*it])) {
+        int64_t nStart = GetTimeMicros();
+        boost::this_thread::disable_interruption di;
+        boost::unique_lock<boost::mutex> lock(cs_flush);
+        while (fFlushPending)
+            condFlush.wait(lock);
+
+        vector<pair<int, CBlockFileInfo> > vFileInfo;
+        for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); it++)
+            vFileInfo.push_back(make_pair(*it, vinfoBlockFile[*it]));
+        setDirtyFileInfo.clear();
+        int nLastFile = vFileInfo.empty() ? -1 : nLastBlockFile;
+        vector<CDiskBlockIndex> vBlockIndex;
+        vBlockIndex.reserve(setDirtyBlockIndex.size());
+        for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); it++)
+            vBlockIndex.push_back(CDiskBlockIndex(*it));
+        setDirtyBlockIndex.clear();
+
+        if (pcoinsFlushView == NULL) {
+            lock.unlock();
+            if (!WriteBlockIndexChanges(vFileInfo, nLastFile, vBlockIndex))
                 return state.Abort("Failed to write to block index");
+            // Finally flush the chainstate (which may refer to block index entries).
+            if (!pcoinsTip->Flush())
+                return state.Abort("Failed to write to coin database");
+            // The journaled changes to the indexes are now covered by the chain state on disk
+            if (IsIndexJournalEnabled()) {
+                if (!pblocktree->ResetIndexJournal(nIndexJournalNext, hashIndexBest))
+                    return state.Abort("Failed to write index journal");
+                nIndexJournalNext = 0;
             }
-            fileschanged = true;
-            setDirtyFileInfo.erase(it++);
-        }
-        if (fileschanged && !pblocktree->WriteLastBlockFile(nLastBlockFile)) {
-            return state.Abort("Failed to write to block index");
-        }
-        for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-             if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
-                 return state.Abort("Failed to write to block index");
-             }
-             setDirtyBlockIndex.erase(it++);
-        }
-        pblocktree->Sync();
-        // Finally flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
-            return state.Abort("Failed to write to coin database");
+            UnlinkPrunedFiles(setFilesToPrune);
+            lock.lock();
+        } else {
+            vFlushFileInfo.swap(vFileInfo);
+            nFlushLastBlockFile = nLastFile;
+            vFlushBlockIndex.swap(vBlockIndex);
+            setFlushFilesToPrune.swap(setFilesToPrune);
+            fFlushIndexJournal = IsIndexJournalEnabled();
+            nFlushIndexJournalEnd = nIndexJournalNext;
+            hashFlushIndexBest = hashIndexBest;
+            flushStats.nPendingUsage = cacheSize;
+            // This only moves the cache contents into the pending batch of pcoinsFlushView
+            if (!pcoinsTip->Flush())
+                return state.Abort("Failed to write to coin database");
+            fFlushPending = true;
+            condFlush.notify_all();
+            if (mode == FLUSH_STATE_ALWAYS) {
+                while (fFlushPending)
+                    condFlush.wait(lock);
+            }
+        }
+        flushStats.histStall.Add(GetTimeMicros() - nStart);
+        lock.unlock();
         // Update best block in wallet (so we can detect restored wallets).
         if (mode != FLUSH_STATE_IF_NEEDED) {
             g_signals.SetBestChain(chainActive.GetLocator());
@@ -1858,25 +2406,141 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     return true;
 }
 
+void ThreadFlushState(CCoinsViewWriteBehind *pcoinsview)
+{
+    RenameThread("dynamiccoin-flush");
+
+    {
+        boost::unique_lock<boost::mutex> lock(cs_flush);
+        pcoinsview->SetDeferred(true);
+        pcoinsFlushView = pcoinsview;
+    }
+
+    try {
+        while (true) {
+            vector<pair<int, CBlockFileInfo> > vFileInfo;
+            vector<CDiskBlockIndex> vBlockIndex;
+            set<int> setFilesToPrune;
+            int nLastFile;
+            bool fIndexJournal;
+            uint32_t nIndexJournalEnd;
+            uint256 hashIndexJournalBase;
+            {
+                boost::unique_lock<boost::mutex> lock(cs_flush);
+                while (!fFlushPending)
+                    condFlush.wait(lock);
+                vFileInfo.swap(vFlushFileInfo);
+                vBlockIndex.swap(vFlushBlockIndex);
+                setFilesToPrune.swap(setFlushFilesToPrune);
+                nLastFile = nFlushLastBlockFile;
+                fIndexJournal = fFlushIndexJournal;
+                nIndexJournalEnd = nFlushIndexJournalEnd;
+                hashIndexJournalBase = hashFlushIndexBest;
+            }
+
+            int64_t nStart = GetTimeMicros();
+            bool fOk = false;
+            try {
+                fOk = WriteBlockIndexChanges(vFileInfo, nLastFile, vBlockIndex) && pcoinsview->Commit() &&
+                      (!fIndexJournal || pblocktree->ResetIndexJournal(nIndexJournalEnd, hashIndexJournalBase));
+            } catch (const std::runtime_error& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+            }
+            int64_t nTime = GetTimeMicros() - nStart;
+            LogPrint("coindb", "Committed chain state flush (%u block index entries) in %.2fms\n", vBlockIndex.size(), 0.001 * nTime);
+            if (fOk)
+                UnlinkPrunedFiles(setFilesToPrune);
+
+            {
+                boost::unique_lock<boost::mutex> lock(cs_flush);
+                flushStats.nFlushes++;
+                flushStats.histCommit.Add(nTime);
+                flushStats.nPendingUsage = 0;
+                fFlushPending = false;
+                condFlush.notify_all();
+            }
+            if (!fOk)
+                AbortNode("Failed to write the chain state to disk");
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Only interrupted while nothing is pending; later flushes write directly
+        boost::unique_lock<boost::mutex> lock(cs_flush);
+        pcoinsFlushView = NULL;
+        pcoinsview->SetDeferred(false);
+        throw;
+    }
+}
+
+void GetFlushStats(CFlushStats &stats)
+{
+    boost::unique_lock<boost::mutex> lock(cs_flush);
+    stats = flushStats;
+    stats.fPending = fFlushPending;
+}
+
 void FlushStateToDisk() {
     CValidationState state;
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+void PruneAndFlush() {
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        fCheckForPruning = true;
+    }
+    FlushStateToDisk(state, FLUSH_STATE_NONE);
+}
+
+//! Guards only the pointer to the published summary, and is held just long enough to copy it
+static CCriticalSection cs_chainTipSummary;
+static CChainTipSummaryRef chainTipSummary(new CChainTipSummary());
+
+CChainTipSummaryRef GetChainTipSummary()
+{
+    LOCK(cs_chainTipSummary);
+    return chainTipSummary;
+}
+
+/** Publish a new summary of chainActive's tip, after it was set. */
+void static UpdateTipSummary()
+{
+    CChainTipSummary* summary = new CChainTipSummary();
+    CBlockIndex* pindex = chainActive.Tip();
+    if (pindex) {
+        summary->pindex = pindex;
+        summary->hash = pindex->GetBlockHash();
+        summary->nHeight = pindex->nHeight;
+        summary->nTime = pindex->GetBlockTime();
+        summary->nTimeMax = chainActive.GetTimeMax(pindex->nHeight);
+        summary->nBits = pindex->nBits;
+        summary->nReward = pindex->nReward;
+        summary->nChainReward = pindex->nChainReward;
+        summary->nChainTx = pindex->nChainTx;
+        summary->nChainWork = pindex->nChainWork;
+        summary->dVerificationProgress = Checkpoints::GuessVerificationProgress(pindex);
+    }
+    CChainTipSummaryRef ref(summary);
+    LOCK(cs_chainTipSummary);
+    chainTipSummary.swap(ref);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     chainActive.SetTip(pindexNew);
+    UpdateTipSummary();
 
     // New best block
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-      Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+      Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
+    g_signals.UpdatedBlockTip(pindexNew);
 
     // Check the version of the last 100 blocks to see if we need to upgrade:
     static bool fWarned = false;
@@ -2033,15 +2697,23 @@ static CBlockIndex* FindMostWorkChain() {
         CBlockIndex *pindexTest = pindexNew;
         bool fInvalidAncestor = false;
         while (pindexTest && !chainActive.Contains(pindexTest)) {
-            assert(pindexTest->nStatus & BLOCK_HAVE_DATA);
             assert(pindexTest->nChainTx || pindexTest->nHeight == 0);
-            if (pindexTest->nStatus & BLOCK_FAILED_MASK) {
-                // Candidate has an invalid ancestor, remove entire chain from the set.
-                if (pindexBestInvalid == NULL || pindexNew->nChainWork > pindexBestInvalid->nChainWork)
+            // The data of blocks off the active chain may have been pruned; such
+            // a candidate cannot be switched to until the blocks are downloaded again.
+            bool fFailedChain = pindexTest->nStatus & BLOCK_FAILED_MASK;
+            bool fMissingData = !(pindexTest->nStatus & BLOCK_HAVE_DATA);
+            if (fFailedChain || fMissingData) {
+                // Candidate has an invalid ancestor or one without data, remove entire chain from the set.
+                if (fFailedChain && (pindexBestInvalid == NULL || pindexNew->nChainWork > pindexBestInvalid->nChainWork))
                     pindexBestInvalid = pindexNew;
                 CBlockIndex *pindexFailed = pindexNew;
                 while (pindexTest != pindexFailed) {
-                    pindexFailed->nStatus |= BLOCK_FAILED_CHILD;
+                    if (fFailedChain) {
+                        pindexFailed->nStatus |= BLOCK_FAILED_CHILD;
+                    } else {
+                        // Reconsider it once the missing block arrives again
+                        mapBlocksUnlinked.insert(std::make_pair(pindexFailed->pprev, pindexFailed));
+                    }
                     setBlockIndexCandidates.erase(pindexFailed);
                     pindexFailed = pindexFailed->pprev;
                 }
@@ -2056,23 +2728,131 @@ static CBlockIndex* FindMostWorkChain() {
     } while(true);
 }
 
-/** Delete all entries in setBlockIndexCandidates that are worse than the current tip. */
-static void PruneBlockIndexCandidates() {
-    // Note that we can't delete the current block itself, as we may need to return to it later in case a
-    // reorganization to a better block fails.
-    std::set<CBlockIndex*, CBlockIndexWorkComparator>::iterator it = setBlockIndexCandidates.begin();
-    while (it != setBlockIndexCandidates.end() && setBlockIndexCandidates.value_comp()(*it, chainActive.Tip())) {
-        setBlockIndexCandidates.erase(it++);
+/** Delete all entries in setBlockIndexCandidates that are worse than the current tip. */
+static void PruneBlockIndexCandidates() {
+    // Note that we can't delete the current block itself, as we may need to return to it later in case a
+    // reorganization to a better block fails.
+    std::set<CBlockIndex*, CBlockIndexWorkComparator>::iterator it = setBlockIndexCandidates.begin();
+    while (it != setBlockIndexCandidates.end() && setBlockIndexCandidates.value_comp()(*it, chainActive.Tip())) {
+        setBlockIndexCandidates.erase(it++);
+    }
+    // Either the current tip or a successor of it we're working towards is left in setBlockIndexCandidates.
+    assert(!setBlockIndexCandidates.empty());
+}
+
+/**
+ * Try to make some progress towards making pindexMostWork the active block.
+ * pblock is either NULL or a pointer to a CBlock corresponding to pindexMostWork.
+ */
+namespace {
+
+/**
+ * Reads stored blocks in a separate thread, in the order they are about to be
+ * connected, so that reading, deserializing and checking them overlaps with
+ * ConnectTip. At most MAX_BLOCKS_READ_AHEAD blocks are kept in memory.
+ */
+class CBlockReadAhead
+{
+private:
+    std::vector<std::pair<uint256, CDiskBlockPos> > vToRead;
+    boost::mutex cs;
+    boost::condition_variable cond;
+    //! blocks read after the ones handed out (NULL if it could not be read)
+    std::deque<boost::shared_ptr<CBlock> > queueRead;
+    //! index in vToRead of the next block to hand out
+    size_t nNext;
+    bool fStop;
+    boost::thread thread;
+
+    void ThreadRead()
+    {
+        for (size_t i = 0; i < vToRead.size(); i++) {
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop && queueRead.size() >= MAX_BLOCKS_READ_AHEAD)
+                    cond.wait(lock);
+                if (fStop)
+                    return;
+            }
+            boost::shared_ptr<CBlock> pblock(new CBlock());
+            if (!ReadBlockFromDisk(*pblock, vToRead[i].second) || pblock->GetHash() != vToRead[i].first)
+                pblock.reset();
+            boost::unique_lock<boost::mutex> lock(cs);
+            queueRead.push_back(pblock);
+            cond.notify_all();
+        }
+    }
+
+public:
+    /** Start reading the blocks at vToReadIn (hash and position, in connection order). */
+    CBlockReadAhead(const std::vector<std::pair<uint256, CDiskBlockPos> > &vToReadIn) : vToRead(vToReadIn), nNext(0), fStop(false)
+    {
+        thread = boost::thread(&CBlockReadAhead::ThreadRead, this);
+    }
+
+    ~CBlockReadAhead()
+    {
+        boost::this_thread::disable_interruption di;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+            cond.notify_all();
+        }
+        thread.join();
+    }
+
+    /** Whether the block with this hash is the next one to be handed out. */
+    bool IsNext(const uint256 &hash) const
+    {
+        return nNext < vToRead.size() && vToRead[nNext].first == hash;
+    }
+
+    /** Wait for the next block; NULL if it could not be read (ConnectTip then reports why). */
+    boost::shared_ptr<CBlock> Next()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (queueRead.empty())
+            cond.wait(lock);
+        boost::shared_ptr<CBlock> pblock = queueRead.front();
+        queueRead.pop_front();
+        nNext++;
+        cond.notify_all();
+        return pblock;
+    }
+};
+
+} // anon namespace
+
+/**
+ * Start reading ahead the stored blocks from the fork with the active chain towards
+ * pindexMostWork, if there are many of them and preadahead is not already doing so.
+ */
+static void StartBlockReadAhead(boost::scoped_ptr<CBlockReadAhead> &preadahead, CBlockIndex *pindexMostWork) {
+    AssertLockHeld(cs_main);
+    const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
+    int nForkHeight = pindexFork ? pindexFork->nHeight : -1;
+    if (pindexMostWork->nHeight - nForkHeight <= (int)MAX_BLOCKS_READ_AHEAD)
+        return;
+    CBlockIndex *pindexNext = pindexMostWork->GetAncestor(nForkHeight + 1);
+    if (preadahead && preadahead->IsNext(pindexNext->GetBlockHash()))
+        return;
+
+    std::vector<std::pair<uint256, CDiskBlockPos> > vToRead;
+    CBlockIndex *pindex = pindexMostWork->GetAncestor(std::min(nForkHeight + (int)BLOCK_READ_AHEAD_BATCH, pindexMostWork->nHeight));
+    for (; pindex != pindexFork; pindex = pindex->pprev) {
+        // Only read up to the first block without data
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            vToRead.clear();
+        else
+            vToRead.push_back(std::make_pair(pindex->GetBlockHash(), pindex->GetBlockPos()));
     }
-    // Either the current tip or a successor of it we're working towards is left in setBlockIndexCandidates.
-    assert(!setBlockIndexCandidates.empty());
+    std::reverse(vToRead.begin(), vToRead.end());
+    preadahead.reset();
+    if (vToRead.size() > MAX_BLOCKS_READ_AHEAD)
+        preadahead.reset(new CBlockReadAhead(vToRead));
 }
 
-/**
- * Try to make some progress towards making pindexMostWork the active block.
- * pblock is either NULL or a pointer to a CBlock corresponding to pindexMostWork.
- */
-static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMostWork, CBlock *pblock) {
+static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMostWork, CBlock *pblock, CBlockReadAhead *preadahead) {
     AssertLockHeld(cs_main);
     bool fInvalidFound = false;
     const CBlockIndex *pindexOldTip = chainActive.Tip();
@@ -2103,7 +2883,13 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
 
     // Connect new blocks.
     BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-        if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
+        CBlock *pblockConnect = pindexConnect == pindexMostWork ? pblock : NULL;
+        boost::shared_ptr<CBlock> pblockRead;
+        if (pblockConnect == NULL && preadahead != NULL && preadahead->IsNext(pindexConnect->GetBlockHash())) {
+            pblockRead = preadahead->Next();
+            pblockConnect = pblockRead.get();
+        }
+        if (!ConnectTip(state, pindexConnect, pblockConnect)) {
             if (state.IsInvalid()) {
                 // The block violates a consensus rule.
                 if (!state.CorruptionPossible())
@@ -2136,6 +2922,33 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     return true;
 }
 
+/**
+ * With -dbprofile=auto, tune the databases for initial block download or for a
+ * synced node as that changes. The databases are reopened for that; while they
+ * are in use by an iterator or a compaction, this is retried after the next block.
+ */
+void static UpdateDatabaseProfiles()
+{
+    if (!fDBProfileAuto || IsInitialBlockDownload() == fDBProfileIBD)
+        return;
+    bool fIBD = !fDBProfileIBD;
+    try {
+        // The block index database is always open; the coin database is not in some unit tests
+        if (!pblocktree->SetProfile(GetLevelDBProfile(fIBD, false)))
+            return;
+        if (pcoinsdbview && !pcoinsdbview->SetProfile(GetLevelDBProfile(fIBD, true)))
+            return;
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error while reopening the databases: ") + e.what());
+        return;
+    }
+    fDBProfileIBD = fIBD;
+    if (fIBD)
+        LogPrintf("%s: databases tuned for initial block download\n", __func__);
+    else
+        LogPrintf("%s: databases tuned for a synced node; the compactdb RPC compacts them\n", __func__);
+}
+
 /**
  * Make the best chain active, in multiple steps. The result is either failure
  * or an activated best chain. pblock is either NULL or a pointer to a block
@@ -2144,23 +2957,42 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
 bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
     CBlockIndex *pindexNewTip = NULL;
     CBlockIndex *pindexMostWork = NULL;
+    boost::scoped_ptr<CBlockReadAhead> preadahead;
     do {
         boost::this_thread::interruption_point();
 
         bool fInitialDownload;
+        // Hashes of the blocks that weren't previously in the best chain, newest first.
+        std::vector<uint256> vHashes;
         {
             LOCK(cs_main);
+            if (fLoadingUTXOSnapshot)
+                return true;
+            CBlockIndex *pindexOldTip = chainActive.Tip();
             pindexMostWork = FindMostWorkChain();
 
             // Whether we have anything to do at all.
             if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip())
                 return true;
 
-            if (!ActivateBestChainStep(state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL))
+            StartBlockReadAhead(preadahead, pindexMostWork);
+            if (!ActivateBestChainStep(state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL, preadahead.get()))
                 return false;
 
             pindexNewTip = chainActive.Tip();
             fInitialDownload = IsInitialBlockDownload();
+
+            const CBlockIndex *pindexFork = chainActive.FindFork(pindexOldTip);
+            CBlockIndex *pindexToAnnounce = pindexNewTip;
+            while (pindexToAnnounce != pindexFork) {
+                vHashes.push_back(pindexToAnnounce->GetBlockHash());
+                pindexToAnnounce = pindexToAnnounce->pprev;
+                if (vHashes.size() == MAX_BLOCKS_TO_ANNOUNCE) {
+                    // Limit announcements in case of a huge reorganization.
+                    // Rely on the peer's synchronization mechanism in that case.
+                    break;
+                }
+            }
         }
         // When we reach this point, we switched to a new tip (stored in pindexNewTip).
 
@@ -2168,18 +3000,24 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
         if (!fInitialDownload) {
             uint256 hashNewTip = pindexNewTip->GetBlockHash();
             // Relay inventory, but don't relay old inventory during initial block download.
+            // The actual announcement (headers or inv) is chosen per peer in SendMessages.
             int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
             {
                 LOCK(cs_vNodes);
-                BOOST_FOREACH(CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                BOOST_FOREACH(CNode* pnode, vNodes) {
+                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate)) {
+                        BOOST_REVERSE_FOREACH(const uint256& hash, vHashes) {
+                            pnode->PushBlockHash(hash);
+                        }
+                    }
+                }
             }
             // Notify external listeners about the new tip.
             uiInterface.NotifyBlockTip(hashNewTip);
         }
     } while(pindexMostWork != chainActive.Tip());
     CheckBlockIndex();
+    UpdateDatabaseProfiles();
 
     // Write changes periodically to disk, after relay.
     if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC)) {
@@ -2260,21 +3098,16 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
 {
     // Check for duplicate
     uint256 hash = block.GetHash();
-    uint256 pow  = block.GetPoW();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = mapBlockIndex.emplace(hash, CBlockIndex(block)).first->second;
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
-    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
-    pindexNew->pPowBlock = boost::make_shared<uint256>(pow);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
@@ -2296,6 +3129,17 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos)
 {
+    if (pindexNew->nStatus & BLOCK_ASSUMED_VALID) {
+        // A block below a loaded UTXO snapshot keeps its placeholder totals
+        // until background validation connects it
+        pindexNew->nFile = pos.nFile;
+        pindexNew->nDataPos = pos.nPos;
+        pindexNew->nUndoPos = 0;
+        pindexNew->nStatus |= BLOCK_HAVE_DATA;
+        setDirtyBlockIndex.insert(pindexNew);
+        return true;
+    }
+
     pindexNew->nTx = block.vtx.size();
     pindexNew->nChainTx = 0;
     pindexNew->nFile = pos.nFile;
@@ -2356,6 +3200,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
             if (vinfoBlockFile.size() <= nFile) {
                 vinfoBlockFile.resize(nFile + 1);
             }
+            if (fPruneMode)
+                fCheckForPruning = true;
         }
         pos.nFile = nFile;
         pos.nPos = vinfoBlockFile[nFile].nSize;
@@ -2379,6 +3225,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
                     AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
                     fclose(file);
                 }
+                if (fPruneMode)
+                    fCheckForPruning = true;
             }
             else
                 return state.Error("out of disk space");
@@ -2410,6 +3258,8 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
                 AllocateFileRange(file, pos.nPos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
                 fclose(file);
             }
+            if (fPruneMode)
+                fCheckForPruning = true;
         }
         else
             return state.Error("out of disk space");
@@ -2728,7 +3578,7 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDis
 
     {
         LOCK(cs_main);
-        MarkBlockAsReceived(pblock->GetHash());
+        MarkBlockAsReceived(pblock->GetHash(), pfrom ? pfrom->GetId() : -1, ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
         if (!checked) {
             return error("%s : CheckBlock FAILED", __func__);
         }
@@ -2849,13 +3699,43 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
-    mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
+    return mapBlockIndex.emplace(hash, CBlockIndex()).first->second;
+}
 
-    return pindexNew;
+/** Compute the chain totals of a loaded block index entry, once its ancestors have them. */
+void static LoadBlockIndexEntry(CBlockIndex* pindex)
+{
+    // Entries written by older versions lack the chain work; it is stored at the next flush
+    // (placeholders for a missing predecessor have no record to rewrite)
+    if (pindex->nChainWork == 0) {
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        if (pindex->nStatus & BLOCK_VALID_MASK)
+            setDirtyBlockIndex.insert(pindex);
+    }
+
+    // nTx stays set when the block data is pruned
+    if (pindex->nTx > 0 || (pindex->nStatus & BLOCK_ASSUMED_VALID)) {
+        if (pindex->pprev) {
+            if (pindex->pprev->nChainTx) {
+                pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+            } else {
+                pindex->nChainTx = 0;
+                mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
+            }
+            pindex->nChainReward = pindex->pprev->nChainReward + pindex->nReward;
+        } else {
+            pindex->nChainTx = pindex->nTx;
+            pindex->nChainReward = pindex->nReward;
+        }
+    }
+    if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
+        setBlockIndexCandidates.insert(pindex);
+    if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
+        pindexBestInvalid = pindex;
+    if (pindex->pprev)
+        pindex->BuildSkip();
+    if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
+        pindexBestHeader = pindex;
 }
 
 bool static LoadBlockIndexDB()
@@ -2863,45 +3743,38 @@ bool static LoadBlockIndexDB()
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
 
+    // The entries were added in the order of their hashes; lay them out by height
+    int64_t nStart = GetTimeMillis();
+    mapBlockIndex.SortByHeight();
+    LogPrintf("%s: sorted %u block index entries by height in %dms, using %.1fMiB\n", __func__,
+        mapBlockIndex.size(), GetTimeMillis() - nStart, mapBlockIndex.DynamicMemoryUsage() * (1.0 / (1 << 20)));
+
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork, nChainTx, nChainReward
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+    // Check whether the blocks below a loaded UTXO snapshot still need validation
+    if (pblocktree->ReadUTXOSnapshot(snapshotHeader)) {
+        BlockMap::iterator mi = mapBlockIndex.find(snapshotHeader.hashBlock);
+        if (mi == mapBlockIndex.end())
+            return error("LoadBlockIndexDB() : UTXO snapshot block %s not found", snapshotHeader.hashBlock.ToString());
+        pindexSnapshotBase = mi->second;
+        nSnapshotMissingHeight = 0;
+        LogPrintf("LoadBlockIndexDB(): blocks below the UTXO snapshot at height %d are not validated yet\n", pindexSnapshotBase->nHeight);
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
 
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
-            if (pindex->pprev) {
-                if (pindex->pprev->nChainTx) {
-                    pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
-                } else {
-                    pindex->nChainTx = 0;
-                    mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
-                }
-                pindex->nChainReward = pindex->pprev->nChainReward + pindex->nReward;
-            } else {
-                pindex->nChainTx = pindex->nTx;
-                pindex->nChainReward = pindex->nReward;
-            }
+    // Calculate nChainWork, nChainTx, nChainReward. With the entries in order of
+    // height, the predecessors of an entry are done before it. The totals of an
+    // unvalidated snapshot block come from the snapshot header, as its
+    // predecessors only have placeholders.
+    nStart = GetTimeMillis();
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex) {
+        CBlockIndex *pindex = item.second;
+        LoadBlockIndexEntry(pindex);
+        if (pindex == pindexSnapshotBase && (pindex->nStatus & BLOCK_ASSUMED_VALID)) {
+            pindex->nChainTx = snapshotHeader.nChainTx;
+            pindex->nChainReward = snapshotHeader.nChainReward;
         }
-        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
-            setBlockIndexCandidates.insert(pindex);
-        if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
-            pindexBestInvalid = pindex;
-        if (pindex->pprev)
-            pindex->BuildSkip();
-        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
-            pindexBestHeader = pindex;
     }
+    LogPrintf("%s: computed the chain totals of %u block index entries in %dms\n", __func__, mapBlockIndex.size(), GetTimeMillis() - nStart);
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -2938,6 +3811,11 @@ bool static LoadBlockIndexDB()
         }
     }
 
+    // Check whether we have ever pruned block & undo files
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -2947,11 +3825,18 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have the address and spent indexes
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("LoadBlockIndexDB(): address index %s\n", fAddressIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    LogPrintf("LoadBlockIndexDB(): spent index %s\n", fSpentIndex ? "enabled" : "disabled");
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    UpdateTipSummary();
 
     PruneBlockIndexCandidates();
 
@@ -2997,6 +3882,14 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        // Blocks below a loaded UTXO snapshot have no undo data (and maybe no block data)
+        if (pindex->nStatus & BLOCK_ASSUMED_VALID)
+            break;
+        // Nor can pruned blocks be checked
+        if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -3014,7 +3907,7 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage() <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3051,12 +3944,394 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
     return true;
 }
 
+/** Resolve a snapshot file name relative to the data directory. */
+static boost::filesystem::path GetSnapshotPath(const std::string &strPath)
+{
+    boost::filesystem::path path(strPath);
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    return path;
+}
+
+/** Write the buffered part of a snapshot to the file and the running checksum. */
+static void WriteSnapshotData(CAutoFile &fileout, CHashWriter &hasher, CDataStream &ss)
+{
+    if (ss.empty())
+        return;
+    fileout.write(&ss[0], ss.size());
+    hasher.write(&ss[0], ss.size());
+    ss.clear();
+}
+
+bool DumpUTXOSnapshot(const std::string &strPath, CUTXOSnapshotHeader &header, std::string &strError)
+{
+    boost::filesystem::path path = GetSnapshotPath(strPath);
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".incomplete";
+    if (boost::filesystem::exists(path)) {
+        strError = strprintf("%s already exists", path.string());
+        return false;
+    }
+
+    // Take a consistent view of the coin database at the current tip; the
+    // records are then streamed out without holding cs_main.
+    boost::scoped_ptr<CCoinsViewCursor> pcursor;
+    {
+        LOCK(cs_main);
+        if (pindexSnapshotBase != NULL || fLoadingUTXOSnapshot) {
+            strError = "The blocks below the loaded UTXO snapshot are still being validated";
+            return false;
+        }
+        FlushStateToDisk();
+        CCoinsStats stats;
+        if (!pcoinsTip->GetStats(stats)) {
+            strError = "UTXO set statistics are still being computed";
+            return false;
+        }
+        pcursor.reset(pcoinsTip->Cursor());
+        CBlockIndex *pindex = chainActive.Tip();
+        if (!pcursor || pindex == NULL || pcursor->GetBestBlock() != pindex->GetBlockHash() || stats.hashBlock != pindex->GetBlockHash()) {
+            strError = "Unable to read the coin database";
+            return false;
+        }
+        header = CUTXOSnapshotHeader();
+        header.hashBlock = pindex->GetBlockHash();
+        header.nHeight = pindex->nHeight;
+        header.nChainTx = pindex->nChainTx;
+        header.nReward = pindex->nReward;
+        header.nChainReward = pindex->nChainReward;
+        header.nTransactions = stats.nTransactions;
+        header.hashMuHash = stats.hashMuHash;
+    }
+
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = strprintf("Unable to open %s for writing", pathTmp.string());
+        return false;
+    }
+    uint64_t nWritten = 0;
+    try {
+        CHashWriter hasher(SER_GETHASH, 0);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << header;
+        // The cursor returns the outputs of a transaction next to each other;
+        // they are put together into one record per transaction.
+        uint256 txid;
+        CCoins coins;
+        for (; pcursor->Valid(); pcursor->Next()) {
+            COutPoint key;
+            Coin coin;
+            pcursor->GetKey(key);
+            pcursor->GetValue(coin);
+            if (!coins.vout.empty() && key.hash != txid) {
+                ss << txid << coins;
+                nWritten++;
+                coins.Clear();
+                if (ss.size() >= (1 << 20))
+                    WriteSnapshotData(fileout, hasher, ss);
+            }
+            txid = key.hash;
+            if (coins.vout.size() <= key.n)
+                coins.vout.resize(key.n + 1);
+            coins.vout[key.n] = coin.out;
+            coins.fCoinBase = coin.fCoinBase;
+            coins.nHeight = coin.nHeight;
+            coins.nVersion = coin.nVersion;
+        }
+        if (!coins.vout.empty()) {
+            ss << txid << coins;
+            nWritten++;
+        }
+        WriteSnapshotData(fileout, hasher, ss);
+        fileout << hasher.GetHash();
+        FileCommit(fileout.Get());
+        fileout.fclose();
+    } catch (const std::exception &e) {
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
+        strError = strprintf("Error writing the snapshot: %s", e.what());
+        return false;
+    }
+    if (nWritten != header.nTransactions) {
+        boost::filesystem::remove(pathTmp);
+        strError = strprintf("Coin database holds %u transactions, statistics say %u", nWritten, header.nTransactions);
+        return false;
+    }
+    if (!RenameOver(pathTmp, path)) {
+        strError = strprintf("Unable to rename %s", pathTmp.string());
+        return false;
+    }
+    LogPrintf("Wrote UTXO snapshot of %u transactions at height %d to %s\n", nWritten, header.nHeight, path.string());
+    return true;
+}
+
+bool LoadUTXOSnapshot(const std::string &strPath, CUTXOSnapshotHeader &header, std::string &strError)
+{
+    boost::filesystem::path path = GetSnapshotPath(strPath);
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf("Unable to open %s", path.string());
+        return false;
+    }
+
+    // Check the checksum over the whole file before anything is touched
+    try {
+        uint64_t nSize = boost::filesystem::file_size(path);
+        if (nSize < sizeof(uint256))
+            throw std::ios_base::failure("file too short");
+        uint64_t nRemaining = nSize - sizeof(uint256);
+        CHashWriter hasher(SER_GETHASH, 0);
+        std::vector<char> vBuf(1 << 20);
+        while (nRemaining > 0) {
+            size_t nChunk = std::min<uint64_t>(nRemaining, vBuf.size());
+            filein.read(&vBuf[0], nChunk);
+            hasher.write(&vBuf[0], nChunk);
+            nRemaining -= nChunk;
+        }
+        uint256 hashFile;
+        filein >> hashFile;
+        if (hashFile != hasher.GetHash())
+            throw std::ios_base::failure("checksum mismatch");
+        if (fseek(filein.Get(), 0, SEEK_SET))
+            throw std::ios_base::failure("fseek failed");
+        filein >> header;
+    } catch (const std::exception &e) {
+        strError = strprintf("%s is not a valid UTXO snapshot: %s", path.string(), e.what());
+        return false;
+    }
+    if (header.nVersion != CUTXOSnapshotHeader::CURRENT_VERSION) {
+        strError = strprintf("Unsupported UTXO snapshot version %d", header.nVersion);
+        return false;
+    }
+
+    CBlockIndex *pindexBase;
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() != 0 || pindexSnapshotBase != NULL || fLoadingUTXOSnapshot) {
+            strError = "A UTXO snapshot can only be loaded before any block after the genesis block is connected";
+            return false;
+        }
+        if (fAddressIndex || fSpentIndex) {
+            strError = "A UTXO snapshot cannot be loaded with -addressindex or -spentindex, which need every block to be connected";
+            return false;
+        }
+        BlockMap::iterator mi = mapBlockIndex.find(header.hashBlock);
+        if (mi == mapBlockIndex.end() || !mi->second->IsValid(BLOCK_VALID_TREE)) {
+            strError = strprintf("The header of snapshot block %s is not known yet; wait for the headers to synchronize", header.hashBlock.ToString());
+            return false;
+        }
+        pindexBase = mi->second;
+        if (pindexBase->nHeight != header.nHeight || header.nHeight < 1 || header.nChainTx <= (uint64_t)header.nHeight) {
+            strError = "The UTXO snapshot header does not match the block chain";
+            return false;
+        }
+        CCoinsStats stats;
+        if (!pcoinsTip->GetStats(stats)) {
+            strError = "UTXO set statistics are still being computed";
+            return false;
+        }
+        fLoadingUTXOSnapshot = true;
+    }
+
+    // The coins go into a cache of their own, straight on top of the coin
+    // database, without cs_main: the tip cache has nothing of them, and no
+    // block is connected meanwhile. Flushing it leaves the best block alone.
+    // From here on a failure leaves a partially written chain state behind.
+    LogPrintf("Loading UTXO snapshot of %u transactions at height %d...\n", header.nTransactions, header.nHeight);
+    int64_t nStart = GetTimeMillis();
+    try {
+        CCoinsViewCache view(pcoinsdbview);
+        for (uint64_t i = 0; i < header.nTransactions; i++) {
+            uint256 txid;
+            CCoins coins;
+            filein >> txid >> coins;
+            // The snapshot is loaded into an empty coin database, so its outputs are FRESH
+            for (unsigned int n = 0; n < coins.vout.size(); n++)
+                if (coins.IsAvailable(n))
+                    view.AddCoin(COutPoint(txid, n), Coin(coins.vout[n], coins.nHeight, coins.fCoinBase, coins.nVersion), false);
+            if (view.DynamicMemoryUsage() > nCoinCacheUsage && !view.Flush())
+                throw std::runtime_error("writing the coin database failed");
+        }
+        if (!view.Flush())
+            throw std::runtime_error("writing the coin database failed");
+    } catch (const std::exception &e) {
+        {
+            LOCK(cs_main);
+            fLoadingUTXOSnapshot = false;
+        }
+        return AbortNode(strprintf("Error loading the UTXO snapshot: %s", e.what()), _("Error loading the UTXO snapshot; restart with -reindex"));
+    }
+
+    {
+        LOCK(cs_main);
+        fLoadingUTXOSnapshot = false;
+        pcoinsTip->SetBestBlock(header.hashBlock);
+        CValidationState state;
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+            return AbortNode("Failed to write the UTXO snapshot to the coin database");
+        CCoinsStats stats;
+        if (!pcoinsTip->GetStats(stats) || stats.nTransactions != header.nTransactions || stats.hashMuHash != header.hashMuHash)
+            return AbortNode("The loaded UTXO set does not match the snapshot header", _("Error loading the UTXO snapshot; restart with -reindex"));
+
+        // Give the blocks below the snapshot placeholder entries. Their nTx
+        // and nReward are unknown (BLOCK_ASSUMED_VALID says so); nTx is 1 so
+        // that they count as processed. The chain totals of the snapshot block
+        // come from the header, so the blocks above it get the same totals as
+        // in a fully synced node. Background validation overwrites all of
+        // them as it connects the real blocks.
+        vector<CBlockIndex*> vHistory;
+        for (CBlockIndex *pindex = pindexBase; pindex->pprev != NULL; pindex = pindex->pprev)
+            vHistory.push_back(pindex);
+        for (vector<CBlockIndex*>::reverse_iterator it = vHistory.rbegin(); it != vHistory.rend(); it++) {
+            CBlockIndex *pindex = *it;
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                pindex->nTx = 1;
+            pindex->nReward = 0;
+            if (pindex == pindexBase) {
+                pindex->nChainTx = header.nChainTx;
+                pindex->nChainReward = header.nChainReward;
+            } else {
+                pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+                pindex->nChainReward = pindex->pprev->nChainReward + pindex->nReward;
+            }
+            pindex->nStatus |= BLOCK_ASSUMED_VALID;
+            pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+            setDirtyBlockIndex.insert(pindex);
+        }
+        pindexBase->nReward = header.nReward;
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindexBase->nSequenceId = nBlockSequenceId++;
+        }
+
+        pindexSnapshotBase = pindexBase;
+        snapshotHeader = header;
+        nSnapshotMissingHeight = 0;
+        if (!pblocktree->WriteUTXOSnapshot(header))
+            return AbortNode("Failed to write the UTXO snapshot record to the block index");
+
+        mempool.clear();
+        chainActive.SetTip(pindexBase);
+        UpdateTipSummary();
+        setBlockIndexCandidates.insert(pindexBase);
+        PruneBlockIndexCandidates();
+        FlushStateToDisk();
+        LogPrintf("Loaded UTXO snapshot at height %d in %dms\n", header.nHeight, GetTimeMillis() - nStart);
+        cvBlockChange.notify_all();
+    }
+    uiInterface.NotifyBlockTip(header.hashBlock);
+
+    // Connect whatever is known beyond the snapshot
+    CValidationState state;
+    ActivateBestChain(state);
+    return true;
+}
+
+bool GetPendingUTXOSnapshot(CUTXOSnapshotHeader &header)
+{
+    LOCK(cs_main);
+    if (pindexSnapshotBase == NULL)
+        return false;
+    header = snapshotHeader;
+    return true;
+}
+
+void ThreadValidateUTXOSnapshot()
+{
+    RenameThread("dynamiccoin-snapshotcheck");
+
+    CBlockIndex *pindexBase = NULL;
+    CUTXOSnapshotHeader header;
+    while (true) {
+        {
+            LOCK(cs_main);
+            // Once the chain has moved past genesis without one, no snapshot can be loaded anymore
+            if (pindexSnapshotBase == NULL && chainActive.Height() > 0)
+                return;
+            if (pindexSnapshotBase != NULL && HaveSnapshotHistory()) {
+                pindexBase = pindexSnapshotBase;
+                header = snapshotHeader;
+                break;
+            }
+        }
+        MilliSleep(5000);
+    }
+
+    LogPrintf("Validating the %d blocks below the UTXO snapshot...\n", header.nHeight);
+    int64_t nStart = GetTimeMillis();
+    const std::string strCheckDir = "chainstate_snapshotcheck";
+    CCoinsStats stats;
+    {
+        CCoinsViewDB viewdb(1 << 23, false, true, strCheckDir);
+        CCoinsViewCache view(&viewdb);
+        for (int nHeight = 0; nHeight <= header.nHeight; nHeight++) {
+            boost::this_thread::interruption_point();
+            CBlockIndex *pindex = pindexBase->GetAncestor(nHeight);
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex)) {
+                AbortNode(strprintf("Failed to read block %s below the UTXO snapshot", pindex->GetBlockHash().ToString()));
+                return;
+            }
+            {
+                LOCK(cs_main);
+                CValidationState state;
+                if (!ConnectBlock(block, state, pindex, view, true)) {
+                    AbortNode(strprintf("Block %s below the UTXO snapshot is invalid: %s", pindex->GetBlockHash().ToString(), state.GetRejectReason()),
+                              _("The loaded UTXO snapshot is not part of a valid chain; restart with -reindex"));
+                    return;
+                }
+                // ConnectBlock filled in the real nReward and nChainReward;
+                // replace the placeholder transaction count as well
+                pindex->nTx = block.vtx.size();
+                pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+                if (pindex == pindexBase && (pindex->nChainTx != header.nChainTx || pindex->nReward != header.nReward || pindex->nChainReward != header.nChainReward)) {
+                    AbortNode(strprintf("The chain totals at height %d do not match the loaded snapshot", header.nHeight),
+                              _("The loaded UTXO snapshot is invalid; restart with -reindex"));
+                    return;
+                }
+                pindex->nStatus &= ~BLOCK_ASSUMED_VALID;
+                setDirtyBlockIndex.insert(pindex);
+                std::vector<std::pair<uint32_t, CRewardLedgerEntry> > vRewardLedger(1, std::make_pair((uint32_t)nHeight, pDmcSystem->GetRewardLedgerEntry(pindex)));
+                if (!pblocktree->WriteRewardLedger(vRewardLedger)) {
+                    AbortNode("Failed to write reward ledger");
+                    return;
+                }
+            }
+            view.SetBestBlock(pindex->GetBlockHash());
+            if (view.DynamicMemoryUsage() > nCoinCacheUsage)
+                view.Flush();
+        }
+        view.Flush();
+        viewdb.GetStats(stats);
+    }
+    boost::filesystem::remove_all(GetDataDir() / strCheckDir);
+
+    if (stats.nTransactions != header.nTransactions || stats.hashMuHash != header.hashMuHash) {
+        AbortNode(strprintf("The UTXO set at height %d does not match the loaded snapshot", header.nHeight),
+                  _("The loaded UTXO snapshot is invalid; restart with -reindex"));
+        return;
+    }
+
+    {
+        LOCK(cs_main);
+        pblocktree->EraseUTXOSnapshot();
+        pindexSnapshotBase = NULL;
+        FlushStateToDisk();
+    }
+    LogPrintf("Blocks below the UTXO snapshot validated in %dms; the snapshot matches the chain\n", GetTimeMillis() - nStart);
+}
+
 void UnloadBlockIndex()
 {
+    chainActive.SetTip(NULL);
+    UpdateTipSummary();
     mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
-    chainActive.SetTip(NULL);
+    mapBlocksUnlinked.clear();
+    setDirtyBlockIndex.clear();
+    pindexBestHeader = NULL;
     pindexBestInvalid = NULL;
+    pindexSnapshotBase = NULL;
 }
 
 bool LoadBlockIndex()
@@ -3077,10 +4352,14 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", false);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fAddressIndex = GetBoolArg("-addressindex", false);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fSpentIndex = GetBoolArg("-spentindex", false);
+    pblocktree->WriteFlag("spentindex", fSpentIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
-    if (!fReindex) {
+    if (!fReindex && !fReindexChainState) {
         try {
             CBlock &block = const_cast<CBlock&>(Params().GenesisBlock());
             // Start new block file
@@ -3106,6 +4385,37 @@ bool InitBlockIndex() {
     return true;
 }
 
+bool UpdateRewardLedger()
+{
+    LOCK(cs_main);
+    // Walk back from the tip to the last block that has its record (blocks
+    // below a UTXO snapshot get theirs when they are validated)
+    CBlockIndex *pindexFirst = NULL;
+    CRewardLedgerEntry entry;
+    for (CBlockIndex *pindex = chainActive.Tip(); pindex != NULL; pindex = pindex->pprev) {
+        if ((pindex->nStatus & BLOCK_ASSUMED_VALID) || pblocktree->ReadRewardLedger(pindex->nHeight, entry))
+            break;
+        pindexFirst = pindex;
+    }
+    if (pindexFirst == NULL)
+        return true;
+
+    // Oldest first and in bounded batches, so that a whole chain is not held
+    // in memory, and an interrupted backfill resumes where it stopped
+    LogPrintf("Adding %d blocks to the reward ledger...\n", chainActive.Height() - pindexFirst->nHeight + 1);
+    std::vector<std::pair<uint32_t, CRewardLedgerEntry> > vRewardLedger;
+    vRewardLedger.reserve(REWARD_LEDGER_BATCH_SIZE);
+    for (CBlockIndex *pindex = pindexFirst; pindex != NULL; pindex = chainActive.Next(pindex)) {
+        vRewardLedger.push_back(std::make_pair((uint32_t)pindex->nHeight, pDmcSystem->GetRewardLedgerEntry(pindex)));
+        if (vRewardLedger.size() == REWARD_LEDGER_BATCH_SIZE || pindex == chainActive.Tip()) {
+            if (!pblocktree->WriteRewardLedger(vRewardLedger))
+                return false;
+            vRewardLedger.clear();
+        }
+    }
+    return true;
+}
+
 
 #ifdef ENABLE_EXTERNAL_BLOCKFILE_LOADING
 
@@ -3222,10 +4532,11 @@ void static CheckBlockIndex()
     LOCK(cs_main);
 
     // During a reindex, we read the genesis block and call CheckBlockIndex before ActivateBestChain,
-    // so we have the genesis block in mapBlockIndex but no active chain.  (A few of the tests when
+    // so we have the genesis block in mapBlockIndex but no active chain; a chain state reindex
+    // starts with the whole block tree but no active chain.  (A few of the tests when
     // iterating the block tree require that chainActive has been initialized.)
     if (chainActive.Height() < 0) {
-        assert(mapBlockIndex.size() <= 1);
+        assert(mapBlockIndex.size() <= 1 || fReindexChainState);
         return;
     }
 
@@ -3248,14 +4559,16 @@ void static CheckBlockIndex()
     size_t nNodes = 0;
     int nHeight = 0;
     CBlockIndex* pindexFirstInvalid = NULL; // Oldest ancestor of pindex which is invalid.
-    CBlockIndex* pindexFirstMissing = NULL; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstMissing = NULL; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA (placeholders below a UTXO snapshot aside).
+    CBlockIndex* pindexFirstNeverProcessed = NULL; // Oldest ancestor of pindex for which nTx == 0.
     CBlockIndex* pindexFirstNotTreeValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
     while (pindex != NULL) {
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
-        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA) && !(pindex->nStatus & BLOCK_ASSUMED_VALID)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
@@ -3266,12 +4579,21 @@ void static CheckBlockIndex()
             assert(pindex->GetBlockHash() == Params().HashGenesisBlock()); // Genesis block's hash must match.
             assert(pindex == chainActive.Genesis()); // The current active chain's genesis block must be this block.
         }
-        // HAVE_DATA is equivalent to VALID_TRANSACTIONS and equivalent to nTx > 0 (we stored the number of transactions in the block)
-        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+        if (!fHavePruned) {
+            // HAVE_DATA is equivalent to nTx > 0 (we stored the number of transactions in the block),
+            // except for the placeholders below a UTXO snapshot, which count as processed without data
+            if (!(pindex->nStatus & BLOCK_ASSUMED_VALID))
+                assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+        } else {
+            // Pruned blocks keep nTx, so only HAVE_DATA implies nTx > 0
+            if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
+        }
+        // VALID_TRANSACTIONS is equivalent to nTx > 0 (whether or not the data was pruned since)
         assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
-        // All parents having data is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstMissing != NULL) == (pindex->nChainTx == 0)); // nChainTx == 0 is used to signal that all parent block's transaction data is available.
+        // All parents having been processed is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx == 0 is used to signal that all parent block's transaction data was received.
         assert(pindex->nHeight == nHeight); // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
@@ -3283,8 +4605,9 @@ void static CheckBlockIndex()
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstMissing == NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block sorts at least as good as the current tip and is valid, it must be in setBlockIndexCandidates.
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
+            // If this block sorts at least as good as the current tip, is valid and all its data is available (or it is the tip), it must be in setBlockIndexCandidates.
+            if (pindexFirstInvalid == NULL && (pindexFirstMissing == NULL || pindex == chainActive.Tip())) {
                  assert(setBlockIndexCandidates.count(pindex));
             }
         } else { // If this block sorts worse than the current tip, it cannot be in setBlockIndexCandidates.
@@ -3301,13 +4624,14 @@ void static CheckBlockIndex()
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstMissing != NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block has block data available, some parent doesn't, and has no invalid parents, it must be in mapBlocksUnlinked.
-                assert(foundInUnlinked);
-            }
-        } else { // If this block does not have block data available, or all parents do, it cannot be in mapBlocksUnlinked.
-            assert(!foundInUnlinked);
+        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
+            // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
+            assert(foundInUnlinked);
         }
+        // If this block does not have block data available, or all parents do, it cannot be in mapBlocksUnlinked.
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || pindexFirstMissing == NULL) assert(!foundInUnlinked);
+        // Having data for a block, and for all its parents at some point, but not for some parent now, means that parent was pruned.
+        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) assert(fHavePruned);
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
         // End: actual consistency checks.
 
@@ -3326,6 +4650,7 @@ void static CheckBlockIndex()
             // If pindex was the first with a certain property, unset the corresponding variable.
             if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
             if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+            if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
             if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
@@ -3434,8 +4759,11 @@ bool static AlreadyHave(const CInv& inv)
         {
             bool txInMap = false;
             txInMap = mempool.exists(inv.hash);
+            // Only the cache is checked for the outputs of confirmed
+            // transactions, as looking them up in the database is expensive.
             return txInMap || mapOrphanTransactions.count(inv.hash) ||
-                pcoinsTip->HaveCoins(inv.hash);
+                pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+                pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
@@ -3482,6 +4810,12 @@ void static ProcessGetData(CNode* pfrom)
                         }
                     }
                 }
+                // The block data may have been pruned
+                if (send && !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                    LogPrint("net", "ProcessGetData(): block %s requested by peer=%i is not available\n", inv.hash.ToString(), pfrom->GetId());
+                    vNotFound.push_back(inv);
+                    send = false;
+                }
                 if (send)
                 {
                     // Send block from disk
@@ -3505,7 +4839,7 @@ void static ProcessGetData(CNode* pfrom)
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                if (!pfrom->filterInventoryKnown.contains(pair.second))
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
                         }
                         // else
@@ -3718,6 +5052,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     {
         pfrom->SetRecvVersion(min(pfrom->nVersion, PROTOCOL_VERSION));
 
+        if (pfrom->nVersion >= SENDHEADERS_VERSION) {
+            // Tell our peer we prefer to receive headers rather than inv's.
+            // We send this to non-NODE_NETWORK peers as well, because even
+            // those can announce blocks.
+            pfrom->PushMessage("sendheaders");
+        }
+
         // Mark this node as currently connected, so we update its timestamp later.
         if (pfrom->fNetworkNode) {
             LOCK(cs_main);
@@ -3758,7 +5099,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 {
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
-                    // at a time so the setAddrKnowns of the chosen nodes prevent repeats
+                    // at a time so the addrKnowns of the chosen nodes prevent repeats
                     static uint256 hashSalt;
                     if (hashSalt == 0)
                         hashSalt = GetRandHash();
@@ -3793,6 +5134,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "sendheaders")
+    {
+        LOCK(cs_main);
+        State(pfrom->GetId())->fPreferHeaders = true;
+    }
+
+
     else if (strCommand == "inv")
     {
         vector<CInv> vInv;
@@ -3833,8 +5181,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     // not a direct successor.
                     pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
-                    if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    if (CanDirectFetch() && nodestate->nBlocksInFlight < nodestate->nBlocksInFlightLimit) {
                         vToFetch.push_back(inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
@@ -3902,6 +5249,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 LogPrint("net", "  getblocks stopping at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
                 break;
             }
+            // Don't announce blocks we could not serve
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            {
+                LogPrint("net", "  getblocks stopping at pruned block %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+                break;
+            }
             pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
             if (--nLimit <= 0)
             {
@@ -3923,6 +5276,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         LOCK(cs_main);
 
+        CNodeState *nodestate = State(pfrom->GetId());
         CBlockIndex* pindex = NULL;
         if (locator.IsNull())
         {
@@ -3950,6 +5304,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
+        // pindex can be NULL either if we sent chainActive.Tip() OR
+        // if our peer has chainActive.Tip() (and thus we are sending an empty
+        // headers message). In both cases it's safe to update
+        // pindexBestHeaderSent to be our tip.
+        nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
         pfrom->PushMessage("headers", vHeaders);
     }
 
@@ -4113,6 +5472,50 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256(0));
         }
 
+        CNodeState *nodestate = State(pfrom->GetId());
+        // If this set of headers is valid and ends in a block with at least as
+        // much work as our tip, download as much as possible. This lets blocks
+        // announced through headers be fetched without an extra round-trip.
+        if (CanDirectFetch() && pindexLast->IsValid(BLOCK_VALID_TREE) && chainActive.Tip()->nChainWork <= pindexLast->nChainWork) {
+            vector<CBlockIndex *> vToFetch;
+            CBlockIndex *pindexWalk = pindexLast;
+            // Calculate all the blocks we'd need to switch to pindexLast, up to a limit.
+            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= (unsigned int)nodestate->nBlocksInFlightLimit) {
+                if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) &&
+                        !mapBlocksInFlight.count(pindexWalk->GetBlockHash())) {
+                    // We don't have this block, and it's not yet in flight.
+                    vToFetch.push_back(pindexWalk);
+                }
+                pindexWalk = pindexWalk->pprev;
+            }
+            // If pindexWalk still isn't on our main chain, we're looking at a
+            // very large reorg at a time we think we're close to caught up to
+            // the main chain. Bail out on the direct fetch and rely on parallel
+            // download instead.
+            if (!chainActive.Contains(pindexWalk)) {
+                LogPrint("net", "Large reorg, won't direct fetch to %s (%d)\n",
+                        pindexLast->GetBlockHash().ToString(), pindexLast->nHeight);
+            } else {
+                vector<CInv> vGetData;
+                // Download as much as possible, from earliest to latest.
+                BOOST_REVERSE_FOREACH(CBlockIndex *pindex, vToFetch) {
+                    if (nodestate->nBlocksInFlight >= nodestate->nBlocksInFlightLimit) {
+                        // Can't download any more from this peer
+                        break;
+                    }
+                    vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                    MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), pindex);
+                    LogPrint("net", "Requesting block %s from peer=%d\n", pindex->GetBlockHash().ToString(), pfrom->id);
+                }
+                if (vGetData.size() > 1) {
+                    LogPrint("net", "Downloading blocks toward %s (%d) via headers direct fetch\n",
+                            pindexLast->GetBlockHash().ToString(), pindexLast->nHeight);
+                }
+                if (!vGetData.empty())
+                    pfrom->PushMessage("getdata", vGetData);
+            }
+        }
+
         CheckBlockIndex();
     }
 
@@ -4449,6 +5852,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nProcessStart = GetTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
@@ -4481,6 +5885,8 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        pfrom->RecordMessageProcessed(strCommand, nMessageSize + CMessageHeader::HEADER_SIZE, GetTimeMicros() - nProcessStart);
+
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
 
@@ -4542,9 +5948,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LOCK(cs_vNodes);
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
-                // Periodically clear setAddrKnown to allow refresh broadcasts
+                // Periodically clear addrKnown to allow refresh broadcasts
                 if (nLastRebroadcast)
-                    pnode->setAddrKnown.clear();
+                    pnode->addrKnown.reset();
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -4562,9 +5968,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second)
+                if (!pto->addrKnown.contains(addr.GetKey()))
                 {
+                    pto->addrKnown.insert(addr.GetKey());
                     vAddr.push_back(addr);
                     // receiver rejects addr messages larger than 1000
                     if (vAddr.size() >= 1000)
@@ -4622,6 +6028,102 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             g_signals.Broadcast();
         }
 
+        //
+        // Try sending block announcements via headers
+        //
+        {
+            // If we have less than MAX_BLOCKS_TO_ANNOUNCE in our list of block
+            // hashes we're relaying, and our peer wants headers announcements,
+            // then find the first header not yet known to our peer but would
+            // connect, and send. If no header would connect, or if we have too
+            // many blocks, or if the peer doesn't want headers, just add all to
+            // the inv queue.
+            LOCK(pto->cs_inventory);
+            vector<CBlock> vHeaders;
+            bool fRevertToInv = (!state.fPreferHeaders || pto->vBlockHashesToAnnounce.size() > MAX_BLOCKS_TO_ANNOUNCE);
+            CBlockIndex *pBestIndex = NULL; // last header queued for delivery
+            ProcessBlockAvailability(pto->id); // ensure pindexBestKnownBlock is up-to-date
+
+            if (!fRevertToInv) {
+                bool fFoundStartingHeader = false;
+                // Try to find first header that our peer doesn't have, and
+                // then send all headers past that one. If we come across any
+                // headers that aren't on chainActive, give up.
+                BOOST_FOREACH(const uint256 &hash, pto->vBlockHashesToAnnounce) {
+                    BlockMap::iterator mi = mapBlockIndex.find(hash);
+                    assert(mi != mapBlockIndex.end());
+                    CBlockIndex *pindex = mi->second;
+                    if (chainActive[pindex->nHeight] != pindex) {
+                        // Bail out if we reorged away from this block
+                        fRevertToInv = true;
+                        break;
+                    }
+                    if (pBestIndex != NULL && pindex->pprev != pBestIndex) {
+                        // The list of blocks to announce doesn't connect; this can
+                        // happen when invalidateblock/reconsiderblock is used
+                        // repeatedly on the tip. Fall back to an inv.
+                        fRevertToInv = true;
+                        break;
+                    }
+                    pBestIndex = pindex;
+                    if (fFoundStartingHeader) {
+                        // add this to the headers message
+                        vHeaders.push_back(pindex->GetBlockHeader());
+                    } else if (PeerHasHeader(&state, pindex)) {
+                        continue; // keep looking for the first new block
+                    } else if (pindex->pprev == NULL || PeerHasHeader(&state, pindex->pprev)) {
+                        // Peer doesn't have this header but they do have the prior one.
+                        // Start sending headers.
+                        fFoundStartingHeader = true;
+                        vHeaders.push_back(pindex->GetBlockHeader());
+                    } else {
+                        // Peer doesn't have this header or the prior one -- nothing will
+                        // connect, so bail out.
+                        fRevertToInv = true;
+                        break;
+                    }
+                }
+            }
+            if (fRevertToInv) {
+                // If falling back to using an inv, just try to inv the tip.
+                // The last entry in vBlockHashesToAnnounce was our tip at some
+                // point in the past.
+                if (!pto->vBlockHashesToAnnounce.empty()) {
+                    const uint256 &hashToAnnounce = pto->vBlockHashesToAnnounce.back();
+                    BlockMap::iterator mi = mapBlockIndex.find(hashToAnnounce);
+                    assert(mi != mapBlockIndex.end());
+                    CBlockIndex *pindex = mi->second;
+
+                    // Warn if we're announcing a block that is not on the main chain.
+                    if (chainActive[pindex->nHeight] != pindex) {
+                        LogPrint("net", "Announcing block %s not on main chain (tip=%s)\n",
+                            hashToAnnounce.ToString(), chainActive.Tip()->GetBlockHash().ToString());
+                    }
+
+                    // If the peer announced this block to us, don't inv it back.
+                    // (Since block announcements may not be via inv's, we can't
+                    // solely rely on filterInventoryKnown to track this.)
+                    if (!PeerHasHeader(&state, pindex)) {
+                        pto->PushInventory(CInv(MSG_BLOCK, hashToAnnounce));
+                        LogPrint("net", "SendMessages: sending inv peer=%d hash=%s\n", pto->id, hashToAnnounce.ToString());
+                    }
+                }
+            } else if (!vHeaders.empty()) {
+                if (vHeaders.size() > 1) {
+                    LogPrint("net", "SendMessages: %u headers, range (%s, %s), to peer=%d\n",
+                            vHeaders.size(),
+                            vHeaders.front().GetHash().ToString(),
+                            vHeaders.back().GetHash().ToString(), pto->id);
+                } else {
+                    LogPrint("net", "SendMessages: sending header %s to peer=%d\n",
+                            vHeaders.front().GetHash().ToString(), pto->id);
+                }
+                pto->PushMessage("headers", vHeaders);
+                state.pindexBestHeaderSent = pBestIndex;
+            }
+            pto->vBlockHashesToAnnounce.clear();
+        }
+
         //
         // Message: inventory
         //
@@ -4633,7 +6135,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vInvWait.reserve(pto->vInventoryToSend.size());
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->filterInventoryKnown.contains(inv.hash))
                     continue;
 
                 // trickle out tx inv to protect privacy
@@ -4654,15 +6156,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+                pto->filterInventoryKnown.insert(inv.hash);
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000)
                 {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000)
-                    {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
                 }
             }
             pto->vInventoryToSend = vInvWait;
@@ -4693,10 +6192,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        UpdateBlocksInFlightLimit(&state, pto->nPingUsecTime);
+        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < state.nBlocksInFlightLimit) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            FindNextBlocksToDownload(pto->GetId(), state.nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload, staller);
+            if (vToDownload.empty())
+                FindHistoricalBlocksToDownload(pto->GetId(), state.nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
@@ -4804,9 +6306,6 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
 
         // orphan transactions
@@ -11,9 +11,11 @@
 #endif
 
 #include "amount.h"
+#include "blockmap.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "coins.h"
+#include "histogram.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "net.h"
@@ -21,6 +23,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "spentindex.h"
 #include "sync.h"
 #include "tinyformat.h"
 #include "txmempool.h"
@@ -37,11 +40,14 @@
 #include <utility>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CBloomFilter;
+class CCoinsViewWriteBehind;
 class CInv;
 class CScriptCheck;
 class CValidationInterface;
@@ -75,22 +81,42 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of blocks that can be requested at any given time from a single peer, until its throughput is measured. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds for the number of blocks in flight from a single peer once its throughput is known. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER_MEASURED = 64;
+/** Time in seconds of block data we try to keep in flight from each peer, on top of its round-trip time. */
+static const unsigned int BLOCK_DOWNLOAD_PIPELINE_TIME = 2;
+/** Number of blocks after the last block we have in common with a peer, in which blocks that are overdue
+ *  from a slower peer may be requested again from a faster one. */
+static const unsigned int BLOCK_DOWNLOAD_REREQUEST_WINDOW = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached their tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
-/** Size of the "block download window": how far ahead of our current height do we fetch?
- *  Larger windows tolerate larger download speed differences between peer, but increase the potential
- *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
- *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
-static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Size of the "block download window" per block a peer may have in flight: how far ahead of the last
+ *  block in common with a peer do we fetch from it? Larger windows tolerate larger download speed
+ *  differences between peers, but increase the potential degree of disordering of blocks on disk (which
+ *  make reindexing and pruning harder). A peer at MAX_BLOCKS_IN_TRANSIT_PER_PEER gets a window of 1024. */
+static const unsigned int BLOCK_DOWNLOAD_WINDOW_PER_BLOCK_IN_FLIGHT = 64;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
+/** Maximum number of headers to announce when relaying blocks with headers message. */
+static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
+/** Number of stored blocks that may be read ahead of connecting them, when connecting a long stretch. */
+static const unsigned int MAX_BLOCKS_READ_AHEAD = 16;
+/** Number of blocks to prepare a read-ahead for at once. */
+static const unsigned int BLOCK_READ_AHEAD_BATCH = 1024;
+/** Number of reward ledger records missing at startup that are written at once. */
+static const unsigned int REWARD_LEDGER_BATCH_SIZE = 10000;
+/** Number of blocks at the tip whose block and undo data is never pruned, for reorganisations. */
+static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** Smallest -prune target: the blocks kept above plus room for the block and undo files being written. */
+static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 
 /** "reject" message codes */
 static const unsigned char REJECT_MALFORMED = 0x01;
@@ -102,15 +128,10 @@ static const unsigned char REJECT_DUST = 0x41;
 static const unsigned char REJECT_INSUFFICIENTFEE = 0x42;
 static const unsigned char REJECT_CHECKPOINT = 0x43;
 
-struct BlockHasher
-{
-    size_t operator()(const uint256& hash) const { return hash.GetLow64(); }
-};
-
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
-typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+typedef CBlockMap BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
@@ -120,11 +141,26 @@ extern CWaitableCriticalSection csBestBlock;
 extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
+/** Whether the chain state is being rebuilt from the stored blocks (-reindex-chainstate) */
+extern bool fReindexChainState;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+/** Whether old block and undo files are deleted to stay below nPruneTarget (-prune) */
+extern bool fPruneMode;
+/** Whether any block files were ever pruned (then -reindex is needed to leave prune mode) */
+extern bool fHavePruned;
+/** Number of bytes the block and undo files may take in prune mode */
+extern uint64_t nPruneTarget;
+/** Memory the coins cache may use before it is trimmed or flushed, in bytes */
+extern size_t nCoinCacheUsage;
+/** Whether the databases switch between the profiles for initial block download and a synced node (-dbprofile=auto) */
+extern bool fDBProfileAuto;
+/** Whether the databases use the profile for initial block download */
+extern bool fDBProfileIBD;
 extern CFeeRate minRelayTxFee;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
@@ -175,6 +211,8 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
+/** Write the reward ledger records missing for the active chain (from before the ledger, or an unclean shutdown) */
+bool UpdateRewardLedger();
 /** Unload database information */
 void UnloadBlockIndex();
 /** Process protocol messages received from a given node */
@@ -194,6 +232,18 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fAllowSlow = false);
+/** Find the input spending an output, in the spent index (-spentindex) or, with fMempool, the memory pool */
+bool GetSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value, bool fMempool);
+/** Number of blocks to keep in flight from a peer that serves a block every nAvgBlockServiceTime
+ *  microseconds (0 while not measured) at the given ping time: enough to cover its round-trip time plus
+ *  BLOCK_DOWNLOAD_PIPELINE_TIME of blocks. */
+int GetBlocksInFlightLimit(int64_t nAvgBlockServiceTime, int64_t nPingUsecTime);
+/** How far beyond the last block in common with a peer to fetch from it, given its in-flight limit */
+int GetBlockDownloadWindow(int nBlocksInFlightLimit);
+/** Whether a block in flight for nTimeInFlight microseconds from a peer serving a block every
+ *  nAvgServiceTimeInFlight microseconds should be requested again from one serving a block every
+ *  nAvgServiceTime: it is overdue and the latter is at least twice as fast (0 means not measured). */
+bool ShouldRerequestBlock(int64_t nAvgServiceTime, int64_t nAvgServiceTimeInFlight, int64_t nTimeInFlight);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState &state, CBlock *pblock = NULL);
 CAmount GetBlockValue(int nHeight, const CAmount& nFees);
@@ -208,6 +258,30 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Prune block files if needed and flush all state to disk. */
+void PruneAndFlush();
+/** Total size of the block and undo files currently on disk. */
+uint64_t CalculateCurrentUsage();
+/** Commit the chain state flushes handed over by FlushStateToDisk, through pcoinsview */
+void ThreadFlushState(CCoinsViewWriteBehind *pcoinsview);
+
+/** Chain state flush timings, in microseconds */
+struct CFlushStats
+{
+    uint64_t nFlushes;
+    bool fPending;
+    //! memory used by the coins being committed
+    size_t nPendingUsage;
+    //! time spent in FlushStateToDisk (holding cs_main), including waits for the previous flush
+    CLatencyHistogram histStall;
+    //! time ThreadFlushState took to commit a flush
+    CLatencyHistogram histCommit;
+
+    CFlushStats() : nFlushes(0), fPending(false), nPendingUsage(0) {}
+};
+
+/** Get the chain state flush timings */
+void GetFlushStats(CFlushStats &stats);
 
 
 /** (try to) add transaction to memory pool **/
@@ -220,6 +294,8 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInFlightLimit;
+    int64_t nDownloadRate;
 };
 
 struct CDiskTxPos : public CDiskBlockPos
@@ -341,8 +417,8 @@ private:
 
 public:
     CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+        scriptPubKey(outIn.scriptPubKey),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
 
     bool operator()();
@@ -371,7 +447,8 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
+ *  of problems. Note that in any case, coins may be modified. The address and spent indexes
+ *  are only updated without pfClean, as blocks are only checked with it. */
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
@@ -448,6 +525,18 @@ public:
      }
 };
 
+/**
+ * Choose the oldest of the block files [0, nLastFile) to prune, until
+ * nCurrentUsage (of the block and undo files) fits in nTarget again, with room
+ * for the chunks the files being written may still allocate. Files with blocks
+ * above nMaxHeight are kept, and so are files with blocks at or below
+ * nSnapshotHeight (-1 for none), which are needed to validate a UTXO snapshot.
+ */
+void SelectFilesToPrune(const std::vector<CBlockFileInfo> &vinfo, int nLastFile, uint64_t nCurrentUsage, uint64_t nTarget,
+                        unsigned int nMaxHeight, int nSnapshotHeight, std::set<int> &setFilesToPrune);
+/** Forget the block and undo data of a block whose file is pruned (cs_main must be held) */
+void PruneBlockIndexEntry(CBlockIndex *pindex);
+
 /** Capture information about block/transaction validation */
 class CValidationState {
 private:
@@ -519,6 +608,107 @@ public:
     bool VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
 };
 
+/**
+ * Entry of the index journal: a block connected to (or disconnected from) the
+ * optional indexes, with where to read it and its undo data back. Entries are
+ * written before the changes to the indexes, which are written right away,
+ * and forgotten once the chain state they lead up to is flushed, so that
+ * RepairIndexes can bring the indexes back in line with the chain state on
+ * disk after an unclean shutdown.
+ */
+class CIndexJournalEntry
+{
+public:
+    uint256 hashBlock;
+    uint256 hashPrevBlock;
+    int nHeight;
+    CDiskBlockPos posData;
+    CDiskBlockPos posUndo;
+    bool fConnect;
+
+    CIndexJournalEntry() : hashBlock(0), hashPrevBlock(0), nHeight(0), fConnect(false) {}
+    CIndexJournalEntry(const CBlockIndex *pindex, bool fConnectIn) :
+        hashBlock(pindex->GetBlockHash()), hashPrevBlock(pindex->pprev->GetBlockHash()), nHeight(pindex->nHeight),
+        posData(pindex->GetBlockPos()), posUndo(pindex->GetUndoPos()), fConnect(fConnectIn) {}
+
+    //! The block the indexes are at after this entry
+    const uint256& GetIndexBest() const { return fConnect ? hashBlock : hashPrevBlock; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(hashPrevBlock);
+        READWRITE(nHeight);
+        READWRITE(posData);
+        READWRITE(posUndo);
+        READWRITE(fConnect);
+    }
+};
+
+/**
+ * Bring the optional indexes in line with the active chain at startup: undo
+ * the journaled blocks the chain state on disk does not include, and connect
+ * those it has that the indexes miss.
+ */
+bool RepairIndexes();
+
+/**
+ * Header of a UTXO snapshot file, as written by dumptxoutset: describes the
+ * chain state the coins that follow it belong to. The records after it are
+ * (txid, CCoins) pairs in CCoins' compressed serialization, and the file ends
+ * with the double SHA256 of everything before.
+ */
+class CUTXOSnapshotHeader
+{
+public:
+    static const uint32_t SNAPSHOT_MAGIC = 0x78747564; // "dutx"
+    static const int CURRENT_VERSION = 1;
+
+    int nVersion;
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nChainTx;
+    CAmount nReward;      //! nReward of the snapshot block
+    CAmount nChainReward; //! nChainReward of the snapshot block
+    uint64_t nTransactions;
+    uint256 hashMuHash;
+
+    CUTXOSnapshotHeader() : nVersion(CURRENT_VERSION), hashBlock(0), nHeight(0), nChainTx(0), nReward(0), nChainReward(0), nTransactions(0), hashMuHash(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        uint32_t nMagic = SNAPSHOT_MAGIC;
+        READWRITE(nMagic);
+        if (ser_action.ForRead() && nMagic != SNAPSHOT_MAGIC)
+            throw std::ios_base::failure("CUTXOSnapshotHeader : not a UTXO snapshot");
+        READWRITE(this->nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nChainTx);
+        READWRITE(nReward);
+        READWRITE(nChainReward);
+        READWRITE(nTransactions);
+        READWRITE(hashMuHash);
+    }
+};
+
+/** Write the UTXO set at the current tip to a snapshot file */
+bool DumpUTXOSnapshot(const std::string &strPath, CUTXOSnapshotHeader &header, std::string &strError);
+/**
+ * Replace the chain state of a node that has not synchronized any blocks yet
+ * with a snapshot file; the blocks below it are then downloaded and validated
+ * in the background.
+ */
+bool LoadUTXOSnapshot(const std::string &strPath, CUTXOSnapshotHeader &header, std::string &strError);
+/** Get the loaded UTXO snapshot that still awaits validation of the blocks below it */
+bool GetPendingUTXOSnapshot(CUTXOSnapshotHeader &header);
+/** Replay the blocks below a loaded UTXO snapshot once they are all available, and check the result */
+void ThreadValidateUTXOSnapshot();
+
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
@@ -531,12 +721,47 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks. */
 extern CChain chainActive;
 
+/**
+ * What read-only callers ask about the tip of the active chain, copied when it
+ * changes so that they need not wait for cs_main while blocks are connected.
+ * Summaries are never modified once published.
+ */
+struct CChainTipSummary
+{
+    //! The tip itself (NULL before the block index is loaded). Its header fields,
+    //! nChainWork and its ancestors do not change, and the entry is not freed
+    //! while the block index is loaded, so those may be read without cs_main;
+    //! nStatus and the active chain may not.
+    const CBlockIndex* pindex;
+    uint256 hash;
+    int nHeight;
+    int64_t nTime;
+    //! chainActive.GetTimeMax() of the tip: no block of the chain has a later median time past
+    int64_t nTimeMax;
+    unsigned int nBits;
+    CAmount nReward;
+    CAmount nChainReward;
+    unsigned int nChainTx;
+    uint256 nChainWork;
+    double dVerificationProgress;
+
+    CChainTipSummary() : pindex(NULL), hash(0), nHeight(-1), nTime(0), nTimeMax(-1), nBits(0), nReward(0), nChainReward(0), nChainTx(0), nChainWork(0), dVerificationProgress(0.0) {}
+};
+
+typedef boost::shared_ptr<const CChainTipSummary> CChainTipSummaryRef;
+
+/** The summary of the tip of the active chain as of its last change. Does not take cs_main, and never returns NULL. */
+CChainTipSummaryRef GetChainTipSummary();
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the coin database, under pcoinsTip */
+extern CCoinsViewDB *pcoinsdbview;
+
 struct CBlockTemplate
 {
     CBlock block;
@@ -558,6 +783,7 @@ protected:
     virtual void Inventory(const uint256 &hash) {};
     virtual void ResendWalletTransactions() {};
     virtual void BlockChecked(const CBlock&, const CValidationState&) {};
+    virtual void UpdatedBlockTip(const CBlockIndex *pindexNew) {};
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
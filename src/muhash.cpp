@@ -0,0 +1,155 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include "crypto/sha256.h"
+
+#include <assert.h>
+
+#include <openssl/bn.h>
+
+namespace {
+
+/** The modulus, 2^3072 - 1103717; set up once and only read afterwards */
+class CMuHashModulus
+{
+public:
+    BIGNUM* p;
+
+    CMuHashModulus() {
+        p = BN_new();
+        assert(p);
+        BN_zero(p);
+        BN_set_bit(p, 3072);
+        BN_sub_word(p, 1103717);
+    }
+
+    ~CMuHashModulus() {
+        BN_free(p);
+    }
+};
+
+const BIGNUM* GetModulus()
+{
+    static CMuHashModulus modulus;
+    return modulus.p;
+}
+
+void ToBytes(const BIGNUM* bn, unsigned char* pch)
+{
+    int nBytes = BN_num_bytes(bn);
+    assert(nBytes <= (int)MuHash3072::BYTE_SIZE);
+    memset(pch, 0, MuHash3072::BYTE_SIZE - nBytes);
+    BN_bn2bin(bn, pch + MuHash3072::BYTE_SIZE - nBytes);
+}
+
+/** Expand vData into a 3072-bit number, by running SHA256 in counter mode over its hash. */
+void HashToNumber(const std::vector<unsigned char>& vData, unsigned char* pch)
+{
+    unsigned char seed[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(vData.empty() ? NULL : &vData[0], vData.size()).Finalize(seed);
+    for (unsigned char i = 0; i < MuHash3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE; i++)
+        CSHA256().Write(seed, sizeof(seed)).Write(&i, 1).Finalize(pch + i * CSHA256::OUTPUT_SIZE);
+}
+
+/** bn = bn * (the number vData hashes to) mod p */
+void MultiplyElement(BIGNUM* bn, const std::vector<unsigned char>& vData, BN_CTX* ctx)
+{
+    unsigned char element[MuHash3072::BYTE_SIZE];
+    HashToNumber(vData, element);
+    BN_CTX_start(ctx);
+    BIGNUM* e = BN_CTX_get(ctx);
+    assert(e);
+    BN_bin2bn(element, MuHash3072::BYTE_SIZE, e);
+    BN_mod_mul(bn, bn, e, GetModulus(), ctx);
+    BN_CTX_end(ctx);
+}
+
+} // anon namespace
+
+MuHash3072::MuHash3072()
+{
+    numerator = BN_new();
+    denominator = BN_new();
+    ctx = BN_CTX_new();
+    assert(numerator && denominator && ctx);
+    BN_one(numerator);
+    BN_one(denominator);
+}
+
+MuHash3072::MuHash3072(const MuHash3072& other)
+{
+    numerator = BN_dup(other.numerator);
+    denominator = BN_dup(other.denominator);
+    ctx = BN_CTX_new();
+    assert(numerator && denominator && ctx);
+}
+
+MuHash3072& MuHash3072::operator=(const MuHash3072& other)
+{
+    if (this != &other) {
+        BN_copy(numerator, other.numerator);
+        BN_copy(denominator, other.denominator);
+    }
+    return *this;
+}
+
+MuHash3072::~MuHash3072()
+{
+    BN_free(numerator);
+    BN_free(denominator);
+    BN_CTX_free(ctx);
+}
+
+void MuHash3072::Insert(const std::vector<unsigned char>& vData)
+{
+    MultiplyElement(numerator, vData, ctx);
+}
+
+void MuHash3072::Remove(const std::vector<unsigned char>& vData)
+{
+    MultiplyElement(denominator, vData, ctx);
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& other)
+{
+    BN_mod_mul(numerator, numerator, other.numerator, GetModulus(), ctx);
+    BN_mod_mul(denominator, denominator, other.denominator, GetModulus(), ctx);
+    return *this;
+}
+
+uint256 MuHash3072::Finalize() const
+{
+    BN_CTX_start(ctx);
+    BIGNUM* inv = BN_CTX_get(ctx);
+    BIGNUM* result = BN_CTX_get(ctx);
+    assert(inv && result);
+    BIGNUM* ret = BN_mod_inverse(inv, denominator, GetModulus(), ctx);
+    assert(ret);
+    BN_mod_mul(result, numerator, inv, GetModulus(), ctx);
+
+    unsigned char pch[BYTE_SIZE];
+    ToBytes(result, pch);
+    BN_CTX_end(ctx);
+
+    uint256 hash;
+    CSHA256().Write(pch, BYTE_SIZE).Finalize((unsigned char*)&hash);
+    return hash;
+}
+
+void MuHash3072::GetBytes(unsigned char* pch) const
+{
+    ToBytes(numerator, pch);
+    ToBytes(denominator, pch + BYTE_SIZE);
+}
+
+void MuHash3072::SetBytes(const unsigned char* pch)
+{
+    // Reduce what was read, the operations expect numbers below the modulus
+    BN_bin2bn(pch, BYTE_SIZE, numerator);
+    BN_bin2bn(pch + BYTE_SIZE, BYTE_SIZE, denominator);
+    BN_nnmod(numerator, numerator, GetModulus(), ctx);
+    BN_nnmod(denominator, denominator, GetModulus(), ctx);
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MUHASH_H
+#define BITCOIN_MUHASH_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <string.h>
+#include <vector>
+
+#include <openssl/bn.h>
+
+/**
+ * Rolling hash of a set of byte strings, independent of insertion order.
+ *
+ * Every element is hashed to a number modulo the prime 2^3072 - 1103717, and
+ * the set hash is the product of those numbers (MuHash). Elements are removed
+ * again by dividing; to keep updates cheap the divisions are collected in a
+ * separate denominator, and only Finalize() computes a modular inverse.
+ * Two MuHash3072 objects can be combined with operator*=, which gives the hash
+ * of the union of both (multi)sets.
+ *
+ * Numerator and denominator are kept as OpenSSL numbers, with the scratch
+ * space to update them, for the lifetime of the object; they are only
+ * converted to bytes when the object is serialized.
+ */
+class MuHash3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+
+    MuHash3072();
+    MuHash3072(const MuHash3072& other);
+    MuHash3072& operator=(const MuHash3072& other);
+    ~MuHash3072();
+
+    void Insert(const std::vector<unsigned char>& vData);
+    void Remove(const std::vector<unsigned char>& vData);
+    MuHash3072& operator*=(const MuHash3072& other);
+
+    /** 256-bit digest of the set; the empty set and any set re-emptied give the same result. */
+    uint256 Finalize() const;
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 2 * BYTE_SIZE;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        unsigned char pch[2 * BYTE_SIZE];
+        GetBytes(pch);
+        s.write((const char*)pch, sizeof(pch));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        unsigned char pch[2 * BYTE_SIZE];
+        s.read((char*)pch, sizeof(pch));
+        SetBytes(pch);
+    }
+
+private:
+    //! numbers modulo the prime
+    BIGNUM* numerator;
+    BIGNUM* denominator;
+    //! scratch space of the computations; OpenSSL needs it writable even to read
+    mutable BN_CTX* ctx;
+
+    //! numerator and denominator as big-endian numbers of BYTE_SIZE bytes each
+    void GetBytes(unsigned char* pch) const;
+    void SetBytes(const unsigned char* pch);
+};
+
+#endif // BITCOIN_MUHASH_H
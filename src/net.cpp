@@ -349,6 +349,9 @@ uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+MsgCmdStatsMap CNode::mapTotalMsgCmdStats;
+std::map<std::string, CLatencyHistogram> CNode::mapProcessTimeHistograms;
+CCriticalSection CNode::cs_totalMsgCmdStats;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -531,6 +534,11 @@ void CNode::copyStats(CNodeStats &stats)
     X(nSendBytes);
     X(nRecvBytes);
     X(fWhitelisted);
+    stats.nKnownFilterBytes = addrKnown.GetMemoryUsage() + filterInventoryKnown.GetMemoryUsage();
+    {
+        LOCK(cs_msgCmdStats);
+        X(mapMsgCmdStats);
+    }
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -1343,10 +1351,12 @@ void ThreadOpenAddedConnections()
         }
 
         list<vector<CService> > lservAddressesToAdd(0);
+        bool fLookupsPending = false;
         BOOST_FOREACH(string& strAddNode, lAddresses)
         {
             vector<CService> vservNode(0);
-            if(Lookup(strAddNode.c_str(), vservNode, Params().GetDefaultPort(), fNameLookup, 0))
+            bool fPending = false;
+            if(Lookup(strAddNode.c_str(), vservNode, Params().GetDefaultPort(), fNameLookup, 0, &fPending))
             {
                 lservAddressesToAdd.push_back(vservNode);
                 {
@@ -1355,6 +1365,8 @@ void ThreadOpenAddedConnections()
                         setservAddNodeAddresses.insert(serv);
                 }
             }
+            if (fPending)
+                fLookupsPending = true;
         }
         // Attempt to connect to each IP for each addnode entry until at least one is successful per addnode entry
         // (keeping in mind that addnode entries can have many IPs if fNameLookup)
@@ -1376,7 +1388,8 @@ void ThreadOpenAddedConnections()
             OpenNetworkConnection(CAddress(vserv[i % vserv.size()]), &grant);
             MilliSleep(500);
         }
-        MilliSleep(120000); // Retry every 2 minutes
+        // Retry every 2 minutes, or as soon as the resolver may have answered
+        MilliSleep(fLookupsPending ? 1000 : 120000);
     }
 }
 
@@ -1646,6 +1659,8 @@ void StartNode(boost::thread_group& threadGroup)
     // Start threads
     //
 
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "dnsresolve", &ThreadDNSResolver));
+
     if (!GetBoolArg("-dnsseed", true))
         LogPrintf("DNS seeding disabled\n");
     else
@@ -1781,6 +1796,55 @@ void CNode::RecordBytesSent(uint64_t bytes)
     nTotalBytesSent += bytes;
 }
 
+/** Map commands we don't know about to a single entry, so peers can't grow the statistics maps. */
+static const std::string& NormalizeMsgCmd(const std::string& strCommand)
+{
+    static const std::set<std::string> setKnown(getAllNetMessageTypes().begin(), getAllNetMessageTypes().end());
+    static const std::string strOther(NET_MESSAGE_COMMAND_OTHER);
+    std::set<std::string>::const_iterator it = setKnown.find(strCommand);
+    return it == setKnown.end() ? strOther : *it;
+}
+
+void CNode::RecordMessageSent(const std::string& strCommand, uint64_t nBytes)
+{
+    const std::string& strKey = NormalizeMsgCmd(strCommand);
+    {
+        LOCK(cs_msgCmdStats);
+        CMsgCmdStats& stats = mapMsgCmdStats[strKey];
+        stats.nSendBytes += nBytes;
+        stats.nSendMsgs++;
+    }
+    LOCK(cs_totalMsgCmdStats);
+    CMsgCmdStats& stats = mapTotalMsgCmdStats[strKey];
+    stats.nSendBytes += nBytes;
+    stats.nSendMsgs++;
+}
+
+void CNode::RecordMessageProcessed(const std::string& strCommand, uint64_t nBytes, int64_t nProcessUsec)
+{
+    const std::string& strKey = NormalizeMsgCmd(strCommand);
+    {
+        LOCK(cs_msgCmdStats);
+        CMsgCmdStats& stats = mapMsgCmdStats[strKey];
+        stats.nRecvBytes += nBytes;
+        stats.nRecvMsgs++;
+        stats.nProcessUsec += nProcessUsec;
+    }
+    LOCK(cs_totalMsgCmdStats);
+    CMsgCmdStats& stats = mapTotalMsgCmdStats[strKey];
+    stats.nRecvBytes += nBytes;
+    stats.nRecvMsgs++;
+    stats.nProcessUsec += nProcessUsec;
+    mapProcessTimeHistograms[strKey].Add(nProcessUsec);
+}
+
+void CNode::GetTotalMsgCmdStats(MsgCmdStatsMap& mapStats, std::map<std::string, CLatencyHistogram>& mapHistograms)
+{
+    LOCK(cs_totalMsgCmdStats);
+    mapStats = mapTotalMsgCmdStats;
+    mapHistograms = mapProcessTimeHistograms;
+}
+
 uint64_t CNode::GetTotalBytesRecv()
 {
     LOCK(cs_totalBytesRecv);
@@ -1932,7 +1996,9 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
-CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION),
+    addrKnown(5000, 0.001),
+    filterInventoryKnown(SendBufferSize() / 1000, 0.000001)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -1960,7 +2026,6 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
-    setInventoryKnown.max_size(SendBufferSize() / 1000);
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
@@ -2071,6 +2136,9 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
+    const char *pchCommand = &ssSend[MESSAGE_START_SIZE];
+    RecordMessageSent(std::string(pchCommand, pchCommand + strnlen_int(pchCommand, CMessageHeader::COMMAND_SIZE)), ssSend.size());
+
     std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
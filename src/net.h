@@ -9,8 +9,8 @@
 #include "bloom.h"
 #include "compat.h"
 #include "hash.h"
+#include "histogram.h"
 #include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -148,6 +148,20 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** Traffic and processing time accounted to one message type. */
+class CMsgCmdStats
+{
+public:
+    uint64_t nSendBytes;
+    uint64_t nSendMsgs;
+    uint64_t nRecvBytes;
+    uint64_t nRecvMsgs;
+    int64_t nProcessUsec; //! Total time (in microseconds) spent in ProcessMessage
+
+    CMsgCmdStats() : nSendBytes(0), nSendMsgs(0), nRecvBytes(0), nRecvMsgs(0), nProcessUsec(0) {}
+};
+typedef std::map<std::string, CMsgCmdStats> MsgCmdStatsMap;
+
 class CNodeStats
 {
 public:
@@ -167,6 +181,8 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    size_t nKnownFilterBytes;
+    MsgCmdStatsMap mapMsgCmdStats;
 };
 
 
@@ -284,13 +300,18 @@ public:
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
-    mruset<CAddress> setAddrKnown;
+    //! Addresses this peer already knows about; false-positive rate 0.1%
+    CRollingBloomFilter addrKnown;
     bool fGetAddr;
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    //! Hashes of inventory this peer already knows about; false-positive rate 0.0001%
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
+    // List of block hashes to relay in headers messages (or inv, if the peer
+    // didn't ask for headers announcements). Protected by cs_inventory.
+    std::vector<uint256> vBlockHashesToAnnounce;
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
 
@@ -314,6 +335,13 @@ private:
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
 
+    // Per message type accounting, for this node and for all nodes together
+    MsgCmdStatsMap mapMsgCmdStats;
+    CCriticalSection cs_msgCmdStats;
+    static MsgCmdStatsMap mapTotalMsgCmdStats;
+    static std::map<std::string, CLatencyHistogram> mapProcessTimeHistograms;
+    static CCriticalSection cs_totalMsgCmdStats;
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
@@ -364,7 +392,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
-        setAddrKnown.insert(addr);
+        addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
@@ -372,7 +400,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
-        if (addr.IsValid() && !setAddrKnown.count(addr)) {
+        if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
             } else {
@@ -386,7 +414,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
@@ -394,11 +422,17 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!filterInventoryKnown.contains(inv.hash))
                 vInventoryToSend.push_back(inv);
         }
     }
 
+    void PushBlockHash(const uint256 &hash)
+    {
+        LOCK(cs_inventory);
+        vBlockHashesToAnnounce.push_back(hash);
+    }
+
     void AskFor(const CInv& inv);
 
     // TODO: Document the postcondition of this function.  Is cs_vSend locked?
@@ -604,6 +638,12 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    //! Account a message of nBytes (header included) queued for sending
+    void RecordMessageSent(const std::string& strCommand, uint64_t nBytes);
+    //! Account a received message of nBytes (header included) and the time ProcessMessage took for it
+    void RecordMessageProcessed(const std::string& strCommand, uint64_t nBytes, int64_t nProcessUsec);
+    static void GetTotalMsgCmdStats(MsgCmdStatsMap& mapStats, std::map<std::string, CLatencyHistogram>& mapHistograms);
 };
 
 
@@ -30,6 +30,9 @@
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
 #include <boost/thread.hpp>
 
+#include <deque>
+#include <map>
+
 #if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -85,18 +88,9 @@ void SplitHostPort(std::string in, int &portOut, std::string &hostOut) {
         hostOut = in;
 }
 
-bool static LookupIntern(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions, bool fAllowLookup)
+/** Resolve pszName with getaddrinfo; only numeric addresses are accepted unless fAllowLookup is set. */
+bool static SystemResolve(const char *pszName, std::vector<CNetAddr>& vIP, bool fAllowLookup)
 {
-    vIP.clear();
-
-    {
-        CNetAddr addr;
-        if (addr.SetSpecial(std::string(pszName))) {
-            vIP.push_back(addr);
-            return true;
-        }
-    }
-
 #ifdef HAVE_GETADDRINFO_A
     struct in_addr ipv4_addr;
 #ifdef HAVE_INET_PTON
@@ -160,7 +154,7 @@ bool static LookupIntern(const char *pszName, std::vector<CNetAddr>& vIP, unsign
         return false;
 
     struct addrinfo *aiTrav = aiRes;
-    while (aiTrav != NULL && (nMaxSolutions == 0 || vIP.size() < nMaxSolutions))
+    while (aiTrav != NULL)
     {
         if (aiTrav->ai_family == AF_INET)
         {
@@ -182,8 +176,212 @@ bool static LookupIntern(const char *pszName, std::vector<CNetAddr>& vIP, unsign
     return (vIP.size() > 0);
 }
 
-bool LookupHost(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions, bool fAllowLookup)
+bool static SystemNameResolver(const std::string& strName, std::vector<CNetAddr>& vIP)
+{
+    return SystemResolve(strName.c_str(), vIP, true);
+}
+
+//
+// DNS cache
+//
+// Host names are resolved at most once per nDNSCacheTTL seconds, and failures
+// are remembered for DNS_NEGATIVE_CACHE_TTL seconds. While ThreadDNSResolver is
+// running, cache misses are queued to it, so that callers which must not block
+// can come back later for the answer; otherwise names are resolved in the
+// caller's thread.
+//
+
+struct CDNSCacheEntry
+{
+    std::vector<CNetAddr> vIP;
+    int64_t nExpires;
+    bool fPending;
+
+    CDNSCacheEntry() : nExpires(0), fPending(false) {}
+};
+
+static const unsigned int MAX_DNS_CACHE_ENTRIES = 1000;
+
+int nDNSCacheTTL = DEFAULT_DNS_CACHE_TTL;
+static CWaitableCriticalSection cs_dnsCache;
+static CConditionVariable condDNSQueue;
+static CConditionVariable condDNSResolved;
+static std::map<std::string, CDNSCacheEntry> mapDNSCache;
+static std::deque<std::string> queueDNSPending;
+static bool fDNSResolverRunning = false;
+static NameResolverFunc pNameResolver = SystemNameResolver;
+
+void static StoreDNSResult(const std::string& strKey, const std::vector<CNetAddr>& vIP)
+{
+    boost::unique_lock<boost::mutex> lock(cs_dnsCache);
+    int64_t nNow = GetTime();
+    if (mapDNSCache.size() >= MAX_DNS_CACHE_ENTRIES && !mapDNSCache.count(strKey)) {
+        // Make room: drop everything that expired, or an arbitrary settled entry if nothing did
+        std::map<std::string, CDNSCacheEntry>::iterator itVictim = mapDNSCache.end();
+        for (std::map<std::string, CDNSCacheEntry>::iterator it = mapDNSCache.begin(); it != mapDNSCache.end();) {
+            if (!it->second.fPending && it->second.nExpires <= nNow) {
+                mapDNSCache.erase(it++);
+                continue;
+            }
+            if (!it->second.fPending)
+                itVictim = it;
+            it++;
+        }
+        if (mapDNSCache.size() >= MAX_DNS_CACHE_ENTRIES && itVictim != mapDNSCache.end())
+            mapDNSCache.erase(itVictim);
+    }
+    CDNSCacheEntry& entry = mapDNSCache[strKey];
+    entry.vIP = vIP;
+    entry.nExpires = nNow + (vIP.empty() ? DNS_NEGATIVE_CACHE_TTL : nDNSCacheTTL);
+    entry.fPending = false;
+    condDNSResolved.notify_all();
+}
+
+/**
+ * Look up a host name through the cache. If pfPending is set, never block:
+ * a name that still needs resolving is queued to the resolver thread and
+ * *pfPending is set (an expired answer is still returned while it refreshes).
+ */
+bool static LookupCached(const std::string& strName, std::vector<CNetAddr>& vIP, bool* pfPending)
+{
+    std::string strKey = boost::algorithm::to_lower_copy(strName);
+    std::vector<CNetAddr> vResolved;
+    NameResolverFunc resolver;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_dnsCache);
+        std::map<std::string, CDNSCacheEntry>::iterator it = mapDNSCache.find(strKey);
+        if (it != mapDNSCache.end() && !it->second.fPending && it->second.nExpires > GetTime()) {
+            vIP = it->second.vIP;
+            return !vIP.empty();
+        }
+        if (fDNSResolverRunning) {
+            if (it == mapDNSCache.end()) {
+                it = mapDNSCache.insert(std::make_pair(strKey, CDNSCacheEntry())).first;
+            }
+            if (!it->second.fPending) {
+                it->second.fPending = true;
+                queueDNSPending.push_back(strKey);
+                condDNSQueue.notify_one();
+            }
+            if (pfPending) {
+                vIP = it->second.vIP;
+                *pfPending = vIP.empty();
+                return !vIP.empty();
+            }
+            while (true) {
+                it = mapDNSCache.find(strKey);
+                if (it == mapDNSCache.end())
+                    return false;
+                if (!it->second.fPending)
+                    break;
+                condDNSResolved.wait(lock);
+            }
+            vIP = it->second.vIP;
+            return !vIP.empty();
+        }
+        resolver = pNameResolver;
+    }
+
+    resolver(strKey, vResolved);
+    StoreDNSResult(strKey, vResolved);
+    vIP = vResolved;
+    return !vIP.empty();
+}
+
+void static StopDNSResolver()
+{
+    boost::unique_lock<boost::mutex> lock(cs_dnsCache);
+    fDNSResolverRunning = false;
+    // Nobody is going to answer the queued names anymore
+    while (!queueDNSPending.empty()) {
+        mapDNSCache.erase(queueDNSPending.front());
+        queueDNSPending.pop_front();
+    }
+    condDNSResolved.notify_all();
+}
+
+void ThreadDNSResolver()
 {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_dnsCache);
+        fDNSResolverRunning = true;
+    }
+
+    try {
+        while (true) {
+            std::string strName;
+            NameResolverFunc resolver;
+            {
+                boost::unique_lock<boost::mutex> lock(cs_dnsCache);
+                while (queueDNSPending.empty())
+                    condDNSQueue.wait(lock);
+                strName = queueDNSPending.front();
+                queueDNSPending.pop_front();
+                resolver = pNameResolver;
+            }
+
+            std::vector<CNetAddr> vIP;
+            int64_t nStart = GetTimeMillis();
+            resolver(strName, vIP);
+            LogPrint("net", "resolved %s to %u addresses in %dms\n", strName, vIP.size(), GetTimeMillis() - nStart);
+            StoreDNSResult(strName, vIP);
+        }
+    } catch (...) {
+        StopDNSResolver();
+        throw;
+    }
+}
+
+void SetNameResolver(NameResolverFunc resolver)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_dnsCache);
+        pNameResolver = resolver ? resolver : SystemNameResolver;
+    }
+    ClearDNSCache();
+}
+
+void ClearDNSCache()
+{
+    boost::unique_lock<boost::mutex> lock(cs_dnsCache);
+    // Keep the entries the resolver thread still has to fill in
+    for (std::map<std::string, CDNSCacheEntry>::iterator it = mapDNSCache.begin(); it != mapDNSCache.end();) {
+        if (it->second.fPending)
+            it++;
+        else
+            mapDNSCache.erase(it++);
+    }
+}
+
+bool static LookupIntern(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions, bool fAllowLookup, bool* pfPending)
+{
+    vIP.clear();
+    if (pfPending)
+        *pfPending = false;
+
+    {
+        CNetAddr addr;
+        if (addr.SetSpecial(std::string(pszName))) {
+            vIP.push_back(addr);
+            return true;
+        }
+    }
+
+    // Numeric addresses never need the resolver
+    if (!SystemResolve(pszName, vIP, false)) {
+        if (!fAllowLookup || !LookupCached(std::string(pszName), vIP, pfPending))
+            return false;
+    }
+
+    if (nMaxSolutions > 0 && vIP.size() > nMaxSolutions)
+        vIP.resize(nMaxSolutions);
+    return true;
+}
+
+bool LookupHost(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions, bool fAllowLookup, bool* pfPending)
+{
+    if (pfPending)
+        *pfPending = false;
     std::string strHost(pszName);
     if (strHost.empty())
         return false;
@@ -192,11 +390,13 @@ bool LookupHost(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nM
         strHost = strHost.substr(1, strHost.size() - 2);
     }
 
-    return LookupIntern(strHost.c_str(), vIP, nMaxSolutions, fAllowLookup);
+    return LookupIntern(strHost.c_str(), vIP, nMaxSolutions, fAllowLookup, pfPending);
 }
 
-bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault, bool fAllowLookup, unsigned int nMaxSolutions)
+bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault, bool fAllowLookup, unsigned int nMaxSolutions, bool* pfPending)
 {
+    if (pfPending)
+        *pfPending = false;
     if (pszName[0] == 0)
         return false;
     int port = portDefault;
@@ -204,7 +404,7 @@ bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault,
     SplitHostPort(std::string(pszName), port, hostname);
 
     std::vector<CNetAddr> vIP;
-    bool fRet = LookupIntern(hostname.c_str(), vIP, nMaxSolutions, fAllowLookup);
+    bool fRet = LookupIntern(hostname.c_str(), vIP, nMaxSolutions, fAllowLookup, pfPending);
     if (!fRet)
         return false;
     vAddr.resize(vIP.size());
@@ -559,10 +759,16 @@ bool ConnectSocketByName(CService &addr, SOCKET& hSocketRet, const char *pszDest
     CService nameProxy;
     GetNameProxy(nameProxy);
 
-    CService addrResolved(CNetAddr(strDest, fNameLookup && !HaveNameProxy()), port);
-    if (addrResolved.IsValid()) {
-        addr = addrResolved;
-        return ConnectSocket(addr, hSocketRet, nTimeout);
+    // Do not wait for the resolver here; a name that is not cached yet fails
+    // this attempt, and the caller retries once the answer is in.
+    std::vector<CNetAddr> vIP;
+    bool fPending = false;
+    if (LookupHost(strDest.c_str(), vIP, 1, fNameLookup && !HaveNameProxy(), &fPending)) {
+        CService addrResolved(vIP[0], port);
+        if (addrResolved.IsValid()) {
+            addr = addrResolved;
+            return ConnectSocket(addr, hSocketRet, nTimeout);
+        }
     }
 
     addr = CService("0.0.0.0:0");
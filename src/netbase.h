@@ -18,9 +18,14 @@
 
 extern int nConnectTimeout;
 extern bool fNameLookup;
+extern int nDNSCacheTTL;
 
 /** -timeout default */
 static const int DEFAULT_CONNECT_TIMEOUT = 5000;
+/** -dnscachettl default (seconds) */
+static const int DEFAULT_DNS_CACHE_TTL = 600;
+/** How long a host name that failed to resolve is remembered (seconds) */
+static const int DNS_NEGATIVE_CACHE_TTL = 60;
 
 #ifdef WIN32
 // In MSVC, this is defined as a macro, undefine it to prevent a compile and link error
@@ -180,9 +185,22 @@ bool GetProxy(enum Network net, proxyType &proxyInfoOut);
 bool IsProxy(const CNetAddr &addr);
 bool SetNameProxy(CService addrProxy);
 bool HaveNameProxy();
-bool LookupHost(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions = 0, bool fAllowLookup = true);
+/** Resolves a host name to its addresses; returns false if it does not resolve. */
+typedef bool (*NameResolverFunc)(const std::string& strName, std::vector<CNetAddr>& vIP);
+/** Replace the resolver behind host name lookups (NULL restores the system resolver) and flush the DNS cache */
+void SetNameResolver(NameResolverFunc resolver);
+/** Forget all cached host name resolutions */
+void ClearDNSCache();
+/** Resolve queued host names in the background; while this is not running, names are resolved in the caller's thread */
+void ThreadDNSResolver();
+/**
+ * Host name lookups go through the DNS cache. Passing pfPending makes the call non-blocking:
+ * if the name has not been resolved yet, it is queued to ThreadDNSResolver, false is
+ * returned and *pfPending is set, and a later call picks up the answer.
+ */
+bool LookupHost(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions = 0, bool fAllowLookup = true, bool* pfPending = NULL);
 bool Lookup(const char *pszName, CService& addr, int portDefault = 0, bool fAllowLookup = true);
-bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault = 0, bool fAllowLookup = true, unsigned int nMaxSolutions = 0);
+bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault = 0, bool fAllowLookup = true, unsigned int nMaxSolutions = 0, bool* pfPending = NULL);
 bool LookupNumeric(const char *pszName, CService& addr, int portDefault = 0);
 bool ConnectSocket(const CService &addr, SOCKET& hSocketRet, int nTimeout, bool *outProxyConnectionFailed = 0);
 bool ConnectSocketByName(CService &addr, SOCKET& hSocketRet, const char *pszDest, int portDefault, int nTimeout, bool *outProxyConnectionFailed = 0);
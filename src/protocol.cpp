@@ -21,6 +21,40 @@ static const char* ppszTypeName[] =
     "filtered block"
 };
 
+static const char* ppszNetMessageTypes[] =
+{
+    "version",
+    "verack",
+    "addr",
+    "inv",
+    "getdata",
+    "merkleblock",
+    "getblocks",
+    "getheaders",
+    "tx",
+    "headers",
+    "block",
+    "getaddr",
+    "mempool",
+    "ping",
+    "pong",
+    "alert",
+    "notfound",
+    "filterload",
+    "filteradd",
+    "filterclear",
+    "reject",
+    "sendheaders"
+};
+static const std::vector<std::string> vAllNetMessageTypes(ppszNetMessageTypes, ppszNetMessageTypes + ARRAYLEN(ppszNetMessageTypes));
+
+const char *NET_MESSAGE_COMMAND_OTHER = "*other*";
+
+const std::vector<std::string> &getAllNetMessageTypes()
+{
+    return vAllNetMessageTypes;
+}
+
 CMessageHeader::CMessageHeader()
 {
     memcpy(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE);
@@ -63,6 +63,11 @@ public:
     unsigned int nChecksum;
 };
 
+/** All message types known to this node. Per-command statistics are only kept
+ *  for these, other commands are accounted under NET_MESSAGE_COMMAND_OTHER. */
+const std::vector<std::string> &getAllNetMessageTypes();
+extern const char *NET_MESSAGE_COMMAND_OTHER;
+
 /** nServices flags */
 enum {
     NODE_NETWORK = (1 << 0),
@@ -9,7 +9,6 @@
 
 #include "alert.h"
 #include "chainparams.h"
-#include "checkpoints.h"
 #include "clientversion.h"
 #include "main.h"
 #include "net.h"
@@ -61,8 +60,7 @@ int ClientModel::getNumConnections(unsigned int flags) const
 
 int ClientModel::getNumBlocks() const
 {
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainTipSummary()->nHeight;
 }
 
 int ClientModel::getNumBlocksAtStartup()
@@ -81,29 +79,36 @@ quint64 ClientModel::getTotalBytesSent() const
     return CNode::GetTotalBytesSent();
 }
 
+QMap<QString, quint64> ClientModel::getTotalBytesPerMsgType() const
+{
+    MsgCmdStatsMap mapStats;
+    std::map<std::string, CLatencyHistogram> mapHistograms;
+    CNode::GetTotalMsgCmdStats(mapStats, mapHistograms);
+
+    QMap<QString, quint64> result;
+    for (MsgCmdStatsMap::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it)
+        result.insert(QString::fromStdString(it->first), it->second.nSendBytes + it->second.nRecvBytes);
+    return result;
+}
+
 QDateTime ClientModel::getLastBlockDate() const
 {
-    LOCK(cs_main);
-    if (chainActive.Tip())
-        return QDateTime::fromTime_t(chainActive.Tip()->GetBlockTime());
+    CChainTipSummaryRef tip = GetChainTipSummary();
+    if (tip->pindex)
+        return QDateTime::fromTime_t(tip->nTime);
     else
         return QDateTime::fromTime_t(Params().GenesisBlock().GetBlockTime()); // Genesis block's time of current network
 }
 
 double ClientModel::getVerificationProgress() const
 {
-    LOCK(cs_main);
-    return Checkpoints::GuessVerificationProgress(chainActive.Tip());
+    return GetChainTipSummary()->dVerificationProgress;
 }
 
 void ClientModel::updateTimer()
 {
-    // Get required lock upfront. This avoids the GUI from getting stuck on
-    // periodical polls if the core is holding the locks for a longer time -
-    // for example, during a wallet rescan.
-    TRY_LOCK(cs_main, lockMain);
-    if(!lockMain)
-        return;
+    // Does not need cs_main, so the GUI keeps up while the core holds it for
+    // a long time, for example while connecting a block or during a wallet rescan.
     // Some quantities (such as number of blocks) change so fast that we don't want to be notified for each change.
     // Periodically check and update with a timer.
     int newNumBlocks = getNumBlocks();
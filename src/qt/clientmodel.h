@@ -5,7 +5,9 @@
 #ifndef BITCOIN_QT_CLIENTMODEL_H
 #define BITCOIN_QT_CLIENTMODEL_H
 
+#include <QMap>
 #include <QObject>
+#include <QString>
 
 class AddressTableModel;
 class OptionsModel;
@@ -52,6 +54,8 @@ public:
 
     quint64 getTotalBytesRecv() const;
     quint64 getTotalBytesSent() const;
+    //! Total bytes sent and received per network message type
+    QMap<QString, quint64> getTotalBytesPerMsgType() const;
 
     double getVerificationProgress() const;
     QDateTime getLastBlockDate() const;
@@ -12,6 +12,7 @@
 #include <cmath>
 
 #define DESIRED_SAMPLES         800
+#define MSGTYPES_SHOWN          5
 
 #define XMARGIN                 10
 #define YMARGIN                 10
@@ -37,6 +38,7 @@ void TrafficGraphWidget::setClientModel(ClientModel *model)
     if(model) {
         nLastBytesIn = model->getTotalBytesRecv();
         nLastBytesOut = model->getTotalBytesSent();
+        mapLastBytesPerMsgType = model->getTotalBytesPerMsgType();
     }
 }
 
@@ -116,6 +118,29 @@ void TrafficGraphWidget::paintEvent(QPaintEvent *)
         painter.setPen(Qt::red);
         painter.drawPath(p);
     }
+
+    // list the message types that used the most bandwidth in the last sample
+    painter.setPen(Qt::white);
+    int yy = YMARGIN + painter.fontMetrics().height();
+    for(int i = 0; i < vMsgTypeRates.size() && i < MSGTYPES_SHOWN; ++i) {
+        if(vMsgTypeRates.at(i).first <= 0.0f)
+            break;
+        QString text = QString("%1: %2 %3").arg(vMsgTypeRates.at(i).second).arg(vMsgTypeRates.at(i).first, 0, 'f', 1).arg(units);
+        painter.drawText(width() - XMARGIN - painter.fontMetrics().width(text), yy, text);
+        yy += painter.fontMetrics().height();
+    }
+}
+
+void TrafficGraphWidget::updateMsgTypeRates()
+{
+    QMap<QString, quint64> mapBytes = clientModel->getTotalBytesPerMsgType();
+    vMsgTypeRates.clear();
+    for(QMap<QString, quint64>::const_iterator it = mapBytes.constBegin(); it != mapBytes.constEnd(); ++it) {
+        float rate = (it.value() - mapLastBytesPerMsgType.value(it.key(), 0)) / 1024.0f * 1000 / timer->interval();
+        vMsgTypeRates.append(qMakePair(rate, it.key()));
+    }
+    qSort(vMsgTypeRates.begin(), vMsgTypeRates.end(), qGreater<QPair<float, QString> >());
+    mapLastBytesPerMsgType = mapBytes;
 }
 
 void TrafficGraphWidget::updateRates()
@@ -130,6 +155,7 @@ void TrafficGraphWidget::updateRates()
     vSamplesOut.push_front(outRate);
     nLastBytesIn = bytesIn;
     nLastBytesOut = bytesOut;
+    updateMsgTypeRates();
 
     while(vSamplesIn.size() > DESIRED_SAMPLES) {
         vSamplesIn.pop_back();
@@ -165,11 +191,13 @@ void TrafficGraphWidget::clear()
 
     vSamplesOut.clear();
     vSamplesIn.clear();
+    vMsgTypeRates.clear();
     fMax = 0.0f;
 
     if(clientModel) {
         nLastBytesIn = clientModel->getTotalBytesRecv();
         nLastBytesOut = clientModel->getTotalBytesSent();
+        mapLastBytesPerMsgType = clientModel->getTotalBytesPerMsgType();
     }
     timer->start();
 }
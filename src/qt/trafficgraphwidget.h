@@ -5,8 +5,12 @@
 #ifndef BITCOIN_QT_TRAFFICGRAPHWIDGET_H
 #define BITCOIN_QT_TRAFFICGRAPHWIDGET_H
 
-#include <QWidget>
+#include <QList>
+#include <QMap>
+#include <QPair>
 #include <QQueue>
+#include <QString>
+#include <QWidget>
 
 class ClientModel;
 
@@ -34,6 +38,7 @@ public slots:
 
 private:
     void paintPath(QPainterPath &path, QQueue<float> &samples);
+    void updateMsgTypeRates();
 
     QTimer *timer;
     float fMax;
@@ -42,6 +47,10 @@ private:
     QQueue<float> vSamplesOut;
     quint64 nLastBytesIn;
     quint64 nLastBytesOut;
+    //! Bytes per message type at the last sample
+    QMap<QString, quint64> mapLastBytesPerMsgType;
+    //! KB/s per message type over the last sample, busiest first
+    QList<QPair<float, QString> > vMsgTypeRates;
     ClientModel *clientModel;
 };
 
@@ -6,9 +6,11 @@
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
+#include "rpccache.h"
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
+#include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
@@ -17,6 +19,11 @@
 using namespace std;
 using namespace json_spirit;
 
+//! Most headers, or block hashes, returned by one request
+static const size_t MAX_REST_HEADERS_RESULTS = 2000;
+//! Most outpoints looked up by one getutxos request
+static const size_t MAX_GETUTXOS_OUTPOINTS = 1000;
+
 enum RetFormat {
     RF_UNDEF,
     RF_BINARY,
@@ -41,8 +48,27 @@ public:
     string message;
 };
 
+/** An unspent output, as returned by getutxos */
+struct CCoin {
+    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside SerializationOp
+    uint32_t nHeight;
+    CTxOut out;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nTxVer);
+        READWRITE(nHeight);
+        READWRITE(out);
+    }
+};
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
-extern Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, CJSONStreamWriter& writer, bool txDetails = false);
+extern void blockheaderToJSON(const CBlockIndex* blockindex, CJSONStreamWriter& writer);
+extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeHex);
 
 static RestErr RESTERR(enum HTTPStatusCode status, string message)
 {
@@ -91,6 +117,7 @@ static bool ParseHashStr(const string& strReq, uint256& v)
 
 static bool rest_block(AcceptedConnection* conn,
                        string& strReq,
+                       const string& strBody,
                        map<string, string>& mapHeaders,
                        bool fRun,
                        bool showTxDetails)
@@ -103,38 +130,61 @@ static bool rest_block(AcceptedConnection* conn,
     if (!ParseHashStr(hashStr, hash))
         throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
-    CBlockIndex* pblockindex = NULL;
-    {
-        LOCK(cs_main);
-        if (mapBlockIndex.count(hash) == 0)
-            throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
+    if (rf == RF_UNDEF)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
 
-        pblockindex = mapBlockIndex[hash];
-        if (!ReadBlockFromDisk(block, pblockindex))
-            throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
-    }
+    string strKey = strprintf("rest/block %s %d %d", hash.GetHex(), rf, showTxDetails);
+    string strReply;
+    if (!rpcResponseCache.Get(strKey, strReply)) {
+        uint64_t nCacheGeneration = rpcResponseCache.GetGeneration();
+
+        CBlock block;
+        CBlockIndex* pblockindex = NULL;
+        bool fCacheable;
+        {
+            LOCK(cs_main);
+            if (mapBlockIndex.count(hash) == 0)
+                throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
+            pblockindex = mapBlockIndex[hash];
+            if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+                throw RESTERR(HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
+
+            if (!ReadBlockFromDisk(block, pblockindex))
+                throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
+
+            fCacheable = rpcResponseCache.IsCacheable(pblockindex);
+        }
+
+        if (rf == RF_JSON) {
+            std::ostringstream ssJSON;
+            CJSONStreamWriter writer(ssJSON);
+            blockToJSON(block, pblockindex, writer, showTxDetails);
+            ssJSON << "\n";
+            strReply = ssJSON.str();
+        } else {
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+            ssBlock << block;
+            strReply = rf == RF_BINARY ? ssBlock.str() : HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        }
+
+        if (fCacheable)
+            rpcResponseCache.Put(strKey, strReply, pblockindex->nHeight, rf == RF_JSON, nCacheGeneration);
+    }
 
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryBlock.size(), "application/octet-stream") << binaryBlock << std::flush;
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strReply.size(), "application/octet-stream") << strReply << std::flush;
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        conn->stream() << HTTPReply(HTTP_OK, strReply, fRun, false, "text/plain") << std::flush;
         return true;
     }
 
     case RF_JSON: {
-        Object objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = write_string(Value(objBlock), false) + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        conn->stream() << HTTPReply(HTTP_OK, strReply, fRun) << std::flush;
         return true;
     }
 
@@ -149,22 +199,25 @@ static bool rest_block(AcceptedConnection* conn,
 
 static bool rest_block_extended(AcceptedConnection* conn,
                        string& strReq,
+                       const string& strBody,
                        map<string, string>& mapHeaders,
                        bool fRun)
 {
-    return rest_block(conn, strReq, mapHeaders, fRun, true);
+    return rest_block(conn, strReq, strBody, mapHeaders, fRun, true);
 }
 
 static bool rest_block_notxdetails(AcceptedConnection* conn,
                        string& strReq,
+                       const string& strBody,
                        map<string, string>& mapHeaders,
                        bool fRun)
 {
-    return rest_block(conn, strReq, mapHeaders, fRun, false);
+    return rest_block(conn, strReq, strBody, mapHeaders, fRun, false);
 }
 
 static bool rest_tx(AcceptedConnection* conn,
                     string& strReq,
+                    const string& strBody,
                     map<string, string>& mapHeaders,
                     bool fRun)
 {
@@ -214,20 +267,419 @@ static bool rest_tx(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_headers(AcceptedConnection* conn,
+                         string& strReq,
+                         const string& strBody,
+                         map<string, string>& mapHeaders,
+                         bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+
+    int32_t nCount;
+    if (!ParseInt32(path[0], &nCount) || nCount < 1 || (size_t)nCount > MAX_REST_HEADERS_RESULTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Header count out of range (1-%u): %s", MAX_REST_HEADERS_RESULTS, path[0]));
+
+    string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    // Entries of the block index stay in place, and the fields of their headers
+    // do not change, so they are written after releasing cs_main
+    vector<const CBlockIndex*> headers;
+    headers.reserve(nCount);
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindex = mapBlockIndex[hash];
+        while (pindex != NULL && chainActive.Contains(pindex)) {
+            headers.push_back(pindex);
+            if (headers.size() == (size_t)nCount)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    if (rf == RF_BINARY || rf == RF_HEX) {
+        BOOST_FOREACH(const CBlockIndex* pindex, headers)
+            ssHeader << pindex->GetBlockHeader();
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        string binaryHeader = ssHeader.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryHeader.size(), "application/octet-stream") << binaryHeader << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ssHeader.begin(), ssHeader.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        std::ostringstream ssJSON;
+        CJSONStreamWriter writer(ssJSON);
+        writer.BeginArray();
+        BOOST_FOREACH(const CBlockIndex* pindex, headers)
+            blockheaderToJSON(pindex, writer);
+        writer.EndArray();
+        ssJSON << "\n";
+        conn->stream() << HTTPReply(HTTP_OK, ssJSON.str(), fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_blockhash_by_height(AcceptedConnection* conn,
+                                     string& strReq,
+                                     const string& strBody,
+                                     map<string, string>& mapHeaders,
+                                     bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    // Either <height>, or <count>/<height> for the hashes of count blocks from height on
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+    if (path.size() > 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "Use /rest/blockhashbyheight/<height>.<ext> or /rest/blockhashbyheight/<count>/<height>.<ext>.");
+
+    bool fRange = path.size() == 2;
+    int32_t nCount = 1;
+    if (fRange && (!ParseInt32(path[0], &nCount) || nCount < 1 || (size_t)nCount > MAX_REST_HEADERS_RESULTS))
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Block count out of range (1-%u): %s", MAX_REST_HEADERS_RESULTS, path[0]));
+
+    int32_t nHeight;
+    if (!ParseInt32(path.back(), &nHeight) || nHeight < 0)
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid height: " + path.back());
+
+    vector<uint256> vHash;
+    {
+        LOCK(cs_main);
+        if (nHeight > chainActive.Height())
+            throw RESTERR(HTTP_NOT_FOUND, "Block height out of range");
+        int nEnd = std::min(chainActive.Height(), nHeight + nCount - 1);
+        vHash.reserve(nEnd - nHeight + 1);
+        for (int n = nHeight; n <= nEnd; n++)
+            vHash.push_back(chainActive[n]->GetBlockHash());
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssHash(SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_FOREACH(const uint256& hash, vHash)
+            ssHash << hash;
+        string binaryHash = ssHash.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryHash.size(), "application/octet-stream") << binaryHash << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex;
+        BOOST_FOREACH(const uint256& hash, vHash)
+            strHex += hash.GetHex() + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        std::ostringstream ssJSON;
+        CJSONStreamWriter writer(ssJSON);
+        if (fRange) {
+            writer.BeginArray();
+            BOOST_FOREACH(const uint256& hash, vHash)
+                writer.Write(hash.GetHex());
+            writer.EndArray();
+        } else {
+            writer.BeginObject();
+            writer.Write("blockhash", vHash[0].GetHex());
+            writer.EndObject();
+        }
+        ssJSON << "\n";
+        conn->stream() << HTTPReply(HTTP_OK, ssJSON.str(), fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_spent(AcceptedConnection* conn,
+                       string& strReq,
+                       const string& strBody,
+                       map<string, string>& mapHeaders,
+                       bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    // /rest/spent/<txid>-<n>.<ext>, or /rest/spent/checkmempool/<txid>-<n>.<ext> to include the mem pool
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+    bool fCheckMemPool = path.size() == 2 && path[0] == "checkmempool";
+    if (path.size() != (fCheckMemPool ? 2U : 1U))
+        throw RESTERR(HTTP_BAD_REQUEST, "Use /rest/spent/<txid>-<n>.<ext> or /rest/spent/checkmempool/<txid>-<n>.<ext>.");
+
+    const string& strOutPoint = path.back();
+    size_t nDash = strOutPoint.find("-");
+    uint256 txid;
+    int32_t nOutput;
+    if (nDash == string::npos || !ParseInt32(strOutPoint.substr(nDash + 1), &nOutput) || nOutput < 0 || !ParseHashStr(strOutPoint.substr(0, nDash), txid))
+        throw RESTERR(HTTP_BAD_REQUEST, "Parse error: " + strOutPoint);
+
+    if (!fSpentIndex)
+        throw RESTERR(HTTP_NOT_FOUND, "Spent index not enabled (restart with -spentindex and -reindex)");
+
+    CSpentIndexValue spent;
+    if (!GetSpentIndex(CSpentIndexKey(txid, nOutput), spent, fCheckMemPool))
+        throw RESTERR(HTTP_NOT_FOUND, strOutPoint + " not spent");
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssSpent(SER_NETWORK, PROTOCOL_VERSION);
+        ssSpent << spent;
+        string binarySpent = ssSpent.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binarySpent.size(), "application/octet-stream") << binarySpent << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        CDataStream ssSpent(SER_NETWORK, PROTOCOL_VERSION);
+        ssSpent << spent;
+        string strHex = HexStr(ssSpent.begin(), ssSpent.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        std::ostringstream ssJSON;
+        CJSONStreamWriter writer(ssJSON);
+        writer.BeginObject();
+        writer.Write("txid", spent.txid.GetHex());
+        writer.Write("index", (int64_t)spent.nInputIndex);
+        if (spent.nHeight < 0) {
+            writer.Write("confirmations", 0);
+        } else {
+            writer.Write("height", spent.nHeight);
+            writer.Write("confirmations", std::max(1, GetChainTipSummary()->nHeight - spent.nHeight + 1));
+        }
+        writer.EndObject();
+        ssJSON << "\n";
+        conn->stream() << HTTPReply(HTTP_OK, ssJSON.str(), fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_getutxos(AcceptedConnection* conn,
+                          string& strReq,
+                          const string& strBody,
+                          map<string, string>& mapHeaders,
+                          bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    vector<string> uriParts;
+    if (params.size() > 0 && params[0].length() > 1) {
+        string strUriParams = params[0].substr(1);
+        boost::split(uriParts, strUriParams, boost::is_any_of("/"));
+    }
+
+    // throw exception in case of an empty request
+    if (strBody.length() == 0 && uriParts.size() == 0)
+        throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+
+    bool fCheckMemPool = false;
+    vector<COutPoint> vOutPoints;
+
+    // The outpoints come either in the URI (/rest/getutxos/checkmempool/txid1-n/txid2-n/...),
+    // or, for the binary and hex formats, as the body of a POST in that format
+    if (uriParts.size() > 0) {
+        if (uriParts[0] == "checkmempool")
+            fCheckMemPool = true;
+
+        for (size_t i = fCheckMemPool ? 1 : 0; i < uriParts.size(); i++) {
+            size_t nDash = uriParts[i].find("-");
+            if (nDash == string::npos)
+                throw RESTERR(HTTP_BAD_REQUEST, "Parse error: " + uriParts[i]);
+
+            uint256 txid;
+            int32_t nOutput;
+            string strTxid = uriParts[i].substr(0, nDash);
+            string strOutput = uriParts[i].substr(nDash + 1);
+            if (!ParseInt32(strOutput, &nOutput) || nOutput < 0 || !ParseHashStr(strTxid, txid))
+                throw RESTERR(HTTP_BAD_REQUEST, "Parse error: " + uriParts[i]);
+
+            vOutPoints.push_back(COutPoint(txid, (uint32_t)nOutput));
+        }
+
+        if (vOutPoints.empty())
+            throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+        if (strBody.length() > 0)
+            throw RESTERR(HTTP_BAD_REQUEST, "Combination of URI scheme inputs and raw post data is not allowed");
+    } else {
+        if (rf != RF_BINARY && rf != RF_HEX)
+            throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+
+        vector<unsigned char> vchBody;
+        if (rf == RF_HEX) {
+            string strHex = boost::trim_copy(strBody);
+            if (!IsHex(strHex))
+                throw RESTERR(HTTP_BAD_REQUEST, "Parse error: invalid hex");
+            vchBody = ParseHex(strHex);
+        } else {
+            vchBody.assign(strBody.begin(), strBody.end());
+        }
+
+        try {
+            CDataStream ssRequest(vchBody, SER_NETWORK, PROTOCOL_VERSION);
+            ssRequest >> fCheckMemPool;
+            ssRequest >> vOutPoints;
+        } catch (const std::exception&) {
+            // abort in case of unreadable binary data
+            throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+        }
+    }
+
+    if (vOutPoints.size() > MAX_GETUTXOS_OUTPOINTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Error: max outpoints exceeded (max: %u, tried: %u)", MAX_GETUTXOS_OUTPOINTS, vOutPoints.size()));
+
+    // A bit per outpoint, the lowest bit of the first byte for the first one,
+    // set if it is unspent; and the outputs that are
+    vector<unsigned char> bitmap((vOutPoints.size() + 7) / 8, 0);
+    string bitmapStringRepresentation;
+    vector<CCoin> outs;
+    int nHeight;
+    uint256 hashTip;
+    {
+        LOCK2(cs_main, mempool.cs);
+
+        CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
+        const CCoinsView& view = fCheckMemPool ? static_cast<const CCoinsView&>(viewMempool) : *pcoinsTip;
+
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            Coin coin;
+            bool fHit = false;
+            if (view.GetCoin(vOutPoints[i], coin) && !(fCheckMemPool && mempool.isSpent(vOutPoints[i]))) {
+                fHit = true;
+                CCoin out;
+                out.nTxVer = coin.nVersion;
+                out.nHeight = coin.nHeight;
+                out.out = coin.out;
+                assert(!out.out.IsNull());
+                outs.push_back(out);
+            }
+
+            if (fHit)
+                bitmap[i / 8] |= 1 << (i % 8);
+            bitmapStringRepresentation.append(fHit ? "1" : "0");
+        }
+
+        nHeight = chainActive.Height();
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        // serialize data
+        // use exact same output as mentioned in Bip64
+        CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
+        ssGetUTXOResponse << nHeight << hashTip << bitmap << outs;
+        if (rf == RF_BINARY) {
+            string ssGetUTXOResponseString = ssGetUTXOResponse.str();
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, ssGetUTXOResponseString.size(), "application/octet-stream") << ssGetUTXOResponseString << std::flush;
+        } else {
+            string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
+            conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        }
+        return true;
+    }
+
+    case RF_JSON: {
+        std::ostringstream ssJSON;
+        CJSONStreamWriter writer(ssJSON);
+        writer.BeginObject();
+        writer.Write("chainHeight", nHeight);
+        writer.Write("chaintipHash", hashTip.GetHex());
+        writer.Write("bitmap", bitmapStringRepresentation);
+        writer.BeginArray("utxos");
+        BOOST_FOREACH(const CCoin& coin, outs) {
+            writer.BeginObject();
+            writer.Write("txvers", (int64_t)coin.nTxVer);
+            writer.Write("height", (int64_t)coin.nHeight);
+            writer.Write("value", ValueFromAmount(coin.out.nValue));
+
+            Object o;
+            ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
+            writer.Write("scriptPubKey", o);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+        ssJSON << "\n";
+        conn->stream() << HTTPReply(HTTP_OK, ssJSON.str(), fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
                     string& strURI,
+                    const string& strBody,
                     map<string, string>& mapHeaders,
                     bool fRun);
 } uri_prefixes[] = {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/headers/", rest_headers},
+      {"/rest/blockhashbyheight/", rest_blockhash_by_height},
+      {"/rest/getutxos", rest_getutxos},
+      {"/rest/spent/", rest_spent},
 };
 
 bool HTTPReq_REST(AcceptedConnection* conn,
                   string& strURI,
+                  string& strRequest,
                   map<string, string>& mapHeaders,
                   bool fRun)
 {
@@ -240,7 +692,7 @@ bool HTTPReq_REST(AcceptedConnection* conn,
             unsigned int plen = strlen(uri_prefixes[i].prefix);
             if (strURI.substr(0, plen) == uri_prefixes[i].prefix) {
                 string strReq = strURI.substr(plen);
-                return uri_prefixes[i].handler(conn, strReq, mapHeaders, fRun);
+                return uri_prefixes[i].handler(conn, strReq, strRequest, mapHeaders, fRun);
             }
         }
     } catch (RestErr& re) {
@@ -0,0 +1,79 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_REWARDLEDGER_H
+#define BITCOIN_REWARDLEDGER_H
+
+#include "amount.h"
+#include "serialize.h"
+
+#include <stdint.h>
+
+/** How the reward of a block came about (see CDmcSystem::GetBlockReward) */
+enum RewardDecision
+{
+    //! Fixed schedule, before the live price feed
+    REWARD_SCHEDULE = 0,
+    //! Same as the previous block: the price met the target, or the reward is at a limit
+    REWARD_HOLD = 1,
+    //! One coin more, as the price was above the target
+    REWARD_RAISE = 2,
+    //! One coin less, as the price was below the target
+    REWARD_LOWER = 3,
+};
+
+/** Key of a reward ledger record ('w'), sorting by height */
+struct CRewardLedgerKey
+{
+    uint32_t nHeight;
+
+    CRewardLedgerKey() : nHeight(0) {}
+    explicit CRewardLedgerKey(uint32_t nHeightIn) : nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        char chType = 'w';
+        READWRITE(chType);
+        READWRITE(REF(CBigEndian32(nHeight)));
+    }
+};
+
+/**
+ * Reward ledger record of the block at a height of the active chain: its
+ * reward, and what that was decided on. Prices are in USD1 units.
+ */
+struct CRewardLedgerEntry
+{
+    uint32_t nTime;
+    CAmount nReward;
+    //! Whether the price the reward was decided on is known: it is the
+    //! scheduled one before the live feed, but the miner's feed price after
+    bool fPriceKnown;
+    //! That price, if known; 0 otherwise
+    CAmount nPrice;
+    //! The target price the reward was stepped against; 0 for the schedule
+    CAmount nTargetPrice;
+    unsigned char nDecision;
+
+    CRewardLedgerEntry() : nTime(0), nReward(0), fPriceKnown(false), nPrice(0), nTargetPrice(0), nDecision(REWARD_SCHEDULE) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nTime);
+        READWRITE(VARINT(nReward));
+        READWRITE(fPriceKnown);
+        if (fPriceKnown)
+            READWRITE(VARINT(nPrice));
+        else if (ser_action.ForRead())
+            nPrice = 0;
+        READWRITE(VARINT(nTargetPrice));
+        READWRITE(nDecision);
+    }
+};
+
+#endif // BITCOIN_REWARDLEDGER_H
@@ -0,0 +1,256 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "base58.h"
+#include "main.h"
+#include "rpcserver.h"
+#include "txdb.h"
+#include "utilstrencodings.h"
+
+#include <stdint.h>
+
+#include "json/json_spirit_value.h"
+
+using namespace json_spirit;
+using namespace std;
+
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
+
+//! Default and largest number of entries getaddresshistory and getaddressutxos return at once
+static const int DEFAULT_ADDRESS_INDEX_RESULTS = 1000;
+static const int MAX_ADDRESS_INDEX_RESULTS = 10000;
+
+static void ParseAddressIndexAddress(const Value& value, unsigned char& nAddressType, uint160& hashAddress)
+{
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled (restart with -addressindex and -reindex)");
+    CBitcoinAddress address(value.get_str());
+    if (!address.IsValid() || !GetAddressIndexKey(address.Get(), nAddressType, hashAddress))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid DynamicCoin address");
+}
+
+static int ParseAddressIndexCount(const Array& params, unsigned int nParam)
+{
+    int nCount = params.size() > nParam ? params[nParam].get_int() : DEFAULT_ADDRESS_INDEX_RESULTS;
+    if (nCount < 1 || nCount > MAX_ADDRESS_INDEX_RESULTS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Count must be between 1 and %d", MAX_ADDRESS_INDEX_RESULTS));
+    return nCount;
+}
+
+/** The cursor of a page is the key of the first entry of the next one, hex encoded */
+template <typename K>
+static string AddressIndexCursor(const K& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+template <typename K>
+static void ParseAddressIndexCursor(const Value& value, unsigned char nAddressType, const uint160& hashAddress, K& key)
+{
+    vector<unsigned char> vch = ParseHexV(value, "cursor");
+    CDataStream ss(vch, SER_DISK, CLIENT_VERSION);
+    bool fValid = true;
+    try {
+        ss >> key;
+    } catch (const std::exception&) {
+        fValid = false;
+    }
+    if (!fValid || !ss.empty() || key.nAddressType != nAddressType || key.hashAddress != hashAddress)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor for this address");
+}
+
+Value getaddresshistory(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 6)
+        throw runtime_error(
+            "getaddresshistory \"address\" ( startheight endheight count \"cursor\" includetx )\n"
+            "\nReturns the outputs paid to an address and the inputs spending them, in the order of the chain.\n"
+            "Requires -addressindex. Block files are only read with includetx.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The DynamicCoin address\n"
+            "2. startheight   (numeric, optional, default=0) The first height to return entries of\n"
+            "3. endheight     (numeric, optional, default=-1) The last height to return entries of (-1 for the tip)\n"
+            "4. count         (numeric, optional, default=" + itostr(DEFAULT_ADDRESS_INDEX_RESULTS) + ") The most entries to return (at most " + itostr(MAX_ADDRESS_INDEX_RESULTS) + ")\n"
+            "5. \"cursor\"      (string, optional) The cursor returned with the previous page, to go on from there (overrides startheight)\n"
+            "6. includetx     (boolean, optional, default=false) Whether to include the decoded transactions\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"history\": [\n"
+            "    {\n"
+            "      \"txid\": \"id\",          (string) The transaction id\n"
+            "      \"height\": n,           (numeric) The height of its block\n"
+            "      \"blockindex\": n,       (numeric) Its position in the block\n"
+            "      \"index\": n,            (numeric) The output paid to the address, or the input spending from it\n"
+            "      \"spending\": true|false, (boolean) Whether it spends from the address\n"
+            "      \"amount\": x.xxx,       (numeric) The amount in dmc, negative when spending\n"
+            "      \"tx\": {...}            (object) With includetx, the transaction as decoderawtransaction returns it\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"cursor\": \"hex\"          (string) Only if there are more entries: pass it to get the next page\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresshistory", "\"DMCaddr\"")
+            + HelpExampleCli("getaddresshistory", "\"DMCaddr\" 1000 2000 100")
+            + HelpExampleRpc("getaddresshistory", "\"DMCaddr\", 1000, 2000, 100")
+        );
+
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    ParseAddressIndexAddress(params[0], nAddressType, hashAddress);
+
+    // Entries of a block that is being connected are left out until it is the tip
+    CChainTipSummaryRef tip = GetChainTipSummary();
+    int nStartHeight = params.size() > 1 ? params[1].get_int() : 0;
+    int nEndHeight = params.size() > 2 ? params[2].get_int() : -1;
+    if (nStartHeight < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Start height out of range");
+    if (nEndHeight < 0 || nEndHeight > tip->nHeight)
+        nEndHeight = tip->nHeight;
+    int nCount = ParseAddressIndexCount(params, 3);
+    CAddressIndexKey keyStart(nAddressType, hashAddress, nStartHeight, 0, uint256(0), 0, false);
+    if (params.size() > 4 && !params[4].get_str().empty())
+        ParseAddressIndexCursor(params[4], nAddressType, hashAddress, keyStart);
+    bool fIncludeTx = params.size() > 5 && params[5].get_bool();
+
+    // One more than asked for, to know where the next page starts
+    vector<pair<CAddressIndexKey, CAmount> > vIndex;
+    if (nEndHeight >= 0 && !pblocktree->ReadAddressIndex(keyStart, nEndHeight, nCount + 1, vIndex))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    Array history;
+    CBlock block;
+    const CBlockIndex* pindexBlock = NULL;
+    for (int i = 0; i < (int)vIndex.size() && i < nCount; i++) {
+        const CAddressIndexKey& key = vIndex[i].first;
+        Object entry;
+        entry.push_back(Pair("txid", key.txid.GetHex()));
+        entry.push_back(Pair("height", (int)key.nHeight));
+        entry.push_back(Pair("blockindex", (int)key.nTxIndex));
+        entry.push_back(Pair("index", (int)key.nIndex));
+        entry.push_back(Pair("spending", key.fSpending));
+        entry.push_back(Pair("amount", ValueFromAmount(vIndex[i].second)));
+        if (fIncludeTx) {
+            // The tip and its ancestors can be read without cs_main; the block
+            // files of an address index are never pruned
+            if (pindexBlock == NULL || pindexBlock->nHeight != (int)key.nHeight) {
+                pindexBlock = tip->pindex->GetAncestor(key.nHeight);
+                if (!ReadBlockFromDisk(block, pindexBlock))
+                    throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+            }
+            if (key.nTxIndex >= block.vtx.size() || block.vtx[key.nTxIndex].GetHash() != key.txid)
+                throw JSONRPCError(RPC_MISC_ERROR, "The chain was reorganized meanwhile, try again");
+            Object tx;
+            TxToJSON(block.vtx[key.nTxIndex], uint256(0), tx);
+            entry.push_back(Pair("tx", tx));
+        }
+        history.push_back(entry);
+    }
+
+    Object result;
+    result.push_back(Pair("history", history));
+    if ((int)vIndex.size() > nCount)
+        result.push_back(Pair("cursor", AddressIndexCursor(vIndex.back().first)));
+    return result;
+}
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddressutxos \"address\" ( count \"cursor\" )\n"
+            "\nReturns the unspent outputs paid to an address, oldest first. Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The DynamicCoin address\n"
+            "2. count         (numeric, optional, default=" + itostr(DEFAULT_ADDRESS_INDEX_RESULTS) + ") The most outputs to return (at most " + itostr(MAX_ADDRESS_INDEX_RESULTS) + ")\n"
+            "3. \"cursor\"      (string, optional) The cursor returned with the previous page, to go on from there\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"utxos\": [\n"
+            "    {\n"
+            "      \"txid\": \"id\",          (string) The transaction id\n"
+            "      \"vout\": n,             (numeric) The output\n"
+            "      \"amount\": x.xxx,       (numeric) The amount in dmc\n"
+            "      \"height\": n,           (numeric) The height of the block of the transaction\n"
+            "      \"confirmations\": n,    (numeric) The number of confirmations\n"
+            "      \"coinbase\": true|false, (boolean) Whether it is a coinbase output\n"
+            "      \"scriptPubKey\": \"hex\"  (string) The script of the output\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"cursor\": \"hex\"          (string) Only if there are more outputs: pass it to get the next page\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "\"DMCaddr\"")
+            + HelpExampleRpc("getaddressutxos", "\"DMCaddr\", 100")
+        );
+
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    ParseAddressIndexAddress(params[0], nAddressType, hashAddress);
+    int nCount = ParseAddressIndexCount(params, 1);
+    CAddressUnspentKey keyStart(nAddressType, hashAddress, 0, uint256(0), 0);
+    if (params.size() > 2 && !params[2].get_str().empty())
+        ParseAddressIndexCursor(params[2], nAddressType, hashAddress, keyStart);
+
+    CChainTipSummaryRef tip = GetChainTipSummary();
+    vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    if (!pblocktree->ReadAddressUnspentIndex(keyStart, nCount + 1, vUnspent))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    Array utxos;
+    for (int i = 0; i < (int)vUnspent.size() && i < nCount; i++) {
+        const CAddressUnspentKey& key = vUnspent[i].first;
+        const CAddressUnspentValue& value = vUnspent[i].second;
+        Object entry;
+        entry.push_back(Pair("txid", key.txid.GetHex()));
+        entry.push_back(Pair("vout", (int)key.nIndex));
+        entry.push_back(Pair("amount", ValueFromAmount(value.nValue)));
+        entry.push_back(Pair("height", (int)key.nHeight));
+        entry.push_back(Pair("confirmations", std::max(tip->nHeight - (int)key.nHeight + 1, 0)));
+        entry.push_back(Pair("coinbase", value.fCoinBase));
+        entry.push_back(Pair("scriptPubKey", HexStr(value.scriptPubKey.begin(), value.scriptPubKey.end())));
+        utxos.push_back(entry);
+    }
+
+    Object result;
+    result.push_back(Pair("utxos", utxos));
+    if ((int)vUnspent.size() > nCount)
+        result.push_back(Pair("cursor", AddressIndexCursor(vUnspent.back().first)));
+    return result;
+}
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\"\n"
+            "\nReturns the total of the unspent outputs paid to an address. Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The DynamicCoin address\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\": x.xxx,  (numeric) The total of the unspent outputs in dmc\n"
+            "  \"utxos\": n         (numeric) The number of unspent outputs\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"DMCaddr\"")
+            + HelpExampleRpc("getaddressbalance", "\"DMCaddr\"")
+        );
+
+    unsigned char nAddressType;
+    uint160 hashAddress;
+    ParseAddressIndexAddress(params[0], nAddressType, hashAddress);
+
+    CAmount nBalance;
+    uint64_t nOutputs;
+    if (!pblocktree->ReadAddressBalance(nAddressType, hashAddress, nBalance, nOutputs))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    Object result;
+    result.push_back(Pair("balance", ValueFromAmount(nBalance)));
+    result.push_back(Pair("utxos", nOutputs));
+    return result;
+}
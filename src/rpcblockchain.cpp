@@ -5,13 +5,19 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "checkpoints.h"
+#include "hash.h"
 #include "main.h"
+#include "rpccache.h"
 #include "rpcserver.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
 #include "json/json_spirit_value.h"
 
 using namespace json_spirit;
@@ -47,59 +53,115 @@ double GetDifficulty(const CBlockIndex* blockindex)
     // minimum difficulty = 1.0.
     if (blockindex == NULL)
     {
-        if (chainActive.Tip() == NULL)
+        CChainTipSummaryRef tip = GetChainTipSummary();
+        if (tip->pindex == NULL)
             return 1.0;
-        else
-            blockindex = chainActive.Tip();
+        return GetDifficultyForNBits(tip->nBits);
     }
 
     return GetDifficultyForNBits(blockindex->nBits);
 }
 
+/**
+ * Whether the reward of a block and the total up to it are known: the blocks
+ * below a loaded UTXO snapshot only have placeholders until they are
+ * validated (the snapshot block has its totals from the snapshot header).
+ */
+static bool RewardKnown(const CBlockIndex* blockindex)
+{
+    AssertLockHeld(cs_main);
+    if (!(blockindex->nStatus & BLOCK_ASSUMED_VALID))
+        return true;
+    const CBlockIndex *pnext = chainActive.Next(blockindex);
+    return pnext == NULL || !(pnext->nStatus & BLOCK_ASSUMED_VALID);
+}
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, CJSONStreamWriter& writer, bool txDetails = false)
 {
-    Object result;
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
-    result.push_back(Pair("pow", block.GetPoW().GetHex()));
     int confirmations = -1;
-    // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    Array txs;
+    CBlockIndex *pnext;
+    bool fRewardKnown;
+    {
+        LOCK(cs_main);
+        // Only report confirmations if the block is on the main chain
+        if (chainActive.Contains(blockindex))
+            confirmations = chainActive.Height() - blockindex->nHeight + 1;
+        pnext = chainActive.Next(blockindex);
+        fRewardKnown = RewardKnown(blockindex);
+    }
+
+    writer.BeginObject();
+    writer.Write("hash", block.GetHash().GetHex());
+    writer.Write("pow", block.GetPoW().GetHex());
+    writer.Write("confirmations", confirmations);
+    writer.Write("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.Write("height", blockindex->nHeight);
+    writer.Write("version", block.nVersion);
+    writer.Write("merkleroot", block.hashMerkleRoot.GetHex());
+    writer.BeginArray("tx");
     BOOST_FOREACH(const CTransaction&tx, block.vtx)
     {
         if(txDetails)
         {
             Object objTx;
             TxToJSON(tx, uint256(0), objTx);
-            txs.push_back(objTx);
+            writer.Write(objTx);
         }
         else
-            txs.push_back(tx.GetHash().GetHex());
+            writer.Write(tx.GetHash().GetHex());
     }
-    result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
-    result.push_back(Pair("chainreward", blockindex->nChainReward));
-    result.push_back(Pair("reward", blockindex->nReward));
+    writer.EndArray();
+    writer.Write("time", block.GetBlockTime());
+    writer.Write("nonce", (uint64_t)block.nNonce);
+    writer.Write("bits", strprintf("%08x", block.nBits));
+    writer.Write("difficulty", GetDifficulty(blockindex));
+    writer.Write("chainwork", blockindex->nChainWork.GetHex());
+    writer.Write("chainreward", fRewardKnown ? Value(blockindex->nChainReward) : Value());
+    writer.Write("reward", fRewardKnown ? Value(blockindex->nReward) : Value());
 
     if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+        writer.Write("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
     if (pnext)
-        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
-    return result;
+        writer.Write("nextblockhash", pnext->GetBlockHash().GetHex());
+    writer.EndObject();
 }
 
+void blockheaderToJSON(const CBlockIndex* blockindex, CJSONStreamWriter& writer)
+{
+    int confirmations = -1;
+    CBlockIndex *pnext;
+    bool fRewardKnown;
+    {
+        LOCK(cs_main);
+        // Only report confirmations if the block is on the main chain
+        if (chainActive.Contains(blockindex))
+            confirmations = chainActive.Height() - blockindex->nHeight + 1;
+        pnext = chainActive.Next(blockindex);
+        fRewardKnown = RewardKnown(blockindex);
+    }
+
+    writer.BeginObject();
+    writer.Write("hash", blockindex->GetBlockHash().GetHex());
+    writer.Write("pow", blockindex->GetBlockPoW().GetHex());
+    writer.Write("confirmations", confirmations);
+    writer.Write("height", blockindex->nHeight);
+    writer.Write("version", blockindex->nVersion);
+    writer.Write("merkleroot", blockindex->hashMerkleRoot.GetHex());
+    writer.Write("time", blockindex->GetBlockTime());
+    writer.Write("mediantime", blockindex->GetMedianTimePast());
+    writer.Write("nonce", (uint64_t)blockindex->nNonce);
+    writer.Write("bits", strprintf("%08x", blockindex->nBits));
+    writer.Write("difficulty", GetDifficulty(blockindex));
+    writer.Write("chainwork", blockindex->nChainWork.GetHex());
+    writer.Write("chainreward", fRewardKnown ? Value(blockindex->nChainReward) : Value());
+    writer.Write("reward", fRewardKnown ? Value(blockindex->nReward) : Value());
+
+    if (blockindex->pprev)
+        writer.Write("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+    if (pnext)
+        writer.Write("nextblockhash", pnext->GetBlockHash().GetHex());
+    writer.EndObject();
+}
 
 Value getblockcount(const Array& params, bool fHelp)
 {
@@ -114,7 +176,7 @@ Value getblockcount(const Array& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    return chainActive.Height();
+    return GetChainTipSummary()->nHeight;
 }
 
 Value getbestblockhash(const Array& params, bool fHelp)
@@ -130,7 +192,7 @@ Value getbestblockhash(const Array& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainTipSummary()->hash.GetHex();
 }
 
 Value getdifficulty(const Array& params, bool fHelp)
@@ -150,7 +212,25 @@ Value getdifficulty(const Array& params, bool fHelp)
 }
 
 
+//! What getrawmempool reports of a transaction, copied so that the mempool need not be locked while it is written
+struct CMempoolEntryInfo
+{
+    uint256 hash;
+    unsigned int nSize;
+    CAmount nFee;
+    int64_t nTime;
+    unsigned int nHeight;
+    double dStartingPriority;
+    double dCurrentPriority;
+    set<string> setDepends;
+};
+
 Value getrawmempool(const Array& params, bool fHelp)
+{
+    return StreamToValue(getrawmempool, params, fHelp);
+}
+
+void getrawmempool(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() > 1)
         throw runtime_error(
@@ -188,42 +268,58 @@ Value getrawmempool(const Array& params, bool fHelp)
 
     if (fVerbose)
     {
-        LOCK(mempool.cs);
-        Object o;
-        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
+        vector<CMempoolEntryInfo> vInfo;
         {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
-            Object info;
-            info.push_back(Pair("size", (int)e.GetTxSize()));
-            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-            info.push_back(Pair("time", e.GetTime()));
-            info.push_back(Pair("height", (int)e.GetHeight()));
-            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            LOCK2(cs_main, mempool.cs);
+            vInfo.reserve(mempool.mapTx.size());
+            BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
             {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
+                const CTxMemPoolEntry& e = entry.second;
+                vInfo.push_back(CMempoolEntryInfo());
+                CMempoolEntryInfo& info = vInfo.back();
+                info.hash = entry.first;
+                info.nSize = e.GetTxSize();
+                info.nFee = e.GetFee();
+                info.nTime = e.GetTime();
+                info.nHeight = e.GetHeight();
+                info.dStartingPriority = e.GetPriority(e.GetHeight());
+                info.dCurrentPriority = e.GetPriority(chainActive.Height());
+                const CTransaction& tx = e.GetTx();
+                BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                {
+                    if (mempool.exists(txin.prevout.hash))
+                        info.setDepends.insert(txin.prevout.hash.ToString());
+                }
             }
-            Array depends(setDepends.begin(), setDepends.end());
-            info.push_back(Pair("depends", depends));
-            o.push_back(Pair(hash.ToString(), info));
         }
-        return o;
+
+        writer.BeginObject();
+        BOOST_FOREACH(const CMempoolEntryInfo& info, vInfo)
+        {
+            writer.BeginObject(info.hash.ToString());
+            writer.Write("size", (int)info.nSize);
+            writer.Write("fee", ValueFromAmount(info.nFee));
+            writer.Write("time", info.nTime);
+            writer.Write("height", (int)info.nHeight);
+            writer.Write("startingpriority", info.dStartingPriority);
+            writer.Write("currentpriority", info.dCurrentPriority);
+            writer.BeginArray("depends");
+            BOOST_FOREACH(const string& strDepend, info.setDepends)
+                writer.Write(strDepend);
+            writer.EndArray();
+            writer.EndObject();
+        }
+        writer.EndObject();
     }
     else
     {
         vector<uint256> vtxid;
         mempool.queryHashes(vtxid);
 
-        Array a;
+        writer.BeginArray();
         BOOST_FOREACH(const uint256& hash, vtxid)
-            a.push_back(hash.ToString());
-
-        return a;
+            writer.Write(hash.ToString());
+        writer.EndArray();
     }
 }
 
@@ -242,6 +338,8 @@ Value getblockhash(const Array& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
+    LOCK(cs_main);
+
     int nHeight = params[0].get_int();
     if (nHeight < 0 || nHeight > chainActive.Height())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
@@ -250,7 +348,132 @@ Value getblockhash(const Array& params, bool fHelp)
     return pblockindex->GetBlockHash().GetHex();
 }
 
+//! Default and largest number of hashes getblockhashesbytime returns at once
+static const int DEFAULT_BLOCK_HASHES_BY_TIME = 1000;
+static const int MAX_BLOCK_HASHES_BY_TIME = 10000;
+
+Value getblockhashesbytime(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "getblockhashesbytime starttime endtime ( count )\n"
+            "\nReturns the hashes of the blocks in best-block-chain within a time range, oldest first.\n"
+            "Blocks are placed in time by their median time past, which unlike the block time never decreases\n"
+            "along the chain; the range is found by binary search.\n"
+            "\nArguments:\n"
+            "1. starttime     (numeric, required) The earliest time, in seconds since epoch (Jan 1 1970 GMT)\n"
+            "2. endtime       (numeric, required) The latest time, in seconds since epoch (Jan 1 1970 GMT)\n"
+            "3. count         (numeric, optional, default=" + itostr(DEFAULT_BLOCK_HASHES_BY_TIME) + ") The most hashes to return (at most " + itostr(MAX_BLOCK_HASHES_BY_TIME) + ")\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"hash\"         (string) The block hash\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockhashesbytime", "1441880383 1441966783")
+            + HelpExampleRpc("getblockhashesbytime", "1441880383, 1441966783")
+        );
+
+    int64_t nStartTime = params[0].get_int64();
+    int64_t nEndTime = params[1].get_int64();
+    int nCount = params.size() > 2 ? params[2].get_int() : DEFAULT_BLOCK_HASHES_BY_TIME;
+    if (nCount < 1 || nCount > MAX_BLOCK_HASHES_BY_TIME)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Count must be between 1 and %d", MAX_BLOCK_HASHES_BY_TIME));
+
+    Array ret;
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.FindEarliestAtLeast(nStartTime);
+    for (; pindex && chainActive.GetTimeMax(pindex->nHeight) <= nEndTime && (int)ret.size() < nCount; pindex = chainActive.Next(pindex))
+        ret.push_back(pindex->GetBlockHash().GetHex());
+    return ret;
+}
+
+static const char* RewardDecisionName(unsigned char nDecision)
+{
+    switch (nDecision) {
+    case REWARD_SCHEDULE: return "schedule";
+    case REWARD_HOLD: return "hold";
+    case REWARD_RAISE: return "raise";
+    case REWARD_LOWER: return "lower";
+    }
+    return "unknown";
+}
+
+static bool RewardLedgerEntryToJSON(CJSONStreamWriter& writer, uint32_t nHeight, const CRewardLedgerEntry& entry)
+{
+    writer.BeginObject();
+    writer.Write("height", (int)nHeight);
+    writer.Write("time", (int64_t)entry.nTime);
+    writer.Write("reward", entry.nReward);
+    if (entry.fPriceKnown)
+        writer.Write("price", entry.nPrice);
+    else
+        writer.Write("price", Value());
+    writer.Write("targetprice", entry.nTargetPrice);
+    writer.Write("decision", RewardDecisionName(entry.nDecision));
+    writer.EndObject();
+    return true;
+}
+
+Value getrewardhistory(const Array& params, bool fHelp)
+{
+    return StreamToValue(getrewardhistory, params, fHelp);
+}
+
+void getrewardhistory(const Array& params, bool fHelp, CJSONStreamWriter& writer)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getrewardhistory startheight endheight\n"
+            "\nReturns the reward ledger of the blocks in best-block-chain within a height range, oldest first:\n"
+            "the reward of each block and the prices it was decided on.\n"
+            "\nArguments:\n"
+            "1. startheight     (numeric, required) The first height\n"
+            "2. endheight       (numeric, required) The last height; capped at the current block count\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"height\" : n,       (numeric) The block height\n"
+            "    \"time\" : n,         (numeric) The block time in seconds since epoch (Jan 1 1970 GMT)\n"
+            "    \"reward\" : n,       (numeric) The block reward in satoshis\n"
+            "    \"price\" : n,        (numeric) The price the reward was decided on, in 1/1000 USD: the scheduled one before\n"
+            "                          the live feed; null after, as blocks do not carry the feed price their miner used\n"
+            "    \"targetprice\" : n,  (numeric) The target price the reward was stepped against, in 1/1000 USD; 0 on the schedule\n"
+            "    \"decision\" : \"xxx\", (string) \"schedule\", or how the reward changed on the previous one: \"raise\", \"lower\" or \"hold\"\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrewardhistory", "200000 201000")
+            + HelpExampleRpc("getrewardhistory", "200000, 201000")
+        );
+
+    int nStartHeight = params[0].get_int();
+    int nEndHeight = params[1].get_int();
+    if (nStartHeight < 0 || nEndHeight < nStartHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid height range");
+    nEndHeight = std::min(nEndHeight, GetChainTipSummary()->nHeight);
+
+    CBlockTreeDB* pblocktreedb;
+    {
+        LOCK(cs_main);
+        pblocktreedb = pblocktree;
+    }
+
+    // Written out record by record while iterating over the database
+    writer.BeginArray();
+    if (nStartHeight <= nEndHeight &&
+        !pblocktreedb->ReadRewardLedger(nStartHeight, nEndHeight, boost::bind(&RewardLedgerEntryToJSON, boost::ref(writer), _1, _2)))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the reward ledger");
+    writer.EndArray();
+}
+
 Value getblock(const Array& params, bool fHelp)
+{
+    return StreamToValue(getblock, params, fHelp);
+}
+
+void getblock(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -293,33 +516,107 @@ Value getblock(const Array& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    std::string strKey = strprintf("getblock %s %d", hash.GetHex(), fVerbose);
+    std::string strReply;
+    if (rpcResponseCache.Get(strKey, strReply)) {
+        writer.WriteRaw(strReply);
+        return;
+    }
+    uint64_t nCacheGeneration = rpcResponseCache.GetGeneration();
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    CBlockIndex* pblockindex;
+    bool fCacheable;
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+        pblockindex = mapBlockIndex[hash];
+
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        if(!ReadBlockFromDisk(block, pblockindex))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+        fCacheable = rpcResponseCache.IsCacheable(pblockindex);
+    }
+
+    // A reply to be cached is written to a string first
+    std::ostringstream ssReply;
+    CJSONStreamWriter writerReply(ssReply);
+    CJSONStreamWriter& writerOut = fCacheable ? writerReply : writer;
 
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        writerOut.Write(strHex);
     }
+    else
+        blockToJSON(block, pblockindex, writerOut);
 
-    return blockToJSON(block, pblockindex);
+    if (fCacheable) {
+        strReply = ssReply.str();
+        rpcResponseCache.Put(strKey, strReply, pblockindex->nHeight, fVerbose, nCacheGeneration);
+        writer.WriteRaw(strReply);
+    }
+}
+
+/**
+ * Hash of the unspent outputs as gettxoutsetinfo has always reported it: the
+ * outputs of each transaction serialized together, in the order of the
+ * cursor. That is txid order, except that outputs still stored in the old
+ * per-transaction layout come after the others until they are upgraded.
+ */
+static bool GetHashSerialized(CCoinsViewCursor *pcursor, uint256 &hash)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << pcursor->GetBestBlock();
+    bool fInTx = false;
+    uint256 txid;
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+                return false;
+            if (!fInTx || key.hash != txid) {
+                if (fInTx)
+                    ss << VARINT(0);
+                txid = key.hash;
+                fInTx = true;
+                ss << txid;
+                ss << VARINT(coin.nVersion);
+                ss << (coin.fCoinBase ? 'c' : 'n');
+                ss << VARINT(coin.nHeight);
+            }
+            ss << VARINT(key.n + 1);
+            ss << coin.out;
+        }
+    } catch (const std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (fInTx)
+        ss << VARINT(0);
+    hash = ss.GetHash();
+    return true;
 }
 
 Value gettxoutsetinfo(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( include_hash )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "The statistics are maintained as blocks are connected; right after upgrading\n"
+            "from an older version they are computed in the background first.\n"
+            "\nArguments:\n"
+            "1. include_hash    (boolean, optional, default=false) Also compute hash_serialized, which\n"
+            "                   takes a pass over the whole set\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -327,30 +624,210 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (only with include_hash)\n"
+            "  \"muhash\": \"hash\",    (string) Order-independent hash of the unspent outputs\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "true")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    bool fIncludeHash = params.size() > 0 && params[0].get_bool();
+
     Object ret;
 
     CCoinsStats stats;
     FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
-        ret.push_back(Pair("height", (int64_t)stats.nHeight));
-        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
-        ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
-        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
-        ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
-        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    if (!pcoinsTip->GetStats(stats))
+        throw JSONRPCError(RPC_IN_WARMUP, "UTXO set statistics are still being computed");
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
+    if (fIncludeHash) {
+        uint256 hashSerialized;
+        boost::scoped_ptr<CCoinsViewCursor> pcursor(pcoinsTip->Cursor());
+        if (!pcursor || pcursor->GetBestBlock() != stats.hashBlock || !GetHashSerialized(pcursor.get(), hashSerialized))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the coin database");
+        ret.push_back(Pair("hash_serialized", hashSerialized.GetHex()));
     }
+    ret.push_back(Pair("muhash", stats.hashMuHash.GetHex()));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     return ret;
 }
 
+Value dumptxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at the current tip to a snapshot file.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",      (string) The file written\n"
+            "  \"bestblock\": \"hex\",  (string) The block the snapshot belongs to\n"
+            "  \"height\": n,           (numeric) The height of that block\n"
+            "  \"transactions\": n,     (numeric) The number of transactions with unspent outputs\n"
+            "  \"muhash\": \"hash\"     (string) Order-independent hash of the unspent outputs\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    CUTXOSnapshotHeader header;
+    std::string strError;
+    if (!DumpUTXOSnapshot(params[0].get_str(), header, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    Object ret;
+    ret.push_back(Pair("path", params[0].get_str()));
+    ret.push_back(Pair("bestblock", header.hashBlock.GetHex()));
+    ret.push_back(Pair("height", header.nHeight));
+    ret.push_back(Pair("transactions", (int64_t)header.nTransactions));
+    ret.push_back(Pair("muhash", header.hashMuHash.GetHex()));
+    return ret;
+}
+
+Value loadtxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "loadtxoutset \"path\"\n"
+            "\nReplace the chain state with a snapshot written by dumptxoutset, and continue\n"
+            "synchronizing from the snapshot block. Only possible before any block after the\n"
+            "genesis block is connected, and once the header of the snapshot block is known.\n"
+            "The blocks below the snapshot are downloaded and validated in the background;\n"
+            "the node shuts down if they do not lead to the same unspent output set.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The snapshot file, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hex\",  (string) The block the snapshot belongs to\n"
+            "  \"height\": n,           (numeric) The height of that block\n"
+            "  \"transactions\": n,     (numeric) The number of transactions with unspent outputs\n"
+            "  \"muhash\": \"hash\"     (string) Order-independent hash of the unspent outputs\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\"")
+        );
+
+    CUTXOSnapshotHeader header;
+    std::string strError;
+    if (!LoadUTXOSnapshot(params[0].get_str(), header, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    Object ret;
+    ret.push_back(Pair("bestblock", header.hashBlock.GetHex()));
+    ret.push_back(Pair("height", header.nHeight));
+    ret.push_back(Pair("transactions", (int64_t)header.nTransactions));
+    ret.push_back(Pair("muhash", header.hashMuHash.GetHex()));
+    return ret;
+}
+
+static Object DBStatsToJSON(const CLevelDBStats& stats)
+{
+    Object ret;
+    ret.push_back(Pair("profile", stats.strProfile));
+    ret.push_back(Pair("writebuffer", (uint64_t)stats.nWriteBufferSize));
+    ret.push_back(Pair("blockcache", (uint64_t)stats.nBlockCacheSize));
+    ret.push_back(Pair("maxopenfiles", stats.nMaxOpenFiles));
+    ret.push_back(Pair("approximatesize", stats.nApproximateSize));
+    Array files;
+    BOOST_FOREACH(int nFiles, stats.vFilesAtLevel)
+        files.push_back(nFiles);
+    ret.push_back(Pair("filesatlevel", files));
+    ret.push_back(Pair("stats", stats.strStats));
+    ret.push_back(Pair("byteswritten", stats.nBytesWritten));
+    return ret;
+}
+
+Value getdbstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "\nReturns the settings and the state of the chain state and block index databases.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {           (object) The chain state database\n"
+            "    \"profile\": \"name\",       (string) The profile in use (ibd, steady or default)\n"
+            "    \"writebuffer\": n,        (numeric) Size of the write buffer in bytes\n"
+            "    \"blockcache\": n,         (numeric) Size of the block cache in bytes\n"
+            "    \"maxopenfiles\": n,       (numeric) The number of table files kept open\n"
+            "    \"approximatesize\": n,    (numeric) Approximate size on disk in bytes\n"
+            "    \"filesatlevel\": [n,...], (array) The number of table files at each level\n"
+            "    \"stats\": \"text\",         (string) Compaction statistics of LevelDB\n"
+            "    \"byteswritten\": n        (numeric) Size of the keys and values written since startup\n"
+            "  },\n"
+            "  \"blockindex\": {...}       (object) The block index database, as above\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    CCoinsViewDB* pcoinsdb;
+    CBlockTreeDB* pblocktreedb;
+    {
+        LOCK(cs_main);
+        pcoinsdb = pcoinsdbview;
+        pblocktreedb = pblocktree;
+    }
+
+    Object ret;
+    CLevelDBStats stats;
+    pcoinsdb->GetDBStats(stats);
+    ret.push_back(Pair("chainstate", DBStatsToJSON(stats)));
+    pblocktreedb->GetStats(stats);
+    ret.push_back(Pair("blockindex", DBStatsToJSON(stats)));
+    return ret;
+}
+
+Value compactdb(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "compactdb ( \"database\" )\n"
+            "\nCompact a database completely, which makes reads faster after a long initial\n"
+            "block download. This takes a while; blocks are still processed meanwhile.\n"
+            "\nArguments:\n"
+            "1. \"database\"    (string, optional) chainstate or blockindex; both if omitted\n"
+            "\nResult:\n"
+            "n    (numeric) The time the compaction took, in seconds\n"
+            "\nExamples:\n"
+            + HelpExampleCli("compactdb", "")
+            + HelpExampleCli("compactdb", "\"chainstate\"")
+            + HelpExampleRpc("compactdb", "\"chainstate\"")
+        );
+
+    std::string strDatabase = params.size() > 0 ? params[0].get_str() : "";
+    if (strDatabase != "" && strDatabase != "chainstate" && strDatabase != "blockindex")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown database " + strDatabase);
+
+    CCoinsViewDB* pcoinsdb;
+    CBlockTreeDB* pblocktreedb;
+    {
+        LOCK(cs_main);
+        pcoinsdb = pcoinsdbview;
+        pblocktreedb = pblocktree;
+    }
+
+    // Without cs_main: reads and writes continue while LevelDB compacts
+    int64_t nStart = GetTimeMillis();
+    if (strDatabase != "blockindex")
+        pcoinsdb->Compact();
+    if (strDatabase != "chainstate")
+        pblocktreedb->Compact();
+    return (GetTimeMillis() - nStart) / 1000.0;
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -398,37 +875,89 @@ Value gettxout(const Array& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return Value::null;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return Value::null;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return Value::null;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return Value::null;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if ((unsigned int)coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", pindex->nHeight - coin.nHeight + 1));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     Object o;
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("version", coin.nVersion));
+    ret.push_back(Pair("coinbase", coin.fCoinBase));
 
     return ret;
 }
 
+Value getspentinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "getspentinfo \"txid\" n ( includemempool )\n"
+            "\nReturns the input spending a transaction output, without scanning blocks.\n"
+            "Requires -spentindex.\n"
+            "\nArguments:\n"
+            "1. \"txid\"       (string, required) The transaction id\n"
+            "2. n              (numeric, required) vout value\n"
+            "3. includemempool  (boolean, optional, default=true) Whether to include spends in the mem pool\n"
+            "\nResult (null when the output is not spent):\n"
+            "{\n"
+            "  \"txid\" : \"hash\",         (string) The spending transaction id\n"
+            "  \"index\" : n,             (numeric) The input of the spending transaction\n"
+            "  \"height\" : n,            (numeric) The height of the block of the spending transaction (not set for the mem pool)\n"
+            "  \"confirmations\" : n      (numeric) The number of confirmations of the spend\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "\"txid\" 1")
+            + HelpExampleRpc("getspentinfo", "\"txid\", 1")
+        );
+
+    if (!fSpentIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index not enabled (restart with -spentindex and -reindex)");
+
+    uint256 hash = ParseHashV(params[0], "txid");
+    int n = params[1].get_int();
+    if (n < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid vout");
+    bool fMempool = true;
+    if (params.size() > 2)
+        fMempool = params[2].get_bool();
+
+    CSpentIndexValue spent;
+    if (!GetSpentIndex(CSpentIndexKey(hash, n), spent, fMempool))
+        return Value::null;
+
+    Object ret;
+    ret.push_back(Pair("txid", spent.txid.GetHex()));
+    ret.push_back(Pair("index", (int64_t)spent.nInputIndex));
+    if (spent.nHeight < 0) {
+        ret.push_back(Pair("confirmations", 0));
+    } else {
+        // The index is written as a block is connected, just before it becomes the tip
+        ret.push_back(Pair("height", spent.nHeight));
+        ret.push_back(Pair("confirmations", std::max(1, GetChainTipSummary()->nHeight - spent.nHeight + 1)));
+    }
+    return ret;
+}
+
 Value verifychain(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -470,22 +999,83 @@ Value getblockchaininfo(const Array& params, bool fHelp)
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
+            "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
+            "  \"flushes\": {            (object) chain state flushes to disk\n"
+            "    \"count\": n,            (numeric) number of flushes committed in the background\n"
+            "    \"pending\": true|false, (boolean) whether a flush is being committed\n"
+            "    \"stall\": {...},        (object) time spent blocking validation per flush, in microseconds (mean, p50, p90, p99, max)\n"
+            "    \"commit\": {...}        (object) time the background commit took, in microseconds (mean, p50, p90, p99, max)\n"
+            "  },\n"
+            "  \"coinscache\": {         (object) in-memory cache of the UTXO set\n"
+            "    \"entries\": xxxxx,      (numeric) number of cached transactions\n"
+            "    \"usage\": xxxxx,        (numeric) memory used by the cache, in bytes\n"
+            "    \"limit\": xxxxx,        (numeric) memory the cache may use before it is trimmed or flushed (-dbcache), in bytes\n"
+            "    \"pendingusage\": xxxxx  (numeric) memory held by the flush being committed, in bytes\n"
+            "  },\n"
+            "  \"blockindex\": {         (object) in-memory index of all known block headers\n"
+            "    \"entries\": xxxxx,      (numeric) number of headers\n"
+            "    \"usage\": xxxxx         (numeric) memory used by the index, in bytes\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getblockchaininfo", "")
             + HelpExampleRpc("getblockchaininfo", "")
         );
 
+    // The tip comes from its summary; the rest still needs cs_main
+    CChainTipSummaryRef tip = GetChainTipSummary();
+    int nHeaders, nPruneHeight = 0;
+    uint64_t nCoinsEntries, nCoinsUsage, nBlockIndexEntries, nBlockIndexUsage;
+    {
+        LOCK(cs_main);
+        nHeaders = pindexBestHeader ? pindexBestHeader->nHeight : -1;
+        if (fPruneMode) {
+            CBlockIndex *block = chainActive.Tip();
+            while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+                block = block->pprev;
+            nPruneHeight = block->nHeight;
+        }
+        nCoinsEntries = pcoinsTip->GetCacheSize();
+        nCoinsUsage = pcoinsTip->DynamicMemoryUsage();
+        nBlockIndexEntries = mapBlockIndex.size();
+        nBlockIndexUsage = mapBlockIndex.DynamicMemoryUsage();
+    }
+
     Object obj;
     obj.push_back(Pair("chain",                 Params().NetworkIDString()));
-    obj.push_back(Pair("blocks",                (int)chainActive.Height()));
-    obj.push_back(Pair("headers",               pindexBestHeader ? pindexBestHeader->nHeight : -1));
-    obj.push_back(Pair("bestblockhash",         chainActive.Tip()->GetBlockHash().GetHex()));
-    obj.push_back(Pair("difficulty",            (double)GetDifficulty()));
-    obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(chainActive.Tip())));
-    obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
-    obj.push_back(Pair("chainreward",           chainActive.Tip()->nChainReward));
-    obj.push_back(Pair("reward",                chainActive.Tip()->nReward));
+    obj.push_back(Pair("blocks",                tip->nHeight));
+    obj.push_back(Pair("headers",               nHeaders));
+    obj.push_back(Pair("bestblockhash",         tip->hash.GetHex()));
+    obj.push_back(Pair("difficulty",            tip->pindex ? GetDifficultyForNBits(tip->nBits) : 1.0));
+    obj.push_back(Pair("verificationprogress",  tip->dVerificationProgress));
+    obj.push_back(Pair("chainwork",             tip->nChainWork.GetHex()));
+    obj.push_back(Pair("chainreward",           tip->nChainReward));
+    obj.push_back(Pair("reward",                tip->nReward));
+    obj.push_back(Pair("pruned",                fPruneMode));
+    if (fPruneMode)
+        obj.push_back(Pair("pruneheight",       nPruneHeight));
+
+    CFlushStats flushstats;
+    GetFlushStats(flushstats);
+    Object flushes;
+    flushes.push_back(Pair("count", flushstats.nFlushes));
+    flushes.push_back(Pair("pending", flushstats.fPending));
+    flushes.push_back(Pair("stall", HistogramToJSON(flushstats.histStall)));
+    flushes.push_back(Pair("commit", HistogramToJSON(flushstats.histCommit)));
+    obj.push_back(Pair("flushes", flushes));
+
+    Object coinscache;
+    coinscache.push_back(Pair("entries", nCoinsEntries));
+    coinscache.push_back(Pair("usage", nCoinsUsage));
+    coinscache.push_back(Pair("limit", (uint64_t)nCoinCacheUsage));
+    coinscache.push_back(Pair("pendingusage", (uint64_t)flushstats.nPendingUsage));
+    obj.push_back(Pair("coinscache", coinscache));
+
+    Object blockindex;
+    blockindex.push_back(Pair("entries", nBlockIndexEntries));
+    blockindex.push_back(Pair("usage", nBlockIndexUsage));
+    obj.push_back(Pair("blockindex", blockindex));
     return obj;
 }
 
@@ -560,7 +1150,7 @@ Value getchaintips(const Array& params, bool fHelp)
         Object obj;
         obj.push_back(Pair("height", block->nHeight));
         obj.push_back(Pair("hash", block->phashBlock->GetHex()));
-        obj.push_back(Pair("pow", block->pPowBlock->GetHex()));
+        obj.push_back(Pair("pow", block->GetBlockPoW().GetHex()));
 
         const int branchLen = block->nHeight - chainActive.FindFork(block)->nHeight;
         obj.push_back(Pair("branchlen", branchLen));
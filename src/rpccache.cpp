@@ -0,0 +1,167 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpccache.h"
+
+#include "chain.h"
+#include "memusage.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+using namespace std;
+
+//! Bytes an entry takes besides its strings: the list node, and the node and bucket of the map
+static const size_t ENTRY_OVERHEAD = 160;
+
+static const string strConfirmations = "\"confirmations\":";
+
+CRPCResponseCache rpcResponseCache;
+
+CRPCResponseCache::CRPCResponseCache() :
+    nBytes(0), nMaxBytes(0), nMinDepth(DEFAULT_RPC_CACHE_DEPTH), nTipHeight(-1), nGeneration(0),
+    nHits(0), nMisses(0), nInserted(0), nEvicted(0), nInvalidated(0)
+{
+}
+
+void CRPCResponseCache::SetLimits(size_t nMaxBytesIn, int nMinDepthIn, int nTipHeightIn)
+{
+    LOCK(cs);
+    nMaxBytes = nMaxBytesIn;
+    // The reply about a block names the next one, so that has to be there
+    nMinDepth = std::max(nMinDepthIn, 2);
+    nTipHeight = nTipHeightIn;
+    while (nBytes > nMaxBytes)
+        Erase(--listEntries.end());
+}
+
+bool CRPCResponseCache::IsCacheable(const CBlockIndex* pindex) const
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+    return nMaxBytes > 0 && chainActive.Contains(pindex) && chainActive.Height() - pindex->nHeight + 1 >= nMinDepth;
+}
+
+uint64_t CRPCResponseCache::GetGeneration() const
+{
+    LOCK(cs);
+    return nGeneration;
+}
+
+bool CRPCResponseCache::Get(const string& strKey, string& strReply)
+{
+    LOCK(cs);
+    if (nMaxBytes == 0)
+        return false;
+    boost::unordered_map<string, EntryList::iterator>::iterator mi = mapEntries.find(strKey);
+    if (mi == mapEntries.end()) {
+        nMisses++;
+        return false;
+    }
+    nHits++;
+    listEntries.splice(listEntries.begin(), listEntries, mi->second);
+    const CEntry& entry = *mi->second;
+    if (entry.fConfirmations)
+        strReply = entry.strReply + itostr(nTipHeight - entry.nHeight + 1) + entry.strSuffix;
+    else
+        strReply = entry.strReply;
+    return true;
+}
+
+void CRPCResponseCache::Put(const string& strKey, const string& strReply, int nHeight, bool fConfirmations, uint64_t nGenerationIn)
+{
+    CEntry entry;
+    entry.strKey = strKey;
+    entry.fConfirmations = false;
+    entry.nHeight = nHeight;
+    if (fConfirmations) {
+        // Split the reply around the number. Inside JSON strings quotes are
+        // escaped, so the first match is a key.
+        size_t nPos = strReply.find(strConfirmations);
+        if (nPos != string::npos) {
+            nPos += strConfirmations.size();
+            size_t nEnd = strReply.find_first_not_of("-0123456789", nPos);
+            if (nEnd == string::npos)
+                nEnd = strReply.size();
+            entry.strReply = strReply.substr(0, nPos);
+            entry.strSuffix = strReply.substr(nEnd);
+            entry.fConfirmations = true;
+        }
+    }
+    if (!entry.fConfirmations)
+        entry.strReply = strReply;
+    entry.nUsage = 2 * memusage::MallocUsage(strKey.size() + 1) + memusage::MallocUsage(entry.strReply.size() + 1) +
+                   memusage::MallocUsage(entry.strSuffix.size() + 1) + ENTRY_OVERHEAD;
+
+    LOCK(cs);
+    // Too large, or about a block that may have been disconnected since the reply was made
+    if (entry.nUsage > nMaxBytes || nGenerationIn != nGeneration || nHeight > nTipHeight)
+        return;
+    boost::unordered_map<string, EntryList::iterator>::iterator mi = mapEntries.find(strKey);
+    if (mi != mapEntries.end())
+        Erase(mi->second);
+    while (nBytes + entry.nUsage > nMaxBytes) {
+        Erase(--listEntries.end());
+        nEvicted++;
+    }
+    listEntries.push_front(entry);
+    mapEntries[strKey] = listEntries.begin();
+    nBytes += entry.nUsage;
+    nInserted++;
+}
+
+void CRPCResponseCache::Erase(EntryList::iterator it)
+{
+    nBytes -= it->nUsage;
+    mapEntries.erase(it->strKey);
+    listEntries.erase(it);
+}
+
+void CRPCResponseCache::Clear()
+{
+    LOCK(cs);
+    listEntries.clear();
+    mapEntries.clear();
+    nBytes = 0;
+    nGeneration++;
+}
+
+void CRPCResponseCache::GetStats(CRPCCacheStats& stats) const
+{
+    LOCK(cs);
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nInserted = nInserted;
+    stats.nEvicted = nEvicted;
+    stats.nInvalidated = nInvalidated;
+    stats.nEntries = mapEntries.size();
+    stats.nBytes = nBytes;
+    stats.nMaxBytes = nMaxBytes;
+    stats.nMinDepth = nMinDepth;
+}
+
+void CRPCResponseCache::UpdatedBlockTip(const CBlockIndex* pindexNew)
+{
+    int nHeight = pindexNew ? pindexNew->nHeight : -1;
+
+    LOCK(cs);
+    if (nHeight <= nTipHeight) {
+        // Blocks above nHeight were disconnected
+        nGeneration++;
+        size_t nDropped = 0;
+        EntryList::iterator it = listEntries.begin();
+        while (it != listEntries.end()) {
+            EntryList::iterator itNext = it;
+            itNext++;
+            if (it->nHeight >= nHeight) {
+                Erase(it);
+                nDropped++;
+            }
+            it = itNext;
+        }
+        nInvalidated += nDropped;
+        if (nDropped)
+            LogPrint("rpc", "%s: dropped %u replies, the tip went back to height %d\n", __func__, nDropped, nHeight);
+    }
+    nTipHeight = nHeight;
+}
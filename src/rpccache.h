@@ -0,0 +1,115 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPCCACHE_H
+#define BITCOIN_RPCCACHE_H
+
+#include "main.h"
+#include "sync.h"
+
+#include <list>
+#include <stdint.h>
+#include <string>
+
+#include <boost/unordered_map.hpp>
+
+/** Default for -rpccachesize, the size of the cache of replies in MiB (0 disables it) */
+static const unsigned int DEFAULT_RPC_CACHE_SIZE = 32;
+/** Default for -rpccachedepth, the confirmations a block needs for replies about it to be cached */
+static const int DEFAULT_RPC_CACHE_DEPTH = 10;
+
+struct CRPCCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserted;
+    uint64_t nEvicted;
+    uint64_t nInvalidated;
+    size_t nEntries;
+    size_t nBytes;
+    size_t nMaxBytes;
+    int nMinDepth;
+};
+
+/**
+ * Cache of serialized replies about blocks deep in the main chain, and their
+ * transactions (getblock, getrawtransaction and /rest/block/), which do not change
+ * unless a reorganization reaches that deep.
+ *
+ * Entries are keyed by the method, its parameters and the format of the reply,
+ * and the least recently used ones are evicted to stay within a budget of bytes.
+ * The number of confirmations in a JSON reply is not stored, but filled in on
+ * every hit from the height of the tip, which the cache follows through
+ * UpdatedBlockTip(). When blocks are disconnected, the entries about them are
+ * dropped, as well as those about the new tip, whose replies name the next block.
+ */
+class CRPCResponseCache : public CValidationInterface
+{
+public:
+    CRPCResponseCache();
+
+    /** Set the budget (0 disables the cache) and the depth, for a chain whose tip is at nTipHeight */
+    void SetLimits(size_t nMaxBytesIn, int nMinDepthIn, int nTipHeightIn);
+
+    /** Whether replies about pindex may be cached. cs_main must be held. */
+    bool IsCacheable(const CBlockIndex* pindex) const;
+
+    /**
+     * The generation of the cache, to be read before a reply is made and passed
+     * to Put(), so that a reply about a block that was disconnected meanwhile is
+     * not added.
+     */
+    uint64_t GetGeneration() const;
+
+    /** Look up the reply for strKey */
+    bool Get(const std::string& strKey, std::string& strReply);
+
+    /**
+     * Add the reply for strKey, about the block at nHeight. With fConfirmations,
+     * the reply is JSON and its first "confirmations" is filled in on hits.
+     */
+    void Put(const std::string& strKey, const std::string& strReply, int nHeight, bool fConfirmations, uint64_t nGenerationIn);
+
+    void Clear();
+    void GetStats(CRPCCacheStats& stats) const;
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindexNew);
+
+private:
+    struct CEntry
+    {
+        std::string strKey;
+        //! The reply; with confirmations, the parts before and after their number
+        std::string strReply;
+        std::string strSuffix;
+        bool fConfirmations;
+        int nHeight;
+        size_t nUsage;
+    };
+
+    typedef std::list<CEntry> EntryList;
+
+    mutable CCriticalSection cs;
+    //! Most recently used first
+    EntryList listEntries;
+    boost::unordered_map<std::string, EntryList::iterator> mapEntries;
+    size_t nBytes;
+    size_t nMaxBytes;
+    int nMinDepth;
+    int nTipHeight;
+    uint64_t nGeneration;
+
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserted;
+    uint64_t nEvicted;
+    uint64_t nInvalidated;
+
+    void Erase(EntryList::iterator it);
+};
+
+extern CRPCResponseCache rpcResponseCache;
+
+#endif // BITCOIN_RPCCACHE_H
@@ -44,6 +44,11 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getbalance", 1 },
     { "getbalance", 2 },
     { "getblockhash", 0 },
+    { "getblockhashesbytime", 0 },
+    { "getblockhashesbytime", 1 },
+    { "getblockhashesbytime", 2 },
+    { "getrewardhistory", 0 },
+    { "getrewardhistory", 1 },
     { "move", 2 },
     { "move", 3 },
     { "sendfrom", 2 },
@@ -76,6 +81,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendrawtransaction", 1 },
     { "gettxout", 1 },
     { "gettxout", 2 },
+    { "gettxoutsetinfo", 0 },
+    { "getspentinfo", 1 },
+    { "getspentinfo", 2 },
     { "lockunspent", 0 },
     { "lockunspent", 1 },
     { "importprivkey", 2 },
@@ -88,6 +96,11 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "estimatepriority", 0 },
     { "prioritisetransaction", 1 },
     { "prioritisetransaction", 2 },
+    { "getaddresshistory", 1 },
+    { "getaddresshistory", 2 },
+    { "getaddresshistory", 3 },
+    { "getaddresshistory", 5 },
+    { "getaddressutxos", 1 },
 };
 
 class CRPCConvertTable
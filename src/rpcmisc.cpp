@@ -74,6 +74,9 @@ Value getinfo(const Array& params, bool fHelp)
     proxyType proxy;
     GetProxy(NET_IPV4, proxy);
 
+    // Thread safe: the chain comes from the summary of its tip, and the wallet
+    // calls take their own locks
+    CChainTipSummaryRef tip = GetChainTipSummary();
     Object obj;
     obj.push_back(Pair("version", CLIENT_VERSION));
     obj.push_back(Pair("protocolversion", PROTOCOL_VERSION));
@@ -83,21 +86,26 @@ Value getinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("balance",       ValueFromAmount(pwalletMain->GetBalance())));
     }
 #endif
-    obj.push_back(Pair("blocks",        (int)chainActive.Height()));
-    obj.push_back(Pair("supply",        chainActive.Tip()->nChainReward));
-    obj.push_back(Pair("reward",        chainActive.Tip()->nReward));
+    obj.push_back(Pair("blocks",        tip->nHeight));
+    obj.push_back(Pair("supply",        tip->nChainReward));
+    obj.push_back(Pair("reward",        tip->nReward));
     obj.push_back(Pair("timeoffset",    GetTimeOffset()));
-    obj.push_back(Pair("connections",   (int)vNodes.size()));
+    {
+        LOCK(cs_vNodes);
+        obj.push_back(Pair("connections", (int)vNodes.size()));
+    }
     obj.push_back(Pair("proxy",         (proxy.IsValid() ? proxy.ToStringIPPort() : string())));
-    obj.push_back(Pair("difficulty",    (double)GetDifficulty()));
+    obj.push_back(Pair("difficulty",    tip->pindex ? GetDifficultyForNBits(tip->nBits) : 1.0));
     obj.push_back(Pair("testnet",       Params().TestnetToBeDeprecatedFieldRPC()));
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
+        // Not before GetBalance(), which takes cs_main first
+        LOCK(pwalletMain->cs_wallet);
         obj.push_back(Pair("keypoololdest", pwalletMain->GetOldestKeyPoolTime()));
         obj.push_back(Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
+        if (pwalletMain->IsCrypted())
+            obj.push_back(Pair("unlocked_until", nWalletUnlockTime));
     }
-    if (pwalletMain && pwalletMain->IsCrypted())
-        obj.push_back(Pair("unlocked_until", nWalletUnlockTime));
     obj.push_back(Pair("paytxfee",      ValueFromAmount(payTxFee.GetFeePerK())));
 #endif
     obj.push_back(Pair("relayfee",      ValueFromAmount(::minRelayTxFee.GetFeePerK())));
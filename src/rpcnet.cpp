@@ -92,6 +92,7 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
+            "    \"knownfilterbytes\": n,     (numeric) Memory used to track addresses and inventory already known to the peer\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
             "    \"pingwait\": n,             (numeric) ping wait\n"
             "    \"version\": v,              (numeric) The peer version, such as 7001\n"
@@ -101,10 +102,21 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"banscore\": n,             (numeric) The ban score\n"
             "    \"synced_headers\": n,       (numeric) The last header we have in common with this peer\n"
             "    \"synced_blocks\": n,        (numeric) The last block we have in common with this peer\n"
+            "    \"inflightlimit\": n,        (numeric) The number of blocks we allow in flight from this peer\n"
+            "    \"downloadrate\": n,         (numeric) Measured block download rate from this peer, in bytes per second\n"
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"msgtypes\": {              (object) Traffic per message type, for types seen on this connection\n"
+            "      \"type\": {\n"
+            "        \"bytessent\": n,         (numeric) Bytes sent, message headers included\n"
+            "        \"bytesrecv\": n,         (numeric) Bytes received, message headers included\n"
+            "        \"msgssent\": n,          (numeric) Number of messages sent\n"
+            "        \"msgsrecv\": n,          (numeric) Number of messages received\n"
+            "        \"processtime\": n        (numeric) Total time spent processing received messages, in microseconds\n"
+            "      }, ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -132,6 +144,7 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
+        obj.push_back(Pair("knownfilterbytes", (uint64_t)stats.nKnownFilterBytes));
         obj.push_back(Pair("pingtime", stats.dPingTime));
         if (stats.dPingWait > 0.0)
             obj.push_back(Pair("pingwait", stats.dPingWait));
@@ -146,6 +159,8 @@ Value getpeerinfo(const Array& params, bool fHelp)
             obj.push_back(Pair("banscore", statestats.nMisbehavior));
             obj.push_back(Pair("synced_headers", statestats.nSyncHeight));
             obj.push_back(Pair("synced_blocks", statestats.nCommonHeight));
+            obj.push_back(Pair("inflightlimit", statestats.nBlocksInFlightLimit));
+            obj.push_back(Pair("downloadrate", statestats.nDownloadRate));
             Array heights;
             BOOST_FOREACH(int height, statestats.vHeightInFlight) {
                 heights.push_back(height);
@@ -153,6 +168,17 @@ Value getpeerinfo(const Array& params, bool fHelp)
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        Object msgtypes;
+        BOOST_FOREACH(const PAIRTYPE(std::string, CMsgCmdStats)& item, stats.mapMsgCmdStats) {
+            Object msgtype;
+            msgtype.push_back(Pair("bytessent", item.second.nSendBytes));
+            msgtype.push_back(Pair("bytesrecv", item.second.nRecvBytes));
+            msgtype.push_back(Pair("msgssent", item.second.nSendMsgs));
+            msgtype.push_back(Pair("msgsrecv", item.second.nRecvMsgs));
+            msgtype.push_back(Pair("processtime", item.second.nProcessUsec));
+            msgtypes.push_back(Pair(item.first, msgtype));
+        }
+        obj.push_back(Pair("msgtypes", msgtypes));
 
         ret.push_back(obj);
     }
@@ -338,7 +364,23 @@ Value getnettotals(const Array& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
-            "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"timemillis\": t,       (numeric) Total cpu time\n"
+            "  \"msgtypes\": {          (object) Traffic per message type, over all peers\n"
+            "    \"type\": {\n"
+            "      \"bytessent\": n,     (numeric) Bytes sent, message headers included\n"
+            "      \"bytesrecv\": n,     (numeric) Bytes received, message headers included\n"
+            "      \"msgssent\": n,      (numeric) Number of messages sent\n"
+            "      \"msgsrecv\": n,      (numeric) Number of messages received\n"
+            "      \"processtime\": {    (object) Time spent processing received messages, in microseconds\n"
+            "        \"total\": n,       (numeric) Total over all messages\n"
+            "        \"mean\": n,        (numeric) Mean per message\n"
+            "        \"p50\": n,         (numeric) Median\n"
+            "        \"p90\": n,         (numeric) 90th percentile\n"
+            "        \"p99\": n,         (numeric) 99th percentile\n"
+            "        \"max\": n          (numeric) Slowest message\n"
+            "      }\n"
+            "    }, ...\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getnettotals", "")
@@ -349,6 +391,29 @@ Value getnettotals(const Array& params, bool fHelp)
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    MsgCmdStatsMap mapStats;
+    std::map<std::string, CLatencyHistogram> mapHistograms;
+    CNode::GetTotalMsgCmdStats(mapStats, mapHistograms);
+    Object msgtypes;
+    BOOST_FOREACH(const PAIRTYPE(std::string, CMsgCmdStats)& item, mapStats) {
+        Object msgtype;
+        msgtype.push_back(Pair("bytessent", item.second.nSendBytes));
+        msgtype.push_back(Pair("bytesrecv", item.second.nRecvBytes));
+        msgtype.push_back(Pair("msgssent", item.second.nSendMsgs));
+        msgtype.push_back(Pair("msgsrecv", item.second.nRecvMsgs));
+        const CLatencyHistogram& histogram = mapHistograms[item.first];
+        Object processtime;
+        processtime.push_back(Pair("total", item.second.nProcessUsec));
+        processtime.push_back(Pair("mean", histogram.GetMean()));
+        processtime.push_back(Pair("p50", histogram.GetPercentile(0.5)));
+        processtime.push_back(Pair("p90", histogram.GetPercentile(0.9)));
+        processtime.push_back(Pair("p99", histogram.GetPercentile(0.99)));
+        processtime.push_back(Pair("max", histogram.GetMax()));
+        msgtype.push_back(Pair("processtime", processtime));
+        msgtypes.push_back(Pair(item.first, msgtype));
+    }
+    obj.push_back(Pair("msgtypes", msgtypes));
     return obj;
 }
 
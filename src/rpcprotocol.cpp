@@ -12,6 +12,7 @@
 #include "utiltime.h"
 #include "version.h"
 
+#include <assert.h>
 #include <stdint.h>
 
 #include <boost/algorithm/string.hpp>
@@ -70,6 +71,7 @@ static const char *httpStatusDescription(int nStatus)
         case HTTP_FORBIDDEN: return "Forbidden";
         case HTTP_NOT_FOUND: return "Not Found";
         case HTTP_INTERNAL_SERVER_ERROR: return "Internal Server Error";
+        case HTTP_SERVICE_UNAVAILABLE: return "Service Unavailable";
         default: return "";
     }
 }
@@ -98,13 +100,13 @@ string HTTPError(int nStatus, bool keepalive, bool headersOnly)
                      headersOnly, "text/plain");
 }
 
-string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const char *contentType)
+static string HTTPReplyHeader(int nStatus, bool keepalive, const string& strLengthHeader, const char *contentType)
 {
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
             "Date: %s\r\n"
             "Connection: %s\r\n"
-            "Content-Length: %u\r\n"
+            "%s\r\n"
             "Content-Type: %s\r\n"
             "Server: dynamiccoin-json-rpc/%s\r\n"
             "\r\n",
@@ -112,11 +114,26 @@ string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const
         httpStatusDescription(nStatus),
         rfc1123Time(),
         keepalive ? "keep-alive" : "close",
-        contentLength,
+        strLengthHeader,
         contentType,
         FormatFullVersion());
 }
 
+string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const char *contentType)
+{
+    return HTTPReplyHeader(nStatus, keepalive, strprintf("Content-Length: %u", contentLength), contentType);
+}
+
+string HTTPReplyHeaderChunked(int nStatus, bool keepalive, const char *contentType)
+{
+    return HTTPReplyHeader(nStatus, keepalive, "Transfer-Encoding: chunked", contentType);
+}
+
+string HTTPChunkHeader(size_t nSize)
+{
+    return strprintf("%x\r\n", nSize);
+}
+
 string HTTPReply(int nStatus, const string& strMsg, bool keepalive,
                  bool headersOnly, const char *contentType)
 {
@@ -217,7 +234,29 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0)
+    if (mapHeadersRet["transfer-encoding"] == "chunked")
+    {
+        while (true)
+        {
+            string str;
+            getline(stream, str);
+            size_t nChunk = strtoul(str.c_str(), NULL, 16);
+            if (!stream || nChunk > max_size - strMessageRet.size())
+                return HTTP_INTERNAL_SERVER_ERROR;
+            if (nChunk == 0)
+                break;
+            size_t ptr = strMessageRet.size();
+            strMessageRet.resize(ptr + nChunk);
+            stream.read(&strMessageRet[ptr], nChunk);
+            getline(stream, str); // line end after the data
+            if (!stream) // Connection lost while reading
+                return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        // Trailer, if any
+        map<string, string> mapTrailers;
+        ReadHTTPHeaders(stream, mapTrailers);
+    }
+    else if (nLen > 0)
     {
         vector<char> vch;
         size_t ptr = 0;
@@ -233,17 +272,22 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         strMessageRet = string(vch.begin(), vch.end());
     }
 
-    string sConHdr = mapHeadersRet["connection"];
+    SetHTTPConnectionHeader(mapHeadersRet, nProto);
+
+    return HTTP_OK;
+}
+
+void SetHTTPConnectionHeader(map<string, string>& mapHeaders, int nProto)
+{
+    string sConHdr = mapHeaders["connection"];
 
     if ((sConHdr != "close") && (sConHdr != "keep-alive"))
     {
         if (nProto >= 1)
-            mapHeadersRet["connection"] = "keep-alive";
+            mapHeaders["connection"] = "keep-alive";
         else
-            mapHeadersRet["connection"] = "close";
+            mapHeaders["connection"] = "close";
     }
-
-    return HTTP_OK;
 }
 
 /**
@@ -290,3 +334,63 @@ Object JSONRPCError(int code, const string& message)
     error.push_back(Pair("message", message));
     return error;
 }
+
+void CJSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+    } else if (!vEmpty.empty()) {
+        if (!vEmpty.back())
+            os << ',';
+        vEmpty.back() = false;
+    }
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    Separate();
+    os << '{';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    os << '}';
+    vEmpty.pop_back();
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    Separate();
+    os << '[';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    os << ']';
+    vEmpty.pop_back();
+}
+
+void CJSONStreamWriter::Key(const string& strKey)
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    Separate();
+    write_stream(Value(strKey), os, false);
+    os << ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Write(const Value& value)
+{
+    Separate();
+    write_stream(value, os, false);
+}
+
+void CJSONStreamWriter::WriteRaw(const string& strJSON)
+{
+    Separate();
+    os << strJSON;
+}
@@ -10,6 +10,8 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
+
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/asio.hpp>
@@ -152,6 +154,11 @@ std::string HTTPError(int nStatus, bool keepalive,
                       bool headerOnly = false);
 std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength,
                       const char *contentType = "application/json");
+/** Header of a reply whose body is sent with chunked transfer encoding (see HTTPChunk) */
+std::string HTTPReplyHeaderChunked(int nStatus, bool keepalive,
+                      const char *contentType = "application/json");
+/** Frame nSize bytes of a chunked body; the last chunk is empty */
+std::string HTTPChunkHeader(size_t nSize);
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive,
                       bool headerOnly = false,
                       const char *contentType = "application/json");
@@ -161,9 +168,45 @@ int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
 int ReadHTTPHeaders(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet);
 int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet,
                     std::string& strMessageRet, int nProto, size_t max_size);
+/** Set the "connection" header to keep-alive or close if it is neither, by the default of HTTP/1.nProto */
+void SetHTTPConnectionHeader(std::map<std::string, std::string>& mapHeaders, int nProto);
 std::string JSONRPCRequest(const std::string& strMethod, const json_spirit::Array& params, const json_spirit::Value& id);
 json_spirit::Object JSONRPCReplyObj(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 std::string JSONRPCReply(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 json_spirit::Object JSONRPCError(int code, const std::string& message);
 
+/**
+ * Writes JSON to a stream piece by piece, so that a large result need not be
+ * built as a json_spirit::Value first, nor held as a string. The output is the
+ * same as that of write_string(value, false) for the equivalent value.
+ *
+ * Members of an object are written with Key() followed by the value, or with
+ * the two argument forms of Write(), BeginObject() and BeginArray().
+ */
+class CJSONStreamWriter
+{
+public:
+    explicit CJSONStreamWriter(std::ostream& osIn) : os(osIn), fAfterKey(false) {}
+
+    void BeginObject();
+    void BeginObject(const std::string& strKey) { Key(strKey); BeginObject(); }
+    void EndObject();
+    void BeginArray();
+    void BeginArray(const std::string& strKey) { Key(strKey); BeginArray(); }
+    void EndArray();
+    void Key(const std::string& strKey);
+    void Write(const json_spirit::Value& value);
+    void Write(const std::string& strKey, const json_spirit::Value& value) { Key(strKey); Write(value); }
+    //! Write a value that is already serialized as JSON
+    void WriteRaw(const std::string& strJSON);
+
+private:
+    std::ostream& os;
+    //! For every object or array that is open, whether nothing was written to it yet
+    std::vector<bool> vEmpty;
+    bool fAfterKey;
+
+    void Separate();
+};
+
 #endif // BITCOIN_RPCPROTOCOL_H
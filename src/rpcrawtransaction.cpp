@@ -10,6 +10,7 @@
 #include "keystore.h"
 #include "main.h"
 #include "net.h"
+#include "rpccache.h"
 #include "rpcserver.h"
 #include "script/script.h"
 #include "script/sign.h"
@@ -106,6 +107,11 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
 }
 
 Value getrawtransaction(const Array& params, bool fHelp)
+{
+    return StreamToValue(getrawtransaction, params, fHelp);
+}
+
+void getrawtransaction(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -177,6 +183,14 @@ Value getrawtransaction(const Array& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
+    string strKey = strprintf("getrawtransaction %s %d", hash.GetHex(), fVerbose);
+    string strReply;
+    if (rpcResponseCache.Get(strKey, strReply)) {
+        writer.WriteRaw(strReply);
+        return;
+    }
+    uint64_t nCacheGeneration = rpcResponseCache.GetGeneration();
+
     CTransaction tx;
     uint256 hashBlock = 0;
     if (!GetTransaction(hash, tx, hashBlock, true))
@@ -184,17 +198,37 @@ Value getrawtransaction(const Array& params, bool fHelp)
 
     string strHex = EncodeHexTx(tx);
 
-    if (!fVerbose)
-        return strHex;
+    Value result = strHex;
+    int nCacheHeight = -1;
+    {
+        LOCK(cs_main);
+        if (fVerbose) {
+            Object entry;
+            entry.push_back(Pair("hex", strHex));
+            TxToJSON(tx, hashBlock, entry);
+            result = entry;
+        }
+        CBlockIndex* pindex = hashBlock != 0 ? mapBlockIndex[hashBlock] : NULL;
+        if (pindex && rpcResponseCache.IsCacheable(pindex))
+            nCacheHeight = pindex->nHeight;
+    }
 
-    Object result;
-    result.push_back(Pair("hex", strHex));
-    TxToJSON(tx, hashBlock, result);
-    return result;
+    if (nCacheHeight < 0) {
+        writer.Write(result);
+        return;
+    }
+    strReply = write_string(result, false);
+    rpcResponseCache.Put(strKey, strReply, nCacheHeight, fVerbose, nCacheGeneration);
+    writer.WriteRaw(strReply);
 }
 
 #ifdef ENABLE_WALLET
 Value listunspent(const Array& params, bool fHelp)
+{
+    return StreamToValue(listunspent, params, fHelp);
+}
+
+void listunspent(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() > 3)
         throw runtime_error(
@@ -256,50 +290,57 @@ Value listunspent(const Array& params, bool fHelp)
     }
 
     Array results;
-    vector<COutput> vecOutputs;
     assert(pwalletMain != NULL);
-    pwalletMain->AvailableCoins(vecOutputs, false);
-    BOOST_FOREACH(const COutput& out, vecOutputs) {
-        if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
-            continue;
-
-        if (setAddress.size()) {
-            CTxDestination address;
-            if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        vector<COutput> vecOutputs;
+        pwalletMain->AvailableCoins(vecOutputs, false);
+        BOOST_FOREACH(const COutput& out, vecOutputs) {
+            if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
                 continue;
 
-            if (!setAddress.count(address))
-                continue;
-        }
+            if (setAddress.size()) {
+                CTxDestination address;
+                if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
+                    continue;
 
-        CAmount nValue = out.tx->vout[out.i].nValue;
-        const CScript& pk = out.tx->vout[out.i].scriptPubKey;
-        Object entry;
-        entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
-        entry.push_back(Pair("vout", out.i));
-        CTxDestination address;
-        if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
-            entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
-            if (pwalletMain->mapAddressBook.count(address))
-                entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
-        }
-        entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
-        if (pk.IsPayToScriptHash()) {
+                if (!setAddress.count(address))
+                    continue;
+            }
+
+            CAmount nValue = out.tx->vout[out.i].nValue;
+            const CScript& pk = out.tx->vout[out.i].scriptPubKey;
+            Object entry;
+            entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
+            entry.push_back(Pair("vout", out.i));
             CTxDestination address;
-            if (ExtractDestination(pk, address)) {
-                const CScriptID& hash = boost::get<CScriptID>(address);
-                CScript redeemScript;
-                if (pwalletMain->GetCScript(hash, redeemScript))
-                    entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
+            if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
+                entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
+                if (pwalletMain->mapAddressBook.count(address))
+                    entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
             }
+            entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
+            if (pk.IsPayToScriptHash()) {
+                CTxDestination address;
+                if (ExtractDestination(pk, address)) {
+                    const CScriptID& hash = boost::get<CScriptID>(address);
+                    CScript redeemScript;
+                    if (pwalletMain->GetCScript(hash, redeemScript))
+                        entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
+                }
+            }
+            entry.push_back(Pair("amount",ValueFromAmount(nValue)));
+            entry.push_back(Pair("confirmations",out.nDepth));
+            entry.push_back(Pair("spendable", out.fSpendable));
+            results.push_back(entry);
         }
-        entry.push_back(Pair("amount",ValueFromAmount(nValue)));
-        entry.push_back(Pair("confirmations",out.nDepth));
-        entry.push_back(Pair("spendable", out.fSpendable));
-        results.push_back(entry);
     }
 
-    return results;
+    // Written without the wallet locked
+    writer.BeginArray();
+    BOOST_FOREACH(const Value& entry, results)
+        writer.Write(entry);
+    writer.EndArray();
 }
 #endif
 
@@ -568,9 +609,7 @@ Value signrawtransaction(const Array& params, bool fHelp)
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
         BOOST_FOREACH(const CTxIn& txin, mergedTx.vin) {
-            const uint256& prevHash = txin.prevout.hash;
-            CCoins coins;
-            view.AccessCoins(prevHash); // this is certainly allowed to fail
+            view.AccessCoin(txin.prevout); // Load entries from viewChain into view; can fail.
         }
 
         view.SetBackend(viewDummy); // switch back to avoid locking mempool for too long
@@ -618,17 +657,19 @@ Value signrawtransaction(const Array& params, bool fHelp)
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                const COutPoint out(txid, nOut);
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + coins->vout[nOut].scriptPubKey.ToString() + "\nvs:\n"+
+                    err = err + coin.out.scriptPubKey.ToString() + "\nvs:\n"+
                         scriptPubKey.ToString();
                     throw JSONRPCError(RPC_DESERIALIZATION_ERROR, err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0; // we don't know the actual output value
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0; // we don't know the actual output value
+                newcoin.nHeight = 1;
+                view.AddCoin(out, newcoin, true);
             }
 
             // if redeemScript given and not using the local wallet (private keys
@@ -674,12 +715,12 @@ Value signrawtransaction(const Array& params, bool fHelp)
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsSpent()) {
             fComplete = false;
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
+        const CScript& prevPubKey = coin.out.scriptPubKey;
 
         txin.scriptSig.clear();
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
@@ -737,9 +778,12 @@ Value sendrawtransaction(const Array& params, bool fHelp)
         fOverrideFees = params[1].get_bool();
 
     CCoinsViewCache &view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(hashTx);
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx.vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
     bool fHaveMempool = mempool.exists(hashTx);
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CValidationState state;
@@ -7,18 +7,23 @@
 #include "rpcserver.h"
 
 #include "base58.h"
+#include "histogram.h"
 #include "init.h"
 #include "main.h"
+#include "rpccache.h"
 #include "ui_interface.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet.h"
 #endif
 
+#include <deque>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/iostreams/concepts.hpp>
@@ -48,6 +53,137 @@ static boost::asio::io_service::work *rpc_dummy_work = NULL;
 static std::vector<CSubNet> rpc_allow_subnets; //!< List of subnets to allow RPC connections from
 static std::vector< boost::shared_ptr<ip::tcp::acceptor> > rpc_acceptors;
 
+//! Largest request line and headers that are read; larger requests are refused
+static const size_t MAX_HTTP_HEADERS_SIZE = 64 * 1024;
+//! Largest body read before the request is known to be authorized; no request of the REST API is larger
+static const size_t MAX_UNAUTHORIZED_BODY_SIZE = 256 * 1024;
+//! Replies up to this size are sent at once; larger ones in chunks of about this size
+static const size_t RPC_REPLY_BUFFER_SIZE = 64 * 1024;
+
+struct CRPCWorkQueueStats
+{
+    size_t nDepth;
+    size_t nMaxDepth;
+    size_t nHighWater;
+    uint64_t nRejected;
+    //! Time from queueing to execution, and of execution, in microseconds
+    CLatencyHistogram histQueued;
+    CLatencyHistogram histExecuted;
+};
+
+/**
+ * Bounded queue of the requests that the worker threads execute. When it is
+ * full, further requests are refused (with 503) rather than buffered without
+ * bound, so a client that floods the server learns so right away.
+ */
+class CRPCWorkQueue
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque<std::pair<int64_t, boost::function<void(void)> > > queue;
+    size_t nMaxDepth;
+    bool fRunning;
+    size_t nHighWater;
+    uint64_t nRejected;
+    CLatencyHistogram histQueued;
+    CLatencyHistogram histExecuted;
+
+public:
+    CRPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fRunning(true), nHighWater(0), nRejected(0) {}
+
+    //! Queue func for a worker thread; false if the queue is full
+    bool Enqueue(const boost::function<void(void)>& func)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (queue.size() >= nMaxDepth) {
+            nRejected++;
+            return false;
+        }
+        queue.push_back(std::make_pair(GetTimeMicros(), func));
+        nHighWater = std::max(nHighWater, queue.size());
+        cond.notify_one();
+        return true;
+    }
+
+    //! Execute queued functions until interrupted (the loop of a worker thread)
+    void Run()
+    {
+        while (true) {
+            std::pair<int64_t, boost::function<void(void)> > item;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (fRunning && queue.empty())
+                    cond.wait(lock);
+                if (!fRunning)
+                    return;
+                item.first = queue.front().first;
+                item.second.swap(queue.front().second);
+                queue.pop_front();
+            }
+            int64_t nStart = GetTimeMicros();
+            item.second();
+            int64_t nEnd = GetTimeMicros();
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            histQueued.Add(nStart - item.first);
+            histExecuted.Add(nEnd - nStart);
+        }
+    }
+
+    //! Queue func only if the queue is less than half full; for work that may as well be skipped
+    bool EnqueueOptional(const boost::function<void(void)>& func)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (queue.size() * 2 >= nMaxDepth)
+            return false;
+        queue.push_back(std::make_pair(GetTimeMicros(), func));
+        nHighWater = std::max(nHighWater, queue.size());
+        cond.notify_one();
+        return true;
+    }
+
+    //! Make the worker threads return after what they are executing; queued functions are not run
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = false;
+        cond.notify_all();
+    }
+
+    void GetStats(CRPCWorkQueueStats& stats)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        stats.nDepth = queue.size();
+        stats.nMaxDepth = nMaxDepth;
+        stats.nHighWater = nHighWater;
+        stats.nRejected = nRejected;
+        stats.histQueued = histQueued;
+        stats.histExecuted = histExecuted;
+    }
+};
+
+//! Created by StartRPCThreads, destroyed in StopRPCThreads (protected by cs_rpcStats)
+static CRPCWorkQueue* rpc_work_queue = NULL;
+static int nRPCWorkThreads = 0;
+static CCriticalSection cs_rpcStats;
+//! Open connections, the most that may be open, and connections accepted since startup (protected by cs_rpcStats)
+static int nRPCConnections = 0;
+static int nRPCMaxConnections = DEFAULT_RPC_MAX_CONNECTIONS;
+static uint64_t nRPCConnectionsAccepted = 0;
+//! Connections refused because of nRPCMaxConnections, and closed because of nRPCServerTimeout (protected by cs_rpcStats)
+static uint64_t nRPCConnectionsRefused = 0;
+static uint64_t nRPCConnectionsTimedOut = 0;
+//! Seconds a connection may take to send a request or read a reply (-rpcservertimeout); set before the I/O thread starts
+static int nRPCServerTimeout = DEFAULT_RPC_SERVER_TIMEOUT;
+//! JSON-RPC batches executed and refused, their requests, and those that timed out (protected by cs_rpcStats)
+static uint64_t nRPCBatches = 0;
+static uint64_t nRPCBatchesRefused = 0;
+static uint64_t nRPCBatchRequests = 0;
+static uint64_t nRPCBatchRequestsTimedOut = 0;
+static CLatencyHistogram histRPCBatchSize;
+static CLatencyHistogram histRPCBatchTime;
+
 void RPCTypeCheck(const Array& params,
                   const list<Value_type>& typesExpected,
                   bool fAllowNull)
@@ -236,15 +372,130 @@ Value stop(const Array& params, bool fHelp)
 }
 
 
+Object HistogramToJSON(const CLatencyHistogram& histogram)
+{
+    Object ret;
+    ret.push_back(Pair("mean", histogram.GetMean()));
+    ret.push_back(Pair("p50", histogram.GetPercentile(0.5)));
+    ret.push_back(Pair("p90", histogram.GetPercentile(0.9)));
+    ret.push_back(Pair("p99", histogram.GetPercentile(0.99)));
+    ret.push_back(Pair("max", histogram.GetMax()));
+    return ret;
+}
+
+Value getrpcinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcinfo\n"
+            "\nReturns the state of the RPC server.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"connections\": n,        (numeric) The number of open connections\n"
+            "  \"accepted\": n,           (numeric) The number of connections accepted since startup\n"
+            "  \"maxconnections\": n,     (numeric) The number of connections that may be open (-rpcmaxconnections)\n"
+            "  \"refused\": n,            (numeric) The number of connections refused because that many were open\n"
+            "  \"timedout\": n,           (numeric) The number of connections closed because of -rpcservertimeout\n"
+            "  \"workthreads\": n,        (numeric) The number of threads executing requests\n"
+            "  \"workqueue\": {           (object) Requests read and waiting for a worker thread\n"
+            "    \"depth\": n,            (numeric) The number of queued requests\n"
+            "    \"maxdepth\": n,         (numeric) The number of requests that may be queued (-rpcworkqueue)\n"
+            "    \"highwater\": n,        (numeric) The largest depth since startup\n"
+            "    \"rejected\": n          (numeric) The number of requests refused because the queue was full\n"
+            "  },\n"
+            "  \"requests\": n,           (numeric) The number of requests (and batch helpers) executed since startup\n"
+            "  \"queuetime\": {          (object) Time requests were queued, in microseconds\n"
+            "    \"mean\": n, \"p50\": n, \"p90\": n, \"p99\": n, \"max\": n\n"
+            "  },\n"
+            "  \"exectime\": {...},       (object) Time requests took to execute, in microseconds, as above\n"
+            "  \"batches\": {             (object) JSON-RPC batches, whose thread safe requests run in parallel, before the others run in order\n"
+            "    \"count\": n,            (numeric) The number of batches executed since startup\n"
+            "    \"requests\": n,         (numeric) The number of requests in those batches\n"
+            "    \"timedout\": n,         (numeric) The number of those requests not executed because of -rpcbatchtimeout\n"
+            "    \"refused\": n,          (numeric) The number of batches refused because of -rpcbatchmax\n"
+            "    \"size\": {...},         (object) Requests per batch, as above\n"
+            "    \"time\": {...}          (object) Time batches took to execute, in microseconds, as above\n"
+            "  },\n"
+            "  \"cache\": {               (object) Cached replies about deep blocks (-rpccachesize, -rpccachedepth)\n"
+            "    \"entries\": n,          (numeric) The number of cached replies\n"
+            "    \"bytes\": n,            (numeric) The memory they take\n"
+            "    \"maxbytes\": n,         (numeric) The memory they may take, 0 if the cache is disabled\n"
+            "    \"depth\": n,            (numeric) The confirmations a block needs for replies about it to be cached\n"
+            "    \"hits\": n,             (numeric) The number of requests answered from the cache\n"
+            "    \"misses\": n,           (numeric) The number of requests that were not\n"
+            "    \"hitrate\": x.xxx,      (numeric) hits / (hits + misses)\n"
+            "    \"inserted\": n,         (numeric) The number of replies added\n"
+            "    \"evicted\": n,          (numeric) The number of replies dropped to stay within maxbytes\n"
+            "    \"invalidated\": n       (numeric) The number of replies dropped because their block was disconnected\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcinfo", "")
+            + HelpExampleRpc("getrpcinfo", "")
+        );
+
+    Object ret;
+    CRPCWorkQueueStats stats;
+    stats.nDepth = stats.nMaxDepth = stats.nHighWater = 0;
+    stats.nRejected = 0;
+    Object batches;
+    {
+        LOCK(cs_rpcStats);
+        ret.push_back(Pair("connections", nRPCConnections));
+        ret.push_back(Pair("accepted", nRPCConnectionsAccepted));
+        ret.push_back(Pair("maxconnections", nRPCMaxConnections));
+        ret.push_back(Pair("refused", nRPCConnectionsRefused));
+        ret.push_back(Pair("timedout", nRPCConnectionsTimedOut));
+        ret.push_back(Pair("workthreads", nRPCWorkThreads));
+        // There is no work queue if the server is not running, e.g. in the GUI debug console
+        if (rpc_work_queue)
+            rpc_work_queue->GetStats(stats);
+        batches.push_back(Pair("count", nRPCBatches));
+        batches.push_back(Pair("requests", nRPCBatchRequests));
+        batches.push_back(Pair("timedout", nRPCBatchRequestsTimedOut));
+        batches.push_back(Pair("refused", nRPCBatchesRefused));
+        batches.push_back(Pair("size", HistogramToJSON(histRPCBatchSize)));
+        batches.push_back(Pair("time", HistogramToJSON(histRPCBatchTime)));
+    }
+    Object workqueue;
+    workqueue.push_back(Pair("depth", (uint64_t)stats.nDepth));
+    workqueue.push_back(Pair("maxdepth", (uint64_t)stats.nMaxDepth));
+    workqueue.push_back(Pair("highwater", (uint64_t)stats.nHighWater));
+    workqueue.push_back(Pair("rejected", stats.nRejected));
+    ret.push_back(Pair("workqueue", workqueue));
+    ret.push_back(Pair("requests", stats.histExecuted.GetCount()));
+    ret.push_back(Pair("queuetime", HistogramToJSON(stats.histQueued)));
+    ret.push_back(Pair("exectime", HistogramToJSON(stats.histExecuted)));
+    ret.push_back(Pair("batches", batches));
+
+    CRPCCacheStats cacheStats;
+    rpcResponseCache.GetStats(cacheStats);
+    Object cache;
+    cache.push_back(Pair("entries", (uint64_t)cacheStats.nEntries));
+    cache.push_back(Pair("bytes", (uint64_t)cacheStats.nBytes));
+    cache.push_back(Pair("maxbytes", (uint64_t)cacheStats.nMaxBytes));
+    cache.push_back(Pair("depth", cacheStats.nMinDepth));
+    cache.push_back(Pair("hits", cacheStats.nHits));
+    cache.push_back(Pair("misses", cacheStats.nMisses));
+    uint64_t nLookups = cacheStats.nHits + cacheStats.nMisses;
+    cache.push_back(Pair("hitrate", nLookups ? (double)cacheStats.nHits / nLookups : 0.0));
+    cache.push_back(Pair("inserted", cacheStats.nInserted));
+    cache.push_back(Pair("evicted", cacheStats.nEvicted));
+    cache.push_back(Pair("invalidated", cacheStats.nInvalidated));
+    ret.push_back(Pair("cache", cache));
+    return ret;
+}
+
 
 /**
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode threadSafe reqWallet
-  //  --------------------- ------------------------  -----------------------  ---------- ---------- ---------
+{ //  category              name                      actor (function)         okSafeMode threadSafe reqWallet  streamActor
+  //  --------------------- ------------------------  -----------------------  ---------- ---------- ---------  ---------------
     /* Overall control/query calls */
-    { "control",            "getinfo",                &getinfo,                true,      false,      false }, /* uses wallet if enabled */
+    { "control",            "getinfo",                &getinfo,                true,      true,       false }, /* uses wallet if enabled */
+    { "control",            "getrpcinfo",             &getrpcinfo,             true,      true,       false },
     { "control",            "help",                   &help,                   true,      true,       false },
     { "control",            "stop",                   &stop,                   true,      true,       false },
 
@@ -258,24 +509,36 @@ static const CRPCCommand vRPCCommands[] =
     { "network",            "ping",                   &ping,                   true,      false,      false },
 
     /* Block chain and UTXO */
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      false,      false },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      false,      false },
-    { "blockchain",         "getblockcount",          &getblockcount,          true,      false,      false },
-    { "blockchain",         "getblock",               &getblock,               true,      false,      false },
-    { "blockchain",         "getblockhash",           &getblockhash,           true,      false,      false },
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      true,       false },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      true,       false },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,      true,       false },
+    { "blockchain",         "getblock",               &getblock,               true,      true,       false,     &getblock },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,      true,       false },
+    { "blockchain",         "getblockhashesbytime",   &getblockhashesbytime,   true,      true,       false },
     { "blockchain",         "getchaintips",           &getchaintips,           true,      false,      false },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      false,      false },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      true,       false },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      true,       false,     &getrawmempool },
+    { "blockchain",         "getrewardhistory",       &getrewardhistory,       true,      true,       false,     &getrewardhistory },
+    { "blockchain",         "getdbstats",             &getdbstats,             true,      true,       false },
+    { "blockchain",         "compactdb",              &compactdb,              true,      true,       false },
+    { "blockchain",         "getspentinfo",           &getspentinfo,           true,      true,       false },
     { "blockchain",         "gettxout",               &gettxout,               true,      false,      false },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,      true,       false },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           false,     true,       false },
     { "blockchain",         "verifychain",            &verifychain,            true,      false,      false },
     { "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false },
     { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
 
+    /* Address index */
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      true,      true,       false },
+    { "addressindex",       "getaddresshistory",      &getaddresshistory,      true,      true,       false },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        true,      true,       false },
+
     /* Mining */
     { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false,      false },
-    { "mining",             "getmininginfo",          &getmininginfo,          true,      false,      false },
+    { "mining",             "getmininginfo",          &getmininginfo,          true,      true,       false },
     { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      false,      false },
     { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      false,      false },
     { "mining",             "submitblock",            &submitblock,            true,      true,       false },
@@ -291,12 +554,12 @@ static const CRPCCommand vRPCCommands[] =
     { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      false,      false },
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      false,      false },
     { "rawtransactions",    "decodescript",           &decodescript,           true,      false,      false },
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      false,      false },
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      true,       false,     &getrawtransaction },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false,     false,      false },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     false,      false }, /* uses wallet if enabled */
 
     /* Utility functions */
-    { "util",               "createmultisig",         &createmultisig,         true,      true ,      false },
+    { "util",               "createmultisig",         &createmultisig,         true,      true,       false },
     { "util",               "validateaddress",        &validateaddress,        true,      false,      false }, /* uses wallet if enabled */
     { "util",               "verifymessage",          &verifymessage,          true,      false,      false },
     { "util",               "estimatefee",            &estimatefee,            true,      true,       false },
@@ -335,8 +598,8 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,      true },
     { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,      true },
     { "wallet",             "listsinceblock",         &listsinceblock,         false,     false,      true },
-    { "wallet",             "listtransactions",       &listtransactions,       false,     false,      true },
-    { "wallet",             "listunspent",            &listunspent,            false,     false,      true },
+    { "wallet",             "listtransactions",       &listtransactions,       false,     true,       true,      &listtransactions },
+    { "wallet",             "listunspent",            &listunspent,            false,     true,       true,      &listunspent },
     { "wallet",             "lockunspent",            &lockunspent,            true,      false,      true },
     { "wallet",             "move",                   &movecmd,                false,     false,      true },
     { "wallet",             "sendfrom",               &sendfrom,               false,     false,      true },
@@ -424,51 +687,438 @@ bool ClientAllowed(const boost::asio::ip::address& address)
     return false;
 }
 
-template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+/**
+ * Connection of a request that is executed by a worker thread. The reply is
+ * buffered, and then written by the I/O thread.
+ */
+class CRPCReply : public AcceptedConnection
 {
 public:
-    AcceptedConnectionImpl(
-            asio::io_service& io_service,
-            ssl::context &context,
-            bool fUseSSL) :
-        sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
-    {
-    }
+    /**
+     * writePartIn, if set, sends part of the reply (swapping it out of the
+     * string it is passed) and returns once that is written.
+     */
+    CRPCReply(const std::string& strPeerIn, const boost::function<bool(std::string&)>& writePartIn) :
+        strPeer(strPeerIn), writePart(writePartIn) {}
 
     virtual std::iostream& stream()
     {
-        return _stream;
+        return ss;
     }
 
     virtual std::string peer_address_to_string() const
     {
-        return peer.address().to_string();
+        return strPeer;
     }
 
     virtual void close()
     {
-        _stream.close();
+    }
+
+    virtual bool can_write_part() const
+    {
+        return !writePart.empty();
+    }
+
+    virtual bool write_part()
+    {
+        if (writePart.empty())
+            return false;
+        std::string strPart = ss.str();
+        ss.str("");
+        return writePart(strPart);
+    }
+
+    std::string str() const
+    {
+        return ss.str();
+    }
+
+private:
+    std::stringstream ss;
+    std::string strPeer;
+    boost::function<bool(std::string&)> writePart;
+};
+
+static bool ServiceRequest(AcceptedConnection *conn,
+                           string& strURI,
+                           string& strRequest,
+                           map<string, string>& mapHeaders,
+                           bool fRun);
+
+typedef asio::buffers_iterator<asio::streambuf::const_buffers_type> StreamBufIterator;
+
+/**
+ * Match condition for asio::async_read_until: the empty line after the request
+ * line and headers (lines may end with "\r\n" or just "\n").
+ */
+static std::pair<StreamBufIterator, bool> MatchEndOfHeaders(StreamBufIterator begin, StreamBufIterator end)
+{
+    StreamBufIterator it = begin;
+    while (it != end) {
+        if (*it != '\n') {
+            ++it;
+            continue;
+        }
+        StreamBufIterator itLineEnd = it;
+        if (++it != end && *it == '\r')
+            ++it;
+        if (it == end)
+            return std::make_pair(itLineEnd, false); // look at this line end again with more data
+        if (*it == '\n')
+            return std::make_pair(++it, true);
+    }
+    return std::make_pair(it, false);
+}
+
+/**
+ * A connection of the RPC server. Requests are read and replies written
+ * asynchronously by the I/O thread, so a keep-alive connection that is idle
+ * between requests does not take up a thread. A request that has been read
+ * completely is queued for the worker threads (see CRPCWorkQueue); reading
+ * resumes once its reply is written, so the requests of a connection are
+ * handled one at a time, in order. A connection that takes longer than
+ * -rpcservertimeout to send a request or to read (part of) a reply, or is
+ * idle that long between requests, is closed.
+ */
+template <typename Protocol>
+class CRPCConnection : public boost::enable_shared_from_this< CRPCConnection<Protocol> >
+{
+public:
+    CRPCConnection(asio::io_service& io_serviceIn, ssl::context &context, bool fUseSSLIn) :
+        sslStream(io_serviceIn, context),
+        io_service(io_serviceIn),
+        fUseSSL(fUseSSLIn),
+        fStarted(false),
+        timer(io_serviceIn),
+        fTimerArmed(false),
+        buf(MAX_HTTP_HEADERS_SIZE),
+        nProto(0),
+        fRun(true),
+        fPartPending(false),
+        fPartFailed(false)
+    {
+    }
+
+    ~CRPCConnection()
+    {
+        if (fStarted) {
+            LOCK(cs_rpcStats);
+            nRPCConnections--;
+        }
+    }
+
+    //! Serve requests until the connection is closed
+    void Start()
+    {
+        fStarted = true;
+        {
+            LOCK(cs_rpcStats);
+            nRPCConnections++;
+            nRPCConnectionsAccepted++;
+        }
+        SetTimeout();
+        if (fUseSSL)
+            sslStream.async_handshake(ssl::stream_base::server,
+                boost::bind(&CRPCConnection::HandleHandshake, this->shared_from_this(), asio::placeholders::error));
+        else
+            ReadRequest();
+    }
+
+    //! Refuse a client that is not allowed to connect
+    void Refuse()
+    {
+        // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
+        if (fUseSSL)
+            Close();
+        else
+            WriteReply(HTTPError(HTTP_FORBIDDEN, false), false);
+    }
+
+    //! Refuse a client because too many connections are open
+    void RefuseBusy()
+    {
+        if (fUseSSL)
+            Close();
+        else
+            WriteReply(HTTPReply(HTTP_SERVICE_UNAVAILABLE, "Too many connections\r\n", false, false, "text/plain"), false);
     }
 
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
-};
+    asio::io_service& io_service;
+    bool fUseSSL;
+    bool fStarted;
+
+    //! Closes the connection when a request or reply takes too long to transfer (see SetTimeout)
+    deadline_timer timer;
+    bool fTimerArmed;
+
+    //! Data read but not yet parsed; holds at most the request line and headers
+    asio::streambuf buf;
+
+    //! The request being read or executed
+    int nProto;
+    string strMethod;
+    string strURI;
+    map<string, string> mapHeaders;
+    vector<char> vchBody;
+    bool fRun;
+
+    //! The reply being written
+    string strReply;
+
+    //! Part of a reply that a worker thread waits to be written (see WritePart)
+    boost::mutex csPart;
+    boost::condition_variable condPart;
+    string strPart;
+    bool fPartPending;
+    bool fPartFailed;
+
+    template <typename MatchCondition, typename Handler>
+    void AsyncReadUntil(MatchCondition match, Handler handler)
+    {
+        if (fUseSSL)
+            asio::async_read_until(sslStream, buf, match, handler);
+        else
+            asio::async_read_until(sslStream.next_layer(), buf, match, handler);
+    }
+
+    template <typename Buffers, typename Handler>
+    void AsyncRead(const Buffers& buffers, Handler handler)
+    {
+        if (fUseSSL)
+            asio::async_read(sslStream, buffers, handler);
+        else
+            asio::async_read(sslStream.next_layer(), buffers, handler);
+    }
+
+    template <typename Buffers, typename Handler>
+    void AsyncWrite(const Buffers& buffers, Handler handler)
+    {
+        if (fUseSSL)
+            asio::async_write(sslStream, buffers, handler);
+        else
+            asio::async_write(sslStream.next_layer(), buffers, handler);
+    }
+
+    //! Close the connection unless what is read or written next is done within nRPCServerTimeout seconds
+    void SetTimeout()
+    {
+        if (nRPCServerTimeout <= 0)
+            return;
+        fTimerArmed = true;
+        timer.expires_from_now(posix_time::seconds(nRPCServerTimeout));
+        timer.async_wait(boost::bind(&CRPCConnection::HandleTimeout, this->shared_from_this(), asio::placeholders::error));
+    }
+
+    void CancelTimeout()
+    {
+        fTimerArmed = false;
+        boost::system::error_code ec;
+        timer.cancel(ec);
+    }
+
+    void HandleTimeout(const boost::system::error_code& error)
+    {
+        // The handler may already be queued when the timer is cancelled or set again
+        if (error == asio::error::operation_aborted || !fTimerArmed || timer.expires_at() > deadline_timer::traits_type::now())
+            return;
+        fTimerArmed = false;
+        LogPrint("rpc", "%s: transfer with %s did not complete within %d seconds, closing the connection\n", __func__, peer.address().to_string(), nRPCServerTimeout);
+        {
+            LOCK(cs_rpcStats);
+            nRPCConnectionsTimedOut++;
+        }
+        Close();
+    }
+
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (error) {
+            LogPrint("rpc", "%s: SSL handshake with %s failed: %s\n", __func__, peer.address().to_string(), error.message());
+            Close();
+            return;
+        }
+        ReadRequest();
+    }
+
+    void ReadRequest()
+    {
+        if (!fRun || !IsRPCRunning() || ShutdownRequested()) {
+            Close();
+            return;
+        }
+        SetTimeout();
+        AsyncReadUntil(MatchEndOfHeaders,
+            boost::bind(&CRPCConnection::HandleHeaders, this->shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleHeaders(const boost::system::error_code& error)
+    {
+        if (error) {
+            // not_found: the request line and headers do not fit in the buffer
+            if (error == asio::error::not_found)
+                WriteReply(HTTPError(HTTP_BAD_REQUEST, false), false);
+            else
+                Close();
+            return;
+        }
 
-void ServiceConnection(AcceptedConnection *conn);
+        std::istream stream(&buf);
+        mapHeaders.clear();
+        if (!ReadHTTPRequestLine(stream, nProto, strMethod, strURI)) {
+            Close();
+            return;
+        }
+        int nLen = ReadHTTPHeaders(stream, mapHeaders);
+        if (nLen < 0 || (size_t)nLen > MAX_SIZE) {
+            WriteReply(HTTPError(HTTP_BAD_REQUEST, false), false);
+            return;
+        }
+        SetHTTPConnectionHeader(mapHeaders, nProto);
+
+        // HTTP Keep-Alive is false; close connection after the reply
+        fRun = (mapHeaders["connection"] != "close") && GetBoolArg("-rpckeepalive", true);
+
+        // Neither allocate nor wait for a large body without the password
+        if ((size_t)nLen > MAX_UNAUTHORIZED_BODY_SIZE && !HTTPAuthorized(mapHeaders)) {
+            if (strURI != "/") {
+                WriteReply(HTTPError(HTTP_BAD_REQUEST, false), false);
+                return;
+            }
+            // Refused by HTTPReq_JSONRPC as any other unauthorized request; the
+            // body is left unread, so the connection is closed after the reply
+            fRun = false;
+            vchBody.clear();
+            QueueRequest();
+            return;
+        }
+
+        // Part of the body may have been read along with the headers
+        vchBody.resize(nLen);
+        size_t nBuffered = std::min(buf.size(), (size_t)nLen);
+        if (nBuffered > 0)
+            stream.read(&vchBody[0], nBuffered);
+        if (nBuffered < (size_t)nLen)
+            AsyncRead(asio::buffer(&vchBody[nBuffered], nLen - nBuffered),
+                boost::bind(&CRPCConnection::HandleBody, this->shared_from_this(), asio::placeholders::error));
+        else
+            QueueRequest();
+    }
+
+    void HandleBody(const boost::system::error_code& error)
+    {
+        if (error) {
+            // Connection lost while reading
+            Close();
+            return;
+        }
+        QueueRequest();
+    }
+
+    void QueueRequest()
+    {
+        CancelTimeout();
+        if (!rpc_work_queue->Enqueue(boost::bind(&CRPCConnection::Execute, this->shared_from_this()))) {
+            LogPrint("rpc", "%s: work queue full, refusing request from %s\n", __func__, peer.address().to_string());
+            WriteReply(HTTPReply(HTTP_SERVICE_UNAVAILABLE, "Work queue depth exceeded\r\n", fRun, false, "text/plain"), fRun);
+        }
+    }
+
+    //! Run by a worker thread
+    void Execute()
+    {
+        // Chunked transfer encoding is HTTP/1.1
+        boost::function<bool(std::string&)> writePart;
+        if (nProto >= 1)
+            writePart = boost::bind(&CRPCConnection::WritePart, this, _1);
+        CRPCReply reply(peer.address().to_string(), writePart);
+        bool fKeepOpen = false;
+        try {
+            string strRequest(vchBody.begin(), vchBody.end());
+            fKeepOpen = ServiceRequest(&reply, strURI, strRequest, mapHeaders, fRun);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            reply.stream() << HTTPError(HTTP_INTERNAL_SERVER_ERROR, false);
+        }
+        io_service.post(boost::bind(&CRPCConnection::WriteReply, this->shared_from_this(), reply.str(), fRun && fKeepOpen));
+    }
+
+    /**
+     * Run by a worker thread, while it executes a request: have the I/O thread
+     * write part of the reply, and wait until it is written. Returns false if
+     * the connection was lost or timed out (which closes it, failing the
+     * write), or the server stopped.
+     */
+    bool WritePart(string& str)
+    {
+        boost::unique_lock<boost::mutex> lock(csPart);
+        strPart.swap(str);
+        fPartPending = true;
+        io_service.post(boost::bind(&CRPCConnection::StartWritePart, this->shared_from_this()));
+        while (fPartPending) {
+            // Once the I/O thread is stopped the write will not complete
+            if (io_service.stopped())
+                return false;
+            condPart.timed_wait(lock, boost::posix_time::milliseconds(100));
+        }
+        strPart.clear();
+        return !fPartFailed;
+    }
+
+    void StartWritePart()
+    {
+        // strPart is not touched by the worker thread until the write completes
+        SetTimeout();
+        AsyncWrite(asio::buffer(strPart),
+            boost::bind(&CRPCConnection::HandleWritePart, this->shared_from_this(), asio::placeholders::error));
+    }
+
+    void HandleWritePart(const boost::system::error_code& error)
+    {
+        CancelTimeout();
+        boost::unique_lock<boost::mutex> lock(csPart);
+        fPartPending = false;
+        fPartFailed = !!error;
+        condPart.notify_all();
+    }
+
+    void WriteReply(const string& strReplyIn, bool fKeepOpen)
+    {
+        SetTimeout();
+        strReply = strReplyIn;
+        AsyncWrite(asio::buffer(strReply),
+            boost::bind(&CRPCConnection::HandleWrite, this->shared_from_this(), asio::placeholders::error, fKeepOpen));
+    }
+
+    void HandleWrite(const boost::system::error_code& error, bool fKeepOpen)
+    {
+        CancelTimeout();
+        strReply.clear();
+        if (error || !fKeepOpen)
+            Close();
+        else
+            ReadRequest();
+    }
+
+    void Close()
+    {
+        CancelTimeout();
+        boost::system::error_code ec;
+        sslStream.lowest_layer().shutdown(socket_base::shutdown_both, ec);
+        sslStream.lowest_layer().close(ec);
+    }
+};
 
 //! Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< CRPCConnection<Protocol> > conn,
                              const boost::system::error_code& error);
 
 /**
@@ -480,7 +1130,7 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
                    const bool fUseSSL)
 {
     // Accept connection
-    boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn(new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL));
+    boost::shared_ptr< CRPCConnection<Protocol> > conn(new CRPCConnection<Protocol>(acceptor->get_io_service(), context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -494,6 +1144,16 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
 }
 
 
+//! Whether nRPCMaxConnections are open; counts the connection as refused if so
+static bool RPCConnectionsFull()
+{
+    LOCK(cs_rpcStats);
+    if (nRPCConnections < nRPCMaxConnections)
+        return false;
+    nRPCConnectionsRefused++;
+    return true;
+}
+
 /**
  * Accept and handle incoming connection.
  */
@@ -501,34 +1161,27 @@ template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< CRPCConnection<Protocol> > conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<ip::tcp>* >(conn.get());
-
     if (error)
     {
         // TODO: Actually handle errors
         LogPrintf("%s: Error: %s\n", __func__, error.message());
     }
     // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
+    // do this before reading any request, to filter out
     // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
-    {
-        // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
-        if (!fUseSSL)
-            conn->stream() << HTTPError(HTTP_FORBIDDEN, false) << std::flush;
-        conn->close();
-    }
-    else {
-        ServiceConnection(conn.get());
-        conn->close();
-    }
+    else if (!ClientAllowed(conn->peer.address()))
+        conn->Refuse();
+    else if (RPCConnectionsFull())
+        conn->RefuseBusy();
+    else
+        conn->Start();
 }
 
 static ip::tcp::endpoint ParseEndpoint(const std::string &strEndpoint, int defaultPort)
@@ -692,9 +1345,23 @@ void StartRPCThreads()
         return;
     }
 
+    // One thread does all reading and writing; the worker threads execute the requests
+    int nWorkThreads = std::max((int)GetArg("-rpcthreads", 4), 1);
+    int nWorkQueueDepth = std::max((int)GetArg("-rpcworkqueue", 16), 1);
+    int nMaxConnections = std::max((int)GetArg("-rpcmaxconnections", DEFAULT_RPC_MAX_CONNECTIONS), 1);
+    nRPCServerTimeout = std::max((int)GetArg("-rpcservertimeout", DEFAULT_RPC_SERVER_TIMEOUT), 0);
+    LogPrintf("RPC server uses %d worker threads, and queues up to %d requests\n", nWorkThreads, nWorkQueueDepth);
+    LogPrintf("RPC server accepts up to %d connections, with a timeout of %d seconds\n", nMaxConnections, nRPCServerTimeout);
+    {
+        LOCK(cs_rpcStats);
+        rpc_work_queue = new CRPCWorkQueue(nWorkQueueDepth);
+        nRPCWorkThreads = nWorkThreads;
+        nRPCMaxConnections = nMaxConnections;
+    }
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    for (int i = 0; i < nWorkThreads; i++)
+        rpc_worker_group->create_thread(boost::bind(&CRPCWorkQueue::Run, rpc_work_queue));
     fRPCRunning = true;
 }
 
@@ -737,10 +1404,18 @@ void StopRPCThreads()
     }
     deadlineTimers.clear();
 
+    if (rpc_work_queue != NULL)
+        rpc_work_queue->Interrupt();
     rpc_io_service->stop();
     cvBlockChange.notify_all();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
+    {
+        // Connections of requests that were still queued are closed here
+        LOCK(cs_rpcStats);
+        delete rpc_work_queue; rpc_work_queue = NULL;
+        nRPCWorkThreads = 0;
+    }
     delete rpc_dummy_work; rpc_dummy_work = NULL;
     delete rpc_worker_group; rpc_worker_group = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
@@ -834,7 +1509,8 @@ void JSONRequest::parse(const Value& valRequest)
 }
 
 
-static Object JSONRPCExecOne(const Value& req)
+//! Execute a request of a batch; returns its reply as JSON (streaming commands write their result to it directly)
+static string JSONRPCExecOne(const Value& req)
 {
     Object rpc_result;
 
@@ -842,8 +1518,15 @@ static Object JSONRPCExecOne(const Value& req)
     try {
         jreq.parse(req);
 
-        Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-        rpc_result = JSONRPCReplyObj(result, Value::null, jreq.id);
+        std::ostringstream os;
+        CJSONStreamWriter writer(os);
+        writer.BeginObject();
+        writer.Key("result");
+        tableRPC.execute(jreq.strMethod, jreq.params, writer);
+        writer.Write("error", Value::null);
+        writer.Write("id", jreq.id);
+        writer.EndObject();
+        return os.str();
     }
     catch (Object& objError)
     {
@@ -855,18 +1538,223 @@ static Object JSONRPCExecOne(const Value& req)
                                      JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
     }
 
-    return rpc_result;
+    return write_string(Value(rpc_result), false);
 }
 
+/**
+ * The thread safe requests of a batch, which worker threads take turns to
+ * execute. The thread serving the batch executes them too, so a batch completes
+ * even when no worker is free to help, or when the workers are interrupted.
+ * Helpers only touch vReq after claiming a request, which they cannot once all
+ * requests are claimed, so they may safely run after the batch has returned.
+ */
+class CRPCBatch
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable condDone;
+    const Array* pvReq;
+    //! Positions in the batch of the requests to execute in parallel
+    std::vector<unsigned int> vPos;
+    size_t nNext;
+    size_t nDone;
+    int64_t nDeadline;
+    uint64_t nTimedOut;
+
+public:
+    //! Replies to all requests of the batch as JSON, by position
+    std::vector<string> vReply;
+
+    CRPCBatch(const Array& vReq, int64_t nDeadlineIn) : pvReq(&vReq), nNext(0), nDone(0), nDeadline(nDeadlineIn), nTimedOut(0), vReply(vReq.size()) {}
+
+    void Add(unsigned int nPos) { vPos.push_back(nPos); }
+    size_t size() const { return vPos.size(); }
+
+    //! Execute the request at nPos, unless the time limit of the batch has passed
+    string ExecOne(unsigned int nPos)
+    {
+        const Value& req = (*pvReq)[nPos];
+        if (nDeadline && GetTimeMicros() > nDeadline) {
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                nTimedOut++;
+            }
+            Value id = req.type() == obj_type ? find_value(req.get_obj(), "id") : Value::null;
+            return write_string(Value(JSONRPCReplyObj(Value::null, JSONRPCError(RPC_MISC_ERROR, "Batch time limit exceeded"), id)), false);
+        }
+        return JSONRPCExecOne(req);
+    }
+
+    //! Execute requests until all are claimed
+    void Work()
+    {
+        while (true) {
+            unsigned int nPos;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (nNext == vPos.size())
+                    return;
+                nPos = vPos[nNext++];
+            }
+            string reply = ExecOne(nPos);
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            vReply[nPos].swap(reply);
+            if (++nDone == vPos.size())
+                condDone.notify_all();
+        }
+    }
+
+    //! Wait for the requests that helpers are still executing; returns the number of requests that timed out so far
+    uint64_t Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nDone < vPos.size())
+            condDone.wait(lock);
+        return nTimedOut;
+    }
+};
+
 static string JSONRPCExecBatch(const Array& vReq)
 {
-    Array ret;
+    int nBatchMax = GetArg("-rpcbatchmax", DEFAULT_RPC_BATCH_MAX);
+    if (nBatchMax > 0 && vReq.size() > (size_t)nBatchMax) {
+        {
+            LOCK(cs_rpcStats);
+            nRPCBatchesRefused++;
+        }
+        throw JSONRPCError(RPC_INVALID_REQUEST, strprintf("Batch of %u requests exceeds the limit of %d (-rpcbatchmax)", vReq.size(), nBatchMax));
+    }
+    int64_t nStart = GetTimeMicros();
+    int64_t nTimeout = GetArg("-rpcbatchtimeout", DEFAULT_RPC_BATCH_TIMEOUT);
+    boost::shared_ptr<CRPCBatch> batch(new CRPCBatch(vReq, nTimeout > 0 ? nStart + nTimeout * 1000000 : 0));
+
+    // Thread safe requests may run in any order on any worker; the others run
+    // after them, in order on this thread, as they would all wait for cs_main
+    // anyway. So no other request of the batch runs at the same time as one
+    // that is not thread safe.
+    std::vector<unsigned int> vSerial;
+    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++) {
+        const CRPCCommand *pcmd = NULL;
+        if (vReq[reqIdx].type() == obj_type) {
+            const Value& valMethod = find_value(vReq[reqIdx].get_obj(), "method");
+            if (valMethod.type() == str_type)
+                pcmd = tableRPC[valMethod.get_str()];
+        }
+        if (pcmd && pcmd->threadSafe)
+            batch->Add(reqIdx);
+        else
+            vSerial.push_back(reqIdx);
+    }
+
+    // Helpers only take up the first half of the work queue, so that a batch
+    // does not make it refuse the requests of other clients
+    if (batch->size() > 1) {
+        LOCK(cs_rpcStats);
+        size_t nHelpers = std::min((size_t)std::max(nRPCWorkThreads - 1, 0), batch->size() - 1);
+        for (size_t i = 0; i < nHelpers && rpc_work_queue; i++) {
+            if (!rpc_work_queue->EnqueueOptional(boost::bind(&CRPCBatch::Work, batch)))
+                break;
+        }
+    }
+
+    batch->Work();
+    batch->Wait();
+    for (unsigned int i = 0; i < vSerial.size(); i++)
+        batch->vReply[vSerial[i]] = batch->ExecOne(vSerial[i]);
+    uint64_t nTimedOut = batch->Wait();
+
+    std::ostringstream os;
+    CJSONStreamWriter writer(os);
+    writer.BeginArray();
     for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+        writer.WriteRaw(batch->vReply[reqIdx]);
+    writer.EndArray();
+    os << "\n";
 
-    return write_string(Value(ret), false) + "\n";
+    {
+        LOCK(cs_rpcStats);
+        nRPCBatches++;
+        nRPCBatchRequests += vReq.size();
+        nRPCBatchRequestsTimedOut += nTimedOut;
+        histRPCBatchSize.Add(vReq.size());
+        histRPCBatchTime.Add(GetTimeMicros() - nStart);
+    }
+    return os.str();
 }
 
+/**
+ * Body of a reply to a connection that is written as it is produced. A body that
+ * fits in the buffer is sent at once, with a Content-Length. A larger one is sent
+ * with chunked transfer encoding, a chunk whenever the buffer is full, so that
+ * only about that much of it is held at a time; this waits for the client to
+ * read it. If the connection cannot send parts, the whole body is buffered.
+ */
+class CHTTPReplyStreamBuf : public std::streambuf
+{
+public:
+    CHTTPReplyStreamBuf(AcceptedConnection* connIn, bool fKeepAliveIn) :
+        conn(connIn), fKeepAlive(fKeepAliveIn), fChunked(false), vBuffer(RPC_REPLY_BUFFER_SIZE)
+    {
+        setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+    }
+
+    //! Whether part of the reply was sent, so it can no longer be replaced by an error reply
+    bool IsStarted() const
+    {
+        return fChunked;
+    }
+
+    //! Write the rest of the reply to the connection (to be sent by the caller)
+    void Finish()
+    {
+        size_t nSize = pptr() - pbase();
+        if (!fChunked) {
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fKeepAlive, nSize);
+            conn->stream().write(pbase(), nSize);
+        } else {
+            if (nSize > 0) {
+                conn->stream() << HTTPChunkHeader(nSize);
+                conn->stream().write(pbase(), nSize);
+                conn->stream() << "\r\n";
+            }
+            conn->stream() << HTTPChunkHeader(0) << "\r\n";
+        }
+        conn->stream() << std::flush;
+        setp(pbase(), epptr());
+    }
+
+protected:
+    virtual int_type overflow(int_type ch)
+    {
+        size_t nSize = pptr() - pbase();
+        if (!conn->can_write_part()) {
+            vBuffer.resize(vBuffer.size() * 2);
+            setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+            pbump(nSize);
+        } else {
+            if (!fChunked)
+                conn->stream() << HTTPReplyHeaderChunked(HTTP_OK, fKeepAlive);
+            fChunked = true;
+            conn->stream() << HTTPChunkHeader(nSize);
+            conn->stream().write(pbase(), nSize);
+            conn->stream() << "\r\n";
+            setp(pbase(), epptr());
+            if (!conn->write_part())
+                return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            sputc(traits_type::to_char_type(ch));
+        return traits_type::not_eof(ch);
+    }
+
+private:
+    AcceptedConnection* conn;
+    bool fKeepAlive;
+    bool fChunked;
+    std::vector<char> vBuffer;
+};
+
 static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
                             string& strRequest,
                             map<string, string>& mapHeaders,
@@ -908,14 +1796,31 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
 
         string strReply;
 
-        // singleton request
+        // singleton request: the reply is written as the result is produced
         if (valRequest.type() == obj_type) {
             jreq.parse(valRequest);
 
-            Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-
-            // Send reply
-            strReply = JSONRPCReply(result, Value::null, jreq.id);
+            CHTTPReplyStreamBuf buf(conn, fRun);
+            std::ostream os(&buf);
+            os.exceptions(std::ios_base::badbit);
+            try {
+                CJSONStreamWriter writer(os);
+                writer.BeginObject();
+                writer.Key("result");
+                tableRPC.execute(jreq.strMethod, jreq.params, writer);
+                writer.Write("error", Value::null);
+                writer.Write("id", jreq.id);
+                writer.EndObject();
+                os << "\n";
+                buf.Finish();
+            } catch (...) {
+                if (!buf.IsStarted())
+                    throw;
+                // Leave the chunked reply unfinished, so the client knows it is incomplete
+                LogPrint("rpc", "ThreadRPCServer reply to %s for %s aborted\n", conn->peer_address_to_string(), SanitizeString(jreq.strMethod));
+                return false;
+            }
+            return true;
 
         // array of requests
         } else if (valRequest.type() == array_type)
@@ -938,44 +1843,30 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
     return true;
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+/**
+ * Execute a request read from a connection, writing the reply to conn. Returns
+ * whether further requests may be read from the connection.
+ */
+static bool ServiceRequest(AcceptedConnection *conn,
+                           string& strURI,
+                           string& strRequest,
+                           map<string, string>& mapHeaders,
+                           bool fRun)
 {
-    bool fRun = true;
-    while (fRun && !ShutdownRequested())
-    {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
-
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
-
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
+    // Process via JSON-RPC API
+    if (strURI == "/")
+        return HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun);
 
-        // HTTP Keep-Alive is false; close connection immediately
-        if ((mapHeaders["connection"] == "close") || (!GetBoolArg("-rpckeepalive", true)))
-            fRun = false;
-
-        // Process via JSON-RPC API
-        if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
-                break;
+    // Process via HTTP REST API
+    if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false))
+        return HTTPReq_REST(conn, strURI, strRequest, mapHeaders, fRun);
 
-        // Process via HTTP REST API
-        } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
-            if (!HTTPReq_REST(conn, strURI, mapHeaders, fRun))
-                break;
-
-        } else {
-            conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
-            break;
-        }
-    }
+    conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
+    return false;
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+//! The command strMethod, if it may be executed now
+static const CRPCCommand* FindCommand(const std::string &strMethod)
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -991,6 +1882,42 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     if (strWarning != "" && !GetBoolArg("-disablesafemode", false) &&
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
+    return pcmd;
+}
+
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, CJSONStreamWriter& writer) const
+{
+    const CRPCCommand *pcmd = FindCommand(strMethod);
+    if (!pcmd->streamActor) {
+        writer.Write(execute(strMethod, params));
+        return;
+    }
+
+    try
+    {
+        assert(pcmd->threadSafe);
+        pcmd->streamActor(params, false, writer);
+    }
+    catch (std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+}
+
+Value StreamToValue(rpcstreamfn_type fn, const Array& params, bool fHelp)
+{
+    std::ostringstream os;
+    CJSONStreamWriter writer(os);
+    fn(params, fHelp, writer);
+    Value value;
+    if (!read_string(os.str(), value))
+        throw runtime_error("invalid JSON written by command");
+    return value;
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    const CRPCCommand *pcmd = FindCommand(strMethod);
 
     try
     {
@@ -20,8 +20,18 @@
 #include "json/json_spirit_writer_template.h"
 
 class CBlockIndex;
+class CLatencyHistogram;
 class CNetAddr;
 
+//! Largest number of requests in a JSON-RPC batch (0 for no limit)
+static const int DEFAULT_RPC_BATCH_MAX = 1000;
+//! Seconds after which the requests of a batch that did not start yet fail (0 for no limit)
+static const int DEFAULT_RPC_BATCH_TIMEOUT = 0;
+//! Largest number of open RPC connections; further connections are refused
+static const int DEFAULT_RPC_MAX_CONNECTIONS = 128;
+//! Seconds a connection may take to send a request or read a reply, or stay idle between requests (0 for no limit)
+static const int DEFAULT_RPC_SERVER_TIMEOUT = 30;
+
 class AcceptedConnection
 {
 public:
@@ -30,6 +40,11 @@ public:
     virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
     virtual void close() = 0;
+
+    //! Whether the reply may be sent in parts, with chunked transfer encoding
+    virtual bool can_write_part() const { return false; }
+    //! Send what was written to stream() so far; false if the connection was lost
+    virtual bool write_part() { return false; }
 };
 
 /** Start RPC threads */
@@ -81,6 +96,15 @@ extern CNetAddr BoostAsioToCNetAddr(boost::asio::ip::address address);
 
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
 
+/**
+ * A command that writes its result with a CJSONStreamWriter, which the server
+ * sends to the client as it is written. It is executed without locks (so it must
+ * be threadSafe), and should not hold any while writing, as writing waits for a
+ * client that reads slowly. Its result is written only after the parameters are
+ * checked, as an error can no longer be reported once part of it is sent.
+ */
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
+
 class CRPCCommand
 {
 public:
@@ -90,6 +114,8 @@ public:
     bool okSafeMode;
     bool threadSafe;
     bool reqWallet;
+    //! Streaming version of actor, for large results (or NULL)
+    rpcstreamfn_type streamActor;
 };
 
 /**
@@ -112,6 +138,8 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+    /** Execute a method, writing its result to writer (as it is produced, if the method can stream it). */
+    void execute(const std::string &method, const json_spirit::Array &params, CJSONStreamWriter& writer) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -125,6 +153,12 @@ extern uint256 ParseHashO(const json_spirit::Object& o, std::string strKey);
 extern std::vector<unsigned char> ParseHexV(const json_spirit::Value& v, std::string strName);
 extern std::vector<unsigned char> ParseHexO(const json_spirit::Object& o, std::string strKey);
 
+//! Result of a streaming command as a Value, for its actor (used by the GUI console and help; the server writes the stream itself)
+extern json_spirit::Value StreamToValue(rpcstreamfn_type fn, const json_spirit::Array& params, bool fHelp);
+
+//! Mean and percentiles of a latency histogram
+extern json_spirit::Object HistogramToJSON(const CLatencyHistogram& histogram);
+
 extern void InitRPCMining();
 extern void ShutdownRPCMining();
 
@@ -132,6 +166,7 @@ extern int64_t nWalletUnlockTime;
 extern CAmount AmountFromValue(const json_spirit::Value& value);
 extern json_spirit::Value ValueFromAmount(const CAmount& amount);
 extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
+extern double GetDifficultyForNBits(unsigned int nBits);
 extern std::string HelpRequiringPassphrase();
 extern std::string HelpExampleCli(std::string methodname, std::string args);
 extern std::string HelpExampleRpc(std::string methodname, std::string args);
@@ -183,6 +218,7 @@ extern json_spirit::Value createmultisig(const json_spirit::Array& params, bool
 extern json_spirit::Value listreceivedbyaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaccount(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listtransactions(const json_spirit::Array& params, bool fHelp);
+extern void listtransactions(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 extern json_spirit::Value listaddressgroupings(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listaccounts(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listsinceblock(const json_spirit::Array& params, bool fHelp);
@@ -200,8 +236,14 @@ extern json_spirit::Value getblockchaininfo(const json_spirit::Array& params, bo
 extern json_spirit::Value getnetworkinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value setmocktime(const json_spirit::Array& params, bool fHelp);
 
+extern json_spirit::Value getaddresshistory(const json_spirit::Array& params, bool fHelp); // in rpcaddressindex.cpp
+extern json_spirit::Value getaddressutxos(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressbalance(const json_spirit::Array& params, bool fHelp);
+
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
+extern void getrawtransaction(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
+extern void listunspent(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 extern json_spirit::Value lockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listlockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
@@ -216,10 +258,20 @@ extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool f
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getmempoolinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern void getrawmempool(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getblockhashesbytime(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getrewardhistory(const json_spirit::Array& params, bool fHelp);
+extern void getrewardhistory(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
+extern void getblock(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value dumptxoutset(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value loadtxoutset(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getdbstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value compactdb(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getspentinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value verifychain(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getchaintips(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value invalidateblock(const json_spirit::Array& params, bool fHelp);
@@ -228,6 +280,7 @@ extern json_spirit::Value reconsiderblock(const json_spirit::Array& params, bool
 // in rest.cpp
 extern bool HTTPReq_REST(AcceptedConnection *conn,
                   std::string& strURI,
+                  std::string& strRequest,
                   std::map<std::string, std::string>& mapHeaders,
                   bool fRun);
 
@@ -1247,6 +1247,11 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Ar
 }
 
 Value listtransactions(const Array& params, bool fHelp)
+{
+    return StreamToValue(listtransactions, params, fHelp);
+}
+
+void listtransactions(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() > 4)
         throw runtime_error(
@@ -1324,20 +1329,24 @@ Value listtransactions(const Array& params, bool fHelp)
 
     Array ret;
 
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
-
-    // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
     {
-        CWalletTx *const pwtx = (*it).second.first;
-        if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
-        CAccountingEntry *const pacentry = (*it).second.second;
-        if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
-
-        if ((int)ret.size() >= (nCount+nFrom)) break;
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        std::list<CAccountingEntry> acentries;
+        CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
+
+        // iterate backwards until we have nCount items to return:
+        for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+        {
+            CWalletTx *const pwtx = (*it).second.first;
+            if (pwtx != 0)
+                ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
+            CAccountingEntry *const pacentry = (*it).second.second;
+            if (pacentry != 0)
+                AcentryToJSON(*pacentry, strAccount, ret);
+
+            if ((int)ret.size() >= (nCount+nFrom)) break;
+        }
     }
     // ret is newest to oldest
 
@@ -1355,7 +1364,11 @@ Value listtransactions(const Array& params, bool fHelp)
 
     std::reverse(ret.begin(), ret.end()); // Return oldest to newest
 
-    return ret;
+    // Written without the wallet locked
+    writer.BeginArray();
+    BOOST_FOREACH(const Value& entry, ret)
+        writer.Write(entry);
+    writer.EndArray();
 }
 
 Value listaccounts(const Array& params, bool fHelp)
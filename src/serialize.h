@@ -388,6 +388,32 @@ public:
     }
 };
 
+/** Serializes a 32 bit integer big endian, so that LevelDB keys sort by it */
+class CBigEndian32
+{
+protected:
+    uint32_t& n;
+public:
+    CBigEndian32(uint32_t& nIn) : n(nIn) { }
+
+    unsigned int GetSerializeSize(int, int) const {
+        return 4;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int, int) const {
+        unsigned char buf[4] = { (unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n };
+        s.write((char*)buf, 4);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int) {
+        unsigned char buf[4];
+        s.read((char*)buf, 4);
+        n = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 | (uint32_t)buf[2] << 8 | (uint32_t)buf[3];
+    }
+};
+
 template<size_t Limit>
 class LimitedString
 {
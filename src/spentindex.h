@@ -0,0 +1,60 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SPENTINDEX_H
+#define BITCOIN_SPENTINDEX_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+
+/** Key of a spent index record ('p'): the spent output (-spentindex) */
+struct CSpentIndexKey
+{
+    uint256 txid;
+    uint32_t nIndex;
+
+    CSpentIndexKey() : txid(0), nIndex(0) {}
+    CSpentIndexKey(const uint256& txidIn, uint32_t nIndexIn) : txid(txidIn), nIndex(nIndexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        char chType = 'p';
+        READWRITE(chType);
+        READWRITE(txid);
+        READWRITE(nIndex);
+    }
+};
+
+/**
+ * The input spending an output, and the height of its block. A null value in
+ * an update erases the record; lookups that include the memory pool return
+ * its spends with a height of -1.
+ */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    uint32_t nInputIndex;
+    int32_t nHeight;
+
+    CSpentIndexValue() { SetNull(); }
+    CSpentIndexValue(const uint256& txidIn, uint32_t nInputIndexIn, int32_t nHeightIn) : txid(txidIn), nInputIndex(nInputIndexIn), nHeight(nHeightIn) {}
+
+    void SetNull() { txid = 0; nInputIndex = 0; nHeight = 0; }
+    bool IsNull() const { return txid == 0; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(nInputIndex);
+        READWRITE(nHeight);
+    }
+};
+
+#endif // BITCOIN_SPENTINDEX_H
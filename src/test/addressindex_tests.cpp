@@ -0,0 +1,381 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "test_dynamiccoin.h"
+
+#include "chainparams.h"
+#include "key.h"
+#include "main.h"
+#include "script/standard.h"
+#include "txdb.h"
+
+#include <utility>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static vector<pair<CAddressIndexKey, CAmount> > ReadHistory(unsigned char nAddressType, const uint160& hashAddress)
+{
+    vector<pair<CAddressIndexKey, CAmount> > vIndex;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(CAddressIndexKey(nAddressType, hashAddress, 0, 0, uint256(0), 0, false), 1000000, 1000, vIndex));
+    return vIndex;
+}
+
+static vector<pair<CAddressUnspentKey, CAddressUnspentValue> > ReadUnspent(unsigned char nAddressType, const uint160& hashAddress)
+{
+    vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(CAddressUnspentKey(nAddressType, hashAddress, 0, uint256(0), 0), 1000, vUnspent));
+    return vUnspent;
+}
+
+static CAmount ReadBalance(unsigned char nAddressType, const uint160& hashAddress)
+{
+    CAmount nBalance = -1;
+    uint64_t nOutputs;
+    BOOST_CHECK(pblocktree->ReadAddressBalance(nAddressType, hashAddress, nBalance, nOutputs));
+    return nBalance;
+}
+
+static bool operator==(const CAddressIndexKey& a, const CAddressIndexKey& b)
+{
+    return a.nAddressType == b.nAddressType && a.hashAddress == b.hashAddress && a.nHeight == b.nHeight &&
+           a.nTxIndex == b.nTxIndex && a.txid == b.txid && a.nIndex == b.nIndex && a.fSpending == b.fSpending;
+}
+
+static bool operator==(const CAddressUnspentKey& a, const CAddressUnspentKey& b)
+{
+    return a.nAddressType == b.nAddressType && a.hashAddress == b.hashAddress && a.nHeight == b.nHeight &&
+           a.txid == b.txid && a.nIndex == b.nIndex;
+}
+
+static bool operator==(const CAddressUnspentValue& a, const CAddressUnspentValue& b)
+{
+    return a.nValue == b.nValue && a.scriptPubKey == b.scriptPubKey && a.fCoinBase == b.fCoinBase;
+}
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+BOOST_AUTO_TEST_CASE(addressindex_destinations)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    unsigned char nAddressType;
+    uint160 hashAddress;
+
+    // Pay to pubkey counts for the address of the key
+    BOOST_CHECK(GetAddressIndexKey(CScript() << ToByteVector(pubkey) << OP_CHECKSIG, nAddressType, hashAddress));
+    BOOST_CHECK_EQUAL(nAddressType, ADDRESS_INDEX_PUBKEYHASH);
+    BOOST_CHECK(hashAddress == pubkey.GetID());
+
+    BOOST_CHECK(GetAddressIndexKey(GetScriptForDestination(pubkey.GetID()), nAddressType, hashAddress));
+    BOOST_CHECK_EQUAL(nAddressType, ADDRESS_INDEX_PUBKEYHASH);
+    BOOST_CHECK(hashAddress == pubkey.GetID());
+    BOOST_CHECK(GetAddressIndexDestination(nAddressType, hashAddress) == CTxDestination(pubkey.GetID()));
+
+    CScript inner = GetScriptForMultisig(1, vector<CPubKey>(1, pubkey));
+    BOOST_CHECK(GetAddressIndexKey(GetScriptForDestination(CScriptID(inner)), nAddressType, hashAddress));
+    BOOST_CHECK_EQUAL(nAddressType, ADDRESS_INDEX_SCRIPTHASH);
+    BOOST_CHECK(hashAddress == CScriptID(inner));
+    BOOST_CHECK(GetAddressIndexDestination(nAddressType, hashAddress) == CTxDestination(CScriptID(inner)));
+
+    // Bare multisig and data carrier outputs have no address
+    BOOST_CHECK(!GetAddressIndexKey(inner, nAddressType, hashAddress));
+    BOOST_CHECK(!GetAddressIndexKey(CScript() << OP_RETURN, nAddressType, hashAddress));
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_key_order)
+{
+    // Keys sort by height, then by position in the block, as serialized
+    uint160 hashAddress(1);
+    CDataStream ss1(SER_DISK, CLIENT_VERSION), ss2(SER_DISK, CLIENT_VERSION), ss3(SER_DISK, CLIENT_VERSION);
+    ss1 << CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashAddress, 255, 7, uint256(9), 0, false);
+    ss2 << CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashAddress, 256, 1, uint256(1), 0, false);
+    ss3 << CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashAddress, 256, 2, uint256(0), 0, false);
+    BOOST_CHECK(ss1.str() < ss2.str());
+    BOOST_CHECK(ss2.str() < ss3.str());
+
+    CAddressIndexKey key;
+    ss2 >> key;
+    BOOST_CHECK_EQUAL(key.nHeight, 256U);
+    BOOST_CHECK_EQUAL(key.nTxIndex, 1U);
+    BOOST_CHECK(key.txid == uint256(1));
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_blocktree)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 hashA(1), hashB(2);
+    CScript script = CScript() << OP_TRUE;
+
+    // Two blocks paying to A, the second one also spending from it, and one paying to B
+    vector<pair<CAddressIndexKey, CAmount> > vIndex1, vIndex2;
+    vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent1, vUnspent2;
+    for (unsigned int i = 0; i < 3; i++) {
+        vIndex1.push_back(make_pair(CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 10, i, uint256(i + 1), 0, false), 100));
+        vUnspent1.push_back(make_pair(CAddressUnspentKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 10, uint256(i + 1), 0), CAddressUnspentValue(100, script, i == 0)));
+    }
+    vIndex1.push_back(make_pair(CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashB, 10, 3, uint256(4), 0, false), 5));
+    vUnspent1.push_back(make_pair(CAddressUnspentKey(ADDRESS_INDEX_PUBKEYHASH, hashB, 10, uint256(4), 0), CAddressUnspentValue(5, script, false)));
+    BOOST_CHECK(db.WriteAddressIndex(vIndex1, vUnspent1));
+
+    vIndex2.push_back(make_pair(CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 11, 1, uint256(5), 0, true), -100));
+    vUnspent2.push_back(make_pair(CAddressUnspentKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 10, uint256(2), 0), CAddressUnspentValue()));
+    vIndex2.push_back(make_pair(CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 11, 1, uint256(5), 1, false), 40));
+    vUnspent2.push_back(make_pair(CAddressUnspentKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 11, uint256(5), 1), CAddressUnspentValue(40, script, false)));
+    BOOST_CHECK(db.WriteAddressIndex(vIndex2, vUnspent2));
+
+    vector<pair<CAddressIndexKey, CAmount> > vIndex;
+    CAddressIndexKey keyStart(ADDRESS_INDEX_PUBKEYHASH, hashA, 0, 0, uint256(0), 0, false);
+    BOOST_CHECK(db.ReadAddressIndex(keyStart, 1000, 100, vIndex));
+    BOOST_CHECK_EQUAL(vIndex.size(), 5U);
+    BOOST_CHECK(vIndex[3].first.fSpending);
+    BOOST_CHECK_EQUAL(vIndex[3].second, -100);
+
+    // Pages, and height ranges
+    vIndex.clear();
+    BOOST_CHECK(db.ReadAddressIndex(keyStart, 1000, 2, vIndex));
+    BOOST_CHECK_EQUAL(vIndex.size(), 2U);
+    keyStart = vIndex.back().first;
+    vIndex.clear();
+    BOOST_CHECK(db.ReadAddressIndex(keyStart, 1000, 2, vIndex));
+    BOOST_CHECK_EQUAL(vIndex.size(), 2U);
+    BOOST_CHECK_EQUAL(vIndex[0].first.nTxIndex, 1U);
+    BOOST_CHECK_EQUAL(vIndex[1].first.nTxIndex, 2U);
+    vIndex.clear();
+    BOOST_CHECK(db.ReadAddressIndex(CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 0, 0, uint256(0), 0, false), 10, 100, vIndex));
+    BOOST_CHECK_EQUAL(vIndex.size(), 3U);
+    vIndex.clear();
+    BOOST_CHECK(db.ReadAddressIndex(CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 11, 0, uint256(0), 0, false), 11, 100, vIndex));
+    BOOST_CHECK_EQUAL(vIndex.size(), 2U);
+
+    vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(CAddressUnspentKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 0, uint256(0), 0), 100, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 3U);
+    BOOST_CHECK(vUnspent[0].second.fCoinBase);
+    BOOST_CHECK(vUnspent[2].first.txid == uint256(5));
+
+    CAmount nBalance;
+    uint64_t nOutputs;
+    BOOST_CHECK(db.ReadAddressBalance(ADDRESS_INDEX_PUBKEYHASH, hashA, nBalance, nOutputs));
+    BOOST_CHECK_EQUAL(nBalance, 240);
+    BOOST_CHECK_EQUAL(nOutputs, 3U);
+    BOOST_CHECK(db.ReadAddressBalance(ADDRESS_INDEX_PUBKEYHASH, hashB, nBalance, nOutputs));
+    BOOST_CHECK_EQUAL(nBalance, 5);
+    BOOST_CHECK(db.ReadAddressBalance(ADDRESS_INDEX_SCRIPTHASH, hashA, nBalance, nOutputs));
+    BOOST_CHECK_EQUAL(nOutputs, 0U);
+
+    // Disconnecting the second block restores the spent output
+    vUnspent2.clear();
+    vUnspent2.push_back(make_pair(CAddressUnspentKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 11, uint256(5), 1), CAddressUnspentValue()));
+    vUnspent2.push_back(make_pair(CAddressUnspentKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 10, uint256(2), 0), CAddressUnspentValue(100, script, false)));
+    BOOST_CHECK(db.EraseAddressIndex(vIndex2, vUnspent2));
+    vIndex.clear();
+    BOOST_CHECK(db.ReadAddressIndex(CAddressIndexKey(ADDRESS_INDEX_PUBKEYHASH, hashA, 0, 0, uint256(0), 0, false), 1000, 100, vIndex));
+    BOOST_CHECK_EQUAL(vIndex.size(), 3U);
+    BOOST_CHECK(db.ReadAddressBalance(ADDRESS_INDEX_PUBKEYHASH, hashA, nBalance, nOutputs));
+    BOOST_CHECK_EQUAL(nBalance, 300);
+    BOOST_CHECK_EQUAL(nOutputs, 3U);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_connect_disconnect)
+{
+    // The index first catches up with the blocks connected while it was off
+    // (read back from disk, without proof of work)
+    fAddressIndex = true;
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    BOOST_CHECK(RepairIndexes());
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+
+    // A coinbase paying to A (a script hash anyone can spend), matured
+    CScript redeemA = CScript() << OP_TRUE;
+    uint160 hashA = CScriptID(redeemA);
+    CScript scriptA = GetScriptForDestination(CScriptID(redeemA));
+    uint160 hashB(0xb);
+    CScript scriptB = GetScriptForDestination(CKeyID(hashB));
+    vector<CMutableTransaction> noTxns;
+    CBlock blockCoinbase = CreateAndProcessBlock(noTxns, scriptA);
+    const CTransaction &txCoinbase = blockCoinbase.vtx[0];
+    const CAmount nReward = txCoinbase.vout[0].nValue;
+    unsigned int nCoinbaseHeight;
+    {
+        LOCK(cs_main);
+        nCoinbaseHeight = chainActive.Height();
+    }
+    for (int i = 0; i < COINBASE_MATURITY; i++)
+        CreateAndProcessBlock(noTxns, CScript() << OP_TRUE);
+
+    vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspentBefore = ReadUnspent(ADDRESS_INDEX_SCRIPTHASH, hashA);
+    BOOST_CHECK_EQUAL(ReadHistory(ADDRESS_INDEX_SCRIPTHASH, hashA).size(), 1U);
+    BOOST_REQUIRE_EQUAL(vUnspentBefore.size(), 1U);
+    BOOST_CHECK_EQUAL(vUnspentBefore[0].first.nHeight, nCoinbaseHeight);
+    BOOST_CHECK(vUnspentBefore[0].first.txid == txCoinbase.GetHash());
+    BOOST_CHECK(vUnspentBefore[0].second.fCoinBase);
+    BOOST_CHECK_EQUAL(ReadBalance(ADDRESS_INDEX_SCRIPTHASH, hashA), nReward);
+
+    // One block spends the coinbase to B with change to A, and the change to B
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = COutPoint(txCoinbase.GetHash(), 0);
+    tx1.vin[0].scriptSig = CScript() << ToByteVector(redeemA);
+    tx1.vout.resize(2);
+    tx1.vout[0].scriptPubKey = scriptB;
+    tx1.vout[0].nValue = COIN;
+    tx1.vout[1].scriptPubKey = scriptA;
+    tx1.vout[1].nValue = nReward - COIN;
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 1);
+    tx2.vin[0].scriptSig = CScript() << ToByteVector(redeemA);
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = scriptB;
+    tx2.vout[0].nValue = nReward - COIN;
+    vector<CMutableTransaction> txns;
+    txns.push_back(tx1);
+    txns.push_back(tx2);
+    CBlock block = CreateAndProcessBlock(txns, CScript() << OP_TRUE);
+    CBlockIndex *pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+        BOOST_REQUIRE(pindex->GetBlockHash() == block.GetHash());
+    }
+    unsigned int nHeight = pindex->nHeight;
+
+    // A: the coinbase, and in the new block its spend, the change and the spend of that
+    vector<pair<CAddressIndexKey, CAmount> > vHistoryA = ReadHistory(ADDRESS_INDEX_SCRIPTHASH, hashA);
+    BOOST_REQUIRE_EQUAL(vHistoryA.size(), 4U);
+    BOOST_CHECK(vHistoryA[0].first == CAddressIndexKey(ADDRESS_INDEX_SCRIPTHASH, hashA, nCoinbaseHeight, 0, txCoinbase.GetHash(), 0, false));
+    BOOST_CHECK_EQUAL(vHistoryA[0].second, nReward);
+    BOOST_CHECK(vHistoryA[1].first == CAddressIndexKey(ADDRESS_INDEX_SCRIPTHASH, hashA, nHeight, 1, tx1.GetHash(), 0, true));
+    BOOST_CHECK_EQUAL(vHistoryA[1].second, -nReward);
+    BOOST_CHECK(vHistoryA[2].first == CAddressIndexKey(ADDRESS_INDEX_SCRIPTHASH, hashA, nHeight, 1, tx1.GetHash(), 1, false));
+    BOOST_CHECK_EQUAL(vHistoryA[2].second, nReward - COIN);
+    BOOST_CHECK(vHistoryA[3].first == CAddressIndexKey(ADDRESS_INDEX_SCRIPTHASH, hashA, nHeight, 2, tx2.GetHash(), 0, true));
+    BOOST_CHECK_EQUAL(vHistoryA[3].second, -(nReward - COIN));
+    BOOST_CHECK(ReadUnspent(ADDRESS_INDEX_SCRIPTHASH, hashA).empty());
+    BOOST_CHECK_EQUAL(ReadBalance(ADDRESS_INDEX_SCRIPTHASH, hashA), 0);
+
+    // B: both outputs, unspent
+    vector<pair<CAddressIndexKey, CAmount> > vHistoryB = ReadHistory(ADDRESS_INDEX_PUBKEYHASH, hashB);
+    vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspentB = ReadUnspent(ADDRESS_INDEX_PUBKEYHASH, hashB);
+    BOOST_CHECK_EQUAL(vHistoryB.size(), 2U);
+    BOOST_REQUIRE_EQUAL(vUnspentB.size(), 2U);
+    BOOST_CHECK(vUnspentB[0].first == CAddressUnspentKey(ADDRESS_INDEX_PUBKEYHASH, hashB, nHeight, tx1.GetHash(), 0));
+    BOOST_CHECK(vUnspentB[0].second == CAddressUnspentValue(COIN, scriptB, false));
+    BOOST_CHECK(vUnspentB[1].first == CAddressUnspentKey(ADDRESS_INDEX_PUBKEYHASH, hashB, nHeight, tx2.GetHash(), 0));
+    BOOST_CHECK_EQUAL(ReadBalance(ADDRESS_INDEX_PUBKEYHASH, hashB), nReward);
+
+    // Checking the last blocks by disconnecting them from a copy of the chain
+    // state, and connecting them again, leaves the index alone (the blocks
+    // read back from disk have no proof of work)
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    BOOST_CHECK(CVerifyDB().VerifyDB(pcoinsTip, 4, 5));
+    BOOST_CHECK(ReadHistory(ADDRESS_INDEX_SCRIPTHASH, hashA) == vHistoryA);
+    BOOST_CHECK(ReadUnspent(ADDRESS_INDEX_SCRIPTHASH, hashA).empty());
+    BOOST_CHECK(ReadUnspent(ADDRESS_INDEX_PUBKEYHASH, hashB) == vUnspentB);
+
+    // Disconnecting the block restores the coinbase, at its own height
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, pindex));
+        BOOST_CHECK(chainActive.Tip() == pindex->pprev);
+    }
+    BOOST_CHECK_EQUAL(ReadHistory(ADDRESS_INDEX_SCRIPTHASH, hashA).size(), 1U);
+    BOOST_CHECK(ReadUnspent(ADDRESS_INDEX_SCRIPTHASH, hashA) == vUnspentBefore);
+    BOOST_CHECK_EQUAL(ReadBalance(ADDRESS_INDEX_SCRIPTHASH, hashA), nReward);
+    BOOST_CHECK(ReadHistory(ADDRESS_INDEX_PUBKEYHASH, hashB).empty());
+    BOOST_CHECK(ReadUnspent(ADDRESS_INDEX_PUBKEYHASH, hashB).empty());
+
+    // ... and connecting it again brings the records back
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ReconsiderBlock(state, pindex));
+    }
+    BOOST_CHECK(ActivateBestChain(state));
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip() == pindex);
+    }
+    BOOST_CHECK(ReadHistory(ADDRESS_INDEX_SCRIPTHASH, hashA) == vHistoryA);
+    BOOST_CHECK(ReadUnspent(ADDRESS_INDEX_SCRIPTHASH, hashA).empty());
+    BOOST_CHECK(ReadHistory(ADDRESS_INDEX_PUBKEYHASH, hashB) == vHistoryB);
+    BOOST_CHECK(ReadUnspent(ADDRESS_INDEX_PUBKEYHASH, hashB) == vUnspentB);
+
+    fAddressIndex = false;
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_repair)
+{
+    // The index first catches up with the blocks connected while it was off
+    // (read back from disk, without proof of work)
+    fAddressIndex = true;
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    BOOST_CHECK(RepairIndexes());
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    uint160 hashC(0xc);
+    CScript scriptC = GetScriptForDestination(CKeyID(hashC));
+    vector<CMutableTransaction> noTxns;
+
+    // A flush of the chain state forgets the journal
+    FlushStateToDisk();
+    vector<pair<uint32_t, CIndexJournalEntry> > vJournal;
+    BOOST_CHECK(pblocktree->ReadIndexJournal(vJournal));
+    BOOST_CHECK(vJournal.empty());
+    CBlock block = CreateAndProcessBlock(noTxns, scriptC);
+    CBlockIndex *pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+        BOOST_REQUIRE(pindex->GetBlockHash() == block.GetHash());
+    }
+    BOOST_CHECK(pblocktree->ReadIndexJournal(vJournal));
+    BOOST_REQUIRE_EQUAL(vJournal.size(), 1U);
+    BOOST_CHECK(vJournal[0].second.hashBlock == block.GetHash());
+    BOOST_CHECK(vJournal[0].second.fConnect);
+    BOOST_CHECK_EQUAL(ReadHistory(ADDRESS_INDEX_PUBKEYHASH, hashC).size(), 1U);
+
+    // The chain state going back without the index is what an unclean shutdown
+    // before the next flush leaves: the journaled block is undone
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    CValidationState state;
+    fAddressIndex = false;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, pindex));
+        BOOST_CHECK(chainActive.Tip() == pindex->pprev);
+    }
+    fAddressIndex = true;
+    BOOST_CHECK_EQUAL(ReadHistory(ADDRESS_INDEX_PUBKEYHASH, hashC).size(), 1U);
+    BOOST_CHECK(RepairIndexes());
+    BOOST_CHECK(ReadHistory(ADDRESS_INDEX_PUBKEYHASH, hashC).empty());
+    BOOST_CHECK(ReadUnspent(ADDRESS_INDEX_PUBKEYHASH, hashC).empty());
+    vJournal.clear();
+    BOOST_CHECK(pblocktree->ReadIndexJournal(vJournal));
+    BOOST_CHECK(vJournal.empty());
+
+    // Blocks of the active chain the index misses are connected
+    fAddressIndex = false;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ReconsiderBlock(state, pindex));
+    }
+    BOOST_CHECK(ActivateBestChain(state));
+    fAddressIndex = true;
+    BOOST_CHECK(ReadHistory(ADDRESS_INDEX_PUBKEYHASH, hashC).empty());
+    BOOST_CHECK(RepairIndexes());
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    BOOST_CHECK_EQUAL(ReadHistory(ADDRESS_INDEX_PUBKEYHASH, hashC).size(), 1U);
+    BOOST_CHECK_EQUAL(ReadBalance(ADDRESS_INDEX_PUBKEYHASH, hashC), block.vtx[0].vout[0].nValue);
+
+    fAddressIndex = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,64 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for sizing block download pipelines from peer throughput
+//
+
+#include "main.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockdownload_tests)
+
+BOOST_AUTO_TEST_CASE(blocksinflight_limit)
+{
+    // Unmeasured peers get the fixed limit, and the full window
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(0, 0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(0, 5000000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(MAX_BLOCKS_IN_TRANSIT_PER_PEER), 1024);
+
+    // A block every 100ms: the pipeline time worth of blocks, plus one
+    int nLimit = GetBlocksInFlightLimit(100000, 0);
+    BOOST_CHECK_EQUAL(nLimit, (int)(BLOCK_DOWNLOAD_PIPELINE_TIME * 10 + 1));
+
+    // The limit grows with the peer's latency, to keep its link busy over the round-trip...
+    int nLimitLatent = GetBlocksInFlightLimit(100000, 1000000);
+    BOOST_CHECK_EQUAL(nLimitLatent, nLimit + 10);
+    BOOST_CHECK(GetBlockDownloadWindow(nLimitLatent) > GetBlockDownloadWindow(nLimit));
+
+    // ... and shrinks again when the latency drops
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(100000, 100000), nLimit + 1);
+
+    // Slower peers get fewer blocks, faster ones more
+    BOOST_CHECK(GetBlocksInFlightLimit(500000, 0) < nLimit);
+    BOOST_CHECK(GetBlocksInFlightLimit(50000, 0) > nLimit);
+
+    // Within bounds
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(60000000, 0), MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(1, 0), MAX_BLOCKS_IN_TRANSIT_PER_PEER_MEASURED);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(1000, 30000000), MAX_BLOCKS_IN_TRANSIT_PER_PEER_MEASURED);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(MIN_BLOCKS_IN_TRANSIT_PER_PEER), (int)(MIN_BLOCKS_IN_TRANSIT_PER_PEER * BLOCK_DOWNLOAD_WINDOW_PER_BLOCK_IN_FLIGHT));
+}
+
+BOOST_AUTO_TEST_CASE(rerequest_block)
+{
+    const int64_t nOverdue = 4 * 100000 + 1000000 * BLOCK_DOWNLOAD_PIPELINE_TIME;
+
+    // A peer delivering every 100ms takes over from one at least twice as slow, once overdue
+    BOOST_CHECK(ShouldRerequestBlock(100000, 200000, nOverdue + 1));
+    BOOST_CHECK(!ShouldRerequestBlock(100000, 200000, nOverdue));
+    BOOST_CHECK(ShouldRerequestBlock(100000, 5000000, nOverdue + 1));
+
+    // Not from a peer about as fast
+    BOOST_CHECK(!ShouldRerequestBlock(100000, 199999, 60000000));
+    BOOST_CHECK(!ShouldRerequestBlock(100000, 100000, 60000000));
+
+    // An unmeasured peer that has not delivered anything yet counts as slow...
+    BOOST_CHECK(ShouldRerequestBlock(100000, 0, nOverdue + 1));
+    // ... but is not trusted to be fast
+    BOOST_CHECK(!ShouldRerequestBlock(0, 5000000, 60000000));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,116 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for loading the block index from the block tree database
+//
+
+#include "test_dynamiccoin.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "txdb.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockindex_tests)
+
+BOOST_AUTO_TEST_CASE(load_legacy_block_index)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    vector<CMutableTransaction> noTxns;
+    for (int i = 0; i < 5; i++)
+        CreateAndProcessBlock(noTxns, scriptPubKey);
+    FlushStateToDisk();
+
+    LOCK(cs_main);
+    BOOST_CHECK(nScriptCheckThreads > 1);
+    // Copies of the entries; their pointers go stale once the index is unloaded
+    map<uint256, CBlockIndex> mapSaved;
+    map<uint256, uint256> mapPrev;
+    map<uint256, uint256> mapPoW;
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
+        mapSaved.insert(make_pair(it->first, *it->second));
+        mapPrev[it->first] = it->second->pprev ? it->second->pprev->GetBlockHash() : uint256(0);
+        mapPoW[it->first] = it->second->GetBlockPoW();
+    }
+    uint256 hashTip = chainActive.Tip()->GetBlockHash();
+
+    // A database in which every other entry was written by an older version,
+    // without the chain work after the CDiskBlockIndex
+    CBlockTreeDB dbLegacy(1 << 20, true);
+    int nLegacy = 0;
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
+        CDiskBlockIndex diskindex(it->second);
+        if (nLegacy++ % 2)
+            BOOST_CHECK(dbLegacy.Write(make_pair('b', it->first), diskindex));
+        else
+            BOOST_CHECK(dbLegacy.WriteBlockIndex(diskindex));
+    }
+    int nLastFile;
+    BOOST_CHECK(pblocktree->ReadLastBlockFile(nLastFile));
+    BOOST_CHECK(dbLegacy.WriteLastBlockFile(nLastFile));
+    for (int nFile = 0; nFile <= nLastFile; nFile++) {
+        CBlockFileInfo info;
+        BOOST_CHECK(pblocktree->ReadBlockFileInfo(nFile, info));
+        BOOST_CHECK(dbLegacy.WriteBlockFileInfo(nFile, info));
+    }
+
+    // Decoded by the script check threads, with the missing chain work
+    // computed (the blocks of the tests have no proof of work)
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    CBlockTreeDB *pblocktreeMain = pblocktree;
+    pblocktree = &dbLegacy;
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex());
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), mapSaved.size());
+    for (map<uint256, CBlockIndex>::iterator it = mapSaved.begin(); it != mapSaved.end(); it++) {
+        const CBlockIndex &saved = it->second;
+        BlockMap::iterator mi = mapBlockIndex.find(it->first);
+        BOOST_REQUIRE(mi != mapBlockIndex.end());
+        const CBlockIndex *pindex = mi->second;
+        BOOST_CHECK_EQUAL(pindex->nHeight, saved.nHeight);
+        BOOST_CHECK((pindex->pprev ? pindex->pprev->GetBlockHash() : uint256(0)) == mapPrev[it->first]);
+        BOOST_CHECK_EQUAL(pindex->nStatus, saved.nStatus);
+        BOOST_CHECK(pindex->nChainWork == saved.nChainWork);
+        BOOST_CHECK_EQUAL(pindex->nTx, saved.nTx);
+        BOOST_CHECK_EQUAL(pindex->nChainTx, saved.nChainTx);
+        BOOST_CHECK_EQUAL(pindex->nChainReward, saved.nChainReward);
+        BOOST_CHECK(pindex->GetBlockPoW() == mapPoW[it->first]);
+    }
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashTip);
+
+    // The next flush rewrites the older entries with their chain work
+    FlushStateToDisk();
+    boost::scoped_ptr<leveldb::Iterator> pcursor(dbLegacy.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('b', uint256(0));
+    int nRecords = 0;
+    for (pcursor->Seek(ssKeySet.str()); pcursor->Valid() && pcursor->key()[0] == 'b'; pcursor->Next()) {
+        CDataStream ssValue(pcursor->value().data(), pcursor->value().data() + pcursor->value().size(), SER_DISK, CLIENT_VERSION);
+        CDiskBlockIndex diskindex;
+        ssValue >> diskindex;
+        BOOST_CHECK_EQUAL(ssValue.size(), sizeof(uint256));
+        nRecords++;
+    }
+    BOOST_CHECK_EQUAL(nRecords, (int)mapSaved.size());
+
+    // Back to the database of the other tests
+    pblocktree = pblocktreeMain;
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex());
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), mapSaved.size());
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashTip);
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,137 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockmap.h"
+#include "random.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#define BLOCKMAP_LENGTH 20000
+
+BOOST_AUTO_TEST_SUITE(blockmap_tests)
+
+static CBlockIndex* Insert(CBlockMap& map, const uint256& hash)
+{
+    return map.emplace(hash, CBlockIndex()).first->second;
+}
+
+BOOST_AUTO_TEST_CASE(blockmap_lookup)
+{
+    CBlockMap map;
+    std::vector<uint256> vHash;
+    for (int i = 0; i < BLOCKMAP_LENGTH; i++) {
+        vHash.push_back(GetRandHash());
+        // Same bucket as the previous one, to make the probes run on
+        if (i % 10 == 9)
+            vHash.back() = vHash[i - 1] ^ (uint256(1) << 200);
+    }
+
+    for (int i = 0; i < BLOCKMAP_LENGTH; i++) {
+        CBlockIndex index;
+        index.nHeight = i;
+        std::pair<CBlockMap::iterator, bool> ret = map.emplace(vHash[i], index);
+        BOOST_CHECK(ret.second);
+        BOOST_CHECK(ret.first->first == vHash[i]);
+        BOOST_CHECK(ret.first->second->phashBlock == &ret.first->first);
+    }
+    BOOST_CHECK_EQUAL(map.size(), (size_t)BLOCKMAP_LENGTH);
+
+    // Adding again returns the existing entry
+    CBlockIndex* pindex = map[vHash[42]];
+    std::pair<CBlockMap::iterator, bool> ret = map.emplace(vHash[42], CBlockIndex());
+    BOOST_CHECK(!ret.second);
+    BOOST_CHECK(ret.first->second == pindex);
+    BOOST_CHECK_EQUAL(map.size(), (size_t)BLOCKMAP_LENGTH);
+
+    // Entries did not move while the table grew
+    BOOST_CHECK_EQUAL(pindex->nHeight, 42);
+    BOOST_CHECK(*pindex->phashBlock == vHash[42]);
+
+    for (int i = 0; i < BLOCKMAP_LENGTH; i++) {
+        CBlockMap::const_iterator it = map.find(vHash[i]);
+        BOOST_CHECK(it != map.end());
+        BOOST_CHECK_EQUAL(it->second->nHeight, i);
+        BOOST_CHECK(it->second->GetBlockHash() == vHash[i]);
+    }
+    for (int i = 0; i < 100; i++) {
+        uint256 hash = GetRandHash();
+        BOOST_CHECK(map.find(hash) == map.end());
+        BOOST_CHECK_EQUAL(map.count(hash), 0U);
+        BOOST_CHECK(map[hash] == NULL);
+    }
+    BOOST_CHECK_EQUAL(map.size(), (size_t)BLOCKMAP_LENGTH);
+
+    // Iteration follows the order of insertion
+    int nHeight = 0;
+    for (CBlockMap::iterator it = map.begin(); it != map.end(); it++)
+        BOOST_CHECK_EQUAL(it->second->nHeight, nHeight++);
+    BOOST_CHECK_EQUAL(nHeight, BLOCKMAP_LENGTH);
+    BOOST_CHECK(map.DynamicMemoryUsage() >= BLOCKMAP_LENGTH * sizeof(CBlockIndex));
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK(map.find(vHash[0]) == map.end());
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(blockmap_sort_by_height)
+{
+    // A chain with forks, added in random order like LoadBlockIndexGuts does:
+    // a predecessor may be added as a placeholder first
+    std::vector<uint256> vHash(BLOCKMAP_LENGTH);
+    std::vector<int> vPrev(BLOCKMAP_LENGTH, -1);
+    std::vector<int> vHeight(BLOCKMAP_LENGTH, 0);
+    for (int i = 0; i < BLOCKMAP_LENGTH; i++) {
+        vHash[i] = GetRandHash();
+        if (i > 0) {
+            vPrev[i] = i % 7 == 0 ? insecure_rand() % i : i - 1;
+            vHeight[i] = vHeight[vPrev[i]] + 1;
+        }
+    }
+    std::vector<int> vOrder;
+    for (int i = 0; i < BLOCKMAP_LENGTH; i++)
+        vOrder.push_back(i);
+    std::random_shuffle(vOrder.begin(), vOrder.end(), GetRandInt);
+
+    CBlockMap map;
+    for (int n = 0; n < BLOCKMAP_LENGTH; n++) {
+        int i = vOrder[n];
+        CBlockIndex* pindex = Insert(map, vHash[i]);
+        pindex->pprev = vPrev[i] < 0 ? NULL : Insert(map, vHash[vPrev[i]]);
+        pindex->nHeight = vHeight[i];
+    }
+    BOOST_CHECK_EQUAL(map.size(), (size_t)BLOCKMAP_LENGTH);
+
+    map.SortByHeight();
+    BOOST_CHECK_EQUAL(map.size(), (size_t)BLOCKMAP_LENGTH);
+
+    int nLastHeight = 0;
+    for (CBlockMap::iterator it = map.begin(); it != map.end(); it++) {
+        CBlockIndex* pindex = it->second;
+        BOOST_CHECK(pindex->nHeight >= nLastHeight);
+        nLastHeight = pindex->nHeight;
+        BOOST_CHECK(pindex->phashBlock == &it->first);
+        if (pindex->pprev)
+            pindex->BuildSkip();
+    }
+
+    for (int i = 0; i < BLOCKMAP_LENGTH; i++) {
+        CBlockIndex* pindex = map[vHash[i]];
+        BOOST_CHECK(pindex != NULL);
+        BOOST_CHECK_EQUAL(pindex->nHeight, vHeight[i]);
+        BOOST_CHECK(pindex->GetBlockHash() == vHash[i]);
+        if (vPrev[i] < 0) {
+            BOOST_CHECK(pindex->pprev == NULL);
+        } else {
+            BOOST_CHECK(pindex->pprev == map[vHash[vPrev[i]]]);
+            BOOST_CHECK(pindex->GetAncestor(0) == map[vHash[0]]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
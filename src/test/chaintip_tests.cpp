@@ -0,0 +1,143 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for the summary of the chain tip published for readers without cs_main
+//
+
+#include "test_dynamiccoin.h"
+
+#include "GrsApi.h"
+#include "chainparams.h"
+#include "main.h"
+
+#include <limits>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static void CheckSummary(const CChainTipSummaryRef& tip, const CBlockIndex* pindex)
+{
+    BOOST_CHECK(tip->pindex == pindex);
+    BOOST_CHECK(tip->hash == pindex->GetBlockHash());
+    BOOST_CHECK_EQUAL(tip->nHeight, pindex->nHeight);
+    BOOST_CHECK_EQUAL(tip->nTime, pindex->GetBlockTime());
+    BOOST_CHECK_EQUAL(tip->nBits, pindex->nBits);
+    BOOST_CHECK_EQUAL(tip->nReward, pindex->nReward);
+    BOOST_CHECK_EQUAL(tip->nChainReward, pindex->nChainReward);
+    BOOST_CHECK_EQUAL(tip->nChainTx, pindex->nChainTx);
+    BOOST_CHECK(tip->nChainWork == pindex->nChainWork);
+}
+
+BOOST_AUTO_TEST_SUITE(chaintip_tests)
+
+BOOST_AUTO_TEST_CASE(summary_follows_connected_blocks)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    vector<CMutableTransaction> noTxns;
+    CreateAndProcessBlock(noTxns, scriptPubKey);
+    CChainTipSummaryRef tipBefore = GetChainTipSummary();
+    {
+        LOCK(cs_main);
+        CheckSummary(tipBefore, chainActive.Tip());
+    }
+
+    CBlock block = CreateAndProcessBlock(noTxns, scriptPubKey);
+    CChainTipSummaryRef tip = GetChainTipSummary();
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    CheckSummary(tip, chainActive.Tip());
+    BOOST_CHECK_EQUAL(tip->nHeight, tipBefore->nHeight + 1);
+    BOOST_CHECK(tip->nChainWork > tipBefore->nChainWork);
+    // A published summary does not change
+    CheckSummary(tipBefore, chainActive.Tip()->pprev);
+}
+
+BOOST_AUTO_TEST_CASE(summary_follows_disconnects_and_reorgs)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    vector<CMutableTransaction> noTxns;
+    CreateAndProcessBlock(noTxns, scriptPubKey);
+    CBlockIndex *pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    CChainTipSummaryRef tipBefore = GetChainTipSummary();
+    CheckSummary(tipBefore, pindexTip);
+
+    // A branch as long as the active chain is not switched to; one block more is
+    CBlock blockFork1 = CreateAndProcessBlock(noTxns, CScript() << OP_2, pindexTip->pprev);
+    CheckSummary(GetChainTipSummary(), pindexTip);
+    CBlockIndex *pindexFork1;
+    {
+        LOCK(cs_main);
+        pindexFork1 = mapBlockIndex[blockFork1.GetHash()];
+    }
+    CBlock blockFork2 = CreateAndProcessBlock(noTxns, CScript() << OP_2, pindexFork1);
+    CBlockIndex *pindexFork2;
+    {
+        LOCK(cs_main);
+        pindexFork2 = mapBlockIndex[blockFork2.GetHash()];
+        BOOST_CHECK(chainActive.Tip() == pindexFork2);
+    }
+    CChainTipSummaryRef tip = GetChainTipSummary();
+    CheckSummary(tip, pindexFork2);
+    BOOST_CHECK_EQUAL(tip->nHeight, tipBefore->nHeight + 1);
+    CheckSummary(tipBefore, pindexTip);
+
+    // Invalidating the branch disconnects it, back to the block it forked from,
+    // before the earlier tip is connected again (the blocks read back from disk
+    // have no proof of work)
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, pindexFork1));
+        BOOST_CHECK(chainActive.Tip() == pindexTip->pprev);
+    }
+    CheckSummary(GetChainTipSummary(), pindexTip->pprev);
+    BOOST_CHECK(ActivateBestChain(state));
+    CheckSummary(GetChainTipSummary(), pindexTip);
+
+    // Back to the longer branch, for the tests after this one
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ReconsiderBlock(state, pindexFork1));
+    }
+    BOOST_CHECK(ActivateBestChain(state));
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    CheckSummary(GetChainTipSummary(), pindexFork2);
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip() == pindexFork2);
+}
+
+BOOST_AUTO_TEST_CASE(block_for_time_follows_the_tip)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    vector<CMutableTransaction> noTxns;
+    CreateAndProcessBlock(noTxns, scriptPubKey);
+    CreateAndProcessBlock(noTxns, scriptPubKey);
+    CChainTipSummaryRef tip = GetChainTipSummary();
+    LOCK(cs_main);
+    const CBlockIndex *pindexTip = chainActive.Tip();
+    BOOST_CHECK_EQUAL(tip->nTimeMax, chainActive.GetTimeMax(pindexTip->nHeight));
+
+    // At or after the tip's time the summary answers
+    BOOST_CHECK(pDmcSystem->GetBlockForTime(tip->nTimeMax) == pindexTip);
+    BOOST_CHECK(pDmcSystem->GetBlockForTime(std::numeric_limits<unsigned int>::max()) == pindexTip);
+    BOOST_CHECK_EQUAL(pDmcSystem->GetTargetPrice((unsigned int)tip->nTimeMax), pDmcSystem->GetTargetPrice());
+
+    // Earlier times are searched for in the active chain
+    for (int nHeight = 0; nHeight <= pindexTip->nHeight; nHeight++) {
+        int64_t nTime = chainActive.GetTimeMax(nHeight);
+        BOOST_CHECK(pDmcSystem->GetBlockForTime(nTime) == chainActive.FindLatestAtMost(nTime));
+        BOOST_CHECK(pDmcSystem->GetBlockForTime(nTime)->nHeight >= nHeight);
+    }
+    BOOST_CHECK(pDmcSystem->GetBlockForTime(chainActive.GetTimeMax(0) - 1) == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
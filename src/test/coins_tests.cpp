@@ -4,11 +4,16 @@
 
 #include "coins.h"
 #include "random.h"
+#include "script/script.h"
+#include "txdb.h"
 #include "uint256.h"
+#include "undo.h"
 
-#include <vector>
 #include <map>
+#include <set>
+#include <vector>
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/test/unit_test.hpp>
 
 namespace
@@ -16,27 +21,27 @@ namespace
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin) && !coin.IsSpent();
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
@@ -44,10 +49,12 @@ public:
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
-            map_[it->first] = it->second.coins;
-            if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
-                // Randomly delete empty entries on write.
-                map_.erase(it->first);
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
+                    // Randomly delete empty entries on write.
+                    map_.erase(it->first);
+                }
             }
             mapCoins.erase(it++);
         }
@@ -58,6 +65,38 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // The incrementally maintained usage matches a full recount
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++)
+            ret += it->second.coin.DynamicMemoryUsage();
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
+
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins)
+    {
+        db.Write(std::make_pair('c', txid), coins);
+        fLegacyCoins = true;
+    }
+
+    void ForgetStats()
+    {
+        fStatsValid = false;
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -67,9 +106,10 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
-// txids picked from a limited list of random 256-bit hashes. Occasionally, a
-// new tip is added to the stack of caches, or the tip is flushed and removed.
+// It will randomly create/update/delete Coin entries to a tip of caches, with
+// outpoints picked from a limited list of random 256-bit hashes and two output
+// indices. Occasionally, a new tip is added to the stack of caches, or the tip
+// is flushed and removed.
 //
 // During the process, booleans are kept to make sure that the randomized
 // operation hits all branches.
@@ -83,14 +123,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool uncached_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -102,39 +143,54 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     for (unsigned int i = 0; i < NUM_SIMULATION_ITERATIONS; i++) {
         // Do a random modification.
         {
-            uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
+            COutPoint outpoint(txids[insecure_rand() % txids.size()], insecure_rand() % 2); // outpoint we're going to modify in this iteration.
+            Coin& coin = result[outpoint];
+            const Coin& entry = stack.back()->AccessCoin(outpoint);
+            BOOST_CHECK(coin == entry);
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.nVersion = insecure_rand();
+                newcoin.nHeight = 1 + insecure_rand() % 1000;
+                newcoin.out.nValue = 1 + insecure_rand();
+                newcoin.out.scriptPubKey = CScript() << OP_TRUE;
+                if (coin.IsSpent()) {
                     added_an_entry = true;
                 } else {
                     updated_an_entry = true;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                // A spent coin may be added with or without the overwrite allowance
+                stack.back()->AddCoin(outpoint, newcoin, !coin.IsSpent() || insecure_rand() % 2);
+                coin = newcoin;
             } else {
-                coins.Clear();
-                entry->Clear();
+                BOOST_CHECK(stack.back()->SpendCoin(outpoint));
+                coin.Clear();
                 removed_an_entry = true;
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(coin == it->second);
+                BOOST_CHECK_EQUAL(stack.back()->HaveCoin(it->first), !coin.IsSpent());
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    found_an_entry = true;
                 }
             }
+            for (unsigned int j = 0; j < stack.size(); j++)
+                stack[j]->SelfTest();
+        }
+
+        if (insecure_rand() % 500 == 0) {
+            // Occasionally drop the unmodified entries of the top cache.
+            unsigned int nBefore = stack.back()->GetCacheSize();
+            stack.back()->UncacheClean(0);
+            stack.back()->SelfTest();
+            if (stack.back()->GetCacheSize() < nBefore)
+                uncached_an_entry = true;
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +207,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -173,6 +229,375 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(uncached_an_entry);
+}
+
+// Adds the outputs of a new transaction to a cache, as AddCoins does
+static void AddNewCoins(CCoinsViewCache& cache, const uint256& txid, const std::vector<Coin>& coins)
+{
+    for (unsigned int i = 0; i < coins.size(); i++) {
+        if (!coins[i].IsSpent())
+            cache.AddCoin(COutPoint(txid, i), coins[i], false);
+    }
+}
+
+static std::vector<Coin> MakeCoins(unsigned int nOutputs, int nHeight, CAmount nValueBase)
+{
+    std::vector<Coin> coins(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        coins[i].nVersion = 1;
+        coins[i].nHeight = nHeight;
+        coins[i].out.nValue = nValueBase + i;
+        coins[i].out.scriptPubKey = CScript() << OP_TRUE;
+    }
+    return coins;
+}
+
+static CCoins MakeLegacyCoins(const std::vector<Coin>& coins)
+{
+    CCoins legacy;
+    legacy.nVersion = coins[0].nVersion;
+    legacy.nHeight = coins[0].nHeight;
+    legacy.fCoinBase = coins[0].fCoinBase;
+    for (unsigned int i = 0; i < coins.size(); i++)
+        legacy.vout.push_back(coins[i].out);
+    return legacy;
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_per_output_test)
+{
+    CCoinsViewDBTest db;
+    std::vector<Coin> coins = MakeCoins(20, 100, 1);
+    uint256 txid = GetRandHash();
+    Coin result;
+
+    {
+        CCoinsViewCache cache(&db);
+        AddNewCoins(cache, txid, coins);
+        BOOST_CHECK(cache.Flush());
+    }
+    for (unsigned int i = 0; i < coins.size(); i++) {
+        BOOST_CHECK(db.HaveCoin(COutPoint(txid, i)));
+        BOOST_CHECK(db.GetCoin(COutPoint(txid, i), result));
+        BOOST_CHECK(result == coins[i]);
+    }
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txid, coins.size())));
+
+    // Spending one output leaves the others in place, and its undo data is complete
+    {
+        CCoinsViewCache cache(&db);
+        Coin spent;
+        BOOST_CHECK(cache.SpendCoin(COutPoint(txid, 7), &spent));
+        BOOST_CHECK(!cache.SpendCoin(COutPoint(txid, 7)));
+        CTxInUndo undo(spent);
+        BOOST_CHECK_EQUAL(undo.nHeight, 100U);
+        BOOST_CHECK_EQUAL(undo.nVersion, 1);
+        BOOST_CHECK(undo.txout == coins[7].out);
+        BOOST_CHECK(cache.Flush());
+    }
+    coins[7].Clear();
+    BOOST_CHECK(!db.GetCoin(COutPoint(txid, 7), result));
+    BOOST_CHECK(db.GetCoin(COutPoint(txid, 8), result));
+    BOOST_CHECK(result == coins[8]);
+
+    // Records of the old per-transaction layout are read, and converted when
+    // one of their outputs changes or by the upgrade pass
+    uint256 txidLegacy = GetRandHash();
+    uint256 txidLegacySpent = GetRandHash();
+    db.WriteLegacyCoins(txidLegacy, MakeLegacyCoins(coins));
+    db.WriteLegacyCoins(txidLegacySpent, MakeLegacyCoins(coins));
+    BOOST_CHECK(db.HaveLegacyCoins());
+    BOOST_CHECK(db.GetCoin(COutPoint(txidLegacy, 3), result));
+    BOOST_CHECK(result == coins[3]);
+    BOOST_CHECK(!db.GetCoin(COutPoint(txidLegacy, 7), result));
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.SpendCoin(COutPoint(txidLegacySpent, 0)));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txidLegacySpent, 0)));
+    BOOST_CHECK(db.GetCoin(COutPoint(txidLegacySpent, 1), result));
+    BOOST_CHECK(result == coins[1]);
+    BOOST_CHECK_EQUAL(db.UpgradeLegacyCoins(100), 1U);
+    BOOST_CHECK(!db.HaveLegacyCoins());
+    BOOST_CHECK(db.GetCoin(COutPoint(txidLegacy, 3), result));
+    BOOST_CHECK(result == coins[3]);
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txidLegacy, 7)));
+
+    // Spending everything removes the transaction
+    {
+        CCoinsViewCache cache(&db);
+        for (unsigned int i = 0; i < coins.size(); i++)
+            cache.SpendCoin(COutPoint(txid, i));
+        BOOST_CHECK(cache.Flush());
+    }
+    for (unsigned int i = 0; i < coins.size(); i++)
+        BOOST_CHECK(!db.HaveCoin(COutPoint(txid, i)));
+    BOOST_CHECK(db.HaveCoin(COutPoint(txidLegacy, 0)));
+}
+
+/** Counts the point lookups that reach the view below it */
+class CCoinsViewCounting : public CCoinsViewBacked
+{
+public:
+    mutable unsigned int nGets;
+
+    CCoinsViewCounting(CCoinsView* base) : CCoinsViewBacked(base), nGets(0) {}
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
+    {
+        nGets++;
+        return CCoinsViewBacked::GetCoin(outpoint, coin);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(coins_access_by_txid_test)
+{
+    CCoinsViewDBTest db;
+    // Indexes past 127 take a longer VARINT, which sorts before some shorter ones
+    std::vector<Coin> coins = MakeCoins(300, 100, 1);
+    uint256 txid = GetRandHash();
+    {
+        CCoinsViewCache cache(&db);
+        AddNewCoins(cache, txid, coins);
+        for (unsigned int i = 0; i < 250; i++)
+            cache.SpendCoin(COutPoint(txid, i));
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsViewCounting counting(&db);
+    CCoinsViewCache cache(&counting);
+    const Coin& found = AccessByTxid(cache, txid);
+    BOOST_CHECK(!found.IsSpent());
+    BOOST_CHECK(found.out.nValue >= 1 + 250);
+
+    // Outputs spent in the cache but not yet on disk are passed over
+    for (unsigned int i = 250; i < 299; i++)
+        cache.SpendCoin(COutPoint(txid, i));
+    BOOST_CHECK(AccessByTxid(cache, txid) == coins[299]);
+    cache.SpendCoin(COutPoint(txid, 299));
+    BOOST_CHECK(AccessByTxid(cache, txid).IsSpent());
+
+    // A transaction that is not in the set costs no point lookups at all
+    counting.nGets = 0;
+    BOOST_CHECK(AccessByTxid(cache, GetRandHash()).IsSpent());
+    BOOST_CHECK_EQUAL(counting.nGets, 0U);
+
+    // Outputs that only the cache has are found too
+    uint256 txidNew = GetRandHash();
+    std::vector<Coin> coinsNew = MakeCoins(10, 200, 1000);
+    AddNewCoins(cache, txidNew, coinsNew);
+    cache.SpendCoin(COutPoint(txidNew, 0));
+    BOOST_CHECK(AccessByTxid(cache, txidNew) == coinsNew[1]);
+
+    // And those of records of the old layout
+    uint256 txidLegacy = GetRandHash();
+    std::vector<Coin> coinsLegacy = MakeCoins(5, 50, 1);
+    db.WriteLegacyCoins(txidLegacy, MakeLegacyCoins(coinsLegacy));
+    cache.SpendCoin(COutPoint(txidLegacy, 0));
+    BOOST_CHECK(AccessByTxid(cache, txidLegacy) == coinsLegacy[1]);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_stats_test)
+{
+    CCoinsViewDBTest db;
+    CCoinsStats stats, statsEmpty;
+    BOOST_CHECK(db.GetStats(statsEmpty));
+    BOOST_CHECK_EQUAL(statsEmpty.nTransactions, 0U);
+
+    std::vector<uint256> txids;
+    std::vector<std::vector<Coin> > vCoins;
+    CCoinsViewCache cache(&db);
+    for (unsigned int i = 0; i < 10; i++) {
+        txids.push_back(GetRandHash());
+        vCoins.push_back(MakeCoins(3, i + 1, 1000 * i));
+        AddNewCoins(cache, txids.back(), vCoins.back());
+    }
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 10U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 30U);
+
+    // Spend some outputs, and all of one transaction
+    cache.SpendCoin(COutPoint(txids[0], 1));
+    for (unsigned int j = 0; j < 3; j++)
+        cache.SpendCoin(COutPoint(txids[2], j));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 9U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 26U);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 45 * 3000 + 10 * 3 - (0 + 1) - (6000 + 3));
+
+    // The maintained statistics match a full pass over the database
+    db.ForgetStats();
+    BOOST_CHECK(!db.GetStats(statsEmpty));
+    BOOST_CHECK(db.RebuildStats());
+    CCoinsStats statsRebuilt;
+    BOOST_CHECK(db.GetStats(statsRebuilt));
+    BOOST_CHECK_EQUAL(statsRebuilt.nTransactions, stats.nTransactions);
+    BOOST_CHECK_EQUAL(statsRebuilt.nTransactionOutputs, stats.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsRebuilt.nSerializedSize, stats.nSerializedSize);
+    BOOST_CHECK_EQUAL(statsRebuilt.nTotalAmount, stats.nTotalAmount);
+    BOOST_CHECK(statsRebuilt.hashMuHash == stats.hashMuHash);
+
+    // Restoring outputs, as disconnecting a block does, counts the transaction again
+    cache.AddCoin(COutPoint(txids[2], 1), vCoins[2][1], true);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 10U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 27U);
+
+    // Spending everything returns to the hash of the empty set
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        for (unsigned int j = 0; j < 3; j++)
+            cache.SpendCoin(COutPoint(txids[i], j));
+    }
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 0U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 0U);
+    BOOST_CHECK(stats.hashMuHash == statsEmpty.hashMuHash);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_cursor_test)
+{
+    CCoinsViewDBTest db;
+    std::map<COutPoint, Coin> mapExpected;
+    uint256 txidSingle;
+    {
+        CCoinsViewCache cache(&db);
+        for (unsigned int i = 0; i < 10; i++) {
+            uint256 txid = GetRandHash();
+            std::vector<Coin> coins = MakeCoins(i + 1, i + 1, 1000 * i);
+            for (unsigned int j = 0; j <= i; j++)
+                coins[j].fCoinBase = i % 2;
+            if (i > 0)
+                coins[0].Clear();
+            else
+                txidSingle = txid;
+            AddNewCoins(cache, txid, coins);
+            for (unsigned int j = 0; j <= i; j++) {
+                if (!coins[j].IsSpent())
+                    mapExpected[COutPoint(txid, j)] = coins[j];
+            }
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    std::vector<Coin> coinsLegacy = MakeCoins(3, 5, 7000);
+    coinsLegacy[1].Clear();
+    uint256 txidLegacy = GetRandHash();
+    db.WriteLegacyCoins(txidLegacy, MakeLegacyCoins(coinsLegacy));
+    mapExpected[COutPoint(txidLegacy, 0)] = coinsLegacy[0];
+    mapExpected[COutPoint(txidLegacy, 2)] = coinsLegacy[2];
+    db.ForgetStats();
+    BOOST_CHECK(db.RebuildStats());
+
+    // Every output shows up once, through a cache as well
+    CCoinsViewCache cache(&db);
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(cache.Cursor());
+    BOOST_REQUIRE(pcursor);
+    BOOST_CHECK(pcursor->GetBestBlock() == db.GetBestBlock());
+
+    // Writes after the cursor was created are not visible through it
+    const COutPoint outSingle(txidSingle, 0);
+    Coin coinSingle = mapExpected[outSingle];
+    BOOST_CHECK(cache.SpendCoin(outSingle));
+    BOOST_CHECK(cache.Flush());
+
+    // Copying the set over, as loadtxoutset does, reproduces its hash
+    CCoinsViewDBTest dbCopy;
+    CCoinsViewCache cacheCopy(&dbCopy);
+    std::map<COutPoint, Coin> mapFound;
+    std::set<uint256> setTxidsDone;
+    uint256 txidLast;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_CHECK(pcursor->GetKey(key));
+        BOOST_CHECK(pcursor->GetValue(coin));
+        BOOST_CHECK(mapFound.count(key) == 0);
+        // The outputs of a transaction come out next to each other
+        if (key.hash != txidLast) {
+            BOOST_CHECK(setTxidsDone.insert(key.hash).second);
+            txidLast = key.hash;
+        }
+        mapFound[key] = coin;
+        cacheCopy.AddCoin(key, coin, false);
+    }
+    BOOST_CHECK(mapFound == mapExpected);
+    BOOST_CHECK(cacheCopy.Flush());
+
+    CCoinsStats stats, statsCopy;
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 10U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, mapExpected.size() - 1);
+    BOOST_CHECK(dbCopy.GetStats(statsCopy));
+    BOOST_CHECK_EQUAL(statsCopy.nTransactions, 11U);
+    BOOST_CHECK_EQUAL(statsCopy.nTransactionOutputs, mapExpected.size());
+
+    // Restoring the spent output brings the hashes together
+    cache.AddCoin(outSingle, coinSingle, true);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, statsCopy.nTransactions);
+    BOOST_CHECK(stats.hashMuHash == statsCopy.hashMuHash);
+}
+
+BOOST_AUTO_TEST_CASE(coins_write_behind_test)
+{
+    CCoinsViewDBTest db;
+    CCoinsViewWriteBehind writebehind(&db);
+    COutPoint outpoint(GetRandHash(), 1);
+    uint256 hashBlock = GetRandHash();
+    Coin coin;
+    coin.nHeight = 10;
+    coin.out.nValue = 5;
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+
+    // Deferred: the flush returns with the batch still pending, but readers see it
+    BOOST_CHECK(writebehind.SetDeferred(true));
+    {
+        CCoinsViewCache cache(&writebehind);
+        cache.AddCoin(outpoint, coin, false);
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(writebehind.IsPending());
+    BOOST_CHECK(!db.HaveCoin(outpoint));
+    BOOST_CHECK(db.GetBestBlock() != hashBlock);
+    Coin result;
+    BOOST_CHECK(writebehind.GetCoin(outpoint, result));
+    BOOST_CHECK(result == coin);
+    BOOST_CHECK(writebehind.HaveCoin(outpoint));
+    BOOST_CHECK(writebehind.GetBestBlock() == hashBlock);
+
+    BOOST_CHECK(writebehind.Commit());
+    BOOST_CHECK(!writebehind.IsPending());
+    BOOST_CHECK(db.GetCoin(outpoint, result));
+    BOOST_CHECK(result == coin);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+    // A spend that is still pending hides the coin in the database
+    {
+        CCoinsViewCache cache(&writebehind);
+        BOOST_CHECK(cache.SpendCoin(outpoint));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.HaveCoin(outpoint));
+    BOOST_CHECK(!writebehind.HaveCoin(outpoint));
+    BOOST_CHECK(!writebehind.GetCoin(outpoint, result));
+
+    // Turning deferral off commits what is pending, and writes through afterwards
+    BOOST_CHECK(writebehind.SetDeferred(false));
+    BOOST_CHECK(!db.HaveCoin(outpoint));
+    {
+        CCoinsViewCache cache(&writebehind);
+        cache.AddCoin(outpoint, coin, false);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!writebehind.IsPending());
+    BOOST_CHECK(db.HaveCoin(outpoint));
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,68 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "histogram.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(histogram_tests)
+
+BOOST_AUTO_TEST_CASE(histogram_buckets)
+{
+    // Small values are counted exactly
+    for (int64_t n = 0; n < 2 * CLatencyHistogram::SUB_BUCKETS; n++) {
+        BOOST_CHECK_EQUAL(CLatencyHistogram::BucketFor(n), n);
+        BOOST_CHECK_EQUAL(CLatencyHistogram::UpperBound(n), n);
+    }
+
+    // Every value lies within the bounds of its bucket, which are within 12.5% of each other
+    int nLastBucket = 0;
+    for (int64_t n = 1; n < ((int64_t)1 << 40); n += n / 7 + 1) {
+        int nBucket = CLatencyHistogram::BucketFor(n);
+        BOOST_CHECK(nBucket >= nLastBucket);
+        BOOST_CHECK(nBucket < CLatencyHistogram::BUCKETS);
+        BOOST_CHECK(n <= CLatencyHistogram::UpperBound(nBucket));
+        if (nBucket > 0)
+            BOOST_CHECK(n > CLatencyHistogram::UpperBound(nBucket - 1));
+        BOOST_CHECK(CLatencyHistogram::UpperBound(nBucket) - n <= n / CLatencyHistogram::SUB_BUCKETS);
+        nLastBucket = nBucket;
+    }
+
+    // Huge values are clamped into the last bucket
+    BOOST_CHECK_EQUAL(CLatencyHistogram::BucketFor(std::numeric_limits<int64_t>::max()), CLatencyHistogram::BUCKETS - 1);
+}
+
+BOOST_AUTO_TEST_CASE(histogram_percentiles)
+{
+    CLatencyHistogram histogram;
+    BOOST_CHECK_EQUAL(histogram.GetCount(), 0U);
+    BOOST_CHECK_EQUAL(histogram.GetPercentile(0.5), 0);
+
+    for (int64_t n = 1; n <= 1000; n++)
+        histogram.Add(n);
+    BOOST_CHECK_EQUAL(histogram.GetCount(), 1000U);
+    BOOST_CHECK_EQUAL(histogram.GetMax(), 1000);
+    BOOST_CHECK_EQUAL(histogram.GetMean(), 500);
+
+    int64_t nMedian = histogram.GetPercentile(0.5);
+    BOOST_CHECK(nMedian >= 500 && nMedian <= 500 + 500 / CLatencyHistogram::SUB_BUCKETS);
+    int64_t n99 = histogram.GetPercentile(0.99);
+    BOOST_CHECK(n99 >= 990 && n99 <= 1000);
+    BOOST_CHECK_EQUAL(histogram.GetPercentile(1.0), 1000);
+
+    CLatencyHistogram other;
+    other.Add(1000000);
+    histogram.Merge(other);
+    BOOST_CHECK_EQUAL(histogram.GetCount(), 1001U);
+    BOOST_CHECK_EQUAL(histogram.GetMax(), 1000000);
+    BOOST_CHECK_EQUAL(histogram.GetPercentile(1.0), 1000000);
+
+    histogram.clear();
+    BOOST_CHECK_EQUAL(histogram.GetCount(), 0U);
+    BOOST_CHECK_EQUAL(histogram.GetMax(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for the LevelDB profiles of the initial download and a synced node
+//
+
+#include "leveldbwrapper.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <string>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static void CheckProfile(const CLevelDBProfile& profile, const string& strName, int nWriteBufferPercent, int nMaxOpenFiles)
+{
+    BOOST_CHECK_EQUAL(profile.strName, strName);
+    BOOST_CHECK_EQUAL(profile.nWriteBufferPercent, nWriteBufferPercent);
+    BOOST_CHECK_EQUAL(profile.nMaxOpenFiles, nMaxOpenFiles);
+}
+
+BOOST_AUTO_TEST_SUITE(leveldbwrapper_tests)
+
+BOOST_AUTO_TEST_CASE(leveldb_profile_args)
+{
+    CheckProfile(GetLevelDBProfile(true, true), "ibd", DEFAULT_DB_IBD_WRITE_BUFFER, DEFAULT_DB_MAX_OPEN_FILES);
+    CheckProfile(GetLevelDBProfile(false, true), "steady", DEFAULT_DB_WRITE_BUFFER, DEFAULT_DB_MAX_OPEN_FILES);
+
+    mapArgs["-dbibdwritebuffer"] = "30";
+    mapArgs["-dbwritebuffer"] = "15";
+    mapArgs["-dbmaxopenfiles"] = "1000";
+    CheckProfile(GetLevelDBProfile(true, true), "ibd", 30, 1000);
+    CheckProfile(GetLevelDBProfile(false, true), "steady", 15, 1000);
+    // The block tree database gets a quarter of the open files, but not less than the LevelDB default
+    CheckProfile(GetLevelDBProfile(true, false), "ibd", 30, 250);
+    CheckProfile(GetLevelDBProfile(false, false), "steady", 15, 250);
+    mapArgs["-dbmaxopenfiles"] = "100";
+    CheckProfile(GetLevelDBProfile(false, false), "steady", 15, 64);
+    mapArgs["-dbmaxopenfiles"] = "20";
+    CheckProfile(GetLevelDBProfile(false, false), "steady", 15, 20);
+
+    mapArgs.erase("-dbibdwritebuffer");
+    mapArgs.erase("-dbwritebuffer");
+    mapArgs.erase("-dbmaxopenfiles");
+}
+
+BOOST_AUTO_TEST_CASE(leveldb_profile_apply)
+{
+    const size_t nCacheSize = 8 << 20;
+    CLevelDBWrapper db(GetDataDir() / "test_leveldb_profile", nCacheSize, true, false, CLevelDBProfile("ibd", 40, 200));
+    CLevelDBStats stats;
+    db.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.strProfile, "ibd");
+    BOOST_CHECK_EQUAL(stats.nWriteBufferSize, nCacheSize / 100 * 40);
+    BOOST_CHECK_EQUAL(stats.nBlockCacheSize, nCacheSize - 2 * stats.nWriteBufferSize);
+    BOOST_CHECK_EQUAL(stats.nMaxOpenFiles, 200);
+    BOOST_CHECK(db.Write('k', string("value")));
+
+    // Reopening with another profile keeps the data
+    BOOST_CHECK(db.SetProfile(CLevelDBProfile("steady", 10, 50)));
+    db.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.strProfile, "steady");
+    BOOST_CHECK_EQUAL(stats.nWriteBufferSize, nCacheSize / 100 * 10);
+    BOOST_CHECK_EQUAL(stats.nBlockCacheSize, nCacheSize - 2 * stats.nWriteBufferSize);
+    BOOST_CHECK_EQUAL(stats.nMaxOpenFiles, 50);
+    string strValue;
+    BOOST_CHECK(db.Read('k', strValue));
+    BOOST_CHECK_EQUAL(strValue, "value");
+
+    // Out of range values are clamped
+    BOOST_CHECK(db.SetProfile(CLevelDBProfile("steady", 90, 5)));
+    db.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nWriteBufferSize, nCacheSize / 100 * 44);
+    BOOST_CHECK_EQUAL(stats.nMaxOpenFiles, 20);
+    BOOST_CHECK(db.SetProfile(CLevelDBProfile("steady", 0, 50)));
+    db.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nWriteBufferSize, nCacheSize / 100);
+
+    // Not while an iterator is open; the same profile needs no reopening
+    {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+        BOOST_CHECK(!db.SetProfile(CLevelDBProfile("ibd", 40, 200)));
+        BOOST_CHECK(db.SetProfile(CLevelDBProfile("steady", 0, 50)));
+    }
+    db.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.strProfile, "steady");
+    BOOST_CHECK(db.SetProfile(CLevelDBProfile("ibd", 40, 200)));
+    db.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.strProfile, "ibd");
+    BOOST_CHECK(db.Read('k', strValue));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,118 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include "clientversion.h"
+#include "serialize.h"
+#include "streams.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+static std::vector<unsigned char> Element(const std::string& str)
+{
+    return std::vector<unsigned char>(str.begin(), str.end());
+}
+
+BOOST_AUTO_TEST_SUITE(muhash_tests)
+
+BOOST_AUTO_TEST_CASE(muhash_set_semantics)
+{
+    MuHash3072 empty;
+    uint256 hashEmpty = empty.Finalize();
+
+    // Insertion order does not matter
+    MuHash3072 a, b;
+    a.Insert(Element("one"));
+    a.Insert(Element("two"));
+    a.Insert(Element("three"));
+    b.Insert(Element("three"));
+    b.Insert(Element("one"));
+    b.Insert(Element("two"));
+    BOOST_CHECK(a.Finalize() == b.Finalize());
+    BOOST_CHECK(a.Finalize() != hashEmpty);
+
+    // Different sets hash differently
+    MuHash3072 c;
+    c.Insert(Element("one"));
+    c.Insert(Element("two"));
+    BOOST_CHECK(c.Finalize() != a.Finalize());
+
+    // Removing undoes inserting, in any order
+    b.Remove(Element("one"));
+    b.Remove(Element("three"));
+    MuHash3072 d;
+    d.Insert(Element("two"));
+    BOOST_CHECK(b.Finalize() == d.Finalize());
+    b.Remove(Element("two"));
+    BOOST_CHECK(b.Finalize() == hashEmpty);
+
+    // A removal may come before its insertion
+    MuHash3072 e;
+    e.Remove(Element("four"));
+    e.Insert(Element("one"));
+    e.Insert(Element("four"));
+    MuHash3072 f;
+    f.Insert(Element("one"));
+    BOOST_CHECK(e.Finalize() == f.Finalize());
+}
+
+BOOST_AUTO_TEST_CASE(muhash_combine_serialize)
+{
+    MuHash3072 a, b, all;
+    a.Insert(Element("one"));
+    b.Insert(Element("two"));
+    b.Remove(Element("three"));
+    all.Insert(Element("two"));
+    all.Insert(Element("one"));
+    all.Remove(Element("three"));
+    a *= b;
+    BOOST_CHECK(a.Finalize() == all.Finalize());
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << a;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * MuHash3072::BYTE_SIZE);
+    MuHash3072 c;
+    ss >> c;
+    BOOST_CHECK(c.Finalize() == all.Finalize());
+}
+
+BOOST_AUTO_TEST_CASE(muhash_known_answer)
+{
+    // Computed independently, from the definition in muhash.h
+    MuHash3072 empty;
+    BOOST_CHECK_EQUAL(empty.Finalize().GetHex(), "a5565d0f791a956bce308affcc938701a132cbff1a5266d12e14ecfba54216ab");
+
+    MuHash3072 a;
+    a.Insert(Element("one"));
+    a.Insert(Element("two"));
+    a.Insert(Element("three"));
+    BOOST_CHECK_EQUAL(a.Finalize().GetHex(), "cf4ba740e68cfa899a2b7b1710c6a86fe9d192332ef5dfd9989b55e3bfaa1677");
+
+    MuHash3072 b;
+    b.Insert(Element("one"));
+    b.Remove(Element("three"));
+    b.Insert(Element("two"));
+    BOOST_CHECK_EQUAL(b.Finalize().GetHex(), "dc854065b153f106b4881a3e37605e9010806d4e83e9010724112f186c4a7e28");
+}
+
+BOOST_AUTO_TEST_CASE(muhash_copy)
+{
+    // Copies are independent of the original
+    MuHash3072 a;
+    a.Insert(Element("one"));
+    MuHash3072 b(a);
+    MuHash3072 c;
+    c = a;
+    a.Insert(Element("two"));
+    BOOST_CHECK(b.Finalize() == c.Finalize());
+    BOOST_CHECK(b.Finalize() != a.Finalize());
+    b.Insert(Element("two"));
+    BOOST_CHECK(b.Finalize() == a.Finalize());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,9 +5,12 @@
 
 #include "netbase.h"
 
+#include "utiltime.h"
+
 #include <string>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
@@ -145,4 +148,85 @@ BOOST_AUTO_TEST_CASE(subnet_test)
     BOOST_CHECK(!CSubNet("fuzzy").IsValid());
 }
 
+static int nStubLookups = 0;
+
+static bool StubResolver(const std::string& strName, std::vector<CNetAddr>& vIP)
+{
+    nStubLookups++;
+    if (strName == "seed.example.org") {
+        vIP.push_back(CNetAddr("1.2.3.4"));
+        vIP.push_back(CNetAddr("2001::1"));
+    }
+    return !vIP.empty();
+}
+
+BOOST_AUTO_TEST_CASE(netbase_dnscache)
+{
+    SetNameResolver(StubResolver);
+    nStubLookups = 0;
+
+    // Numeric addresses never reach the resolver
+    vector<CNetAddr> vIP;
+    BOOST_CHECK(LookupHost("8.8.8.8", vIP));
+    BOOST_CHECK_EQUAL(nStubLookups, 0);
+
+    // Names are resolved once, then served from the cache
+    BOOST_CHECK(LookupHost("seed.example.org", vIP));
+    BOOST_CHECK_EQUAL(vIP.size(), 2U);
+    BOOST_CHECK(vIP[0] == CNetAddr("1.2.3.4"));
+    BOOST_CHECK(LookupHost("Seed.Example.ORG", vIP, 1));
+    BOOST_CHECK_EQUAL(vIP.size(), 1U);
+    CService addr;
+    BOOST_CHECK(Lookup("seed.example.org:1234", addr));
+    BOOST_CHECK(addr == CService("1.2.3.4", 1234));
+    BOOST_CHECK_EQUAL(nStubLookups, 1);
+
+    // Failures are cached too
+    BOOST_CHECK(!LookupHost("nx.example.org", vIP));
+    BOOST_CHECK(!LookupHost("nx.example.org", vIP));
+    BOOST_CHECK_EQUAL(nStubLookups, 2);
+
+    // Lookups are not attempted at all without fAllowLookup
+    BOOST_CHECK(!LookupHost("other.example.org", vIP, 0, false));
+    BOOST_CHECK_EQUAL(nStubLookups, 2);
+
+    ClearDNSCache();
+    BOOST_CHECK(LookupHost("seed.example.org", vIP));
+    BOOST_CHECK_EQUAL(nStubLookups, 3);
+
+    SetNameResolver(NULL);
+}
+
+BOOST_AUTO_TEST_CASE(netbase_dnsresolver_thread)
+{
+    SetNameResolver(StubResolver);
+    nStubLookups = 0;
+
+    boost::thread resolver(&ThreadDNSResolver);
+    MilliSleep(50);
+
+    // A non-blocking lookup queues the name and comes back later for the answer
+    vector<CService> vAddr;
+    bool fPending = false;
+    if (!Lookup("seed.example.org", vAddr, 7333, true, 0, &fPending)) {
+        BOOST_CHECK(fPending);
+        for (int i = 0; i < 100 && !Lookup("seed.example.org", vAddr, 7333, true, 0, &fPending); i++)
+            MilliSleep(10);
+    }
+    BOOST_CHECK(!fPending);
+    BOOST_CHECK_EQUAL(vAddr.size(), 2U);
+    BOOST_CHECK(vAddr[1] == CService("[2001::1]:7333"));
+
+    // Blocking lookups wait for the resolver thread
+    vector<CNetAddr> vIP;
+    BOOST_CHECK(!LookupHost("nx.example.org", vIP));
+    BOOST_CHECK(!LookupHost("nx.example.org", vIP, 0, true, &fPending));
+    BOOST_CHECK(!fPending);
+    BOOST_CHECK_EQUAL(nStubLookups, 2);
+
+    resolver.interrupt();
+    resolver.join();
+    SetNameResolver(NULL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,138 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for choosing block files to prune, and pruning their blocks
+//
+
+#include "test_dynamiccoin.h"
+
+#include "main.h"
+
+#include <set>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static const uint64_t nFileSize = 100 << 20;
+static const uint64_t nUndoSize = 20 << 20;
+static const uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+
+/** Five full block files of 100 blocks each; the last one is being written */
+static vector<CBlockFileInfo> MakeBlockFiles()
+{
+    vector<CBlockFileInfo> vinfo(5);
+    for (unsigned int nFile = 0; nFile < vinfo.size(); nFile++) {
+        for (unsigned int nHeight = nFile * 100; nHeight < nFile * 100 + 100; nHeight++)
+            vinfo[nFile].AddBlock(nHeight, 1441880383 + nHeight * 60);
+        vinfo[nFile].nSize = nFileSize;
+        vinfo[nFile].nUndoSize = nUndoSize;
+    }
+    return vinfo;
+}
+
+static uint64_t Usage(const vector<CBlockFileInfo>& vinfo)
+{
+    uint64_t nUsage = 0;
+    for (unsigned int nFile = 0; nFile < vinfo.size(); nFile++)
+        nUsage += vinfo[nFile].nSize + vinfo[nFile].nUndoSize;
+    return nUsage;
+}
+
+static set<int> Select(const vector<CBlockFileInfo>& vinfo, uint64_t nTarget, unsigned int nMaxHeight, int nSnapshotHeight = -1)
+{
+    set<int> setFilesToPrune;
+    SelectFilesToPrune(vinfo, vinfo.size() - 1, Usage(vinfo), nTarget, nMaxHeight, nSnapshotHeight, setFilesToPrune);
+    return setFilesToPrune;
+}
+
+BOOST_AUTO_TEST_SUITE(pruning_tests)
+
+BOOST_AUTO_TEST_CASE(select_files_to_prune)
+{
+    vector<CBlockFileInfo> vinfo = MakeBlockFiles();
+    const uint64_t nFileUsage = nFileSize + nUndoSize;
+
+    // Nothing while the files, and room for the next chunks, fit in the target
+    BOOST_CHECK(Select(vinfo, 5 * nFileUsage + nBuffer + 1, 1000).empty());
+
+    // The oldest files, just enough of them to get below the target again
+    set<int> setExpected;
+    setExpected.insert(0);
+    BOOST_CHECK(Select(vinfo, 5 * nFileUsage + nBuffer, 1000) == setExpected);
+    BOOST_CHECK(Select(vinfo, 4 * nFileUsage + nBuffer + 1, 1000) == setExpected);
+    setExpected.insert(1);
+    BOOST_CHECK(Select(vinfo, 3 * nFileUsage + nBuffer + 1, 1000) == setExpected);
+
+    // Never the file being written, however far above the target
+    setExpected.insert(2);
+    setExpected.insert(3);
+    BOOST_CHECK(Select(vinfo, 1, 1000) == setExpected);
+
+    // Files with blocks above the last height to prune (the recent blocks to keep) stay
+    setExpected.clear();
+    setExpected.insert(0);
+    BOOST_CHECK(Select(vinfo, 1, 198) == setExpected);
+    BOOST_CHECK(Select(vinfo, 1, 99) == setExpected);
+    BOOST_CHECK(Select(vinfo, 1, 98).empty());
+    setExpected.insert(1);
+    BOOST_CHECK(Select(vinfo, 1, 199) == setExpected);
+
+    // ... and so do files with blocks at or below a snapshot still being validated
+    setExpected.clear();
+    setExpected.insert(2);
+    setExpected.insert(3);
+    BOOST_CHECK(Select(vinfo, 1, 1000, 100) == setExpected);
+    BOOST_CHECK(Select(vinfo, 3 * nFileUsage + nBuffer + 1, 1000, 199) == setExpected);
+    BOOST_CHECK(Select(vinfo, 1, 1000, 399).empty());
+
+    // Files pruned before are skipped, and no longer count
+    vinfo[0].SetNull();
+    setExpected.clear();
+    setExpected.insert(1);
+    BOOST_CHECK(Select(vinfo, 3 * nFileUsage + nBuffer + 1, 1000) == setExpected);
+}
+
+BOOST_AUTO_TEST_CASE(prune_block_index_entry)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    vector<CMutableTransaction> noTxns;
+    for (int i = 0; i < 2; i++)
+        CreateAndProcessBlock(noTxns, scriptPubKey);
+    // A connected block has both block and undo data, a block on a side branch only the former
+    CBlockIndex *pindexConnected = chainActive.Tip()->pprev;
+    CBlock blockFork = CreateAndProcessBlock(noTxns, CScript() << OP_2, pindexConnected->pprev);
+
+    LOCK(cs_main);
+    CBlockIndex *pindexFork = mapBlockIndex[blockFork.GetHash()];
+    BOOST_CHECK(!chainActive.Contains(pindexFork));
+
+    CBlockIndex *vpindex[] = { pindexConnected, pindexFork };
+    for (unsigned int i = 0; i < 2; i++) {
+        CBlockIndex *pindex = vpindex[i];
+        CBlockIndex saved = *pindex;
+        BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_DATA);
+        BOOST_CHECK_EQUAL(!!(pindex->nStatus & BLOCK_HAVE_UNDO), pindex == pindexConnected);
+
+        PruneBlockIndexEntry(pindex);
+        BOOST_CHECK(!(pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)));
+        BOOST_CHECK_EQUAL(pindex->nFile, 0);
+        BOOST_CHECK_EQUAL(pindex->nDataPos, 0U);
+        BOOST_CHECK_EQUAL(pindex->nUndoPos, 0U);
+        // What was validated, and the number of transactions, are kept
+        BOOST_CHECK_EQUAL(pindex->nStatus & BLOCK_VALID_MASK, saved.nStatus & BLOCK_VALID_MASK);
+        BOOST_CHECK_EQUAL(pindex->nTx, saved.nTx);
+        BOOST_CHECK_EQUAL(pindex->nChainTx, saved.nChainTx);
+
+        // The blocks are still needed by the tests after this one
+        pindex->nStatus = saved.nStatus;
+        pindex->nFile = saved.nFile;
+        pindex->nDataPos = saved.nDataPos;
+        pindex->nUndoPos = saved.nUndoPos;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
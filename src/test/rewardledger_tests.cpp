@@ -0,0 +1,186 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rewardledger.h"
+
+#include "test_dynamiccoin.h"
+
+#include "GrsApi.h"
+#include "chainparams.h"
+#include "main.h"
+#include "txdb.h"
+
+#include <utility>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static CRewardLedgerEntry MakeEntry(uint32_t nHeight)
+{
+    CRewardLedgerEntry entry;
+    entry.nTime = 1441880383 + nHeight * 60;
+    entry.nReward = (1000 + nHeight) * COIN;
+    entry.fPriceKnown = nHeight % 3 != 0;
+    entry.nPrice = entry.fPriceKnown ? 10 * USCENT1 + nHeight : 0;
+    entry.nTargetPrice = nHeight % 2 ? 11 * USD1 : 0;
+    entry.nDecision = nHeight % 4;
+    return entry;
+}
+
+static bool CollectEntry(vector<pair<uint32_t, CRewardLedgerEntry> >& vEntries, size_t nMax, uint32_t nHeight, const CRewardLedgerEntry& entry)
+{
+    vEntries.push_back(make_pair(nHeight, entry));
+    return vEntries.size() < nMax;
+}
+
+static vector<pair<uint32_t, CRewardLedgerEntry> > ReadRange(CBlockTreeDB& db, uint32_t nStart, uint32_t nEnd, size_t nMax = 1000)
+{
+    vector<pair<uint32_t, CRewardLedgerEntry> > vEntries;
+    BOOST_CHECK(db.ReadRewardLedger(nStart, nEnd, boost::bind(&CollectEntry, boost::ref(vEntries), nMax, _1, _2)));
+    return vEntries;
+}
+
+BOOST_AUTO_TEST_SUITE(rewardledger_tests)
+
+BOOST_AUTO_TEST_CASE(rewardledger_blocktree)
+{
+    CBlockTreeDB db(1 << 20, true);
+
+    // Heights across byte boundaries, so that a little-endian key would sort them wrongly
+    vector<pair<uint32_t, CRewardLedgerEntry> > vWrite;
+    for (uint32_t nHeight = 250; nHeight < 270; nHeight++)
+        vWrite.push_back(make_pair(nHeight, MakeEntry(nHeight)));
+    vWrite.push_back(make_pair(65536U, MakeEntry(65536)));
+    BOOST_CHECK(db.WriteRewardLedger(vWrite));
+
+    CRewardLedgerEntry entry;
+    BOOST_CHECK(db.ReadRewardLedger(257, entry));
+    BOOST_CHECK_EQUAL(entry.nTime, MakeEntry(257).nTime);
+    BOOST_CHECK_EQUAL(entry.nReward, MakeEntry(257).nReward);
+    BOOST_CHECK(entry.fPriceKnown);
+    BOOST_CHECK_EQUAL(entry.nPrice, MakeEntry(257).nPrice);
+    BOOST_CHECK_EQUAL(entry.nTargetPrice, MakeEntry(257).nTargetPrice);
+    BOOST_CHECK_EQUAL(entry.nDecision, MakeEntry(257).nDecision);
+    // An unknown price reads back as unknown, not as the price of the entry read into
+    BOOST_CHECK(db.ReadRewardLedger(258, entry));
+    BOOST_CHECK(!entry.fPriceKnown);
+    BOOST_CHECK_EQUAL(entry.nPrice, 0);
+    BOOST_CHECK_EQUAL(entry.nTargetPrice, MakeEntry(258).nTargetPrice);
+    BOOST_CHECK_EQUAL(entry.nDecision, MakeEntry(258).nDecision);
+    BOOST_CHECK(!db.ReadRewardLedger(249, entry));
+
+    // A range comes out in height order, and stops at its end
+    vector<pair<uint32_t, CRewardLedgerEntry> > vRead = ReadRange(db, 254, 260);
+    BOOST_CHECK_EQUAL(vRead.size(), 7U);
+    for (size_t i = 0; i < vRead.size(); i++) {
+        BOOST_CHECK_EQUAL(vRead[i].first, 254 + i);
+        BOOST_CHECK_EQUAL(vRead[i].second.nReward, MakeEntry(254 + i).nReward);
+    }
+    BOOST_CHECK_EQUAL(ReadRange(db, 0, 100000).size(), 21U);
+    BOOST_CHECK_EQUAL(ReadRange(db, 270, 65535).size(), 0U);
+    BOOST_CHECK_EQUAL(ReadRange(db, 269, 100000).back().first, 65536U);
+    BOOST_CHECK_EQUAL(ReadRange(db, 0, 100000, 3).size(), 3U);
+
+    // Disconnecting a block erases its record
+    BOOST_CHECK(db.EraseRewardLedger(269));
+    BOOST_CHECK(!db.ReadRewardLedger(269, entry));
+    BOOST_CHECK_EQUAL(ReadRange(db, 260, 300).size(), 9U);
+}
+
+BOOST_AUTO_TEST_CASE(rewardledger_entry)
+{
+    CBlockIndex indexPrev;
+    indexPrev.nReward = 1000 * COIN;
+    CBlockIndex index;
+    index.pprev = &indexPrev;
+
+    // Before the live feed the reward and the price are on the schedule
+    index.nTime = 1441880383;
+    index.nReward = 1024 * COIN;
+    CRewardLedgerEntry entry = pDmcSystem->GetRewardLedgerEntry(&index);
+    BOOST_CHECK_EQUAL(entry.nTime, index.nTime);
+    BOOST_CHECK_EQUAL(entry.nReward, index.nReward);
+    BOOST_CHECK(entry.fPriceKnown);
+    BOOST_CHECK_EQUAL(entry.nPrice, 10 * USCENT1);
+    BOOST_CHECK_EQUAL(entry.nTargetPrice, 0);
+    BOOST_CHECK_EQUAL(entry.nDecision, REWARD_SCHEDULE);
+
+    // After it the reward is stepped against a feed price that blocks do not
+    // carry, however recently this node asked the feed
+    index.nTime = Params().LiveFeedSwitchTime() + 1;
+    index.nReward = 1001 * COIN;
+    entry = pDmcSystem->GetRewardLedgerEntry(&index);
+    BOOST_CHECK(!entry.fPriceKnown);
+    BOOST_CHECK_EQUAL(entry.nPrice, 0);
+    BOOST_CHECK_EQUAL(entry.nTargetPrice, 11 * USD1);
+    BOOST_CHECK_EQUAL(entry.nDecision, REWARD_RAISE);
+    index.nReward = 999 * COIN;
+    BOOST_CHECK_EQUAL(pDmcSystem->GetRewardLedgerEntry(&index).nDecision, REWARD_LOWER);
+    index.nReward = 1000 * COIN;
+    BOOST_CHECK_EQUAL(pDmcSystem->GetRewardLedgerEntry(&index).nDecision, REWARD_HOLD);
+}
+
+static void CheckRecord(const CBlockIndex* pindex)
+{
+    CRewardLedgerEntry entry;
+    BOOST_REQUIRE(pblocktree->ReadRewardLedger(pindex->nHeight, entry));
+    BOOST_CHECK_EQUAL(entry.nTime, pindex->nTime);
+    BOOST_CHECK_EQUAL(entry.nReward, pindex->nReward);
+    // The blocks of the tests are from before the first scheduled price
+    BOOST_CHECK(!entry.fPriceKnown);
+    BOOST_CHECK_EQUAL(entry.nTargetPrice, 0);
+    BOOST_CHECK_EQUAL(entry.nDecision, REWARD_SCHEDULE);
+}
+
+BOOST_AUTO_TEST_CASE(rewardledger_connect_disconnect)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    vector<CMutableTransaction> noTxns;
+    for (int i = 0; i < 3; i++)
+        CreateAndProcessBlock(noTxns, scriptPubKey);
+    CBlockIndex *pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    for (CBlockIndex *pindex = pindexTip; pindex->nHeight > pindexTip->nHeight - 3; pindex = pindex->pprev)
+        CheckRecord(pindex);
+    vector<pair<uint32_t, CRewardLedgerEntry> > vRead = ReadRange(*pblocktree, pindexTip->nHeight - 2, pindexTip->nHeight + 10);
+    BOOST_CHECK_EQUAL(vRead.size(), 3U);
+    BOOST_CHECK_EQUAL(vRead.back().first, (uint32_t)pindexTip->nHeight);
+
+    // Disconnecting the tip erases its record, and connecting it again
+    // writes it back (it is read back from disk, without proof of work)
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    CValidationState state;
+    CRewardLedgerEntry entry;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, pindexTip));
+        BOOST_CHECK(chainActive.Tip() == pindexTip->pprev);
+        BOOST_CHECK(!pblocktree->ReadRewardLedger(pindexTip->nHeight, entry));
+        CheckRecord(pindexTip->pprev);
+        BOOST_CHECK(ReconsiderBlock(state, pindexTip));
+    }
+    BOOST_CHECK(ActivateBestChain(state));
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip() == pindexTip);
+    }
+    CheckRecord(pindexTip);
+
+    // Records missing at the tip, as after an unclean shutdown, are backfilled
+    BOOST_CHECK(pblocktree->EraseRewardLedger(pindexTip->nHeight));
+    BOOST_CHECK(pblocktree->EraseRewardLedger(pindexTip->nHeight - 1));
+    BOOST_CHECK(UpdateRewardLedger());
+    CheckRecord(pindexTip);
+    CheckRecord(pindexTip->pprev);
+    BOOST_CHECK_EQUAL(ReadRange(*pblocktree, pindexTip->nHeight - 2, pindexTip->nHeight + 10).size(), 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -157,6 +157,90 @@ BOOST_AUTO_TEST_CASE(json_parse_errors)
     BOOST_CHECK_EQUAL(read_string(std::string("3J98t1WpEZ73CNmQviecrnyiWrnqRhWNL"), value), false);
 }
 
+BOOST_AUTO_TEST_CASE(json_stream_writer)
+{
+    Object inner;
+    inner.push_back(Pair("a", "x\"y\n"));
+    inner.push_back(Pair("b", Array()));
+    Array arr;
+    arr.push_back(1);
+    arr.push_back(inner);
+    arr.push_back(Object());
+    Object obj;
+    obj.push_back(Pair("int", (int64_t)-5));
+    obj.push_back(Pair("uint", (uint64_t)18446744073709551615ULL));
+    obj.push_back(Pair("real", 0.1));
+    obj.push_back(Pair("bool", true));
+    obj.push_back(Pair("null", Value::null));
+    obj.push_back(Pair("arr", arr));
+    obj.push_back(Pair("obj", inner));
+    obj.push_back(Pair("empty", Object()));
+
+    // Written piece by piece, and in whole values, it is what write_string makes of it
+    std::ostringstream ss;
+    CJSONStreamWriter writer(ss);
+    writer.BeginObject();
+    writer.Write("int", (int64_t)-5);
+    writer.Key("uint");
+    writer.Write((uint64_t)18446744073709551615ULL);
+    writer.Write("real", 0.1);
+    writer.Write("bool", true);
+    writer.Write("null", Value::null);
+    writer.BeginArray("arr");
+    writer.Write(1);
+    writer.BeginObject();
+    writer.Write("a", "x\"y\n");
+    writer.BeginArray("b");
+    writer.EndArray();
+    writer.EndObject();
+    writer.BeginObject();
+    writer.EndObject();
+    writer.EndArray();
+    writer.Write("obj", inner);
+    writer.BeginObject("empty");
+    writer.EndObject();
+    writer.EndObject();
+    BOOST_CHECK_EQUAL(ss.str(), write_string(Value(obj), false));
+
+    std::ostringstream ss2;
+    CJSONStreamWriter writer2(ss2);
+    writer2.Write(arr);
+    BOOST_CHECK_EQUAL(ss2.str(), write_string(Value(arr), false));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_http_chunked)
+{
+    // A reply with chunked transfer encoding, as the server sends large results
+    std::string strBody(100000, 'x');
+    strBody[0] = '[';
+    std::ostringstream ssReply;
+    ssReply << HTTPReplyHeaderChunked(HTTP_OK, true);
+    for (size_t nPos = 0; nPos < strBody.size(); nPos += 65536) {
+        size_t nSize = std::min(strBody.size() - nPos, (size_t)65536);
+        ssReply << HTTPChunkHeader(nSize) << strBody.substr(nPos, nSize) << "\r\n";
+    }
+    ssReply << HTTPChunkHeader(0) << "\r\n";
+
+    std::istringstream stream(ssReply.str());
+    int nProto = 0;
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(stream, nProto), HTTP_OK);
+    map<string, string> mapHeaders;
+    string strMessage;
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(stream, mapHeaders, strMessage, nProto, 1000000), HTTP_OK);
+    BOOST_CHECK(strMessage == strBody);
+    BOOST_CHECK_EQUAL(mapHeaders["connection"], "keep-alive");
+
+    // Larger than allowed
+    std::istringstream stream2(ssReply.str());
+    ReadHTTPStatus(stream2, nProto);
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(stream2, mapHeaders, strMessage, nProto, 99999), HTTP_INTERNAL_SERVER_ERROR);
+
+    // Cut short
+    std::istringstream stream3(ssReply.str().substr(0, ssReply.str().size() / 2));
+    ReadHTTPStatus(stream3, nProto);
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(stream3, mapHeaders, strMessage, nProto, 1000000), HTTP_INTERNAL_SERVER_ERROR);
+}
+
 BOOST_AUTO_TEST_CASE(rpc_boostasiotocnetaddr)
 {
     // Check IPv4 addresses
@@ -0,0 +1,165 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpccache.h"
+
+#include "chain.h"
+#include "tinyformat.h"
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(rpccache_tests)
+
+class CTestResponseCache : public CRPCResponseCache
+{
+public:
+    void SetTip(int nHeight)
+    {
+        CBlockIndex index;
+        index.nHeight = nHeight;
+        UpdatedBlockTip(&index);
+    }
+};
+
+static std::string Reply(int nConfirmations)
+{
+    return strprintf("{\"hash\":\"00ff\",\"confirmations\":%d,\"tx\":[\"\\\"confirmations\\\":7\"]}\n", nConfirmations);
+}
+
+BOOST_AUTO_TEST_CASE(rpccache_get_put)
+{
+    CTestResponseCache cache;
+    std::string strReply;
+
+    // Disabled
+    cache.SetLimits(0, 6, 100);
+    cache.Put("a", "\"hex\"", 90, false, cache.GetGeneration());
+    BOOST_CHECK(!cache.Get("a", strReply));
+
+    cache.SetLimits(1 << 20, 6, 100);
+    cache.Put("a", "\"hex\"", 90, false, cache.GetGeneration());
+    cache.Put("b", Reply(5), 96, true, cache.GetGeneration());
+    BOOST_CHECK(cache.Get("a", strReply));
+    BOOST_CHECK_EQUAL(strReply, "\"hex\"");
+    BOOST_CHECK(cache.Get("b", strReply));
+    BOOST_CHECK_EQUAL(strReply, Reply(5));
+    BOOST_CHECK(!cache.Get("c", strReply));
+
+    // The confirmations follow the tip
+    cache.SetTip(101);
+    cache.SetTip(102);
+    BOOST_CHECK(cache.Get("b", strReply));
+    BOOST_CHECK_EQUAL(strReply, Reply(7));
+    BOOST_CHECK(cache.Get("a", strReply));
+    BOOST_CHECK_EQUAL(strReply, "\"hex\"");
+
+    // Not added when made before a reorganization, or about a block above the tip
+    uint64_t nGeneration = cache.GetGeneration();
+    cache.SetTip(101);
+    cache.Put("c", Reply(10), 92, true, nGeneration);
+    BOOST_CHECK(!cache.Get("c", strReply));
+    cache.Put("c", Reply(10), 102, true, cache.GetGeneration());
+    BOOST_CHECK(!cache.Get("c", strReply));
+
+    CRPCCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 2U);
+    BOOST_CHECK_EQUAL(stats.nInserted, 2U);
+    BOOST_CHECK_EQUAL(stats.nHits, 4U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 3U);
+    BOOST_CHECK_EQUAL(stats.nMinDepth, 6);
+    BOOST_CHECK(stats.nBytes > Reply(5).size());
+
+    cache.Clear();
+    BOOST_CHECK(!cache.Get("a", strReply));
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 0U);
+    BOOST_CHECK_EQUAL(stats.nBytes, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(rpccache_evict)
+{
+    CTestResponseCache cache;
+    std::string strReply;
+    const std::string strLarge(1000, 'x');
+
+    cache.SetLimits(20000, 6, 1000);
+    for (int i = 0; i < 100; i++) {
+        cache.Put(strprintf("key %d", i), strLarge, i, false, cache.GetGeneration());
+        // Keep using the first one
+        BOOST_CHECK(cache.Get("key 0", strReply));
+    }
+
+    CRPCCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK(stats.nBytes <= 20000);
+    BOOST_CHECK(stats.nEntries > 10 && stats.nEntries < 20);
+    BOOST_CHECK_EQUAL(stats.nEvicted + stats.nEntries, 100U);
+
+    // The least recently used are gone
+    BOOST_CHECK(cache.Get("key 0", strReply));
+    BOOST_CHECK(!cache.Get("key 1", strReply));
+    BOOST_CHECK(cache.Get("key 99", strReply));
+
+    // Larger than the whole budget
+    cache.Put("huge", std::string(30000, 'x'), 1, false, cache.GetGeneration());
+    BOOST_CHECK(!cache.Get("huge", strReply));
+
+    // Shrinking the budget evicts
+    cache.SetLimits(5000, 6, 1000);
+    cache.GetStats(stats);
+    BOOST_CHECK(stats.nBytes <= 5000);
+    BOOST_CHECK(cache.Get("key 99", strReply));
+}
+
+BOOST_AUTO_TEST_CASE(rpccache_invalidate)
+{
+    CTestResponseCache cache;
+    std::string strReply;
+
+    cache.SetLimits(1 << 20, 6, 100);
+    cache.Put("50", Reply(51), 50, true, cache.GetGeneration());
+    cache.Put("90", Reply(11), 90, true, cache.GetGeneration());
+    cache.Put("94", Reply(7), 94, true, cache.GetGeneration());
+    cache.Put("95", Reply(6), 95, true, cache.GetGeneration());
+
+    // Connecting blocks does not invalidate anything
+    uint64_t nGeneration = cache.GetGeneration();
+    cache.SetTip(101);
+    BOOST_CHECK_EQUAL(cache.GetGeneration(), nGeneration);
+
+    // Disconnecting down to 94 drops the replies about 95 and 96, and about
+    // 94, which name 95 as the next block
+    cache.SetTip(100);
+    cache.SetTip(99);
+    cache.SetTip(98);
+    cache.SetTip(97);
+    cache.SetTip(96);
+    BOOST_CHECK(cache.Get("95", strReply));
+    BOOST_CHECK_EQUAL(strReply, Reply(2));
+    cache.SetTip(95);
+    BOOST_CHECK(!cache.Get("95", strReply));
+    BOOST_CHECK(cache.Get("94", strReply));
+    cache.SetTip(94);
+    BOOST_CHECK(cache.GetGeneration() != nGeneration);
+    BOOST_CHECK(!cache.Get("94", strReply));
+    BOOST_CHECK(cache.Get("90", strReply));
+    BOOST_CHECK_EQUAL(strReply, Reply(5));
+    BOOST_CHECK(cache.Get("50", strReply));
+
+    CRPCCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nInvalidated, 2U);
+    BOOST_CHECK_EQUAL(stats.nEntries, 2U);
+
+    // The new branch goes on
+    cache.SetTip(95);
+    cache.SetTip(96);
+    BOOST_CHECK(cache.Get("90", strReply));
+    BOOST_CHECK_EQUAL(strReply, Reply(7));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,134 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for announcing blocks with headers (sendheaders)
+//
+
+#include "test_dynamiccoin.h"
+
+#include "hash.h"
+#include "main.h"
+#include "net.h"
+#include "protocol.h"
+#include "version.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static CService ip(uint32_t i)
+{
+    struct in_addr s;
+    s.s_addr = i;
+    return CService(CNetAddr(s), Params().GetDefaultPort());
+}
+
+/** Hand a message to node as if it came in from the network, and process it */
+static void ReceiveMessage(CNode& node, const char* pszCommand, const CDataStream& ssPayload)
+{
+    CMessageHeader hdr(pszCommand, ssPayload.size());
+    uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hdr;
+    string strMessage = ss.str() + ssPayload.str();
+    {
+        LOCK(node.cs_vRecvMsg);
+        BOOST_CHECK(node.ReceiveMsgBytes(strMessage.data(), strMessage.size()));
+    }
+    ProcessMessages(&node);
+}
+
+/** Take the messages queued for sending to node, by command (the first of each) */
+static map<string, CDataStream> TakeSentMessages(CNode& node)
+{
+    map<string, CDataStream> mapSent;
+    LOCK(node.cs_vSend);
+    BOOST_FOREACH(const CSerializeData& data, node.vSendMsg) {
+        CDataStream ss(data.begin(), data.end(), SER_NETWORK, PROTOCOL_VERSION);
+        CMessageHeader hdr;
+        ss >> hdr;
+        mapSent.insert(make_pair(hdr.GetCommand(), ss));
+    }
+    node.vSendMsg.clear();
+    node.nSendSize = 0;
+    node.nSendOffset = 0;
+    return mapSent;
+}
+
+BOOST_AUTO_TEST_SUITE(sendheaders_tests)
+
+BOOST_AUTO_TEST_CASE(sendheaders_announce)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    vector<CMutableTransaction> noTxns;
+    vector<uint256> vHashes;
+    for (int i = 0; i < 3; i++) {
+        vHashes.push_back(CreateAndProcessBlock(noTxns, scriptPubKey).GetHash());
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vHashes.back());
+    }
+
+    map<string, CDataStream> mapSent;
+
+    // A peer that did not ask for headers gets an inv of the tip
+    CNode dummyInv(INVALID_SOCKET, CAddress(ip(0xa0b0c101)), "", true);
+    dummyInv.nVersion = PROTOCOL_VERSION;
+    dummyInv.PushBlockHash(vHashes[1]);
+    dummyInv.PushBlockHash(vHashes[2]);
+    SendMessages(&dummyInv, false);
+    mapSent = TakeSentMessages(dummyInv);
+    BOOST_CHECK(!mapSent.count("headers"));
+    BOOST_REQUIRE(mapSent.count("inv"));
+    vector<CInv> vInv;
+    mapSent.find("inv")->second >> vInv;
+    BOOST_CHECK_EQUAL(vInv.size(), 1U);
+    BOOST_CHECK(vInv[0].type == MSG_BLOCK && vInv[0].hash == vHashes[2]);
+
+    // A peer that did, and has the header before the new blocks, gets their headers
+    CNode dummyHeaders(INVALID_SOCKET, CAddress(ip(0xa0b0c102)), "", true);
+    dummyHeaders.nVersion = PROTOCOL_VERSION;
+    ReceiveMessage(dummyHeaders, "sendheaders", CDataStream(SER_NETWORK, PROTOCOL_VERSION));
+    CDataStream ssGetHeaders(SER_NETWORK, PROTOCOL_VERSION);
+    ssGetHeaders << CBlockLocator() << vHashes[0];
+    ReceiveMessage(dummyHeaders, "getheaders", ssGetHeaders);
+    BOOST_CHECK(TakeSentMessages(dummyHeaders).count("headers"));
+
+    dummyHeaders.PushBlockHash(vHashes[1]);
+    dummyHeaders.PushBlockHash(vHashes[2]);
+    SendMessages(&dummyHeaders, false);
+    mapSent = TakeSentMessages(dummyHeaders);
+    BOOST_CHECK(!mapSent.count("inv"));
+    BOOST_REQUIRE(mapSent.count("headers"));
+    vector<CBlock> vHeaders;
+    mapSent.find("headers")->second >> vHeaders;
+    BOOST_CHECK_EQUAL(vHeaders.size(), 2U);
+    BOOST_CHECK(vHeaders[0].GetHash() == vHashes[1]);
+    BOOST_CHECK(vHeaders[1].GetHash() == vHashes[2]);
+    BOOST_CHECK(vHeaders[1].vtx.empty());
+
+    // What the peer was sent is not announced again
+    dummyHeaders.PushBlockHash(vHashes[2]);
+    SendMessages(&dummyHeaders, false);
+    mapSent = TakeSentMessages(dummyHeaders);
+    BOOST_CHECK(!mapSent.count("headers"));
+    BOOST_CHECK(!mapSent.count("inv"));
+
+    // A block whose parent the peer has not seen falls back to an inv
+    CNode dummyUnknown(INVALID_SOCKET, CAddress(ip(0xa0b0c103)), "", true);
+    dummyUnknown.nVersion = PROTOCOL_VERSION;
+    ReceiveMessage(dummyUnknown, "sendheaders", CDataStream(SER_NETWORK, PROTOCOL_VERSION));
+    dummyUnknown.PushBlockHash(vHashes[2]);
+    SendMessages(&dummyUnknown, false);
+    mapSent = TakeSentMessages(dummyUnknown);
+    BOOST_CHECK(!mapSent.count("headers"));
+    BOOST_CHECK(mapSent.count("inv"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -99,4 +99,65 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+static void CheckTimeIndex(const CChain& chain)
+{
+    for (int i=1; i<=chain.Height(); i++)
+        BOOST_CHECK(chain.GetTimeMax(i) >= chain.GetTimeMax(i - 1));
+
+    // Compare with a linear scan
+    for (int n=0; n<100; n++) {
+        int64_t nTime = chain.GetTimeMax(0) - 100 + insecure_rand() % (chain.GetTimeMax(chain.Height()) - chain.GetTimeMax(0) + 200);
+        CBlockIndex* pindexEarliest = NULL;
+        CBlockIndex* pindexLatest = NULL;
+        for (int i=0; i<=chain.Height(); i++) {
+            if (!pindexEarliest && chain.GetTimeMax(i) >= nTime)
+                pindexEarliest = chain[i];
+            if (chain.GetTimeMax(i) <= nTime)
+                pindexLatest = chain[i];
+        }
+        BOOST_CHECK(chain.FindEarliestAtLeast(nTime) == pindexEarliest);
+        BOOST_CHECK(chain.FindLatestAtMost(nTime) == pindexLatest);
+    }
+    BOOST_CHECK(chain.FindEarliestAtLeast(chain.GetTimeMax(chain.Height()) + 1) == NULL);
+    BOOST_CHECK(chain.FindLatestAtMost(chain.GetTimeMax(0) - 1) == NULL);
+    BOOST_CHECK_EQUAL(chain.GetTimeMax(chain.Height() + 1), -1);
+}
+
+BOOST_AUTO_TEST_CASE(findearliestatleast_test)
+{
+    // Block times that go back and forth, but stay above the median time past
+    std::vector<uint256> vHashMain(10000);
+    std::vector<CBlockIndex> vBlocksMain(10000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vHashMain[i] = i;
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].phashBlock = &vHashMain[i];
+        vBlocksMain[i].nTime = i ? vBlocksMain[i - 1].GetMedianTimePast() + 1 + insecure_rand() % 1200 : 1000000;
+        vBlocksMain[i].BuildSkip();
+    }
+
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+    CheckTimeIndex(chain);
+
+    // A reorganization to a shorter branch with later times updates the index
+    std::vector<uint256> vHashSide(100);
+    std::vector<CBlockIndex> vBlocksSide(100);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vHashSide[i] = i + 9000 + (uint256(1) << 128);
+        vBlocksSide[i].nHeight = i + 9000;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[8999];
+        vBlocksSide[i].phashBlock = &vHashSide[i];
+        vBlocksSide[i].nTime = vBlocksSide[i].pprev->GetMedianTimePast() + 1000000;
+        vBlocksSide[i].BuildSkip();
+    }
+    int64_t nTimeMax = chain.GetTimeMax(8999);
+    chain.SetTip(&vBlocksSide.back());
+    BOOST_CHECK_EQUAL(chain.Height(), 9099);
+    BOOST_CHECK_EQUAL(chain.GetTimeMax(8999), nTimeMax);
+    BOOST_CHECK_EQUAL(chain.GetTimeMax(9099), vBlocksSide.back().GetMedianTimePast());
+    CheckTimeIndex(chain);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,164 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "spentindex.h"
+
+#include "test_dynamiccoin.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "script/standard.h"
+#include "txdb.h"
+
+#include <utility>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static void CheckSpent(const COutPoint& out, const uint256& txid, uint32_t nInputIndex, int nHeight)
+{
+    CSpentIndexValue value;
+    BOOST_CHECK(GetSpentIndex(CSpentIndexKey(out.hash, out.n), value, false));
+    BOOST_CHECK(value.txid == txid);
+    BOOST_CHECK_EQUAL(value.nInputIndex, nInputIndex);
+    BOOST_CHECK_EQUAL(value.nHeight, nHeight);
+}
+
+static bool IsSpent(const COutPoint& out)
+{
+    CSpentIndexValue value;
+    return pblocktree->ReadSpentIndex(CSpentIndexKey(out.hash, out.n), value);
+}
+
+BOOST_AUTO_TEST_SUITE(spentindex_tests)
+
+BOOST_AUTO_TEST_CASE(spentindex_blocktree)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CSpentIndexValue value;
+
+    // A block spending two outputs of one transaction
+    vector<pair<CSpentIndexKey, CSpentIndexValue> > vSpent;
+    vSpent.push_back(make_pair(CSpentIndexKey(uint256(1), 0), CSpentIndexValue(uint256(10), 0, 5)));
+    vSpent.push_back(make_pair(CSpentIndexKey(uint256(1), 2), CSpentIndexValue(uint256(10), 1, 5)));
+    BOOST_CHECK(db.UpdateSpentIndex(vSpent));
+
+    BOOST_CHECK(db.ReadSpentIndex(CSpentIndexKey(uint256(1), 2), value));
+    BOOST_CHECK(value.txid == uint256(10));
+    BOOST_CHECK_EQUAL(value.nInputIndex, 1U);
+    BOOST_CHECK_EQUAL(value.nHeight, 5);
+    BOOST_CHECK(!db.ReadSpentIndex(CSpentIndexKey(uint256(1), 1), value));
+    BOOST_CHECK(!db.ReadSpentIndex(CSpentIndexKey(uint256(10), 0), value));
+
+    // Disconnecting it erases the records
+    vSpent[0].second.SetNull();
+    BOOST_CHECK(db.UpdateSpentIndex(vector<pair<CSpentIndexKey, CSpentIndexValue> >(1, vSpent[0])));
+    BOOST_CHECK(!db.ReadSpentIndex(CSpentIndexKey(uint256(1), 0), value));
+    BOOST_CHECK(db.ReadSpentIndex(CSpentIndexKey(uint256(1), 2), value));
+}
+
+BOOST_AUTO_TEST_CASE(spentindex_connect_disconnect)
+{
+    // The index first catches up with the blocks connected while it was off
+    // (read back from disk, without proof of work)
+    fSpentIndex = true;
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    BOOST_CHECK(RepairIndexes());
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+
+    // A matured coinbase that anyone can spend (through a script hash)
+    CScript redeem = CScript() << OP_TRUE;
+    vector<CMutableTransaction> noTxns;
+    CBlock blockCoinbase = CreateAndProcessBlock(noTxns, GetScriptForDestination(CScriptID(redeem)));
+    const CTransaction &txCoinbase = blockCoinbase.vtx[0];
+    for (int i = 0; i < COINBASE_MATURITY; i++)
+        CreateAndProcessBlock(noTxns, CScript() << OP_TRUE);
+
+    // One block spends it, and the second output of that spend
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = COutPoint(txCoinbase.GetHash(), 0);
+    tx1.vin[0].scriptSig = CScript() << ToByteVector(redeem);
+    tx1.vout.resize(2);
+    tx1.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx1.vout[0].nValue = COIN;
+    tx1.vout[1].scriptPubKey = GetScriptForDestination(CScriptID(redeem));
+    tx1.vout[1].nValue = txCoinbase.vout[0].nValue - COIN;
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 1);
+    tx2.vin[0].scriptSig = CScript() << ToByteVector(redeem);
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx2.vout[0].nValue = tx1.vout[1].nValue;
+    vector<CMutableTransaction> txns;
+    txns.push_back(tx1);
+    txns.push_back(tx2);
+    CBlock block = CreateAndProcessBlock(txns, CScript() << OP_TRUE);
+    CBlockIndex *pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+        BOOST_REQUIRE(pindex->GetBlockHash() == block.GetHash());
+    }
+
+    CheckSpent(tx1.vin[0].prevout, tx1.GetHash(), 0, pindex->nHeight);
+    CheckSpent(tx2.vin[0].prevout, tx2.GetHash(), 0, pindex->nHeight);
+    BOOST_CHECK(!IsSpent(COutPoint(tx1.GetHash(), 0)));
+    BOOST_CHECK(!IsSpent(COutPoint(tx2.GetHash(), 0)));
+
+    // Checking the last blocks leaves the index alone; disconnecting the
+    // block erases its records (the blocks read back from disk have no proof
+    // of work)
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    BOOST_CHECK(CVerifyDB().VerifyDB(pcoinsTip, 4, 5));
+    CheckSpent(tx1.vin[0].prevout, tx1.GetHash(), 0, pindex->nHeight);
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, pindex));
+        BOOST_CHECK(chainActive.Tip() == pindex->pprev);
+    }
+    BOOST_CHECK(!IsSpent(tx1.vin[0].prevout));
+    BOOST_CHECK(!IsSpent(tx2.vin[0].prevout));
+
+    // ... and connecting it again writes them back
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ReconsiderBlock(state, pindex));
+    }
+    BOOST_CHECK(ActivateBestChain(state));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip() == pindex);
+    }
+    CheckSpent(tx1.vin[0].prevout, tx1.GetHash(), 0, pindex->nHeight);
+    CheckSpent(tx2.vin[0].prevout, tx2.GetHash(), 0, pindex->nHeight);
+
+    // A chain state that goes back without the index, as after an unclean
+    // shutdown before the next flush, gets the journaled block undone
+    fSpentIndex = false;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, pindex));
+    }
+    fSpentIndex = true;
+    BOOST_CHECK(IsSpent(tx1.vin[0].prevout));
+    BOOST_CHECK(RepairIndexes());
+    BOOST_CHECK(!IsSpent(tx1.vin[0].prevout));
+    BOOST_CHECK(!IsSpent(tx2.vin[0].prevout));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ReconsiderBlock(state, pindex));
+    }
+    BOOST_CHECK(ActivateBestChain(state));
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    CheckSpent(tx2.vin[0].prevout, tx2.GetHash(), 0, pindex->nHeight);
+
+    fSpentIndex = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
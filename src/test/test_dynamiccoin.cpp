@@ -4,7 +4,11 @@
 
 #define BOOST_TEST_MODULE Bitcoin Test Suite
 
+#include "test_dynamiccoin.h"
+
+#include "GrsApi.h"
 #include "main.h"
+#include "pow.h"
 #include "random.h"
 #include "txdb.h"
 #include "ui_interface.h"
@@ -15,6 +19,7 @@
 #endif
 
 #include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 #include <boost/thread.hpp>
 
@@ -44,6 +49,7 @@ struct TestingSetup {
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        pDmcSystem = new CDmcSystem("http://127.0.0.1/");
         InitBlockIndex();
 #ifdef ENABLE_WALLET
         bool fFirstRun;
@@ -68,6 +74,8 @@ struct TestingSetup {
         delete pcoinsTip;
         delete pcoinsdbview;
         delete pblocktree;
+        delete pDmcSystem;
+        pDmcSystem = NULL;
 #ifdef ENABLE_WALLET
         bitdb.Flush(true);
 #endif
@@ -77,6 +85,58 @@ struct TestingSetup {
 
 BOOST_GLOBAL_FIXTURE(TestingSetup);
 
+CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns, const CScript& scriptPubKey, CBlockIndex* pindexPrev)
+{
+    CBlock block;
+    {
+        LOCK(cs_main);
+        if (pindexPrev == NULL)
+            pindexPrev = chainActive.Tip();
+
+        block.nVersion = BLOCK_VERSION_0_3;
+        block.hashPrevBlock = pindexPrev->GetBlockHash();
+        block.nTime = pindexPrev->GetBlockTime() + Params().TargetSpacing();
+        block.nBits = GetNextWorkRequired(pindexPrev, &block);
+        block.nNonce = 0;
+
+        // The fees, with the inputs of each transaction looked up among the
+        // outputs of the chain and of the transactions before it
+        CAmount nFees = 0;
+        {
+            CCoinsViewCache view(pcoinsTip);
+            CValidationState state;
+            BOOST_FOREACH(const CMutableTransaction& tx, txns) {
+                CTxUndo undoDummy;
+                nFees += view.GetValueIn(tx) - CTransaction(tx).GetValueOut();
+                UpdateCoins(tx, state, view, undoDummy, pindexPrev->nHeight + 1);
+            }
+        }
+
+        CBlockIndex index;
+        index.pprev = pindexPrev;
+        index.nHeight = pindexPrev->nHeight + 1;
+        index.nTime = block.nTime;
+
+        CMutableTransaction txCoinbase;
+        txCoinbase.vin.resize(1);
+        txCoinbase.vin[0].prevout.SetNull();
+        txCoinbase.vin[0].scriptSig = CScript() << index.nHeight << OP_0;
+        txCoinbase.vout.resize(1);
+        txCoinbase.vout[0].scriptPubKey = scriptPubKey;
+        txCoinbase.vout[0].nValue = pDmcSystem->GetBlockReward(&index) + nFees;
+        block.vtx.push_back(txCoinbase);
+        BOOST_FOREACH(const CMutableTransaction& tx, txns)
+            block.vtx.push_back(tx);
+        block.hashMerkleRoot = block.BuildMerkleTree();
+    }
+
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    CValidationState state;
+    ProcessNewBlock(state, NULL, &block);
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    return block;
+}
+
 void Shutdown(void* parg)
 {
   exit(0);
@@ -0,0 +1,25 @@
+// Copyright (c) 2015 The DynamicCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TEST_TEST_DYNAMICCOIN_H
+#define BITCOIN_TEST_TEST_DYNAMICCOIN_H
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * Build a block on pindexPrev (the active chain tip by default) with txns
+ * after a coinbase paying the scheduled reward and the fees to scriptPubKey,
+ * and process it. The proof of work is not checked, and the block time
+ * advances by the target spacing so that rewards stay on the schedule.
+ * Returns the block; whether it became the tip is up to the caller to check.
+ */
+CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns, const CScript& scriptPubKey, CBlockIndex* pindexPrev = NULL);
+
+#endif // BITCOIN_TEST_TEST_DYNAMICCOIN_H
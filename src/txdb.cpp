@@ -5,36 +5,286 @@
 
 #include "txdb.h"
 
+#include "checkqueue.h"
 #include "pow.h"
 #include "uint256.h"
+#include "util.h"
 
+#include <algorithm>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
-#include <boost/make_shared.hpp>
 
 using namespace std;
 
-void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
+namespace {
+
+/** Key of a per-output coin record; the value is the Coin */
+struct CCoinKey
+{
+    uint256 txid;
+    uint32_t n;
+
+    CCoinKey() : txid(0), n(0) {}
+    CCoinKey(const COutPoint &outpoint) : txid(outpoint.hash), n(outpoint.n) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        char chType = 'C';
+        READWRITE(chType);
+        READWRITE(txid);
+        READWRITE(VARINT(n));
+    }
+};
+
+/** Output n of a record of the old per-transaction layout */
+Coin GetLegacyCoin(const CCoins &coins, unsigned int n)
+{
+    return Coin(coins.vout[n], coins.nHeight, coins.fCoinBase, coins.nVersion);
+}
+
+/** Account for one output record being added to (fAdd) or removed from the database */
+void ApplyOutputStats(CCoinsDBStats &stats, const COutPoint &outpoint, const Coin &coin, bool fAdd)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CCoinKey(outpoint) << coin;
+    std::vector<unsigned char> vRecord(ss.begin(), ss.end());
+    int nSign = fAdd ? 1 : -1;
+    stats.nTransactionOutputs += nSign;
+    stats.nSerializedSize += nSign * (int64_t)vRecord.size();
+    stats.nTotalAmount += nSign * coin.out.nValue;
+    if (fAdd)
+        stats.muhash.Insert(vRecord);
     else
-        batch.Write(make_pair('c', hash), coins);
+        stats.muhash.Remove(vRecord);
+}
+
+/** Account for all unspent outputs of a transaction */
+void ApplyCoinsStats(CCoinsDBStats &stats, const uint256 &txid, const CCoins &coins)
+{
+    stats.nTransactions++;
+    for (unsigned int i = 0; i < coins.vout.size(); i++)
+        if (coins.IsAvailable(i))
+            ApplyOutputStats(stats, COutPoint(txid, i), GetLegacyCoin(coins, i), true);
+}
+
+/** Whether the database has per-output records of txid, other than those for the (sorted) output indexes in vSkip */
+bool HaveCoinRecords(leveldb::Iterator *pcursor, const uint256 &txid, const std::vector<uint32_t> &vSkip)
+{
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << 'C' << txid;
+    leveldb::Slice slPrefix(&ssPrefix[0], ssPrefix.size());
+    for (pcursor->Seek(slPrefix); pcursor->Valid() && pcursor->key().starts_with(slPrefix); pcursor->Next()) {
+        if (vSkip.empty())
+            return true;
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        CCoinKey key;
+        ssKey >> key;
+        if (!std::binary_search(vSkip.begin(), vSkip.end(), key.n))
+            return true;
+    }
+    return false;
 }
 
+/** Orders cache entries by outpoint, which puts the outputs of a transaction next to each other */
+struct CCoinsEntryOrder
+{
+    bool operator()(const CCoinsMap::const_iterator &a, const CCoinsMap::const_iterator &b) const {
+        return a->first < b->first;
+    }
+};
+
+/**
+ * Block index entry as stored in a 'b' record: the CDiskBlockIndex, followed by
+ * the chain work of the block, which only depends on the headers and is stored
+ * so that it need not be recomputed at every start. Entries written by older
+ * versions lack it.
+ */
+class CDiskBlockIndexRecord
+{
+public:
+    CDiskBlockIndex index;
+    bool fHaveChainWork;
+    uint256 nChainWork;
+
+    CDiskBlockIndexRecord() : fHaveChainWork(false) {}
+
+    explicit CDiskBlockIndexRecord(const CDiskBlockIndex &indexIn) : index(indexIn), fHaveChainWork(index.nChainWork != 0), nChainWork(index.nChainWork) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return ::GetSerializeSize(index, nType, nVersion) + (fHaveChainWork ? sizeof(uint256) : 0);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const
+    {
+        ::Serialize(s, index, nType, nVersion);
+        if (fHaveChainWork)
+            ::Serialize(s, nChainWork, nType, nVersion);
+    }
+
+    //! Only from a stream holding exactly one record
+    template <typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion)
+    {
+        ::Unserialize(s, index, nType, nVersion);
+        fHaveChainWork = !s.empty();
+        if (fHaveChainWork)
+            ::Unserialize(s, nChainWork, nType, nVersion);
+    }
+};
+
+/** Decodes a 'b' record on a worker thread of LoadBlockIndexGuts, and checks its proof of work */
+class CBlockIndexDecoder
+{
+private:
+    const uint256 *phash;
+    const std::string *pstrValue;
+    CDiskBlockIndexRecord *precord;
+
+public:
+    CBlockIndexDecoder() : phash(NULL), pstrValue(NULL), precord(NULL) {}
+    CBlockIndexDecoder(const uint256 *phashIn, const std::string *pstrValueIn, CDiskBlockIndexRecord *precordIn) : phash(phashIn), pstrValue(pstrValueIn), precord(precordIn) {}
+
+    bool operator()()
+    {
+        try {
+            CDataStream ssValue(pstrValue->data(), pstrValue->data() + pstrValue->size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> *precord;
+        } catch (std::exception &e) {
+            return error("LoadBlockIndex() : Deserialize or I/O error - %s", e.what());
+        }
+        if (!CheckProofOfWork(precord->index.GetBlockPoW(), precord->index.nBits))
+            return error("LoadBlockIndex() : CheckProofOfWork failed: %s", phash->ToString());
+        return true;
+    }
+
+    void swap(CBlockIndexDecoder &check)
+    {
+        std::swap(phash, check.phash);
+        std::swap(pstrValue, check.pstrValue);
+        std::swap(precord, check.precord);
+    }
+};
+
+/** Number of block index records decoded at once by LoadBlockIndexGuts */
+static const unsigned int BLOCK_INDEX_LOAD_BATCH = 16384;
+
+} // anon namespace
+
 void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+CLevelDBProfile GetLevelDBProfile(bool fIBD, bool fChainState)
+{
+    int nMaxOpenFiles = GetArg("-dbmaxopenfiles", DEFAULT_DB_MAX_OPEN_FILES);
+    if (!fChainState)
+        nMaxOpenFiles = std::max(nMaxOpenFiles / 4, std::min(nMaxOpenFiles, 64));
+    if (fIBD)
+        return CLevelDBProfile("ibd", GetArg("-dbibdwritebuffer", DEFAULT_DB_IBD_WRITE_BUFFER), nMaxOpenFiles);
+    return CLevelDBProfile("steady", GetArg("-dbwritebuffer", DEFAULT_DB_WRITE_BUFFER), nMaxOpenFiles);
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const std::string &strName, const CLevelDBProfile &profile) : db(GetDataDir() / strName, nCacheSize, fMemory, fWipe, profile), fLegacyCoins(false), fStatsValid(false) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'c';
+    pcursor->Seek(ssKeySet.str());
+    fLegacyCoins = pcursor->Valid() && pcursor->key().size() > 0 && pcursor->key()[0] == 'c';
+
+    // Statistics written by a version that did not maintain them, or left
+    // behind when an older version wrote to this database, are useless.
+    uint256 hashBestBlock = GetBestBlock();
+    if (hashBestBlock == uint256(0))
+        fStatsValid = true;
+    else if (db.Read('S', dbstats) && dbstats.hashBlock == hashBestBlock)
+        fStatsValid = true;
+    else
+        dbstats = CCoinsDBStats();
+}
+
+/*
+ * Reads do not take cs_coinsdb, so that they are not held up by a batch being
+ * written for other transactions. A conversion batch of UpgradeLegacyCoins()
+ * may get committed between the two lookups though, which is why the
+ * per-output record is checked once more after the old record was not found.
+ * fLegacyCoins only ever goes from true to false, after the last conversion
+ * batch is written; a stale true costs a lookup.
+ */
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    if (db.Read(CCoinKey(outpoint), coin))
+        return true;
+    {
+        LOCK(cs_legacycoins);
+        if (!fLegacyCoins)
+            return false;
+    }
+    CCoins coins;
+    if (db.Read(make_pair('c', outpoint.hash), coins)) {
+        if (!coins.IsAvailable(outpoint.n))
+            return false;
+        coin = GetLegacyCoin(coins, outpoint.n);
+        return true;
+    }
+    return db.Read(CCoinKey(outpoint), coin);
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair('c', txid), coins);
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    Coin coin;
+    return GetCoin(outpoint, coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair('c', txid));
+/**
+ * One seek over the per-output records of txid, and the old-layout record
+ * read from the same snapshot, rather than a lookup per output index: a
+ * transaction that has no unspent outputs costs no more than one that has.
+ */
+bool CCoinsViewDB::GetCoinByTxid(const uint256 &txid, uint32_t nStart, COutPoint &outpoint, Coin &coin) const {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << 'C' << txid;
+    leveldb::Slice slPrefix(&ssPrefix[0], ssPrefix.size());
+    // The output indexes are VARINTs, which do not sort by value, so the records are walked
+    for (pcursor->Seek(slPrefix); pcursor->Valid() && pcursor->key().starts_with(slPrefix); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        CCoinKey key;
+        ssKey >> key;
+        if (key.n < nStart)
+            continue;
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> coin;
+        outpoint = COutPoint(txid, key.n);
+        return true;
+    }
+    {
+        LOCK(cs_legacycoins);
+        if (!fLegacyCoins)
+            return false;
+    }
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION);
+    ssLegacy << make_pair('c', txid);
+    pcursor->Seek(ssLegacy.str());
+    if (!pcursor->Valid() || pcursor->key() != leveldb::Slice(ssLegacy.str()))
+        return false;
+    leveldb::Slice slValue = pcursor->value();
+    CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+    CCoins coins;
+    ssValue >> coins;
+    for (unsigned int n = nStart; n < coins.vout.size(); n++) {
+        if (coins.IsAvailable(n)) {
+            outpoint = COutPoint(txid, n);
+            coin = GetLegacyCoin(coins, n);
+            return true;
+        }
+    }
+    return false;
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -44,32 +294,455 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
+/**
+ * Write the changed outputs [itBegin, itEnd) of one transaction, touching only
+ * the records that change, and keep count of the transactions that have
+ * unspent outputs. pcursor iterates over the database as it was before the batch.
+ */
+void CCoinsViewDB::BatchWriteCoins(CLevelDBBatch &batch, leveldb::Iterator *pcursor, CoinsEntryIter itBegin, CoinsEntryIter itEnd, size_t &nWritten, size_t &nErased) {
+    const uint256 &txid = (*itBegin)->first.hash;
+    // The outputs of a transaction that was added as a whole are all FRESH,
+    // and then the database has nothing of it (see CCoinsCacheEntry).
+    bool fFresh = true;
+    for (CoinsEntryIter it = itBegin; it != itEnd && fFresh; it++)
+        fFresh = (*it)->second.flags & CCoinsCacheEntry::FRESH;
+    bool fHadOutputs = false;
+    bool fLegacy = false;
+    CCoins coinsLegacy;
+    if (!fFresh) {
+        fHadOutputs = HaveCoinRecords(pcursor, txid, std::vector<uint32_t>());
+        if (!fHadOutputs && fLegacyCoins && db.Read(make_pair('c', txid), coinsLegacy)) {
+            // Not converted yet: the old record is replaced by per-output ones
+            batch.Erase(make_pair('c', txid));
+            nErased++;
+            fHadOutputs = fLegacy = true;
+        }
+    }
+
+    bool fHasOutputs = false;
+    std::vector<uint32_t> vErased;
+    for (CoinsEntryIter it = itBegin; it != itEnd; it++) {
+        const COutPoint &outpoint = (*it)->first;
+        const Coin &coin = (*it)->second.coin;
+        Coin coinOld;
+        bool fHave = false;
+        if (fLegacy) {
+            fHave = coinsLegacy.IsAvailable(outpoint.n);
+            if (fHave) {
+                coinOld = GetLegacyCoin(coinsLegacy, outpoint.n);
+                coinsLegacy.vout[outpoint.n].SetNull();
+            }
+        } else if (!((*it)->second.flags & CCoinsCacheEntry::FRESH)) {
+            fHave = db.Read(CCoinKey(outpoint), coinOld);
+        }
+        bool fWant = !coin.IsSpent();
+        fHasOutputs = fHasOutputs || fWant;
+        if (fHave && fWant && !fLegacy && coin == coinOld)
+            continue;
+        if (fHave)
+            ApplyOutputStats(dbstats, outpoint, coinOld, false);
+        if (fWant) {
+            batch.Write(CCoinKey(outpoint), coin);
+            ApplyOutputStats(dbstats, outpoint, coin, true);
+            nWritten++;
+        } else if (fHave && !fLegacy) {
+            batch.Erase(CCoinKey(outpoint));
+            vErased.push_back(outpoint.n);
+            nErased++;
+        }
+    }
+
+    if (fLegacy) {
+        // The other outputs of the old record move over unchanged
+        for (unsigned int i = 0; i < coinsLegacy.vout.size(); i++) {
+            if (coinsLegacy.IsAvailable(i)) {
+                batch.Write(CCoinKey(COutPoint(txid, i)), GetLegacyCoin(coinsLegacy, i));
+                fHasOutputs = true;
+                nWritten++;
+            }
+        }
+    } else if (fHadOutputs && !fHasOutputs) {
+        fHasOutputs = HaveCoinRecords(pcursor, txid, vErased);
+    }
+    dbstats.nTransactions += (fHasOutputs ? 1 : 0) - (fHadOutputs ? 1 : 0);
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    LOCK(cs_coinsdb);
     CLevelDBBatch batch;
     size_t count = 0;
-    size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
-        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
-            changed++;
-        }
+    size_t nWritten = 0;
+    size_t nErased = 0;
+    // mapCoins is only read, as CCoinsViewWriteBehind serves reads from it
+    // meanwhile. The changed outputs are sorted, to go through them one
+    // transaction at a time.
+    std::vector<CCoinsMap::const_iterator> vChanged;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            vChanged.push_back(it);
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+    }
+    std::sort(vChanged.begin(), vChanged.end(), CCoinsEntryOrder());
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    for (CoinsEntryIter it = vChanged.begin(); it != vChanged.end();) {
+        CoinsEntryIter itEnd = it;
+        while (itEnd != vChanged.end() && (*itEnd)->first.hash == (*it)->first.hash)
+            itEnd++;
+        BatchWriteCoins(batch, pcursor.get(), it, itEnd, nWritten, nErased);
+        it = itEnd;
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
+    if (fStatsValid) {
+        dbstats.hashBlock = hashBlock != uint256(0) ? hashBlock : GetBestBlock();
+        batch.Write('S', dbstats);
+    }
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed outputs (out of %u) to coin database: %u records written, %u erased...\n",
+        (unsigned int)vChanged.size(), (unsigned int)count, (unsigned int)nWritten, (unsigned int)nErased);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewCursor *CCoinsViewDB::Cursor() const {
+    LOCK(cs_coinsdb);
+    CCoinsViewDBCursor *pcursor = new CCoinsViewDBCursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator(), GetBestBlock());
+    // Per-output records ('C') sort before the remaining old-layout ones ('c')
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'C';
+    pcursor->pcursor->Seek(ssKeySet.str());
+    pcursor->Next();
+    return pcursor;
+}
+
+CCoinsViewDBCursor::CCoinsViewDBCursor(leveldb::Iterator *pcursorIn, const uint256 &hashBlockIn) : CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), fValid(false), nLegacyNext(0) {
+}
+
+bool CCoinsViewDBCursor::GetKey(COutPoint &key) const {
+    if (!fValid)
+        return false;
+    key = keyCurrent;
+    return true;
+}
+
+bool CCoinsViewDBCursor::GetValue(Coin &coin) const {
+    if (!fValid)
+        return false;
+    coin = coinCurrent;
+    return true;
+}
+
+bool CCoinsViewDBCursor::Valid() const {
+    return fValid;
+}
+
+/** Move to the next output; throws on deserialization errors. */
+void CCoinsViewDBCursor::Next() {
+    fValid = false;
+    while (true) {
+        // The outputs of an old-layout record come out one by one
+        while (nLegacyNext < coinsLegacy.vout.size()) {
+            unsigned int n = nLegacyNext++;
+            if (coinsLegacy.IsAvailable(n)) {
+                keyCurrent.n = n;
+                coinCurrent = GetLegacyCoin(coinsLegacy, n);
+                fValid = true;
+                return;
+            }
+        }
+        if (!pcursor->Valid())
+            return;
+        leveldb::Slice slKey = pcursor->key();
+        leveldb::Slice slValue = pcursor->value();
+        char chType = slKey.size() > 0 ? slKey[0] : 0;
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        if (chType == 'C') {
+            CCoinKey key;
+            ssKey >> key;
+            ssValue >> coinCurrent;
+            keyCurrent = COutPoint(key.txid, key.n);
+            fValid = true;
+            pcursor->Next();
+            return;
+        } else if (chType == 'c') {
+            ssKey >> chType >> keyCurrent.hash;
+            ssValue >> coinsLegacy;
+            nLegacyNext = 0;
+        }
+        pcursor->Next();
+    }
+}
+
+bool CCoinsViewDB::HaveLegacyCoins() const {
+    LOCK(cs_legacycoins);
+    return fLegacyCoins;
+}
+
+unsigned int CCoinsViewDB::UpgradeLegacyCoins(unsigned int nMaxRecords) {
+    LOCK(cs_coinsdb);
+    if (!fLegacyCoins)
+        return 0;
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'c';
+    pcursor->Seek(ssKeySet.str());
+
+    CLevelDBBatch batch;
+    unsigned int nConverted = 0;
+    while (nConverted < nMaxRecords && pcursor->Valid()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        ssKey >> chType;
+        if (chType != 'c')
+            break;
+        uint256 txid;
+        ssKey >> txid;
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        CCoins coins;
+        ssValue >> coins;
+
+        batch.Erase(make_pair('c', txid));
+        for (unsigned int i = 0; i < coins.vout.size(); i++)
+            if (coins.IsAvailable(i))
+                batch.Write(CCoinKey(COutPoint(txid, i)), GetLegacyCoin(coins, i));
+        nConverted++;
+        pcursor->Next();
+    }
+    db.WriteBatch(batch);
+    // Only once the last records are written, or GetCoin could miss them
+    if (nConverted < nMaxRecords) {
+        LOCK(cs_legacycoins);
+        fLegacyCoins = false;
+    }
+    return nConverted;
+}
+
+bool CCoinsViewDB::HaveStats() const {
+    LOCK(cs_coinsdb);
+    return fStatsValid;
+}
+
+bool CCoinsViewDB::RebuildStats() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor;
+    {
+        LOCK(cs_coinsdb);
+        if (fStatsValid)
+            return true;
+        // The iterator sees the database as of now; from here on dbstats
+        // collects the changes written after that point.
+        pcursor.reset(db.NewIterator());
+        dbstats = CCoinsDBStats();
+    }
+
+    CCoinsDBStats stats;
+    uint256 txidLast;
+    pcursor->SeekToFirst();
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            char chType = slKey.size() > 0 ? slKey[0] : 0;
+            if (chType == 'C') {
+                CCoinKey key;
+                ssKey >> key;
+                Coin coin;
+                ssValue >> coin;
+                // Per-output records of one transaction are adjacent
+                if (stats.nTransactionOutputs == 0 || key.txid != txidLast)
+                    stats.nTransactions++;
+                txidLast = key.txid;
+                ApplyOutputStats(stats, COutPoint(key.txid, key.n), coin, true);
+            } else if (chType == 'c') {
+                uint256 txid;
+                ssKey >> chType >> txid;
+                CCoins coins;
+                ssValue >> coins;
+                ApplyCoinsStats(stats, txid, coins);
+            }
+            pcursor->Next();
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    LOCK(cs_coinsdb);
+    stats.Add(dbstats);
+    stats.hashBlock = GetBestBlock();
+    dbstats = stats;
+    fStatsValid = true;
+    return db.Write('S', dbstats);
+}
+
+CCoinsViewWriteBehind::CCoinsViewWriteBehind(CCoinsView *viewIn) : CCoinsViewBacked(viewIn), hashPendingBlock(0), fPending(false), fCommitting(false), fDeferred(false) {
+}
+
+bool CCoinsViewWriteBehind::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_pending);
+        CCoinsMap::const_iterator it = mapPending.find(outpoint);
+        if (it != mapPending.end()) {
+            coin = it->second.coin;
+            return !coin.IsSpent();
+        }
+    }
+    // Not part of the batch being committed, so the base has the latest version
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewWriteBehind::HaveCoin(const COutPoint &outpoint) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_pending);
+        CCoinsMap::const_iterator it = mapPending.find(outpoint);
+        if (it != mapPending.end())
+            return !it->second.coin.IsSpent();
+    }
+    return base->HaveCoin(outpoint);
+}
+
+bool CCoinsViewWriteBehind::GetCoinByTxid(const uint256 &txid, uint32_t nStart, COutPoint &outpoint, Coin &coin) const {
+    // Held while the base is searched as well, so that the batch being
+    // committed stays in view until the base has it
+    boost::unique_lock<boost::mutex> lock(cs_pending);
+    return ::GetCoinByTxid(mapPending, *base, txid, nStart, outpoint, coin);
+}
+
+uint256 CCoinsViewWriteBehind::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_pending);
+        if (fPending && hashPendingBlock != uint256(0))
+            return hashPendingBlock;
+    }
+    return base->GetBestBlock();
+}
+
+void CCoinsViewWriteBehind::WaitForCommitLocked(boost::unique_lock<boost::mutex> &lock) const {
+    while (fCommitting)
+        condCommitted.wait(lock);
+}
+
+/** Write the pending batch; cs_pending is released while the base writes. */
+bool CCoinsViewWriteBehind::CommitLocked(boost::unique_lock<boost::mutex> &lock) {
+    WaitForCommitLocked(lock);
+    if (!fPending)
+        return true;
+    fCommitting = true;
+    lock.unlock();
+    bool fOk = false;
+    try {
+        // mapPending is not modified while fCommitting is set, so readers can
+        // keep using it while the base works through it.
+        fOk = base->BatchWrite(mapPending, hashPendingBlock);
+    } catch (...) {
+        lock.lock();
+        fCommitting = false;
+        condCommitted.notify_all();
+        throw;
+    }
+    lock.lock();
+    if (fOk) {
+        mapPending.clear();
+        hashPendingBlock = uint256(0);
+        fPending = false;
+    }
+    fCommitting = false;
+    condCommitted.notify_all();
+    return fOk;
+}
+
+bool CCoinsViewWriteBehind::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    boost::unique_lock<boost::mutex> lock(cs_pending);
+    // One batch at a time: an older one that nobody committed yet is written first
+    if (!CommitLocked(lock))
+        return false;
+    mapPending.swap(mapCoins);
+    hashPendingBlock = hashBlock;
+    fPending = true;
+    if (!fDeferred)
+        return CommitLocked(lock);
+    return true;
+}
+
+bool CCoinsViewWriteBehind::GetStats(CCoinsStats &stats) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_pending);
+        // Statistics of the base would not include a pending batch
+        while (fPending && fDeferred)
+            condCommitted.wait(lock);
+        if (fPending)
+            return false;
+    }
+    return base->GetStats(stats);
+}
+
+CCoinsViewCursor *CCoinsViewWriteBehind::Cursor() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs_pending);
+        while (fPending && fDeferred)
+            condCommitted.wait(lock);
+        if (fPending)
+            return NULL;
+    }
+    return base->Cursor();
+}
+
+bool CCoinsViewWriteBehind::SetDeferred(bool fDeferredIn) {
+    boost::unique_lock<boost::mutex> lock(cs_pending);
+    fDeferred = fDeferredIn;
+    if (!fDeferred)
+        return CommitLocked(lock);
+    return true;
+}
+
+bool CCoinsViewWriteBehind::Commit() {
+    boost::unique_lock<boost::mutex> lock(cs_pending);
+    return CommitLocked(lock);
+}
+
+bool CCoinsViewWriteBehind::IsPending() const {
+    boost::unique_lock<boost::mutex> lock(cs_pending);
+    return fPending;
+}
+
+size_t CCoinsViewWriteBehind::GetPendingSize() const {
+    boost::unique_lock<boost::mutex> lock(cs_pending);
+    return mapPending.size();
+}
+
+void ThreadUpgradeCoinsDB(CCoinsViewDB* pcoinsdb)
+{
+    RenameThread("dynamiccoin-coinsupgrade");
+
+    if (pcoinsdb->HaveLegacyCoins()) {
+        LogPrintf("Converting the coin database to the per-output layout in the background...\n");
+        int64_t nStart = GetTimeMillis();
+        uint64_t nConverted = 0;
+        do {
+            boost::this_thread::interruption_point();
+            nConverted += pcoinsdb->UpgradeLegacyCoins(10000);
+        } while (pcoinsdb->HaveLegacyCoins());
+        LogPrintf("Converted %u transactions of the coin database in %dms\n", nConverted, GetTimeMillis() - nStart);
+    }
+
+    if (!pcoinsdb->HaveStats()) {
+        LogPrintf("Computing UTXO set statistics in the background...\n");
+        int64_t nStart = GetTimeMillis();
+        if (pcoinsdb->RebuildStats())
+            LogPrintf("Computed UTXO set statistics in %dms\n", GetTimeMillis() - nStart);
+    }
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CLevelDBProfile &profile) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, profile) {
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
 {
-    return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
+    return Write(make_pair('b', blockindex.GetBlockHash()), CDiskBlockIndexRecord(blockindex));
 }
 
 bool CBlockTreeDB::WriteBlockFileInfo(int nFile, const CBlockFileInfo &info) {
@@ -101,55 +774,17 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    LOCK(cs_coinsdb);
+    if (!fStatsValid)
+        return false;
     stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
-            }
-            pcursor->Next();
-        } catch (std::exception &e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        }
-    }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+    BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+    stats.nHeight = it != mapBlockIndex.end() ? it->second->nHeight : 0;
+    stats.nTransactions = dbstats.nTransactions;
+    stats.nTransactionOutputs = dbstats.nTransactionOutputs;
+    stats.nSerializedSize = dbstats.nSerializedSize;
+    stats.nTotalAmount = dbstats.nTotalAmount;
+    stats.hashMuHash = dbstats.muhash.Finalize();
     return true;
 }
 
@@ -164,6 +799,240 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+static void BatchAddressIndex(CLevelDBBatch &batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent) {
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = vUnspent.begin(); it != vUnspent.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(it->first);
+        else
+            batch.Write(it->first, it->second);
+    }
+}
+
+bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vIndex, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = vIndex.begin(); it != vIndex.end(); it++)
+        batch.Write(it->first, it->second);
+    BatchAddressIndex(batch, vUnspent);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vIndex, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = vIndex.begin(); it != vIndex.end(); it++)
+        batch.Erase(it->first);
+    BatchAddressIndex(batch, vUnspent);
+    return WriteBatch(batch);
+}
+
+/**
+ * Walk the records whose keys start with the same nPrefixSize bytes as keyStart,
+ * from keyStart on, until fn returns false. The iterator reads a snapshot, so
+ * blocks being connected meanwhile do not show up halfway.
+ */
+template <typename K, typename V, typename F>
+static bool ScanRecords(CLevelDBWrapper &db, const K &keyStart, size_t nPrefixSize, F fn) {
+    CDataStream ssKeyStart(SER_DISK, CLIENT_VERSION);
+    ssKeyStart << keyStart;
+    const std::string strPrefix = ssKeyStart.str().substr(0, nPrefixSize);
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    for (pcursor->Seek(ssKeyStart.str()); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        leveldb::Slice slKey = pcursor->key();
+        if (!slKey.starts_with(strPrefix))
+            break;
+        K key;
+        V value;
+        try {
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssKey >> key;
+            ssValue >> value;
+        } catch (const std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        // Exceptions of fn, such as those of a failing reply stream, go to the caller
+        if (!fn(key, value))
+            break;
+    }
+    return true;
+}
+
+//! The records of an address share their record type, address type and hash
+static const size_t ADDRESS_RECORD_PREFIX_SIZE = 2 + sizeof(uint160);
+
+namespace {
+
+struct CAddressIndexReader
+{
+    unsigned int nEndHeight;
+    size_t nMax;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > &vIndex;
+
+    CAddressIndexReader(unsigned int nEndHeightIn, size_t nMaxIn, std::vector<std::pair<CAddressIndexKey, CAmount> > &vIndexIn) : nEndHeight(nEndHeightIn), nMax(nMaxIn), vIndex(vIndexIn) {}
+
+    bool operator()(const CAddressIndexKey &key, const CAmount &nValue) {
+        if (key.nHeight > nEndHeight || vIndex.size() >= nMax)
+            return false;
+        vIndex.push_back(std::make_pair(key, nValue));
+        return true;
+    }
+};
+
+struct CAddressUnspentReader
+{
+    size_t nMax;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent;
+
+    CAddressUnspentReader(size_t nMaxIn, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspentIn) : nMax(nMaxIn), vUnspent(vUnspentIn) {}
+
+    bool operator()(const CAddressUnspentKey &key, const CAddressUnspentValue &value) {
+        if (vUnspent.size() >= nMax)
+            return false;
+        vUnspent.push_back(std::make_pair(key, value));
+        return true;
+    }
+};
+
+struct CAddressBalanceReader
+{
+    CAmount &nBalance;
+    uint64_t &nOutputs;
+
+    CAddressBalanceReader(CAmount &nBalanceIn, uint64_t &nOutputsIn) : nBalance(nBalanceIn), nOutputs(nOutputsIn) {}
+
+    bool operator()(const CAddressUnspentKey &key, const CAddressUnspentValue &value) {
+        nBalance += value.nValue;
+        nOutputs++;
+        return true;
+    }
+};
+
+} // anon namespace
+
+bool CBlockTreeDB::ReadAddressIndex(const CAddressIndexKey &keyStart, unsigned int nEndHeight, size_t nMax, std::vector<std::pair<CAddressIndexKey, CAmount> > &vIndex) {
+    return ScanRecords<CAddressIndexKey, CAmount>(*this, keyStart, ADDRESS_RECORD_PREFIX_SIZE, CAddressIndexReader(nEndHeight, nMax, vIndex));
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(const CAddressUnspentKey &keyStart, size_t nMax, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent) {
+    return ScanRecords<CAddressUnspentKey, CAddressUnspentValue>(*this, keyStart, ADDRESS_RECORD_PREFIX_SIZE, CAddressUnspentReader(nMax, vUnspent));
+}
+
+bool CBlockTreeDB::ReadAddressBalance(unsigned char nAddressType, const uint160 &hashAddress, CAmount &nBalance, uint64_t &nOutputs) {
+    nBalance = 0;
+    nOutputs = 0;
+    CAddressUnspentKey keyStart(nAddressType, hashAddress, 0, uint256(0), 0);
+    return ScanRecords<CAddressUnspentKey, CAddressUnspentValue>(*this, keyStart, ADDRESS_RECORD_PREFIX_SIZE, CAddressBalanceReader(nBalance, nOutputs));
+}
+
+bool CBlockTreeDB::WriteRewardLedger(const std::vector<std::pair<uint32_t, CRewardLedgerEntry> > &vEntries) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<uint32_t, CRewardLedgerEntry> >::const_iterator it = vEntries.begin(); it != vEntries.end(); it++)
+        batch.Write(CRewardLedgerKey(it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseRewardLedger(uint32_t nHeight) {
+    return Erase(CRewardLedgerKey(nHeight));
+}
+
+bool CBlockTreeDB::ReadRewardLedger(uint32_t nHeight, CRewardLedgerEntry &entry) {
+    return Read(CRewardLedgerKey(nHeight), entry);
+}
+
+namespace {
+
+struct CRewardLedgerReader
+{
+    uint32_t nEndHeight;
+    const boost::function<bool (uint32_t, const CRewardLedgerEntry &)> &fn;
+
+    CRewardLedgerReader(uint32_t nEndHeightIn, const boost::function<bool (uint32_t, const CRewardLedgerEntry &)> &fnIn) : nEndHeight(nEndHeightIn), fn(fnIn) {}
+
+    bool operator()(const CRewardLedgerKey &key, const CRewardLedgerEntry &entry) {
+        return key.nHeight <= nEndHeight && fn(key.nHeight, entry);
+    }
+};
+
+} // anon namespace
+
+bool CBlockTreeDB::ReadRewardLedger(uint32_t nStartHeight, uint32_t nEndHeight, const boost::function<bool (uint32_t, const CRewardLedgerEntry &)> &fn) {
+    return ScanRecords<CRewardLedgerKey, CRewardLedgerEntry>(*this, CRewardLedgerKey(nStartHeight), 1, CRewardLedgerReader(nEndHeight, fn));
+}
+
+namespace {
+
+/** Key of an index journal entry ('j'), sorting in the order they were written */
+struct CIndexJournalKey
+{
+    uint32_t nEntry;
+
+    CIndexJournalKey() : nEntry(0) {}
+    explicit CIndexJournalKey(uint32_t nEntryIn) : nEntry(nEntryIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        char chType = 'j';
+        READWRITE(chType);
+        READWRITE(REF(CBigEndian32(nEntry)));
+    }
+};
+
+struct CIndexJournalReader
+{
+    std::vector<std::pair<uint32_t, CIndexJournalEntry> > &vEntries;
+
+    CIndexJournalReader(std::vector<std::pair<uint32_t, CIndexJournalEntry> > &vEntriesIn) : vEntries(vEntriesIn) {}
+
+    bool operator()(const CIndexJournalKey &key, const CIndexJournalEntry &entry) {
+        vEntries.push_back(std::make_pair(key.nEntry, entry));
+        return true;
+    }
+};
+
+} // anon namespace
+
+bool CBlockTreeDB::WriteIndexJournal(uint32_t nEntry, const CIndexJournalEntry &entry) {
+    return Write(CIndexJournalKey(nEntry), entry);
+}
+
+bool CBlockTreeDB::ReadIndexJournal(std::vector<std::pair<uint32_t, CIndexJournalEntry> > &vEntries) {
+    return ScanRecords<CIndexJournalKey, CIndexJournalEntry>(*this, CIndexJournalKey(0), 1, CIndexJournalReader(vEntries));
+}
+
+bool CBlockTreeDB::ReadIndexJournalBase(uint256 &hashBlock) {
+    return Read('J', hashBlock);
+}
+
+bool CBlockTreeDB::ResetIndexJournal(uint32_t nEnd, const uint256 &hashBlock) {
+    std::vector<std::pair<uint32_t, CIndexJournalEntry> > vEntries;
+    if (!ReadIndexJournal(vEntries))
+        return false;
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<uint32_t, CIndexJournalEntry> >::const_iterator it = vEntries.begin(); it != vEntries.end() && it->first < nEnd; it++)
+        batch.Erase(CIndexJournalKey(it->first));
+    batch.Write('J', hashBlock);
+    return WriteBatch(batch, true);
+}
+
+bool CBlockTreeDB::ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value) {
+    return Read(key, value);
+}
+
+bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vSpent) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it = vSpent.begin(); it != vSpent.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(it->first);
+        else
+            batch.Write(it->first, it->second);
+    }
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
 }
@@ -176,33 +1045,86 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteUTXOSnapshot(const CUTXOSnapshotHeader &header) {
+    return Write('U', header);
+}
+
+bool CBlockTreeDB::ReadUTXOSnapshot(CUTXOSnapshotHeader &header) {
+    return Read('U', header);
+}
+
+bool CBlockTreeDB::EraseUTXOSnapshot() {
+    return Erase('U');
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
+    int64_t nStart = GetTimeMillis();
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
 
     CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
     ssKeySet << make_pair('b', uint256(0));
     pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
+    // Deserializing and hashing the records dominates, so batches of them are
+    // decoded by a pool of threads (as many as for script checks); only the
+    // insertion into mapBlockIndex is serial.
+    int nThreads = std::max(nScriptCheckThreads, 1);
+    CCheckQueue<CBlockIndexDecoder> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CBlockIndexDecoder>::Thread, &queue));
+
+    bool fOk = true;
+    uint64_t nLoaded = 0;
+    try {
+        std::vector<uint256> vHash;
+        std::vector<std::string> vValue;
+        std::vector<CDiskBlockIndexRecord> vRecord;
+        bool fDone = false;
+        while (fOk && !fDone) {
+            boost::this_thread::interruption_point();
+
+            vHash.clear();
+            vValue.clear();
+            while (vHash.size() < BLOCK_INDEX_LOAD_BATCH) {
+                if (!pcursor->Valid()) {
+                    fDone = true;
+                    break;
+                }
+                leveldb::Slice slKey = pcursor->key();
+                CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                ssKey >> chType;
+                if (chType != 'b') {
+                    fDone = true;
+                    break;
+                }
+                vHash.push_back(uint256());
+                ssKey >> vHash.back();
                 leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
+                vValue.push_back(std::string(slValue.data(), slValue.size()));
+                pcursor->Next();
+            }
+
+            vRecord.assign(vHash.size(), CDiskBlockIndexRecord());
+            std::vector<CBlockIndexDecoder> vChecks;
+            vChecks.reserve(vHash.size());
+            for (unsigned int i = 0; i < vHash.size(); i++)
+                vChecks.push_back(CBlockIndexDecoder(&vHash[i], &vValue[i], &vRecord[i]));
+            CCheckQueueControl<CBlockIndexDecoder> control(&queue);
+            control.Add(vChecks);
+            if (!control.Wait()) {
+                fOk = false;
+                break;
+            }
 
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                uint256 pow = diskindex.GetBlockPoW();
+            // Construct block index objects
+            for (unsigned int i = 0; i < vHash.size(); i++) {
+                const CDiskBlockIndexRecord &record = vRecord[i];
+                const CDiskBlockIndex &diskindex = record.index;
+                CBlockIndex* pindexNew = InsertBlockIndex(vHash[i]);
                 pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pPowBlock      = boost::make_shared<uint256>(pow);
                 pindexNew->nHeight        = diskindex.nHeight;
                 pindexNew->nFile          = diskindex.nFile;
                 pindexNew->nDataPos       = diskindex.nDataPos;
@@ -215,18 +1137,20 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
                 pindexNew->nReward        = diskindex.nReward;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockPoW(), pindexNew->nBits))
-                    return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+                // Left 0 when not stored; LoadBlockIndexDB computes it then
+                if (record.fHaveChainWork)
+                    pindexNew->nChainWork = record.nChainWork;
             }
-        } catch (std::exception &e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            nLoaded += vHash.size();
         }
+    } catch (...) {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+        throw;
     }
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
 
-    return true;
+    LogPrintf("%s: decoded %u block index entries with %d threads in %dms\n", __func__, nLoaded, nThreads, GetTimeMillis() - nStart);
+    return fOk;
 }
@@ -6,14 +6,24 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "addressindex.h"
+#include "amount.h"
 #include "leveldbwrapper.h"
 #include "main.h"
+#include "rewardledger.h"
+#include "spentindex.h"
+#include "muhash.h"
 
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
 class CCoins;
 class uint256;
 
@@ -23,27 +33,191 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -dbmaxopenfiles default; 64 bit systems map (up to 1000) tables into memory rather than keep their files open
+static const int DEFAULT_DB_MAX_OPEN_FILES = sizeof(void*) > 4 ? 500 : 64;
+//! -dbwritebuffer default (percent of a database's cache)
+static const int DEFAULT_DB_WRITE_BUFFER = 10;
+//! -dbibdwritebuffer default (percent of a database's cache)
+static const int DEFAULT_DB_IBD_WRITE_BUFFER = 40;
+
+/**
+ * LevelDB profile of the chain state (or else the block index) database, for
+ * initial block download or for a synced node. The block index database gets a
+ * quarter of the open files, but at least 64 (or all of them, if fewer).
+ */
+CLevelDBProfile GetLevelDBProfile(bool fIBD, bool fChainState);
+
+/**
+ * Running totals over the unspent outputs in the coin database, stored next to
+ * the best block so that they always describe the same state. The counters
+ * are signed so that the same type can hold a set of changes.
+ */
+struct CCoinsDBStats
+{
+    uint256 hashBlock;
+    int64_t nTransactions;
+    int64_t nTransactionOutputs;
+    int64_t nSerializedSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    CCoinsDBStats() : hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    void Add(const CCoinsDBStats &other) {
+        nTransactions += other.nTransactions;
+        nTransactionOutputs += other.nTransactionOutputs;
+        nSerializedSize += other.nSerializedSize;
+        nTotalAmount += other.nTotalAmount;
+        muhash *= other.muhash;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/)
+ *
+ * Every unspent output is stored under its own key ('C', txid, output index),
+ * as a Coin, so spending one output never rewrites its siblings. Databases
+ * written by older versions hold one CCoins record per transaction
+ * ('c', txid); those are still read, and converted to the per-output layout by
+ * UpgradeLegacyCoins() or when one of their outputs changes.
+ *
+ * BatchWrite keeps a CCoinsDBStats up to date with every change, so GetStats
+ * does not need to walk the database. Databases without (valid) statistics
+ * get them computed once by RebuildStats().
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
+    mutable CCriticalSection cs_coinsdb;
+    //! guards fLegacyCoins alone, so that reads need not wait for cs_coinsdb; changed with cs_coinsdb held as well
+    mutable CCriticalSection cs_legacycoins;
+    //! whether per-transaction records of the old layout may still be present
+    bool fLegacyCoins;
+    //! statistics of the database contents; only the changes since RebuildStats() started while !fStatsValid
+    CCoinsDBStats dbstats;
+    bool fStatsValid;
+
+    typedef std::vector<CCoinsMap::const_iterator>::const_iterator CoinsEntryIter;
+    void BatchWriteCoins(CLevelDBBatch &batch, leveldb::Iterator *pcursor, CoinsEntryIter itBegin, CoinsEntryIter itEnd, size_t &nWritten, size_t &nErased);
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const std::string &strName = "chainstate", const CLevelDBProfile &profile = CLevelDBProfile());
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    bool GetCoinByTxid(const uint256 &txid, uint32_t nStart, COutPoint &outpoint, Coin &coin) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    CCoinsViewCursor *Cursor() const;
+
+    //! Whether records of the old per-transaction layout are left to convert
+    bool HaveLegacyCoins() const;
+    //! Convert up to nMaxRecords old per-transaction records; returns how many were converted
+    unsigned int UpgradeLegacyCoins(unsigned int nMaxRecords);
+
+    //! Whether GetStats can answer
+    bool HaveStats() const;
+    //! Compute the statistics with a full pass over the database (which may be written to meanwhile)
+    bool RebuildStats();
+
+    //! See CLevelDBWrapper
+    bool SetProfile(const CLevelDBProfile &profile) { return db.SetProfile(profile); }
+    void Compact() { db.Compact(); }
+    void GetDBStats(CLevelDBStats &stats) const { db.GetStats(stats); }
 };
 
+/** Cursor over a snapshot of the coin database, splitting records of the old layout into outputs */
+class CCoinsViewDBCursor : public CCoinsViewCursor
+{
+public:
+    ~CCoinsViewDBCursor() {}
+
+    bool GetKey(COutPoint &key) const;
+    bool GetValue(Coin &coin) const;
+    bool Valid() const;
+    void Next();
+
+private:
+    CCoinsViewDBCursor(leveldb::Iterator *pcursorIn, const uint256 &hashBlockIn);
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor;
+    bool fValid;
+    COutPoint keyCurrent;
+    Coin coinCurrent;
+    //! old-layout record being walked, and the index of its next output
+    CCoins coinsLegacy;
+    unsigned int nLegacyNext;
+
+    friend class CCoinsViewDB;
+};
+
+/**
+ * CCoinsView between the tip cache and the coin database that lets a flush of
+ * the cache return before the changes are on disk: BatchWrite takes the
+ * changes over as the pending batch, and Commit() writes them to the base
+ * view later, from the thread that flushes the chain state. Reads look at the
+ * pending batch first, so the views above it see no difference.
+ *
+ * At most one batch is pending. Without deferral (the default), BatchWrite
+ * writes through directly.
+ */
+class CCoinsViewWriteBehind : public CCoinsViewBacked
+{
+private:
+    mutable boost::mutex cs_pending;
+    mutable boost::condition_variable condCommitted;
+    //! the pending batch; only modified while no commit is in progress
+    CCoinsMap mapPending;
+    uint256 hashPendingBlock;
+    bool fPending;
+    bool fCommitting;
+    bool fDeferred;
+
+    bool CommitLocked(boost::unique_lock<boost::mutex> &lock);
+    void WaitForCommitLocked(boost::unique_lock<boost::mutex> &lock) const;
+
+public:
+    CCoinsViewWriteBehind(CCoinsView *viewIn);
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    bool GetCoinByTxid(const uint256 &txid, uint32_t nStart, COutPoint &outpoint, Coin &coin) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetStats(CCoinsStats &stats) const;
+    CCoinsViewCursor *Cursor() const;
+
+    //! Keep batches pending until Commit() (or write them through); turning it off commits
+    bool SetDeferred(bool fDeferredIn);
+    //! Write the pending batch (if any) to the base view
+    bool Commit();
+    //! Whether a batch waits for or is being committed
+    bool IsPending() const;
+    //! Number of cache entries (outputs) in the pending batch
+    size_t GetPendingSize() const;
+};
+
+/** Convert the old per-transaction records of a coin database and compute its statistics in the background */
+void ThreadUpgradeCoinsDB(CCoinsViewDB* pcoinsdb);
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CLevelDBProfile &profile = CLevelDBProfile());
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
@@ -57,8 +231,37 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    //! Add the address index records of a block, and apply the changes to the unspent outputs of addresses
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vIndex, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent);
+    //! Erase the address index records of a disconnected block, and apply the changes to the unspent outputs of addresses
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vIndex, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent);
+    //! Read up to nMax records of the address of keyStart, from keyStart on, up to height nEndHeight
+    bool ReadAddressIndex(const CAddressIndexKey &keyStart, unsigned int nEndHeight, size_t nMax, std::vector<std::pair<CAddressIndexKey, CAmount> > &vIndex);
+    //! Read up to nMax unspent outputs of the address of keyStart, from keyStart on
+    bool ReadAddressUnspentIndex(const CAddressUnspentKey &keyStart, size_t nMax, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vUnspent);
+    //! Sum the unspent outputs of an address
+    bool ReadAddressBalance(unsigned char nAddressType, const uint160 &hashAddress, CAmount &nBalance, uint64_t &nOutputs);
+    //! Add an entry to the index journal
+    bool WriteIndexJournal(uint32_t nEntry, const CIndexJournalEntry &entry);
+    //! Read the entries of the index journal, in order
+    bool ReadIndexJournal(std::vector<std::pair<uint32_t, CIndexJournalEntry> > &vEntries);
+    //! Read the block the indexes were at when the entries left in the journal started
+    bool ReadIndexJournalBase(uint256 &hashBlock);
+    //! Erase the entries of the index journal before nEnd, which took the indexes to hashBlock
+    bool ResetIndexJournal(uint32_t nEnd, const uint256 &hashBlock);
+    bool ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+    //! Write the spent index records of a block, erasing those with a null value
+    bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vSpent);
+    bool WriteRewardLedger(const std::vector<std::pair<uint32_t, CRewardLedgerEntry> > &vEntries);
+    bool EraseRewardLedger(uint32_t nHeight);
+    bool ReadRewardLedger(uint32_t nHeight, CRewardLedgerEntry &entry);
+    //! Call fn on the reward ledger records from nStartHeight to nEndHeight in one pass, until it returns false
+    bool ReadRewardLedger(uint32_t nStartHeight, uint32_t nEndHeight, const boost::function<bool (uint32_t, const CRewardLedgerEntry &)> &fn);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WriteUTXOSnapshot(const CUTXOSnapshotHeader &header);
+    bool ReadUTXOSnapshot(CUTXOSnapshotHeader &header);
+    bool EraseUTXOSnapshot();
     bool LoadBlockIndexGuts();
 };
 
@@ -6,26 +6,30 @@
 #ifndef BITCOIN_UNDO_H
 #define BITCOIN_UNDO_H
 
+#include "coins.h"
 #include "compressor.h" 
 #include "primitives/transaction.h"
 #include "serialize.h"
 
 /** Undo information for a CTxIn
  *
- *  Contains the prevout's CTxOut being spent, and if this was the
- *  last output of the affected transaction, its metadata as well
- *  (coinbase or not, height, transaction version)
+ *  Contains the prevout's CTxOut being spent, and the metadata of the
+ *  affected transaction (coinbase or not, height, transaction version).
+ *  Undo data written by older versions only carries the metadata when
+ *  the last unspent output of the transaction was spent; nHeight is 0
+ *  otherwise.
  */
 class CTxInUndo
 {
 public:
     CTxOut txout;         // the txout data before being spent
-    bool fCoinBase;       // if the outpoint was the last unspent: whether it belonged to a coinbase
-    unsigned int nHeight; // if the outpoint was the last unspent: its height
-    int nVersion;         // if the outpoint was the last unspent: its version
+    bool fCoinBase;       // whether the outpoint belonged to a coinbase
+    unsigned int nHeight; // height of the outpoint's transaction (0 if unknown)
+    int nVersion;         // version of the outpoint's transaction
 
     CTxInUndo() : txout(), fCoinBase(false), nHeight(0), nVersion(0) {}
     CTxInUndo(const CTxOut &txoutIn, bool fCoinBaseIn = false, unsigned int nHeightIn = 0, int nVersionIn = 0) : txout(txoutIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), nVersion(nVersionIn) { }
+    explicit CTxInUndo(const Coin &coin) : txout(coin.out), fCoinBase(coin.fCoinBase), nHeight(coin.nHeight), nVersion(coin.nVersion) { }
 
     unsigned int GetSerializeSize(int nType, int nVersion) const {
         return ::GetSerializeSize(VARINT(nHeight*2+(fCoinBase ? 1 : 0)), nType, nVersion) +